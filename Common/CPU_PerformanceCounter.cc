@@ -0,0 +1,413 @@
+#include "Common/Config.h"
+
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+
+double CPU_PerformanceCounter::nanosecondsPerTick = 1;
+std::atomic<RAPL::Sampler *> CPU_PerformanceCounter::energySensor(nullptr);
+
+
+// the counters that exist; function-local, so that counters can be static
+// objects themselves
+
+static std::mutex &registryMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+
+static std::set<CPU_PerformanceCounter *> &registry()
+{
+  static std::set<CPU_PerformanceCounter *> counters;
+  return counters;
+}
+
+
+static unsigned myThreadIndex()
+{
+  static std::atomic<unsigned> nrThreads(0);
+  thread_local unsigned index = nrThreads.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+
+static void updateMax(std::atomic<uint64_t> &max, uint64_t value)
+{
+  for (uint64_t current = max.load(std::memory_order_relaxed); value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed);)
+    ;
+}
+
+
+static std::ostream &printTime(std::ostream &os, double seconds)
+{
+  if (seconds < 1e-3)
+    return os << seconds * 1e6 << " us";
+  else if (seconds < 1)
+    return os << seconds * 1e3 << " ms";
+  else
+    return os << seconds << " s";
+}
+
+
+// the instructions per cycle, LLC misses per 1000 instructions, and fraction
+// of stalled cycles, as far as the events are available
+
+static std::ostream &printEvents(std::ostream &os, const uint64_t events[], unsigned available)
+{
+  auto has = [available] (HardwareCounters::Event event) { return (available & (1U << event)) != 0; };
+
+  if (has(HardwareCounters::Cycles) && has(HardwareCounters::Instructions) && events[HardwareCounters::Cycles] > 0)
+    os << ", IPC " << (double) events[HardwareCounters::Instructions] / events[HardwareCounters::Cycles];
+
+  if (has(HardwareCounters::Instructions) && has(HardwareCounters::LLC_Misses) && events[HardwareCounters::Instructions] > 0)
+    os << ", LLC MPKI " << 1000.0 * events[HardwareCounters::LLC_Misses] / events[HardwareCounters::Instructions];
+
+  if (has(HardwareCounters::Cycles) && has(HardwareCounters::StallCycles) && events[HardwareCounters::Cycles] > 0)
+    os << ", stalled " << 100.0 * events[HardwareCounters::StallCycles] / events[HardwareCounters::Cycles] << '%';
+
+  return os;
+}
+
+
+// the energy and average power per RAPL domain over an interval
+
+static std::ostream &printEnergy(std::ostream &os, const RAPL &sensor, const double joules[], double seconds)
+{
+  const char *separator = "";
+
+  for (unsigned domain = 0; domain < RAPL::nrDomains; domain ++)
+    if (sensor.hasDomain((RAPL::Domain) domain)) {
+      os << separator << RAPL::name((RAPL::Domain) domain) << ' ' << joules[domain] << " J (" << joules[domain] / seconds << " W)";
+      separator = ", ";
+    }
+
+  return os;
+}
+
+
+void CPU_PerformanceCounter::calibrate()
+{
+#if defined __x86_64__ || defined __i386__
+  // the TSC runs at a constant rate on all CPUs that this runs on
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+  uint64_t startTicks = now();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  std::chrono::steady_clock::time_point stopTime = std::chrono::steady_clock::now();
+  uint64_t stopTicks = now();
+
+  nanosecondsPerTick = std::chrono::duration<double, std::nano>(stopTime - startTime).count() / (stopTicks - startTicks);
+#endif
+}
+
+
+void CPU_PerformanceCounter::calibrateOnce()
+{
+  static std::once_flag calibrated;
+  std::call_once(calibrated, calibrate);
+}
+
+
+double CPU_PerformanceCounter::ticksToSeconds(uint64_t ticks)
+{
+  calibrateOnce();
+  return ticks * nanosecondsPerTick * 1e-9;
+}
+
+
+uint64_t CPU_PerformanceCounter::secondsToTicks(double seconds)
+{
+  calibrateOnce();
+  return std::llround(seconds * 1e9 / nanosecondsPerTick);
+}
+
+
+CPU_PerformanceCounter::CPU_PerformanceCounter(const std::string &name, bool profiling)
+:
+  name(name),
+  profiling(profiling)
+{
+  calibrateOnce();
+
+  for (std::atomic<Shard *> &shard : shards)
+    shard.store(nullptr, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(registryMutex());
+  registry().insert(this);
+}
+
+
+CPU_PerformanceCounter::~CPU_PerformanceCounter()
+{
+  {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().erase(this);
+  }
+
+  Summary total = summary();
+
+  if (total.nrTimes > 0)
+#pragma omp critical (cout)
+  {
+    std::cout << std::setw(12) << name << std::setprecision(3) << ": " << total.nrTimes << " times, ";
+    printTime(std::cout, total.totalTime / total.nrTimes) << ", p50 ";
+    printTime(std::cout, total.p50) << ", p99 ";
+    printTime(std::cout, total.p99) << ", max ";
+    printTime(std::cout, total.maxTime);
+    printEvents(std::cout, total.events, total.availableEvents) << std::endl;
+  }
+
+  for (std::atomic<Shard *> &shard : shards)
+    delete shard.load(std::memory_order_relaxed);
+}
+
+
+unsigned CPU_PerformanceCounter::bucket(uint64_t nanoseconds)
+{
+  if (nanoseconds < nrSubBuckets)
+    return nanoseconds;
+
+  unsigned exponent = 63 - __builtin_clzll(nanoseconds);
+  return (exponent - nrSubBucketBits + 1) * nrSubBuckets + ((nanoseconds >> (exponent - nrSubBucketBits)) & (nrSubBuckets - 1));
+}
+
+
+uint64_t CPU_PerformanceCounter::bucketValue(unsigned bucket)
+{
+  if (bucket < nrSubBuckets)
+    return bucket;
+
+  unsigned shift = bucket / nrSubBuckets - 1;
+  return ((uint64_t) (nrSubBuckets + bucket % nrSubBuckets) << shift) + ((1ULL << shift) >> 1);
+}
+
+
+CPU_PerformanceCounter::Shard &CPU_PerformanceCounter::myShard()
+{
+  // threads beyond maxNrShards share shards, which costs only contention
+  std::atomic<Shard *> &slot = shards[myThreadIndex() % maxNrShards];
+  Shard *shard = slot.load(std::memory_order_acquire);
+
+  if (shard == nullptr) {
+    Shard *newShard = new Shard(); // zero-initialized
+
+    if (slot.compare_exchange_strong(shard, newShard, std::memory_order_acq_rel))
+      shard = newShard;
+    else
+      delete newShard;
+  }
+
+  return *shard;
+}
+
+
+void CPU_PerformanceCounter::addNanoseconds(uint64_t nanoseconds)
+{
+  Shard &shard = myShard();
+
+  shard.nrTimes.fetch_add(1, std::memory_order_relaxed);
+  shard.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+  shard.buckets[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+  updateMax(shard.maxNanoseconds, nanoseconds);
+  updateMax(shard.intervalMaxNanoseconds, nanoseconds);
+}
+
+
+void CPU_PerformanceCounter::addEvents(const HardwareCounters::Values &start)
+{
+  HardwareCounters::Values stop;
+
+  if (HardwareCounters::read(stop)) {
+    Shard    &shard = myShard();
+    uint64_t events[HardwareCounters::nrEvents];
+
+    HardwareCounters::difference(start, stop, events);
+
+    for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++)
+      shard.events[event].fetch_add(events[event], std::memory_order_relaxed);
+
+    shard.availableEvents.fetch_or(start.available & stop.available, std::memory_order_relaxed);
+  }
+}
+
+
+void CPU_PerformanceCounter::add(double time)
+{
+  if (profiling)
+    addNanoseconds(std::llround(std::max(time, 0.0) * 1e9));
+}
+
+
+CPU_PerformanceCounter::Totals CPU_PerformanceCounter::totals(bool resetIntervalMax) const
+{
+  Totals totals;
+
+  for (const std::atomic<Shard *> &slot : shards) {
+    Shard *shard = slot.load(std::memory_order_acquire);
+
+    if (shard != nullptr) {
+      totals.nrTimes	      += shard->nrTimes.load(std::memory_order_relaxed);
+      totals.totalNanoseconds += shard->totalNanoseconds.load(std::memory_order_relaxed);
+      totals.maxNanoseconds   = std::max(totals.maxNanoseconds, shard->maxNanoseconds.load(std::memory_order_relaxed));
+      totals.intervalMaxNanoseconds = std::max(totals.intervalMaxNanoseconds, resetIntervalMax ? shard->intervalMaxNanoseconds.exchange(0, std::memory_order_relaxed) : shard->intervalMaxNanoseconds.load(std::memory_order_relaxed));
+
+      for (unsigned bucket = 0; bucket < nrBuckets; bucket ++)
+	totals.buckets[bucket] += shard->buckets[bucket].load(std::memory_order_relaxed);
+
+      for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++)
+	totals.events[event] += shard->events[event].load(std::memory_order_relaxed);
+
+      totals.availableEvents |= shard->availableEvents.load(std::memory_order_relaxed);
+    }
+  }
+
+  return totals;
+}
+
+
+// the value below which the given fraction of the times is; the histogram
+// may be updated while it is read, so the bucket counts need not add up to
+// nrTimes
+
+uint64_t CPU_PerformanceCounter::percentile(const Totals &totals, double fraction)
+{
+  uint64_t nrTimes = 0;
+
+  for (uint64_t count : totals.buckets)
+    nrTimes += count;
+
+  uint64_t rank = std::max((uint64_t) 1, (uint64_t) std::ceil(fraction * nrTimes));
+  uint64_t cumulative = 0;
+
+  for (unsigned bucket = 0; bucket < nrBuckets; bucket ++)
+    if ((cumulative += totals.buckets[bucket]) >= rank)
+      return std::min(bucketValue(bucket), totals.maxNanoseconds);
+
+  return totals.maxNanoseconds;
+}
+
+
+CPU_PerformanceCounter::Summary CPU_PerformanceCounter::summary() const
+{
+  Totals total = totals();
+
+  Summary summary {
+    total.nrTimes,
+    total.totalNanoseconds * 1e-9,
+    percentile(total, .5) * 1e-9,
+    percentile(total, .99) * 1e-9,
+    total.maxNanoseconds * 1e-9,
+    {},
+    total.availableEvents
+  };
+
+  std::copy(total.events, total.events + HardwareCounters::nrEvents, summary.events);
+
+  return summary;
+}
+
+
+void CPU_PerformanceCounter::reportInterval(double interval)
+{
+  Totals total = totals(true), delta = total;
+
+  delta.nrTimes		 -= reported.nrTimes;
+  delta.totalNanoseconds -= reported.totalNanoseconds;
+  delta.maxNanoseconds	 = total.intervalMaxNanoseconds;
+
+  for (unsigned bucket = 0; bucket < nrBuckets; bucket ++)
+    delta.buckets[bucket] -= reported.buckets[bucket];
+
+  for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++)
+    delta.events[event] -= reported.events[event];
+
+  reported = std::move(total);
+
+  if (delta.nrTimes > 0) {
+    std::ostringstream line;
+
+    line << std::setw(12) << name << std::setprecision(3) << ": " << delta.nrTimes / interval << " times/s, " << delta.totalNanoseconds * 1e-9 / interval * 100 << "% busy, mean ";
+    printTime(line, delta.totalNanoseconds * 1e-9 / delta.nrTimes) << ", p50 ";
+    printTime(line, percentile(delta, .5) * 1e-9) << ", p99 ";
+    printTime(line, percentile(delta, .99) * 1e-9) << ", max ";
+    printTime(line, delta.maxNanoseconds * 1e-9);
+    printEvents(line, delta.events, delta.availableEvents);
+    LOG(Logger::Info, line.str());
+  }
+}
+
+
+CPU_PerformanceCounter::PeriodicReport::PeriodicReport(double interval)
+:
+  stop(false)
+{
+  if (interval > 0)
+    thread = std::thread(&PeriodicReport::threadBody, this, interval);
+}
+
+
+CPU_PerformanceCounter::PeriodicReport::~PeriodicReport()
+{
+  if (thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+
+    condition.notify_all();
+    thread.join();
+  }
+}
+
+
+void CPU_PerformanceCounter::PeriodicReport::threadBody(double interval)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  std::chrono::steady_clock::time_point nextReport = std::chrono::steady_clock::now();
+  double reportedJoules[RAPL::nrDomains] = {};
+
+  if (RAPL::Sampler *sensor = energySensor.load(std::memory_order_relaxed))
+    sensor->joules(reportedJoules);
+
+  for (;;) {
+    nextReport += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+
+    if (condition.wait_until(lock, nextReport, [this] { return stop; }))
+      break;
+
+    {
+      // counters unregister under the registry lock, so none disappears
+      // while it is reported
+      std::lock_guard<std::mutex> registryLock(registryMutex());
+
+      for (CPU_PerformanceCounter *counter : registry())
+	if (counter->profiling)
+	  counter->reportInterval(interval);
+    }
+
+    if (RAPL::Sampler *sensor = energySensor.load(std::memory_order_relaxed)) {
+      double joules[RAPL::nrDomains], delta[RAPL::nrDomains];
+      std::ostringstream line;
+
+      sensor->joules(joules);
+
+      for (unsigned domain = 0; domain < RAPL::nrDomains; domain ++)
+	delta[domain] = joules[domain] - reportedJoules[domain], reportedJoules[domain] = joules[domain];
+
+      line << std::setw(12) << "CPU energy" << std::setprecision(3) << ": ";
+      printEnergy(line, sensor->sensor, delta, interval);
+      LOG(Logger::Info, line.str());
+    }
+  }
+}
@@ -0,0 +1,163 @@
+#ifndef CPU_PERFORMANCE_COUNTER_H
+#define CPU_PERFORMANCE_COUNTER_H
+
+#include "Common/HardwareCounters.h"
+#include "Common/RAPL.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#endif
+
+
+// Times host code, without a CUDA context.  A Measurement reads the TSC (or
+// the monotonic clock on other architectures) at construction and
+// destruction; the elapsed time is accumulated into a per-thread shard of
+// the counter, with relaxed atomic additions only, so that threads that time
+// the same code do not contend.  Each shard holds a log-linear (HDR-style)
+// histogram of the times in nanoseconds, with nrSubBuckets buckets per power
+// of two, so that percentiles have a relative error of at most 1/32.
+//
+// If HardwareCounters are enabled, a Measurement also counts the CPU events
+// (cycles, instructions, LLC misses, stall cycles) of its thread, and the
+// reports include the instructions per cycle, LLC misses per 1000
+// instructions, and the fraction of stalled cycles.
+//
+// The counter prints its p50, p99, and maximum time at destruction; a
+// PeriodicReport prints the same for the last interval, for all counters.
+// With an energy sensor (a RAPL::Sampler), the PeriodicReport also prints
+// the energy and power of the CPU packages and DRAM over the interval; the
+// energy is not attributed to the counters, as the RAPL counters cover the
+// whole package and are updated only about once per millisecond.
+
+class CPU_PerformanceCounter
+{
+  public:
+    class Measurement {
+      public:
+	Measurement(CPU_PerformanceCounter &counter)
+	:
+	  counter(counter)
+	{
+	  if (counter.profiling && HardwareCounters::enabled())
+	    HardwareCounters::read(startEvents);
+
+	  start = counter.profiling ? now() : 0;
+	}
+
+	~Measurement()
+	{
+	  if (counter.profiling) {
+	    counter.addTicks(now() - start);
+
+	    if (startEvents.available != 0)
+	      counter.addEvents(startEvents);
+	  }
+	}
+
+      private:
+	CPU_PerformanceCounter	 &counter;
+	uint64_t		 start;
+	HardwareCounters::Values startEvents;
+    };
+
+    // prints the counters that were used in the last interval every interval
+    // seconds, until destruction; does nothing if interval <= 0
+    class PeriodicReport {
+      public:
+	PeriodicReport(double interval);
+	~PeriodicReport();
+
+      private:
+	void			threadBody(double interval);
+
+	std::mutex		mutex;
+	std::condition_variable	condition;
+	bool			stop;
+	std::thread		thread;
+    };
+
+    struct Summary {
+      uint64_t nrTimes;
+      double   totalTime, p50, p99, maxTime; // seconds
+      uint64_t events[HardwareCounters::nrEvents];
+      unsigned availableEvents;		      // bit mask
+    };
+
+    CPU_PerformanceCounter(const std::string &name, bool profiling);
+    ~CPU_PerformanceCounter();
+
+    void		add(double time); // seconds
+    Summary		summary() const;  // since construction
+
+    static double	ticksToSeconds(uint64_t ticks);
+    static uint64_t	secondsToTicks(double seconds);
+
+    // the sensor that the PeriodicReports read (nullptr: none); it must
+    // outlive them
+    static void		setEnergySensor(RAPL::Sampler *sensor) { energySensor.store(sensor, std::memory_order_relaxed); }
+    static RAPL::Sampler *getEnergySensor() { return energySensor.load(std::memory_order_relaxed); }
+
+    static uint64_t	now()
+    {
+#if defined __x86_64__ || defined __i386__
+      return __rdtsc();
+#else
+      struct timespec time;
+      clock_gettime(CLOCK_MONOTONIC, &time);
+      return time.tv_sec * 1000000000ULL + time.tv_nsec;
+#endif
+    }
+
+    const std::string	name;
+    const bool		profiling;
+
+  private:
+    static const unsigned nrSubBucketBits = 5, nrSubBuckets = 1 << nrSubBucketBits;
+    static const unsigned maxNrShards = 64, nrBuckets = (64 - nrSubBucketBits + 1) * nrSubBuckets;
+
+    struct alignas(64) Shard {
+      std::atomic<uint64_t> nrTimes, totalNanoseconds, maxNanoseconds, intervalMaxNanoseconds;
+      std::atomic<uint64_t> buckets[nrBuckets];
+      std::atomic<uint64_t> events[HardwareCounters::nrEvents];
+      std::atomic<unsigned> availableEvents;
+    };
+
+    struct Totals {
+      Totals() : nrTimes(0), totalNanoseconds(0), maxNanoseconds(0), intervalMaxNanoseconds(0), buckets(nrBuckets, 0), events {}, availableEvents(0) {}
+
+      uint64_t		    nrTimes, totalNanoseconds, maxNanoseconds, intervalMaxNanoseconds;
+      std::vector<uint64_t> buckets;
+      uint64_t		    events[HardwareCounters::nrEvents];
+      unsigned		    availableEvents;
+    };
+
+    void		addTicks(uint64_t ticks) { addNanoseconds(ticks * nanosecondsPerTick); }
+    void		addNanoseconds(uint64_t);
+    void		addEvents(const HardwareCounters::Values &start);
+    Shard		&myShard();
+    Totals		totals(bool resetIntervalMax = false) const;
+    void		reportInterval(double interval);
+
+    static unsigned	bucket(uint64_t nanoseconds);
+    static uint64_t	bucketValue(unsigned bucket); // the middle of the bucket
+    static uint64_t	percentile(const Totals &, double fraction);
+    static void		calibrate();
+    static void		calibrateOnce();
+
+    std::atomic<Shard *> shards[maxNrShards];
+    Totals		 reported; // by the periodic report
+
+    static double	nanosecondsPerTick;
+    static std::atomic<RAPL::Sampler *> energySensor;
+};
+
+#endif
@@ -1,26 +1,24 @@
 #if !defined CUDA_SUPPORT_H
 #define CUDA_SUPPORT_H
 
+#include "Common/HostBuffer.h"
+
 #include <cudawrappers/cu.hpp>
 
-#include <boost/multi_array.hpp>
+#include <memory>
+
 
+// Allocates the page-locked memory of a HostBuffer.  Every program that
+// includes this header (i.e., that uses CUDA) installs it.
 
-template <typename T, std::size_t DIM> class MultiArrayHostBuffer : public cu::HostMemory, public boost::multi_array_ref<T, DIM>
+inline std::shared_ptr<void> allocatePageLockedMemory(size_t size, int flags, cu::HostMemory *&pageLockedMemory)
 {
-  public:
-    template <typename ExtentList>
-    MultiArrayHostBuffer(const ExtentList &extents, int flags = 0)
-    :
-      cu::HostMemory(boost::multi_array_ref<T, DIM>(0, extents).num_elements() * sizeof(T), flags),
-      boost::multi_array_ref<T, DIM>((T *) *this, extents)
-    {
-    }
-
-    size_t bytesize() const
-    {
-      return this->num_elements() * sizeof(T);
-    }
-};
+  std::shared_ptr<cu::HostMemory> memory = std::make_shared<cu::HostMemory>(size, flags);
+  pageLockedMemory = memory.get();
+  return std::shared_ptr<void>(memory, (void *) *memory);
+}
+
+
+inline const bool pageLockedAllocatorInstalled = (HostBuffer::pageLockedAllocator = allocatePageLockedMemory, true);
 
 #endif
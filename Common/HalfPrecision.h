@@ -0,0 +1,58 @@
+#if !defined HALF_PRECISION_H
+#define HALF_PRECISION_H
+
+#if defined __F16C__
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+
+// IEEE-754 binary16 conversions with round-to-nearest-even, for CPUs with
+// and without F16C
+
+inline uint16_t floatToHalf(float value)
+{
+#if defined __F16C__
+  return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof bits);
+
+  uint32_t sign = (bits >> 16) & 0x8000, mantissa = bits & 0x7FFFFF;
+  int	   exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+
+  if (exponent >= 31) // overflow, infinity, or NaN
+    return sign | 0x7C00 | (((bits >> 23) & 0xFF) == 0xFF && mantissa != 0 ? 0x200 : 0);
+
+  if (exponent <= 0) { // subnormal or zero
+    if (exponent < -10)
+      return sign;
+
+    mantissa |= 0x800000;
+    unsigned shift = 14 - exponent;
+    uint32_t half = mantissa >> shift, rest = mantissa & ((1U << shift) - 1), halfway = 1U << (shift - 1);
+    return sign | (half + (rest > halfway || (rest == halfway && (half & 1))));
+  }
+
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13), rest = mantissa & 0x1FFF;
+  return half + (rest > 0x1000 || (rest == 0x1000 && (half & 1))); // may carry into the exponent, which is correct
+#endif
+}
+
+
+inline float halfToFloat(uint16_t half)
+{
+#if defined __F16C__
+  return _cvtsh_ss(half);
+#else
+  int	exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+  float value = exponent == 0 ? std::ldexp((float) mantissa, -24) : exponent == 31 ? (mantissa == 0 ? INFINITY : NAN) : std::ldexp((float) (mantissa | 0x400), exponent - 25);
+
+  return half & 0x8000 ? -value : value;
+#endif
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "Common/Config.h"
+
+#include "Common/HardwareCounters.h"
+#include "Common/Logger.h"
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+
+std::atomic<bool> HardwareCounters::isEnabled(false);
+
+
+#if defined __linux__
+
+namespace {
+  // the perf events of one thread, as one group
+  struct ThreadEvents {
+    ThreadEvents();
+    ~ThreadEvents();
+
+    int	     leader;
+    int	     fds[HardwareCounters::nrEvents];
+    unsigned available;
+    unsigned position[HardwareCounters::nrEvents]; // in the group read
+    unsigned nrOpened;
+  };
+
+
+  int openEvent(uint64_t config, int groupFd)
+  {
+    perf_event_attr attr;
+
+    memset(&attr, 0, sizeof attr);
+    attr.size		= sizeof attr;
+    attr.type		= PERF_TYPE_HARDWARE;
+    attr.config		= config;
+    attr.exclude_kernel = 1; // permitted with perf_event_paranoid <= 2
+    attr.exclude_hv	= 1;
+    attr.read_format	= PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1 /* any CPU */, groupFd, PERF_FLAG_FD_CLOEXEC);
+  }
+
+
+  ThreadEvents::ThreadEvents()
+  :
+    leader(-1),
+    available(0),
+    nrOpened(0)
+  {
+    static const uint64_t configs[HardwareCounters::nrEvents] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_STALLED_CYCLES_BACKEND,
+    };
+
+    int error = 0;
+
+    for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++) {
+      if ((fds[event] = openEvent(configs[event], leader)) >= 0) {
+	if (leader < 0)
+	  leader = fds[event];
+
+	available |= 1U << event;
+	position[event] = nrOpened ++;
+      } else if (error == 0) {
+	error = errno;
+      }
+    }
+
+    if (leader < 0) {
+      static std::atomic<bool> warned(false);
+
+      if (!warned.exchange(true))
+	LOG(Logger::Warning, "hardware performance counters not available: ", std::string(strerror(error)));
+    }
+  }
+
+
+  ThreadEvents::~ThreadEvents()
+  {
+    for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++)
+      if (available & (1U << event))
+	close(fds[event]);
+  }
+}
+
+#endif
+
+
+bool HardwareCounters::read(Values &values)
+{
+  values.available = 0;
+
+#if defined __linux__
+  if (enabled()) {
+    thread_local ThreadEvents events;
+
+    if (events.leader >= 0) {
+      uint64_t buffer[3 + nrEvents]; // nr, time enabled, time running, counts
+
+      if (::read(events.leader, buffer, sizeof buffer) >= (ssize_t) ((3 + events.nrOpened) * sizeof(uint64_t))) {
+	values.timeEnabled = buffer[1];
+	values.timeRunning = buffer[2];
+
+	for (unsigned event = 0; event < nrEvents; event ++)
+	  if (events.available & (1U << event))
+	    values.count[event] = buffer[3 + events.position[event]];
+
+	values.available = events.available;
+      }
+    }
+  }
+#endif
+
+  return values.available != 0;
+}
+
+
+void HardwareCounters::difference(const Values &start, const Values &stop, uint64_t count[nrEvents])
+{
+  uint64_t enabled = stop.timeEnabled - start.timeEnabled, running = stop.timeRunning - start.timeRunning;
+  double   scale   = running > 0 ? (double) enabled / running : 0;
+
+  for (unsigned event = 0; event < nrEvents; event ++)
+    count[event] = (start.available & stop.available & (1U << event)) ? std::llround((stop.count[event] - start.count[event]) * scale) : 0;
+}
+
+
+const char *HardwareCounters::name(Event event)
+{
+  static const char *names[nrEvents] = { "cycles", "instructions", "LLC misses", "stall cycles" };
+  return names[event];
+}
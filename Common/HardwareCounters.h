@@ -0,0 +1,53 @@
+#ifndef HARDWARE_COUNTERS_H
+#define HARDWARE_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+
+
+// Counts CPU events of the calling thread with perf_event_open(2), so that a
+// CPU_PerformanceCounter can tell whether its code is compute bound, misses
+// the caches, or stalls on memory.  The events of a thread are opened as one
+// group, at its first read, and counted in user space only; a group that the
+// kernel multiplexes is scaled by the time it was actually counted.
+//
+// Counting is off unless enable() is called.  If perf events are not
+// permitted (see /proc/sys/kernel/perf_event_paranoid) or not supported (e.g.,
+// in a virtual machine), a warning is logged once and the events are not
+// available; an event that the CPU does not support is left out.
+
+class HardwareCounters
+{
+  public:
+    enum Event {
+      Cycles,
+      Instructions,
+      LLC_Misses,	 // last-level cache misses
+      StallCycles,	 // cycles in which the back end stalled, mostly on memory
+      nrEvents
+    };
+
+    struct Values {
+      Values() : available(0) {}
+
+      uint64_t count[nrEvents];
+      uint64_t timeEnabled, timeRunning; // ns
+      unsigned available;		 // bit mask of the events that were read
+    };
+
+    static void	enable(bool enabled = true) { isEnabled.store(enabled, std::memory_order_relaxed); }
+    static bool	enabled() { return isEnabled.load(std::memory_order_relaxed); }
+
+    // false (and no events available) if not enabled or not permitted
+    static bool	read(Values &);
+
+    // the events between two reads, scaled for multiplexing
+    static void	difference(const Values &start, const Values &stop, uint64_t count[nrEvents]);
+
+    static const char *name(Event);
+
+  private:
+    static std::atomic<bool> isEnabled;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#if !defined HOST_BUFFER_H
+#define HOST_BUFFER_H
+
+#include <boost/multi_array.hpp>
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+
+namespace cu {
+  class HostMemory;
+}
+
+
+// Page-locked host memory, or ordinary page-aligned memory if the process
+// does not use CUDA at all (e.g., when it runs with a NullDeviceInstance on
+// a machine without GPU).  In the latter case, usePageLockedMemory must be
+// cleared before the first buffer is allocated.
+//
+// This header does not depend on CUDA, so that code that only uses ordinary
+// memory (the CPU-side tests and benchmarks) builds without the CUDA
+// toolkit.  Page-locked memory is allocated by pageLockedAllocator, which
+// Common/CUDA_Support.h installs.
+
+class HostBuffer
+{
+  public:
+    typedef std::shared_ptr<void> Allocator(size_t size, int flags, cu::HostMemory *&);
+
+    HostBuffer(size_t size, int flags = 0)
+    :
+      pageLockedMemory(nullptr),
+      memory(usePageLockedMemory ? allocatePageLocked(size, flags, pageLockedMemory) : allocate(size))
+    {
+    }
+
+    operator void * () const
+    {
+      return memory.get();
+    }
+
+    // for CUDA calls that need to know that the memory is page locked
+    cu::HostMemory &pageLocked() const
+    {
+      if (pageLockedMemory == nullptr)
+	throw std::runtime_error("host buffer is not page locked");
+
+      return *pageLockedMemory;
+    }
+
+    static inline bool	    usePageLockedMemory = true;
+    static inline Allocator *pageLockedAllocator = nullptr;
+
+  private:
+    static std::shared_ptr<void> allocate(size_t size)
+    {
+      void *ptr = std::aligned_alloc(4096, (size + 4095) & ~(size_t) 4095);
+
+      if (ptr == nullptr)
+	throw std::bad_alloc();
+
+      return std::shared_ptr<void>(ptr, std::free);
+    }
+
+    static std::shared_ptr<void> allocatePageLocked(size_t size, int flags, cu::HostMemory *&pageLockedMemory)
+    {
+      if (pageLockedAllocator == nullptr)
+	throw std::runtime_error("page-locked memory requires CUDA support; clear HostBuffer::usePageLockedMemory");
+
+      return pageLockedAllocator(size, flags, pageLockedMemory);
+    }
+
+    cu::HostMemory	  *pageLockedMemory; // owned by memory
+    std::shared_ptr<void> memory;
+};
+
+
+template <typename T, std::size_t DIM> class MultiArrayHostBuffer : public HostBuffer, public boost::multi_array_ref<T, DIM>
+{
+  public:
+    template <typename ExtentList>
+    MultiArrayHostBuffer(const ExtentList &extents, int flags = 0)
+    :
+      HostBuffer(boost::multi_array_ref<T, DIM>(0, extents).num_elements() * sizeof(T), flags),
+      boost::multi_array_ref<T, DIM>((T *) (void *) *this, extents)
+    {
+    }
+
+    size_t bytesize() const
+    {
+      return this->num_elements() * sizeof(T);
+    }
+};
+
+#endif
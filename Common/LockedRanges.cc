@@ -1,6 +1,7 @@
 #include <Common/Config.h>
 
 #include <Common/LockedRanges.h>
+#include <Common/Logger.h>
 
 #include <iostream>
 #include <omp.h>
@@ -19,16 +20,14 @@ void LockedRanges::lock(unsigned begin, unsigned end)
 
   if (begin < end) {
     while (lockedRanges.subset(begin, end).count() > 0) {
-#pragma omp critical (clog)
-      std::clog << "Circular buffer: reader & writer try to use overlapping sections, range to lock = (" << begin << ", " << end << "), already locked = " << lockedRanges << std::endl;
+      LOG_RATE_LIMITED(Logger::Warning, 1, "Circular buffer: reader & writer try to use overlapping sections, range to lock = (", begin, ", ", end, "), already locked = ", lockedRanges);
       rangeUnlocked.wait(lock);
     }
 
     lockedRanges.include(begin, end);
   } else {
     while (lockedRanges.subset(begin, bufferSize).count() > 0 || lockedRanges.subset(0, end).count() > 0) {
-#pragma omp critical (clog)
-      std::clog << "Circular buffer: reader & writer try to use overlapping sections, range to lock = (" << begin << ", " << end << "), already locked = " << lockedRanges << std::endl;
+      LOG_RATE_LIMITED(Logger::Warning, 1, "Circular buffer: reader & writer try to use overlapping sections, range to lock = (", begin, ", ", end, "), already locked = ", lockedRanges);
       rangeUnlocked.wait(lock);
     }
 
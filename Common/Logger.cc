@@ -0,0 +1,298 @@
+#include "Common/Config.h"
+
+#include "Common/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+std::atomic<Logger::Severity> Logger::threshold(Logger::Info);
+
+
+struct Logger::Ring {
+  static const unsigned nrRecords = 256;
+
+  Ring() : readIndex(0), writeIndex(0), nrDropped(0), threadExited(false) {}
+
+  Record		records[nrRecords];
+  std::atomic<uint64_t> readIndex, writeIndex, nrDropped;
+  std::atomic<bool>	threadExited;
+};
+
+
+struct Logger::State {
+  State() : running(true), stop(false), nrFlushRequests(0), nrFlushes(0) {}
+
+  std::atomic<bool>	  running; // false: messages are written by the caller
+  std::mutex		  mutex;
+  std::condition_variable condition, flushed;
+  bool			  stop;
+  uint64_t		  nrFlushRequests, nrFlushes;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::thread		  thread;
+};
+
+
+static int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+Logger::State &Logger::state()
+{
+  // never destroyed, so that static objects that are destroyed after
+  // shutDown() can still log
+  static State *state = [] {
+    State *state = new State;
+    state->thread = std::thread(threadBody);
+    std::atexit(shutDown);
+    return state;
+  } ();
+
+  return *state;
+}
+
+
+void Logger::shutDown()
+{
+  State &state = Logger::state();
+
+  state.running.store(false, std::memory_order_release);
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stop = true;
+  }
+
+  state.condition.notify_all();
+  state.thread.join();
+}
+
+
+Logger::Site::Site(Severity severity, double maxRate)
+:
+  severity(severity),
+  interval(maxRate > 0 ? std::llround(1e9 / maxRate) : 0),
+  nextTime(0),
+  nrSuppressed(0)
+{
+}
+
+
+bool Logger::Site::admit()
+{
+  if (interval == 0)
+    return true;
+
+  int64_t time = now(), next = nextTime.load(std::memory_order_relaxed);
+
+  if (time < next || !nextTime.compare_exchange_strong(next, time + interval, std::memory_order_relaxed)) {
+    nrSuppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  return true;
+}
+
+
+void Logger::setMinimumSeverity(Severity severity)
+{
+  threshold.store(severity, std::memory_order_relaxed);
+}
+
+
+namespace {
+  // marks the ring of a thread when the thread exits, so that it can be freed
+  // once it is drained
+  struct ThreadExit {
+    ~ThreadExit()
+    {
+      if (exited != nullptr)
+	exited->store(true, std::memory_order_release);
+    }
+
+    std::atomic<bool> *exited = nullptr;
+  };
+
+  thread_local ThreadExit threadExit;
+}
+
+
+Logger::Ring *Logger::myRing()
+{
+  thread_local Ring *ring = nullptr;
+
+  if (ring == nullptr) {
+    ring = new Ring;
+
+    {
+      std::lock_guard<std::mutex> lock(state().mutex);
+      state().rings.emplace_back(ring);
+    }
+
+    threadExit.exited = &ring->threadExited;
+  }
+
+  return ring;
+}
+
+
+Logger::Record &Logger::callerRecord()
+{
+  thread_local Record record;
+  return record;
+}
+
+
+Logger::Record *Logger::reserve()
+{
+  if (!state().running.load(std::memory_order_acquire))
+    return &callerRecord();
+
+  Ring	   *ring  = myRing();
+  uint64_t index = ring->writeIndex.load(std::memory_order_relaxed);
+
+  if (index - ring->readIndex.load(std::memory_order_acquire) == Ring::nrRecords) {
+    ring->nrDropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  return &ring->records[index % Ring::nrRecords];
+}
+
+
+void Logger::commit(Site &site, Record *record)
+{
+  record->severity     = site.severity;
+  record->time	       = now();
+  record->nrSuppressed = site.nrSuppressed.exchange(0, std::memory_order_relaxed);
+
+  if (record == &callerRecord()) {
+#pragma omp critical (clog)
+    {
+      write(std::clog, *record);
+      std::clog.flush();
+    }
+  } else {
+    Ring *ring = myRing();
+
+    ring->writeIndex.store(ring->writeIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    if (record->severity >= Error)
+      state().condition.notify_one();
+  }
+}
+
+
+void Logger::write(std::ostream &os, Record &record)
+{
+  // a message does not change the formatting of the next one
+  std::ios_base::fmtflags flags = os.flags();
+  std::streamsize precision = os.precision();
+
+  if (record.severity == Warning)
+    os << "Warning: ";
+  else if (record.severity == Error)
+    os << "Error: ";
+
+  record.format(os, record.payload);
+  os.flags(flags);
+  os.precision(precision);
+
+  if (record.nrSuppressed > 0)
+    os << " (" << record.nrSuppressed << " similar messages suppressed)";
+
+  os << '\n';
+}
+
+
+void Logger::threadBody()
+{
+  State				 &state = Logger::state();
+  std::vector<Ring *>		 rings;
+  std::vector<uint64_t>		 ends;
+  std::vector<Record *>		 records;
+  std::unique_lock<std::mutex>	 lock(state.mutex);
+
+  for (;;) {
+    bool     stop	     = state.stop;
+    uint64_t nrFlushRequests = state.nrFlushRequests;
+
+    rings.clear();
+
+    for (std::unique_ptr<Ring> &ring : state.rings)
+      rings.push_back(ring.get());
+
+    lock.unlock();
+
+    // merge the messages of all threads in time order
+    uint64_t nrDropped = 0;
+
+    ends.resize(rings.size());
+    records.clear();
+
+    for (unsigned i = 0; i < rings.size(); i ++) {
+      ends[i] = rings[i]->writeIndex.load(std::memory_order_acquire);
+      nrDropped += rings[i]->nrDropped.exchange(0, std::memory_order_relaxed);
+
+      for (uint64_t index = rings[i]->readIndex.load(std::memory_order_relaxed); index < ends[i]; index ++)
+	records.push_back(&rings[i]->records[index % Ring::nrRecords]);
+    }
+
+    std::stable_sort(records.begin(), records.end(), [] (const Record *a, const Record *b) { return a->time < b->time; });
+
+    if (records.size() > 0 || nrDropped > 0) {
+      std::ostringstream text;
+
+      for (Record *record : records)
+	write(text, *record);
+
+      if (nrDropped > 0)
+	text << "Warning: " << nrDropped << " log messages dropped\n";
+
+#pragma omp critical (clog)
+      std::clog << text.str() << std::flush;
+    }
+
+    for (unsigned i = 0; i < rings.size(); i ++)
+      rings[i]->readIndex.store(ends[i], std::memory_order_release);
+
+    lock.lock();
+
+    // free the rings of threads that exited, once nothing is left in them
+    state.rings.erase(std::remove_if(state.rings.begin(), state.rings.end(), [] (const std::unique_ptr<Ring> &ring) {
+      return ring->threadExited.load(std::memory_order_acquire) && ring->readIndex.load(std::memory_order_relaxed) == ring->writeIndex.load(std::memory_order_acquire);
+    }), state.rings.end());
+
+    state.nrFlushes = nrFlushRequests;
+    state.flushed.notify_all();
+
+    if (stop)
+      return;
+
+    state.condition.wait_for(lock, std::chrono::milliseconds(20), [&] { return state.stop || state.nrFlushRequests != nrFlushRequests; });
+  }
+}
+
+
+void Logger::flush()
+{
+  State &state = Logger::state();
+  std::unique_lock<std::mutex> lock(state.mutex);
+
+  if (!state.stop) {
+    uint64_t request = ++ state.nrFlushRequests;
+
+    state.condition.notify_all();
+    state.flushed.wait(lock, [&] { return state.nrFlushes >= request; });
+  }
+}
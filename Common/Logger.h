@@ -0,0 +1,137 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+
+// Writes log messages to std::clog without serializing the threads that log
+// them.  A message is not formatted by the logging thread: its arguments are
+// copied into a ring buffer of that thread, which only that thread writes,
+// and a background thread formats them, in time order, with operator <<.
+// Hence, the arguments must remain valid after the call: pointers (including
+// string literals that decay to them) must outlive the program, and objects
+// are copied.  Messages with arguments that do not fit in a record are
+// formatted by the caller.  If the ring buffer of a thread is full, its
+// messages are dropped and counted.
+//
+// Messages below the minimum severity are discarded without copying their
+// arguments.  A log statement may be rate limited, in which case the next
+// message that is written mentions how many were suppressed.  Usage:
+//
+//   LOG(Logger::Info, "subband ", subband, " done");
+//   LOG_RATE_LIMITED(Logger::Warning, 1 /* per second */, "late: ", time);
+
+#define LOG(severity, ...) LOG_RATE_LIMITED(severity, 0, __VA_ARGS__)
+
+#define LOG_RATE_LIMITED(severity, maxRate, ...)			\
+  do {									\
+    static Logger::Site logSite(severity, maxRate);			\
+    Logger::log(logSite, __VA_ARGS__);					\
+  } while (0)
+
+
+class Logger
+{
+  public:
+    enum Severity { Debug, Info, Warning, Error };
+
+    // one log statement; at most maxRate messages per second (0: no limit)
+    class Site {
+      public:
+	Site(Severity, double maxRate = 0);
+
+      private:
+	friend class Logger;
+
+	bool		      admit();
+
+	const Severity	      severity;
+	const int64_t	      interval; // ns
+	std::atomic<int64_t>  nextTime;
+	std::atomic<uint64_t> nrSuppressed;
+    };
+
+    template <typename... Args> static void log(Site &, Args &&...);
+
+    static void	    setMinimumSeverity(Severity);
+    static Severity minimumSeverity() { return threshold.load(std::memory_order_relaxed); }
+
+    // waits until all messages logged so far are written
+    static void	    flush();
+
+  private:
+    struct Record {
+      static const size_t payloadSize = 192;
+
+      alignas(std::max_align_t) char payload[payloadSize];
+      void	 (*format)(std::ostream &, void *payload); // also destroys the payload
+      Severity severity;
+      int64_t  time; // ns, steady clock
+      uint64_t nrSuppressed;
+    };
+
+    struct Ring;
+    struct State;
+
+    template <typename Arguments> static void format(std::ostream &, void *payload);
+    template <typename Arguments, typename... Args> static void store(Site &, Args &&...);
+
+    static Ring	   *myRing();
+    static Record  &callerRecord(); // for messages written by the caller
+    static Record  *reserve();
+    static void	   commit(Site &, Record *);
+    static void	   write(std::ostream &, Record &);
+    static void	   threadBody();
+    static void	   shutDown();
+    static State	   &state();
+
+    static std::atomic<Severity> threshold;
+};
+
+
+template <typename Arguments> void Logger::format(std::ostream &os, void *payload)
+{
+  Arguments *arguments = static_cast<Arguments *>(payload);
+
+  std::apply([&os] (const auto &... args) { (os << ... << args); }, *arguments);
+  arguments->~Arguments();
+}
+
+
+template <typename Arguments, typename... Args> void Logger::store(Site &site, Args &&... args)
+{
+  if (Record *record = reserve()) {
+    new (record->payload) Arguments(std::forward<Args>(args)...);
+    record->format = &format<Arguments>;
+    commit(site, record);
+  }
+}
+
+
+template <typename... Args> inline void Logger::log(Site &site, Args &&... args)
+{
+  if (site.severity < minimumSeverity() || !site.admit())
+    return;
+
+  typedef std::tuple<typename std::decay<Args>::type...> Arguments;
+
+  if constexpr (sizeof(Arguments) <= Record::payloadSize && alignof(Arguments) <= alignof(std::max_align_t)) {
+    store<Arguments>(site, std::forward<Args>(args)...);
+  } else {
+    // too large to defer; the formatted message is (usually) small enough
+    std::ostringstream message;
+    (message << ... << args);
+    store<std::tuple<std::string>>(site, message.str());
+  }
+}
+
+#endif
@@ -0,0 +1,341 @@
+#include "Common/Config.h"
+
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+#include "Common/SystemCallException.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace {
+  struct Family {
+    std::string			      help;
+    bool			      isCounter;
+    std::map<Metrics::Labels, Metrics::Counter> counters;
+    std::map<Metrics::Labels, Metrics::Gauge>   gauges;
+  };
+
+  // function-local, so that metrics can be looked up during static
+  // initialization
+  std::mutex &registryMutex()
+  {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  std::map<std::string, Family> &registry()
+  {
+    static std::map<std::string, Family> families;
+    return families;
+  }
+}
+
+
+static Family &family(const std::string &name, const std::string &help, bool isCounter)
+{
+  std::map<std::string, Family>::iterator family = registry().find(name);
+
+  if (family == registry().end())
+    family = registry().emplace(name, Family { help, isCounter, {}, {} }).first;
+  else if (family->second.isCounter != isCounter)
+    throw std::runtime_error("metric " + name + " is registered both as a counter and as a gauge");
+
+  return family->second;
+}
+
+
+Metrics::Counter &Metrics::counter(const std::string &name, const Labels &labels, const std::string &help)
+{
+  std::lock_guard<std::mutex> lock(registryMutex());
+  return family(name, help, true).counters.try_emplace(labels).first->second;
+}
+
+
+Metrics::Gauge &Metrics::gauge(const std::string &name, const Labels &labels, const std::string &help)
+{
+  std::lock_guard<std::mutex> lock(registryMutex());
+  return family(name, help, false).gauges.try_emplace(labels).first->second;
+}
+
+
+static std::string escape(const std::string &string)
+{
+  std::string escaped;
+
+  for (char c : string)
+    if (c == '\\' || c == '"')
+      escaped.append({ '\\', c });
+    else if (c == '\n')
+      escaped.append("\\n");
+    else
+      escaped.push_back(c);
+
+  return escaped;
+}
+
+
+static std::string prometheusValue(double value)
+{
+  if (std::isnan(value))
+    return "NaN";
+  else if (std::isinf(value))
+    return value > 0 ? "+Inf" : "-Inf";
+
+  char buffer[32];
+  snprintf(buffer, sizeof buffer, "%.17g", value);
+  return buffer;
+}
+
+
+static std::string jsonValue(double value)
+{
+  return std::isfinite(value) ? prometheusValue(value) : "null";
+}
+
+
+static void printLabels(std::ostream &os, const Metrics::Labels &labels, bool asJSON)
+{
+  os << (asJSON ? "{ " : "{");
+
+  for (unsigned i = 0; i < labels.size(); i ++)
+    if (asJSON)
+      os << (i > 0 ? ", \"" : "\"") << escape(labels[i].first) << "\": \"" << escape(labels[i].second) << '"';
+    else
+      os << (i > 0 ? ",": "") << labels[i].first << "=\"" << escape(labels[i].second) << '"';
+
+  os << (asJSON ? " }" : "}");
+}
+
+
+std::string Metrics::prometheusText()
+{
+  std::lock_guard<std::mutex> lock(registryMutex());
+  std::ostringstream text;
+
+  for (const std::pair<const std::string, Family> &family : registry()) {
+    text << "# HELP " << family.first << ' ' << family.second.help << "\n"
+	    "# TYPE " << family.first << (family.second.isCounter ? " counter\n" : " gauge\n");
+
+    for (const std::pair<const Labels, Counter> &counter : family.second.counters) {
+      text << family.first;
+
+      if (counter.first.size() > 0)
+	printLabels(text, counter.first, false);
+
+      text << ' ' << counter.second.value() << '\n';
+    }
+
+    for (const std::pair<const Labels, Gauge> &gauge : family.second.gauges) {
+      text << family.first;
+
+      if (gauge.first.size() > 0)
+	printLabels(text, gauge.first, false);
+
+      text << ' ' << prometheusValue(gauge.second.value()) << '\n';
+    }
+  }
+
+  return text.str();
+}
+
+
+std::string Metrics::json()
+{
+  std::lock_guard<std::mutex> lock(registryMutex());
+  std::ostringstream json;
+  const char *separator = "\n";
+
+  json << "{\n  \"time\": " << jsonValue(std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count()) << ",\n  \"metrics\": {";
+
+  for (const std::pair<const std::string, Family> &family : registry()) {
+    json << separator << "    \"" << family.first << "\": [";
+    separator = ",\n";
+
+    const char *elementSeparator = "\n";
+
+    for (const std::pair<const Labels, Counter> &counter : family.second.counters) {
+      json << elementSeparator << "      { \"labels\": ";
+      printLabels(json, counter.first, true);
+      json << ", \"value\": " << counter.second.value() << " }";
+      elementSeparator = ",\n";
+    }
+
+    for (const std::pair<const Labels, Gauge> &gauge : family.second.gauges) {
+      json << elementSeparator << "      { \"labels\": ";
+      printLabels(json, gauge.first, true);
+      json << ", \"value\": " << jsonValue(gauge.second.value()) << " }";
+      elementSeparator = ",\n";
+    }
+
+    json << "\n    ]";
+  }
+
+  json << "\n  }\n}\n";
+  return json.str();
+}
+
+
+Metrics::Exporter::Exporter(uint16_t port, const std::string &snapshotFile, double interval)
+:
+  snapshotFile(snapshotFile),
+  interval(interval),
+  listenFd(-1),
+  stop(false)
+{
+  if (port != 0) {
+    if ((listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      throw SystemCallException("socket", errno);
+
+    int		on = 1;
+    sockaddr_in address {};
+
+    address.sin_family	    = AF_INET;
+    address.sin_port	    = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // not exposed outside the host
+
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof address) < 0 || listen(listenFd, 16) < 0) {
+      int error = errno;
+      close(listenFd);
+      throw SystemCallException("metrics port " + std::to_string(port), error);
+    }
+
+    httpThread = std::thread(&Exporter::httpThreadBody, this);
+  }
+
+  if (snapshotFile != "")
+    snapshotThread = std::thread(&Exporter::snapshotThreadBody, this);
+}
+
+
+Metrics::Exporter::~Exporter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+
+  condition.notify_all();
+
+  if (httpThread.joinable())
+    httpThread.join();
+
+  if (snapshotThread.joinable())
+    snapshotThread.join();
+
+  if (listenFd >= 0)
+    close(listenFd);
+}
+
+
+void Metrics::Exporter::serve(int fd)
+{
+  // the request is small; a client that does not send it, or does not read
+  // the response, in time is dropped, so that it cannot stall the thread
+  // (and the destructor, which joins it)
+  struct timeval timeout = { 1, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+  std::string request;
+  char	      buffer[1024];
+
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+    ssize_t bytes = recv(fd, buffer, sizeof buffer, 0);
+
+    if (bytes <= 0)
+      return;
+
+    request.append(buffer, bytes);
+  }
+
+  std::string status = "200 OK", body;
+
+  if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+    body = prometheusText();
+  else
+    status = "404 Not Found", body = "not found\n";
+
+  std::string response = "HTTP/1.1 " + status + "\r\n"
+			 "Content-Type: text/plain; version=0.0.4\r\n"
+			 "Content-Length: " + std::to_string(body.size()) + "\r\n"
+			 "Connection: close\r\n\r\n" + body;
+
+  for (size_t written = 0; written < response.size();) {
+    ssize_t bytes = send(fd, response.data() + written, response.size() - written, MSG_NOSIGNAL);
+
+    if (bytes < 0 && errno != EINTR) // including the time out (EAGAIN)
+      return;
+    else if (bytes > 0)
+      written += bytes;
+  }
+}
+
+
+void Metrics::Exporter::httpThreadBody()
+{
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      if (stop)
+	return;
+    }
+
+    pollfd pfd { listenFd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, 200) > 0) {
+      int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+      if (fd >= 0) {
+	serve(fd);
+	close(fd);
+      }
+    }
+  }
+}
+
+
+void Metrics::Exporter::writeSnapshot()
+{
+  std::string temporaryFile = snapshotFile + ".tmp";
+
+  {
+    std::ofstream file(temporaryFile);
+    file << json();
+  }
+
+  if (rename(temporaryFile.c_str(), snapshotFile.c_str()) < 0)
+    LOG(Logger::Warning, "could not write metrics snapshot ", snapshotFile, ": ", std::string(strerror(errno)));
+}
+
+
+void Metrics::Exporter::snapshotThreadBody()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  std::chrono::steady_clock::time_point nextSnapshot = std::chrono::steady_clock::now();
+
+  // the last snapshot is written at destruction, with the final values
+  do {
+    writeSnapshot();
+    nextSnapshot += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+  } while (!condition.wait_until(lock, nextSnapshot, [this] { return stop; }));
+
+  writeSnapshot();
+}
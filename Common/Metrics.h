@@ -0,0 +1,80 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// A process-wide registry of counters and gauges that describe the health of
+// the pipeline (packets, ring buffer fill, lateness, dropped blocks, queue
+// depths).  A metric is looked up once, by name and labels, typically when
+// its owner is constructed; the registry keeps it until the end of the
+// program, so that the owner may keep a reference.  Updates are relaxed
+// atomic operations, and do not take locks.
+//
+// An Exporter serves the metrics in the Prometheus text format on
+// http://127.0.0.1:<port>/metrics, and/or writes a JSON snapshot to a file
+// every interval seconds (atomically, by renaming a temporary file).
+
+class Metrics
+{
+  public:
+    typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+    class Counter {
+      public:
+	Counter() : count(0) {}
+
+	void	 add(uint64_t n = 1) { count.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t value() const { return count.load(std::memory_order_relaxed); }
+
+      private:
+	std::atomic<uint64_t> count;
+    };
+
+    class Gauge {
+      public:
+	Gauge() : current(0) {}
+
+	void   set(double value) { current.store(value, std::memory_order_relaxed); }
+	double value() const { return current.load(std::memory_order_relaxed); }
+
+      private:
+	std::atomic<double> current;
+    };
+
+    class Exporter {
+      public:
+	// port 0: no HTTP endpoint; empty snapshotFile: no snapshots
+	Exporter(uint16_t port, const std::string &snapshotFile, double interval = 1);
+	~Exporter();
+
+      private:
+	void			httpThreadBody();
+	void			snapshotThreadBody();
+	void			serve(int fd);
+	void			writeSnapshot();
+
+	const std::string	snapshotFile;
+	const double		interval;
+	int			listenFd;
+	std::mutex		mutex;
+	std::condition_variable condition;
+	bool			stop;
+	std::thread		httpThread, snapshotThread;
+    };
+
+    static Counter	&counter(const std::string &name, const Labels &, const std::string &help);
+    static Gauge	&gauge(const std::string &name, const Labels &, const std::string &help);
+
+    static std::string	prometheusText();
+    static std::string	json();
+};
+
+#endif
@@ -170,6 +170,7 @@ Parset::Parset(int argc, char **argv, bool throwExceptionOnUnmatchedParameter)
     ("correctBandPass,B", value<bool>(&_correctBandPass)->default_value(true))
     ("nrChannelsPerSubband,c", value<unsigned>(&_nrChannelsPerSubband)->default_value(64))
     ("delayCompensation,d", value<bool>(&_delayCompensation)->default_value(false))
+    ("delayPolynomialOrder", value<unsigned>(&_delayPolynomialOrder)->default_value(1))
     ("startTime,D", value<std::string>()->notifier([&providedStartTime] (std::string arg) { /* work-around for CodeXL that cannot pass white space */ std::replace(arg.begin(), arg.end(), '_', ' '); providedStartTime = arg; } ))
     ("clockSpeed,f", value<unsigned>(&_clockSpeed)->default_value(32000000))
     ("subbandBandwidth,fs", value<double>(&_subbandBandwidth)->default_value(8e6))
@@ -198,6 +199,9 @@ Parset::Parset(int argc, char **argv, bool throwExceptionOnUnmatchedParameter)
   if (throwExceptionOnUnmatchedParameter && toPassFurther.size() > 0)
     throw Error(std::string("unrecognized argument \'") + toPassFurther[0] + '\'');
 
+  if (_delayPolynomialOrder < 1 || _delayPolynomialOrder > 3)
+    throw Error("delay polynomial order must be 1, 2, or 3");
+
   handleSubbandsAndFrequencies();
   _sampleRate = static_cast<double>(clockSpeed()); 
   _startTime = providedStartTime != "" ? TimeStamp::fromDate(providedStartTime.c_str(), clockSpeed()) : TimeStamp::now(clockSpeed()) + 30 * clockSpeed();
@@ -55,6 +55,7 @@ class Parset
     TimeStamp stopTime() const { return _stopTime; };
     bool     correctBandPass() const { return _correctBandPass; }
     bool     delayCompensation() const { return _delayCompensation; }
+    unsigned delayPolynomialOrder() const { return _delayPolynomialOrder; }
     bool     profiling() const { return _profiling; }
 
     bool     realTime() const { return _realTime; }
@@ -105,6 +106,7 @@ class Parset
     bool     _realTime;
     bool     _correctBandPass;
     bool     _delayCompensation;
+    unsigned _delayPolynomialOrder;
     bool     _profiling;
     TimeStamp _startTime, _stopTime;
 
@@ -1,6 +1,7 @@
 #include "Common/Config.h"
 
 #include "Common/PerformanceCounter.h"
+#include "Common/Tracer.h"
 
 #include <functional>
 #include <iomanip>
@@ -21,7 +22,8 @@ PerformanceCounter::PerformanceCounter(const std::string &name, bool profiling)
   totalTime(0),
   nrTimes(0),
   name(name),
-  profiling(profiling)
+  profiling(profiling),
+  traceTrack(Tracer::newTrack(name))
 {
 //#pragma omp atomic
   counterNumber = nrCounters ++;
@@ -57,15 +59,33 @@ PerformanceCounter::~PerformanceCounter() noexcept(false)
 }
 
 
+void PerformanceCounter::add(double time, size_t nrOperations, size_t nrBytesRead, size_t nrBytesWritten)
+{
+  if (profiling) {
+#pragma omp atomic
+    totalTime += time;
+#pragma omp atomic
+    totalNrOperations   += nrOperations;
+#pragma omp atomic
+    totalNrBytesRead    += nrBytesRead;
+#pragma omp atomic
+    totalNrBytesWritten += nrBytesWritten;
+#pragma omp atomic
+    ++ nrTimes;
+  }
+}
+
+
 PerformanceCounter::Measurement::Measurement(PerformanceCounter &counter, cu::Stream &stream, size_t nrOperations, size_t nrBytesRead, size_t nrBytesWritten)
 :
-  state(new PerformanceCounter::Measurement::State(counter)),
+  state(counter.profiling || Tracer::enabled() ? new PerformanceCounter::Measurement::State(counter) : nullptr), // deleted by the stream callback
   counter(counter),
   stream(stream)
 {
-  if (counter.profiling) {
+  if (state != nullptr)
     stream.record(state->startEvent);
 
+  if (counter.profiling) {
 #if defined MEASURE_POWER
     stream.addCallback([] (CUstream, CUresult, void *arg) {
       static_cast<State *>(arg)->psStartState = powerSensor.read();
@@ -86,14 +106,26 @@ PerformanceCounter::Measurement::Measurement(PerformanceCounter &counter, cu::St
 
 PerformanceCounter::Measurement::~Measurement()
 {
-  if (counter.profiling) {
+  if (state != nullptr) {
     stream.record(state->stopEvent);
 
     stream.addCallback([] (CUstream, CUresult, void *arg) {
-      State *state = static_cast<State *>(arg);
+      State    *state = static_cast<State *>(arg);
+      double   time   = 1e-3 * state->stopEvent.elapsedTime(state->startEvent);
+
+      // the callback runs shortly after the work completed
+      if (Tracer::enabled()) {
+	uint64_t stopTicks = CPU_PerformanceCounter::now();
+	Tracer::complete(state->counter.name.c_str(), stopTicks - CPU_PerformanceCounter::secondsToTicks(time), stopTicks, nullptr, 0, state->counter.traceTrack);
+      }
+
+      if (!state->counter.profiling) {
+	delete state;
+	return;
+      }
 
 #pragma omp atomic
-      state->counter.totalTime += 1e-3 * state->stopEvent.elapsedTime(state->startEvent);
+      state->counter.totalTime += time;
 
 #if defined MEASURE_POWER
       PowerSensor3::State psStopState = powerSensor.read();
@@ -37,6 +37,9 @@ class PerformanceCounter
     PerformanceCounter(const std::string &name, bool profiling);
     ~PerformanceCounter() noexcept(false);
 
+    // for work that is timed on the host instead of on a cu::Stream
+    void add(double time, size_t nrOperations, size_t nrBytesRead, size_t nrBytesWritten);
+
   private:
     friend class Measurement;
 
@@ -51,6 +54,7 @@ class PerformanceCounter
     unsigned	      counterNumber;
     static unsigned   nrCounters;
     bool	      profiling;
+    int		      traceTrack; // the GPU work is traced on a track of its own
 };
 
 #endif
@@ -0,0 +1,235 @@
+#include "Common/Config.h"
+
+#include "Common/RAPL.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+
+
+// MSR addresses (Intel SDM vol. 4; AMD PPR for family 17h and later)
+static const unsigned MSR_RAPL_POWER_UNIT     = 0x606, MSR_PKG_ENERGY_STATUS     = 0x611;
+static const unsigned AMD_MSR_RAPL_POWER_UNIT = 0xC0010299, AMD_MSR_PKG_ENERGY_STATUS = 0xC001029B;
+
+
+static std::vector<std::string> directoryEntries(const std::string &path)
+{
+  std::vector<std::string> entries;
+
+  if (DIR *dir = opendir(path.c_str())) {
+    while (dirent *entry = readdir(dir))
+      if (entry->d_name[0] != '.')
+	entries.push_back(entry->d_name);
+
+    closedir(dir);
+  }
+
+  std::sort(entries.begin(), entries.end());
+  return entries;
+}
+
+
+static bool readMSR(int fd, unsigned address, uint64_t &value)
+{
+  return pread(fd, &value, sizeof value, address) == sizeof value;
+}
+
+
+RAPL::RAPL(const std::string &sysfsRoot)
+{
+  findPowercapZones(sysfsRoot + "/class/powercap");
+
+  if (zones.size() == 0)
+    findMSR_Zones(sysfsRoot);
+}
+
+
+RAPL::~RAPL()
+{
+  for (const Zone &zone : zones)
+    close(zone.fd);
+}
+
+
+void RAPL::findPowercapZones(const std::string &root)
+{
+  // intel-rapl:<package> and its subzones intel-rapl:<package>:<n> (the AMD
+  // driver uses the same names)
+  for (const std::string &entry : directoryEntries(root)) {
+    if (entry.compare(0, 11, "intel-rapl:") != 0 || zones.size() == maxNrZones)
+      continue;
+
+    std::string directory = root + '/' + entry, name;
+    std::ifstream(directory + "/name") >> name;
+
+    Domain domain;
+
+    if (name.compare(0, 7, "package") == 0)
+      domain = Package;
+    else if (name == "dram")
+      domain = DRAM;
+    else
+      continue; // core, uncore, and psys overlap with the package
+
+    uint64_t range = 0;
+
+    if (!(std::ifstream(directory + "/max_energy_range_uj") >> range) || range == 0)
+      continue;
+
+    // energy_uj is readable by root only on recent kernels
+    int fd = open((directory + "/energy_uj").c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd >= 0)
+      zones.push_back(Zone { domain, fd, false, 0, 1e-6, range });
+  }
+}
+
+
+void RAPL::findMSR_Zones(const std::string &sysfsRoot)
+{
+  std::set<std::string> packages;
+
+  for (const std::string &cpu : directoryEntries("/dev/cpu")) {
+    std::string package;
+
+    if (cpu.find_first_not_of("0123456789") != std::string::npos || !(std::ifstream(sysfsRoot + "/devices/system/cpu/cpu" + cpu + "/topology/physical_package_id") >> package) || !packages.insert(package).second)
+      continue;
+
+    int fd = open(("/dev/cpu/" + cpu + "/msr").c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+      continue;
+
+    uint64_t units;
+
+    // bits 12:8 of the unit register: the energy unit is 1 / 2^ESU joule
+    if (readMSR(fd, MSR_RAPL_POWER_UNIT, units) && zones.size() < maxNrZones)
+      zones.push_back(Zone { Package, fd, true, MSR_PKG_ENERGY_STATUS, 1.0 / (1ULL << ((units >> 8) & 0x1F)), 0xFFFFFFFF });
+    else if (readMSR(fd, AMD_MSR_RAPL_POWER_UNIT, units) && zones.size() < maxNrZones)
+      zones.push_back(Zone { Package, fd, true, AMD_MSR_PKG_ENERGY_STATUS, 1.0 / (1ULL << ((units >> 8) & 0x1F)), 0xFFFFFFFF });
+    else
+      close(fd);
+  }
+}
+
+
+bool RAPL::hasDomain(Domain domain) const
+{
+  return std::any_of(zones.begin(), zones.end(), [domain] (const Zone &zone) { return zone.domain == domain; });
+}
+
+
+RAPL::State RAPL::read() const
+{
+  State state;
+
+  for (const Zone &zone : zones) {
+    uint64_t value = 0;
+
+    if (zone.isMSR) {
+      readMSR(zone.fd, zone.msrAddress, value);
+      value &= 0xFFFFFFFF;
+    } else {
+      char    buffer[32];
+      ssize_t size = pread(zone.fd, buffer, sizeof buffer - 1, 0);
+
+      if (size > 0) {
+	buffer[size] = '\0';
+	value = strtoull(buffer, nullptr, 10);
+      }
+    }
+
+    state.energy[state.nrZones ++] = value;
+  }
+
+  return state;
+}
+
+
+void RAPL::joules(const State &start, const State &stop, double joules[nrDomains]) const
+{
+  std::fill(joules, joules + nrDomains, 0);
+
+  if (start.nrZones == zones.size() && stop.nrZones == zones.size())
+    for (unsigned zone = 0; zone < zones.size(); zone ++) {
+      // the counter wrapped around if it went backwards; it counted up to
+      // range, and from 0
+      uint64_t units = stop.energy[zone] >= start.energy[zone] ? stop.energy[zone] - start.energy[zone] : stop.energy[zone] + zones[zone].range + 1 - start.energy[zone];
+
+      joules[zones[zone].domain] += units * zones[zone].joulesPerUnit;
+    }
+}
+
+
+const char *RAPL::name(Domain domain)
+{
+  static const char *names[nrDomains] = { "package", "DRAM" };
+  return names[domain];
+}
+
+
+RAPL::Sampler::Sampler(const RAPL &sensor, double interval)
+:
+  sensor(sensor),
+  stop(false),
+  last(sensor.read()),
+  total {},
+  thread(&Sampler::threadBody, this, interval)
+{
+}
+
+
+RAPL::Sampler::~Sampler()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+
+  condition.notify_all();
+  thread.join();
+}
+
+
+void RAPL::Sampler::sample()
+{
+  State  now = sensor.read();
+  double joules[nrDomains];
+
+  sensor.joules(last, now, joules);
+  last = now;
+
+  for (unsigned domain = 0; domain < nrDomains; domain ++)
+    total[domain] += joules[domain];
+}
+
+
+void RAPL::Sampler::joules(double joules[nrDomains])
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  sample();
+  std::copy(total, total + nrDomains, joules);
+}
+
+
+void RAPL::Sampler::threadBody(double interval)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  std::chrono::steady_clock::time_point nextSample = std::chrono::steady_clock::now();
+
+  for (;;) {
+    nextSample += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+
+    if (condition.wait_until(lock, nextSample, [this] { return stop; }))
+      break;
+
+    sample();
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef RAPL_H
+#define RAPL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Reads the energy counters of the CPU packages and their DRAM (Intel and AMD
+// RAPL, Running Average Power Limit), so that the host-side stages can be
+// accounted for in energy as the GPU work is with PowerSensor3.  The counters
+// are read through the powercap interface in sysfs
+// (<sysfsRoot>/class/powercap/intel-rapl:*), or, if that does not exist,
+// through the MSRs of the first CPU of each package (/dev/cpu/*/msr, package
+// domain only).  Counters wrap around; the energy between two reads is
+// correct as long as a counter does not wrap more than once in between (at
+// least minutes at full power).
+//
+// A read() costs one pread(2) per zone; the zones are opened at
+// construction.  If no zone can be read (no RAPL, or no permission), the
+// sensor is not available and reads return nothing.
+//
+// The counters are updated about once per millisecond, and cover the whole
+// package, so they say little about a single short code region.  A Sampler
+// reads them in a thread of its own, every interval seconds, so that no
+// counter wraps more than once between reads, and accumulates the energy;
+// its owner takes differences over longer periods (a report interval, a
+// run).
+
+class RAPL
+{
+  public:
+    enum Domain { Package, DRAM, nrDomains };
+
+    static const unsigned maxNrZones = 16;
+
+    struct State {
+      State() : nrZones(0) {}
+
+      uint64_t energy[maxNrZones]; // raw counter values
+      unsigned nrZones;		   // 0: not read
+    };
+
+    class Sampler {
+      public:
+	Sampler(const RAPL &sensor, double interval = 1);
+	~Sampler();
+
+	// the energy per domain since construction, up to now, in joules
+	void		  joules(double joules[nrDomains]);
+
+	const RAPL	  &sensor;
+
+      private:
+	void		  sample(); // with the mutex held
+	void		  threadBody(double interval);
+
+	std::mutex	  mutex;
+	std::condition_variable condition;
+	bool		  stop;
+	State		  last;
+	double		  total[nrDomains];
+	std::thread	  thread;
+    };
+
+    RAPL(const std::string &sysfsRoot = "/sys");
+    ~RAPL();
+
+    bool	available() const { return zones.size() > 0; }
+    bool	hasDomain(Domain) const;
+    State	read() const;
+
+    // the energy per domain between two reads, in joules
+    void	joules(const State &start, const State &stop, double joules[nrDomains]) const;
+
+    static const char *name(Domain);
+
+  private:
+    struct Zone {
+      Domain   domain;
+      int      fd;
+      bool     isMSR;
+      unsigned msrAddress;
+      double   joulesPerUnit;
+      uint64_t range;	   // the largest counter value; it wraps to 0 after it
+    };
+
+    void	findPowercapZones(const std::string &root);
+    void	findMSR_Zones(const std::string &sysfsRoot);
+
+    std::vector<Zone> zones;
+};
+
+#endif
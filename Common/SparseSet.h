@@ -96,6 +96,15 @@ template <typename T> class SparseSet
     // Return the subset within [first, last).
     SparseSet<T> subset(T first, T last) const;
 
+    // Replace the contents by the subset of `other' within [first, last).
+    // Unlike subset(), this reuses the storage of this set, so that it does
+    // not allocate memory once the set has grown to its working size.
+    SparseSet<T> &assignSubset(const SparseSet<T> &other, T first, T last);
+
+    // Returns the number of elements in the intersection of two sets,
+    // without constructing the intersection.
+    T		 intersectionCount(const SparseSet<T> &) const;
+
     // Returns the range vector, useful for iteration.
     const Ranges &getRanges() const;
 
@@ -214,6 +223,19 @@ inline SparseSet<T> SparseSet<T>::subset(T first, T last) const
 }
 
 
+template <typename T>
+inline SparseSet<T> &SparseSet<T>::assignSubset(const SparseSet<T> &other, T first, T last)
+{
+  ranges.clear();
+
+  for (const_iterator it = other.ranges.begin(); it != other.ranges.end(); it++)
+    if (it->end > first && it->begin < last)
+      ranges.push_back(range(std::max(it->begin, first), std::min(it->end, last)));
+
+  return *this;
+}
+
+
 //template <typename T> inline const std::vector<typename SparseSet<T>::range> &SparseSet<T>::getRanges() const
 template <typename T>
 inline const typename SparseSet<T>::Ranges & SparseSet<T>::getRanges() const
@@ -400,6 +422,32 @@ SparseSet<T> SparseSet<T>::operator & (const SparseSet<T> &other) const
 }
 
 
+template <typename T>
+T SparseSet<T>::intersectionCount(const SparseSet<T> &other) const
+{
+  T count = 0;
+  const_iterator it1 = ranges.begin(), it2 = other.ranges.begin();
+
+  // same walk as operator &, but only the sizes of the overlaps are summed
+  while (it1 != ranges.end() && it2 != other.ranges.end()) {
+    if (it1->end < it2->begin) {
+      ++it1;
+    } else if (it2->end < it1->begin) {
+      ++it2;
+    } else {
+      count += std::min(it1->end, it2->end) - std::max(it1->begin, it2->begin);
+
+      if (it1->end < it2->end)
+	++it1;
+      else
+	++it2;
+    }
+  }
+
+  return count;
+}
+
+
 template <typename T>
 SparseSet<T> &SparseSet<T>::operator += (size_t count)
 {
@@ -1,11 +1,14 @@
 #include "Common/Config.h"
 
 #include "Common/Stream/Descriptor.h"
+#include "Common/Stream/DirectFileStream.h"
 #include "Common/Stream/FileDescriptorBasedStream.h"
 #include "Common/Stream/FileStream.h"
 #include "Common/Stream/NamedPipeStream.h"
 #include "Common/Stream/NullStream.h"
+#include "Common/Stream/SharedMemoryRingStream.h"
 #include "Common/Stream/SocketStream.h"
+#include "Common/Stream/UDPBlockStream.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -19,7 +22,7 @@ BadDescriptor::BadDescriptor(const std::string &descriptor)
 }
 
 
-Stream *createStream(const std::string &descriptor, bool asReader, time_t deadline)
+Stream *createStream(const std::string &descriptor, bool asReader, time_t deadline, bool zeroCopy)
 {
   std::vector<std::string> split;
   boost::split(split, descriptor, boost::is_any_of(":"));
@@ -28,16 +31,32 @@ Stream *createStream(const std::string &descriptor, bool asReader, time_t deadli
     return new NullStream;
   else if (split.size() == 3 && split[0] == "udp")
     return new SocketStream(split[1].c_str(), boost::lexical_cast<unsigned short>(split[2]), SocketStream::UDP, asReader ? SocketStream::Server : SocketStream::Client, deadline);
-  else if (split.size() == 3 && split[0] == "tcp")
-    return new SocketStream(split[1].c_str(), boost::lexical_cast<unsigned short>(split[2]), SocketStream::TCP, asReader ? SocketStream::Server : SocketStream::Client, deadline);
+  else if (split.size() >= 3 && split.size() <= 5 && split[0] == "udpblock" && !asReader) // udpblock:host:port[:datagramSize[:bitsPerSecond]], read with a UDPBlockReceiver
+    return new UDPBlockStream(split[1], boost::lexical_cast<unsigned short>(split[2]), split.size() > 3 ? boost::lexical_cast<unsigned>(split[3]) : 1472, split.size() > 4 ? boost::lexical_cast<double>(split[4]) : 0, deadline);
+  else if (split.size() == 3 && split[0] == "tcp") {
+    SocketStream *stream = new SocketStream(split[1].c_str(), boost::lexical_cast<unsigned short>(split[2]), SocketStream::TCP, asReader ? SocketStream::Server : SocketStream::Client, deadline);
+
+    if (zeroCopy && !asReader)
+      stream->enableZeroCopy();
+
+    return stream;
+  }
   else if (split.size() == 3 && split[0] == "udpkey")
     return new SocketStream(split[1].c_str(), 0, SocketStream::UDP, asReader ? SocketStream::Server : SocketStream::Client, deadline, split[2].c_str());
   else if (split.size() == 3 && split[0] == "tcpkey")
     return new SocketStream(split[1].c_str(), 0, SocketStream::TCP, asReader ? SocketStream::Server : SocketStream::Client, deadline, split[2].c_str());
   else if (split.size() >= 2 && split[0] == "file")
-    return asReader ? new FileStream(descriptor.c_str() + 5) : new FileStream(descriptor.c_str() + 5, 0666);
-  else if (split.size() >= 2 && split[0] == "pipe")
-    return new NamedPipeStream(descriptor.c_str() + 5, asReader);
+    return asReader ? new FileStream(descriptor.c_str() + 5) : zeroCopy ? (Stream *) new DirectFileStream(descriptor.c_str() + 5, 0666) : new FileStream(descriptor.c_str() + 5, 0666);
+  else if (split.size() >= 2 && split[0] == "pipe") {
+    NamedPipeStream *stream = new NamedPipeStream(descriptor.c_str() + 5, asReader);
+
+    if (zeroCopy && !asReader)
+      stream->enableZeroCopy();
+
+    return stream;
+  }
+  else if ((split.size() == 2 || split.size() == 3) && split[0] == "shm") // shm:name[:megabytes]
+    return new SharedMemoryRingStream(split[1], asReader, split.size() == 3 ? boost::lexical_cast<size_t>(split[2]) << 20 : 1024 << 20, deadline);
   else if (split.size() >= 2 && split[0] == "fd")
     return new FileDescriptorBasedStream(boost::lexical_cast<int>(descriptor.c_str() + 3));
   else if (split.size() == 2)
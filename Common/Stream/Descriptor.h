@@ -16,6 +16,9 @@ class BadDescriptor : public Exception
 };
 
 
-extern Stream *createStream(const std::string &descriptor, bool asReader, time_t deadline = 0);
+// zeroCopy: write file: descriptors with O_DIRECT, pipe: descriptors with
+// vmsplice(), and tcp: descriptors with MSG_ZEROCOPY; see
+// Stream::waitForCompletion()
+extern Stream *createStream(const std::string &descriptor, bool asReader, time_t deadline = 0, bool zeroCopy = false);
 
 #endif
@@ -0,0 +1,147 @@
+#include "Common/Config.h"
+
+#include "Common/SystemCallException.h"
+#include "Common/Stream/DirectFileStream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+DirectFileStream::DirectFileStream(const std::string &name, int mode)
+:
+  memoryAlignment(4096),
+  offsetAlignment(4096),
+  offset(0),
+  nrStagedBytes(0),
+  totalNrStagedBytes(0),
+  staging(nullptr, free)
+{
+  if ((fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, mode)) < 0) {
+    if (errno != EINVAL)
+      throw SystemCallException(std::string("open ") + name, errno);
+
+    // no O_DIRECT support; every write is aligned
+    if ((fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode)) < 0)
+      throw SystemCallException(std::string("open ") + name, errno);
+
+    memoryAlignment = offsetAlignment = 1;
+  }
+
+#if defined STATX_DIOALIGN
+  struct statx stat;
+
+  if (memoryAlignment > 1 && statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stat) == 0 && (stat.stx_mask & STATX_DIOALIGN) && stat.stx_dio_offset_align > 0) {
+    memoryAlignment = stat.stx_dio_mem_align;
+    offsetAlignment = stat.stx_dio_offset_align;
+  }
+#endif
+
+  void *buffer;
+
+  if (posix_memalign(&buffer, std::max(memoryAlignment, (size_t) 4096), stagingSize) != 0)
+    throw std::bad_alloc();
+
+  staging.reset(static_cast<char *>(buffer));
+}
+
+
+DirectFileStream::~DirectFileStream() noexcept(false)
+{
+  if (!std::uncaught_exceptions())
+    writeTail();
+}
+
+
+void DirectFileStream::writeStaged(size_t size)
+{
+  for (size_t done = 0; done < size;) {
+    ssize_t bytes = pwrite(fd, staging.get() + done, size - done, offset + done);
+
+    if (bytes < 0)
+      throw SystemCallException("pwrite", errno);
+
+    done += bytes;
+  }
+}
+
+
+size_t DirectFileStream::tryWrite(const void *ptr, size_t size)
+{
+  // the staged data end on an aligned file offset, so the caller's memory
+  // can be written directly if it is aligned as well
+  if (nrStagedBytes % offsetAlignment == 0 && (uintptr_t) ptr % memoryAlignment == 0 && size >= offsetAlignment) {
+    if (nrStagedBytes > 0) {
+      writeStaged(nrStagedBytes);
+      offset += nrStagedBytes;
+      nrStagedBytes = 0;
+    }
+
+    ssize_t bytes = pwrite(fd, ptr, size / offsetAlignment * offsetAlignment, offset);
+
+    if (bytes < 0)
+      throw SystemCallException("pwrite", errno);
+
+    offset += bytes;
+    return bytes;
+  }
+
+  // stage up to the next aligned file offset, or until the buffer is full
+  size_t bytes = std::min(size, stagingSize - nrStagedBytes);
+
+  if (nrStagedBytes % offsetAlignment != 0)
+    bytes = std::min(bytes, offsetAlignment - nrStagedBytes % offsetAlignment);
+
+  memcpy(staging.get() + nrStagedBytes, ptr, bytes);
+  totalNrStagedBytes += bytes;
+
+  if ((nrStagedBytes += bytes) == stagingSize) {
+    writeStaged(stagingSize);
+    offset += stagingSize;
+    nrStagedBytes = 0;
+  }
+
+  return bytes;
+}
+
+
+size_t DirectFileStream::tryWritev(const iovec *pieces, unsigned count)
+{
+  // the pieces are aligned differently, so they are written one by one
+  return Stream::tryWritev(pieces, count);
+}
+
+
+void DirectFileStream::writeTail()
+{
+  // write the partial block padded to the alignment, but keep it staged, so
+  // that it is completed by the next write
+  if (nrStagedBytes > 0) {
+    size_t padded = (nrStagedBytes + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+
+    memset(staging.get() + nrStagedBytes, 0, padded - nrStagedBytes);
+    writeStaged(padded);
+  }
+
+  if (ftruncate(fd, offset + nrStagedBytes) < 0)
+    throw SystemCallException("ftruncate", errno);
+}
+
+
+void DirectFileStream::sync()
+{
+  writeTail();
+  FileDescriptorBasedStream::sync();
+}
+
+
+size_t DirectFileStream::writeAlignment() const
+{
+  return offsetAlignment;
+}
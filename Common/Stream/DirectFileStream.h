@@ -0,0 +1,44 @@
+#ifndef STREAM_DIRECT_FILE_STREAM_H
+#define STREAM_DIRECT_FILE_STREAM_H
+
+#include "Common/Stream/FileDescriptorBasedStream.h"
+
+#include <memory>
+#include <string>
+
+
+// Writes a file with O_DIRECT, bypassing the page cache.  Data that are
+// suitably aligned in memory and in the file (at a multiple of
+// writeAlignment()) are written directly from the caller's memory; other
+// data are staged in an aligned buffer.  The file is
+// padded to the alignment while it is written, and truncated to its real
+// size by sync() and at destruction.  If the file system does not support
+// O_DIRECT, the file is written normally.
+
+class DirectFileStream : public FileDescriptorBasedStream
+{
+  public:
+		   DirectFileStream(const std::string &name, int mode); // write-only; create file
+    virtual	   ~DirectFileStream() noexcept(false);
+
+    virtual size_t tryWrite(const void *ptr, size_t size);
+    virtual size_t tryWritev(const iovec *, unsigned count);
+
+    virtual void   sync();
+    virtual size_t writeAlignment() const;
+
+    size_t	   nrCopiedBytes() const { return totalNrStagedBytes; } // that were staged rather than written directly
+
+  private:
+    void	   writeStaged(size_t size);
+    void	   writeTail();
+
+    size_t	   memoryAlignment, offsetAlignment;
+    size_t	   offset; // in the file, of the staging buffer
+    size_t	   nrStagedBytes, totalNrStagedBytes;
+    std::unique_ptr<char, decltype(&free)> staging;
+
+    static const size_t stagingSize = 4 << 20;
+};
+
+#endif
@@ -6,6 +6,7 @@
 
 #include <exception>
 
+#include <sys/uio.h>
 #include <unistd.h>
 
 
@@ -50,6 +51,17 @@ size_t FileDescriptorBasedStream::tryWrite(const void *ptr, size_t size)
 }
 
 
+size_t FileDescriptorBasedStream::tryWritev(const iovec *pieces, unsigned count)
+{
+  ssize_t bytes = ::writev(fd, pieces, count);
+
+  if (bytes < 0)
+    throw SystemCallException("writev", errno);
+
+  return bytes;
+}
+
+
 void FileDescriptorBasedStream::sync()
 {
   if (fsync(fd) < 0)
@@ -12,6 +12,7 @@ class FileDescriptorBasedStream : public Stream
 
     virtual size_t tryRead(void *ptr, size_t size);
     virtual size_t tryWrite(const void *ptr, size_t size);
+    virtual size_t tryWritev(const iovec *, unsigned count);
 
     virtual void   sync();
 
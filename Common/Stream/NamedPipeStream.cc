@@ -5,6 +5,9 @@
 //#include "Common/Thread/Cancellation.h"
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -15,7 +18,9 @@ NamedPipeStream::NamedPipeStream(const char *name, bool serverSide)
   itsReadName(std::string(name) + (serverSide ? "-0" : "-1")),
   itsWriteName(std::string(name) + (serverSide ? "-1" : "-0")),
   itsReadStream(0),
-  itsWriteStream(0)
+  itsWriteStream(0),
+  itsZeroCopy(false),
+  itsInotifyFd(-1)
 {
   try {
     if (mknod(itsReadName.c_str(), 0600 | S_IFIFO, 0) < 0 && errno != EEXIST)
@@ -47,6 +52,9 @@ void NamedPipeStream::cleanUp()
   unlink(itsWriteName.c_str());
   delete itsReadStream;
   delete itsWriteStream;
+
+  if (itsInotifyFd >= 0)
+    close(itsInotifyFd);
 }
 
 
@@ -58,7 +66,63 @@ size_t NamedPipeStream::tryRead(void *ptr, size_t size)
 
 size_t NamedPipeStream::tryWrite(const void *ptr, size_t size)
 {
-  return itsWriteStream->tryWrite(ptr, size);
+  iovec piece = { const_cast<void *>(ptr), size };
+  return itsZeroCopy ? tryWritev(&piece, 1) : itsWriteStream->tryWrite(ptr, size);
+}
+
+
+size_t NamedPipeStream::tryWritev(const iovec *pieces, unsigned count)
+{
+#if defined __linux__
+  if (itsZeroCopy) {
+    ssize_t bytes = vmsplice(itsWriteStream->fd, pieces, count, 0);
+
+    if (bytes < 0)
+      throw SystemCallException("vmsplice", errno);
+
+    return bytes;
+  }
+#endif
+
+  return itsWriteStream->tryWritev(pieces, count);
+}
+
+
+void NamedPipeStream::enableZeroCopy()
+{
+#if defined __linux__
+  itsZeroCopy = true;
+
+  // reads of the pipe wake up waitForCompletion()
+  if (itsInotifyFd < 0 && (itsInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    throw SystemCallException("inotify_init1", errno);
+
+  if (inotify_add_watch(itsInotifyFd, itsWriteName.c_str(), IN_ACCESS) < 0)
+    throw SystemCallException(std::string("inotify_add_watch ") + itsWriteName, errno);
+#endif
+}
+
+
+void NamedPipeStream::waitForCompletion()
+{
+  int nrPendingBytes;
+
+  // the pipe refers to the memory of the writer until it is read; sleep until
+  // the reader reads, or at most 10 ms on kernels that do not report pipe
+  // reads to inotify
+  while (itsZeroCopy && ioctl(itsWriteStream->fd, FIONREAD, &nrPendingBytes) == 0 && nrPendingBytes > 0) {
+    pollfd pfd { itsInotifyFd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, 10) < 0 && errno != EINTR)
+      throw SystemCallException("poll", errno);
+
+    if (pfd.revents & POLLIN) {
+      char events[4096];
+
+      while (::read(itsInotifyFd, events, sizeof events) > 0)
+	;
+    }
+  }
 }
 
 
@@ -13,6 +13,13 @@ class NamedPipeStream : public Stream
     virtual	   ~NamedPipeStream() noexcept(false);
 
     virtual size_t tryRead(void *, size_t), tryWrite(const void *, size_t);
+    virtual size_t tryWritev(const iovec *, unsigned count);
+
+    // writes with vmsplice(), which maps the caller's memory into the pipe;
+    // the memory can be reused after waitForCompletion(), which waits until
+    // the pipe is drained
+    void	   enableZeroCopy();
+    virtual void   waitForCompletion();
 
     virtual void   sync();
 
@@ -21,6 +28,8 @@ class NamedPipeStream : public Stream
 
     std::string    itsReadName, itsWriteName;
     FileStream	   *itsReadStream, *itsWriteStream;
+    bool	   itsZeroCopy;
+    int		   itsInotifyFd; // reports reads of the pipe
 };
 
 #endif
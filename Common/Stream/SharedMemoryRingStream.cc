@@ -0,0 +1,383 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/SharedMemoryRingStream.h"
+#include "Common/SystemCallException.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock-free atomics in shared memory");
+static_assert(sizeof(SharedMemoryRingStream::Consumer) == 64, "consumers must not share cache lines");
+static_assert(sizeof(SharedMemoryRingStream::RingHeader) == 64 * (1 + SharedMemoryRingStream::maxConsumers), "unexpected ring header size");
+
+
+static std::string shmName(const std::string &name)
+{
+  return name.size() > 0 && name[0] == '/' ? name : '/' + name;
+}
+
+
+// the pid and the start time (in clock ticks since boot) of a process, or 0
+// if the process does not exist
+
+static uint64_t processToken(pid_t pid)
+{
+  std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+  std::string	line;
+
+  if (!std::getline(file, line) || line.rfind(')') == std::string::npos)
+    return 0;
+
+  // the start time is the 20th field after the command name
+  std::istringstream fields(line.substr(line.rfind(')') + 1));
+  std::string	     field;
+  uint64_t	     startTime = 0;
+
+  for (unsigned i = 0; i < 19; i ++)
+    fields >> field;
+
+  fields >> startTime;
+  return startTime << 32 | (uint32_t) pid;
+}
+
+
+static void futexWait(std::atomic<uint32_t> &word, uint32_t value)
+{
+  // time out now and then, to notice a writer that disappeared
+  struct timespec timeout = { 0, 100000000 };
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, value, &timeout, nullptr, 0);
+}
+
+
+static void futexWakeAll(std::atomic<uint32_t> &word)
+{
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+
+SharedMemoryRingStream::OverrunException::OverrunException(const std::string &msg)
+:
+  Exception(msg)
+{
+}
+
+
+SharedMemoryRingStream::OverrunException::~OverrunException() noexcept
+{
+}
+
+
+SharedMemoryRingStream::SharedMemoryRingStream(const std::string &name, bool asReader, size_t dataSize, time_t deadline)
+:
+  name(shmName(name)),
+  asReader(asReader),
+  segment(nullptr),
+  writePosition(0),
+  consumer(nullptr),
+  haveBlock(false)
+{
+  if (asReader)
+    attach(deadline);
+  else
+    create(dataSize);
+}
+
+
+SharedMemoryRingStream::~SharedMemoryRingStream() noexcept(false)
+{
+  if (asReader) {
+    if (haveBlock)
+      release();
+
+    consumer->owner.store(0, std::memory_order_release);
+  } else {
+    header()->writerDone.store(1, std::memory_order_release);
+    header()->futexWord.fetch_add(1, std::memory_order_release);
+    futexWakeAll(header()->futexWord);
+
+    // consumers that attached keep their mapping
+    shm_unlink(name.c_str());
+  }
+
+  munmap(segment, segmentSize);
+}
+
+
+void SharedMemoryRingStream::create(size_t dataSize)
+{
+  dataSize = (dataSize + blockAlignment - 1) / blockAlignment * blockAlignment;
+  segmentSize = sizeof(RingHeader) + nrBlockDescriptors * sizeof(BlockDescriptor) + dataSize;
+
+  // a ring that is left behind by an earlier run is replaced; its consumers
+  // do not see this ring
+  shm_unlink(name.c_str());
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+
+  if (fd < 0)
+    throw SystemCallException(std::string("shm_open ") + name, errno);
+
+  if (ftruncate(fd, segmentSize) < 0) {
+    int error = errno;
+    close(fd);
+    throw SystemCallException("ftruncate", error);
+  }
+
+  segment = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (segment == MAP_FAILED)
+    throw SystemCallException("mmap", errno);
+
+  // the segment is zero-filled
+  header()->version	       = version;
+  header()->nrBlockDescriptors = nrBlockDescriptors;
+  header()->dataSize	       = dataSize;
+
+  for (unsigned index = 0; index < nrBlockDescriptors; index ++)
+    descriptor(index)->sequence.store(~0ULL, std::memory_order_relaxed);
+
+  header()->magic.store(magic, std::memory_order_release);
+}
+
+
+void SharedMemoryRingStream::attach(time_t deadline)
+{
+  for (;;) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+
+    if (fd < 0 && errno != ENOENT)
+      throw SystemCallException(std::string("shm_open ") + name, errno);
+
+    if (fd >= 0) {
+      struct stat status;
+
+      if (fstat(fd, &status) < 0) {
+	int error = errno;
+	close(fd);
+	throw SystemCallException("fstat", error);
+      }
+
+      // the writer may not have sized or initialized the ring yet
+      if ((size_t) status.st_size >= sizeof(RingHeader)) {
+	segment = mmap(nullptr, segmentSize = status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	close(fd); // the mapping stays valid
+
+	if (segment == MAP_FAILED)
+	  throw SystemCallException("mmap", error);
+
+	if (header()->magic.load(std::memory_order_acquire) == magic)
+	  break;
+
+	munmap(segment, segmentSize);
+      } else {
+	close(fd);
+      }
+    }
+
+    if (deadline > 0 && time(0) >= deadline)
+      throw SystemCallException(std::string("shm_open ") + name, ETIMEDOUT);
+
+    usleep(10000);
+  }
+
+  if (header()->version != version || segmentSize < sizeof(RingHeader) + header()->nrBlockDescriptors * sizeof(BlockDescriptor) + header()->dataSize) {
+    munmap(segment, segmentSize);
+    throw std::runtime_error(std::string("incompatible shared memory ring ") + name);
+  }
+
+  // take a free consumer slot, or the slot of a consumer that died
+  uint64_t token = processToken(getpid());
+
+  for (Consumer &slot : header()->consumers) {
+    uint64_t owner = slot.owner.load(std::memory_order_acquire);
+
+    if ((owner == 0 || processToken((pid_t) (uint32_t) owner) != owner) && slot.owner.compare_exchange_strong(owner, token)) {
+      slot.nrDropped.store(0, std::memory_order_relaxed);
+      slot.readSequence.store(header()->writeSequence.load(std::memory_order_acquire), std::memory_order_release);
+      consumer = &slot;
+      return;
+    }
+  }
+
+  munmap(segment, segmentSize);
+  throw std::runtime_error(std::string("too many consumers of shared memory ring ") + name);
+}
+
+
+// moves the consumers that did not read the oldest block past it, so that
+// its descriptor and data can be reused
+
+void SharedMemoryRingStream::reclaimOldestBlock()
+{
+  uint64_t sequence = header()->oldestSequence.load(std::memory_order_relaxed);
+
+  for (Consumer &slot : header()->consumers)
+    if (slot.owner.load(std::memory_order_acquire) != 0) {
+      uint64_t readSequence = slot.readSequence.load(std::memory_order_acquire);
+
+      while (readSequence <= sequence && !slot.readSequence.compare_exchange_weak(readSequence, sequence + 1, std::memory_order_acq_rel))
+	;
+
+      if (readSequence <= sequence)
+	slot.nrDropped.fetch_add(sequence + 1 - readSequence, std::memory_order_relaxed);
+    }
+
+  header()->oldestSequence.store(sequence + 1, std::memory_order_release);
+}
+
+
+size_t SharedMemoryRingStream::tryWritev(const iovec *pieces, unsigned count)
+{
+  if (asReader)
+    throw std::runtime_error("cannot write to a shared memory ring reader");
+
+  RingHeader *ring = header();
+  size_t     size = 0;
+
+  for (unsigned i = 0; i < count; i ++)
+    size += pieces[i].iov_len;
+
+  size_t allocation = (size + blockAlignment - 1) / blockAlignment * blockAlignment;
+
+  if (allocation > ring->dataSize / 2)
+    throw std::runtime_error("block does not fit in shared memory ring " + name);
+
+  // blocks do not wrap around the end of the data area
+  if (writePosition % ring->dataSize + allocation > ring->dataSize)
+    writePosition += ring->dataSize - writePosition % ring->dataSize;
+
+  uint64_t sequence = ring->writeSequence.load(std::memory_order_relaxed);
+
+  for (uint64_t oldest; (oldest = ring->oldestSequence.load(std::memory_order_relaxed)) < sequence && (sequence - oldest >= ring->nrBlockDescriptors || writePosition + allocation - descriptor(oldest)->position.load(std::memory_order_relaxed) > ring->dataSize);)
+    reclaimOldestBlock();
+
+  char *block = data() + writePosition % ring->dataSize;
+
+  for (unsigned i = 0; i < count; i ++) {
+    memcpy(block, pieces[i].iov_base, pieces[i].iov_len);
+    block += pieces[i].iov_len;
+  }
+
+  BlockDescriptor *blockDescriptor = descriptor(sequence);
+  blockDescriptor->sequence.store(~0ULL, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  blockDescriptor->position.store(writePosition, std::memory_order_relaxed);
+  blockDescriptor->size.store(size, std::memory_order_relaxed);
+  blockDescriptor->sequence.store(sequence, std::memory_order_release);
+
+  writePosition += allocation;
+  ring->writeSequence.store(sequence + 1, std::memory_order_release);
+  ring->futexWord.fetch_add(1, std::memory_order_release);
+  futexWakeAll(ring->futexWord);
+
+  return size;
+}
+
+
+size_t SharedMemoryRingStream::tryWrite(const void *ptr, size_t size)
+{
+  iovec piece { const_cast<void *>(ptr), size };
+  return tryWritev(&piece, 1);
+}
+
+
+const void *SharedMemoryRingStream::acquire(size_t &size)
+{
+  if (!asReader)
+    throw std::runtime_error("cannot read from a shared memory ring writer");
+
+  if (haveBlock && !release())
+    throw OverrunException("shared memory ring " + name + ": block overwritten while it was read");
+
+  RingHeader *ring = header();
+
+  for (;;) {
+    uint32_t futexValue = ring->futexWord.load(std::memory_order_acquire);
+    uint64_t sequence   = consumer->readSequence.load(std::memory_order_acquire);
+
+    if (sequence >= ring->writeSequence.load(std::memory_order_acquire)) {
+      if (ring->writerDone.load(std::memory_order_acquire))
+	return nullptr;
+
+      futexWait(ring->futexWord, futexValue);
+      continue;
+    }
+
+    // if the descriptor is being reused, the writer has moved our cursor
+    const BlockDescriptor *blockDescriptor = descriptor(sequence);
+    uint64_t before   = blockDescriptor->sequence.load(std::memory_order_acquire);
+    uint64_t position = blockDescriptor->position.load(std::memory_order_relaxed);
+    uint64_t bytes    = blockDescriptor->size.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (before != sequence || blockDescriptor->sequence.load(std::memory_order_relaxed) != sequence)
+      continue;
+
+    currentSequence = sequence;
+    currentBlock    = data() + position % ring->dataSize;
+    currentSize	    = size = bytes;
+    currentOffset   = 0;
+    haveBlock	    = true;
+    return currentBlock;
+  }
+}
+
+
+bool SharedMemoryRingStream::release()
+{
+  uint64_t sequence = currentSequence;
+
+  haveBlock = false;
+  std::atomic_thread_fence(std::memory_order_acquire); // finish reading the block before the check
+  return consumer->readSequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acq_rel);
+}
+
+
+size_t SharedMemoryRingStream::tryRead(void *ptr, size_t size)
+{
+  while (!haveBlock || currentOffset == currentSize) {
+    size_t blockSize;
+
+    // every copy from the block was checked, so a block that is reclaimed
+    // after it was read completely lost nothing
+    if (haveBlock)
+      release();
+
+    if (acquire(blockSize) == nullptr)
+      throw EndOfStreamException("shared memory ring " + name);
+  }
+
+  size_t bytes = std::min(size, currentSize - currentOffset);
+  memcpy(ptr, currentBlock + currentOffset, bytes);
+  std::atomic_thread_fence(std::memory_order_acquire); // finish the copy before the check
+
+  // if the writer reclaimed the block, it moved our cursor to the oldest
+  // block that it did not reclaim; the rest of this block is skipped
+  if (consumer->readSequence.load(std::memory_order_relaxed) != currentSequence) {
+    haveBlock = false;
+    throw OverrunException("shared memory ring " + name + ": block overwritten while it was read");
+  }
+
+  currentOffset += bytes;
+  return bytes;
+}
+
+
+uint64_t SharedMemoryRingStream::nrDroppedBlocks() const
+{
+  return consumer->nrDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,123 @@
+#ifndef STREAM_SHARED_MEMORY_RING_STREAM_H
+#define STREAM_SHARED_MEMORY_RING_STREAM_H
+
+#include "Common/Stream/Stream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+
+// A ring of blocks in a named POSIX shared-memory segment (/dev/shm/<name>),
+// written by one process and read in place by up to maxConsumers consumers
+// on the same host.  Every tryWritev() (so every writev() of at most IOV_MAX
+// pieces) becomes one block.  The writer never waits for the consumers: to
+// make room for a new block, it reclaims the oldest blocks, and moves the
+// read cursors of the consumers that did not read them yet past them,
+// counting the skipped blocks as dropped.
+//
+// The segment starts with a RingHeader, followed by nrBlockDescriptors
+// BlockDescriptors and a data area of dataSize bytes, in which the blocks
+// are stored contiguously (a block never wraps around the end of the data
+// area).  The writer publishes block s by setting the sequence of descriptor
+// s % nrBlockDescriptors to s and incrementing writeSequence, and wakes the
+// consumers through a futex on futexWord.  A consumer reads block
+// s = readSequence in place, and then moves its cursor from s to s + 1 with
+// a compare-and-swap.  If the CAS fails, the writer reclaimed the block while
+// it was read, and the data must be discarded.
+//
+// A consumer slot is owned by a process token: the pid and the start time of
+// the process, so that a slot of a consumer that died is taken over even if
+// its pid was reused.
+//
+// As a reader stream, tryRead() copies the blocks as a byte stream; acquire()
+// and release() give access to the blocks in place.  tryRead() checks after
+// every copy that the block was not reclaimed; if it was, it throws an
+// OverrunException, and the next read starts at the beginning of the next
+// block that is still available.
+
+class SharedMemoryRingStream : public Stream
+{
+  public:
+    static const uint32_t magic = 0x3B98F0A0, version = 2, maxConsumers = 16;
+
+    class OverrunException : public Exception
+    {
+      public:
+	OverrunException(const std::string &msg);
+	~OverrunException() noexcept;
+    };
+
+    struct Consumer {
+      std::atomic<uint64_t> owner;	  // process token; 0: free
+      std::atomic<uint64_t> readSequence; // the next block to read
+      std::atomic<uint64_t> nrDropped;
+      char		    pad[40];
+    };
+
+    struct BlockDescriptor {
+      std::atomic<uint64_t> sequence;	    // ~0 while the descriptor is (re)written
+      std::atomic<uint64_t> position, size; // the block is at data + position % dataSize
+    };
+
+    struct RingHeader {
+      std::atomic<uint32_t> magic;	   // set when the ring is initialized
+      uint32_t		    version, nrBlockDescriptors, pad0;
+      uint64_t		    dataSize;
+      std::atomic<uint64_t> writeSequence; // the number of published blocks
+      std::atomic<uint64_t> oldestSequence; // the oldest block that is not reclaimed
+      std::atomic<uint32_t> futexWord;
+      std::atomic<uint32_t> writerDone;
+      char		    pad1[16];
+      Consumer		    consumers[maxConsumers];
+    };
+
+		   // writer: creates the ring (dataSize bytes for the blocks);
+		   // reader: waits until the ring exists, or until the deadline
+		   SharedMemoryRingStream(const std::string &name, bool asReader, size_t dataSize = 1024 << 20, time_t deadline = 0);
+    virtual	   ~SharedMemoryRingStream() noexcept(false);
+
+    virtual size_t tryRead(void *ptr, size_t size);
+    virtual size_t tryWrite(const void *ptr, size_t size);
+    virtual size_t tryWritev(const iovec *, unsigned count);
+
+    // reader: waits for the next block, and returns it in place; returns
+    // nullptr at the end of the stream.  Throws an OverrunException if the
+    // previous block was not released, and was overwritten.
+    const void	   *acquire(size_t &size);
+
+    // reader: releases the block of the last acquire(); returns false if the
+    // block was overwritten while it was read
+    bool	   release();
+
+    uint64_t	   nrDroppedBlocks() const; // reader
+
+  private:
+    void	   create(size_t dataSize);
+    void	   attach(time_t deadline);
+    void	   reclaimOldestBlock();
+
+    RingHeader	   *header() const { return static_cast<RingHeader *>(segment); }
+    BlockDescriptor *descriptor(uint64_t sequence) const { return reinterpret_cast<BlockDescriptor *>(header() + 1) + sequence % header()->nrBlockDescriptors; }
+    char	   *data() const { return reinterpret_cast<char *>(reinterpret_cast<BlockDescriptor *>(header() + 1) + header()->nrBlockDescriptors); }
+
+    const std::string name;
+    const bool	   asReader;
+    void	   *segment;
+    size_t	   segmentSize;
+
+    // writer
+    uint64_t	   writePosition;   // of the next block, not modulo dataSize
+
+    // reader
+    Consumer	   *consumer;
+    uint64_t	   currentSequence;
+    const char	   *currentBlock;
+    size_t	   currentSize, currentOffset;
+    bool	   haveBlock;
+
+    static const unsigned nrBlockDescriptors = 1024, blockAlignment = 64;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "Common/Config.h"
 
 //#include <Common/Thread/Cancellation.h>
+#include "Common/Logger.h"
 #include "Common/Stream/SocketStream.h"
 
 #include <cassert>
@@ -11,6 +12,8 @@
 #include <dirent.h>
 #include <errno.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -21,6 +24,10 @@
 
 #include <boost/lexical_cast.hpp>
 
+#if defined __linux__
+#include <linux/errqueue.h>
+#endif
+
 //# AI_NUMERICSERV is not defined on OS-X
 #ifndef AI_NUMERICSERV
 # define AI_NUMERICSERV 0
@@ -57,7 +64,10 @@ SocketStream::SocketStream(const std::string &hostname, uint16_t _port, Protocol
   hostname(hostname),
   port(_port),
   nfskey(nfskey),
-  listen_sk(-1)
+  listen_sk(-1),
+  zeroCopy(false),
+  nrZeroCopySends(0),
+  nrZeroCopyCompletions(0)
 {  
   struct addrinfo hints;
   bool            autoPort = (port == 0);
@@ -271,7 +281,7 @@ void SocketStream::setTimeout(double seconds)
   if (seconds >= 0) {
     struct timeval tv;
     tv.tv_sec  = static_cast<time_t>(seconds);
-    tv.tv_usec = static_cast<suseconds_t>((seconds - floor(seconds)) * 10e6);
+    tv.tv_usec = static_cast<suseconds_t>((seconds - floor(seconds)) * 1e6);
 
     if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) < 0 || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) < 0)
       throw SystemCallException("setsockopt", errno);
@@ -279,6 +289,90 @@ void SocketStream::setTimeout(double seconds)
 }
 
 
+void SocketStream::enableZeroCopy()
+{
+#if defined SO_ZEROCOPY && defined MSG_ZEROCOPY
+  int on = 1;
+
+  if (protocol == TCP && fd >= 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) < 0)
+      LOG(Logger::Warning, "cannot enable zero-copy sends, sending normally: ", std::string(strerror(errno)));
+    else
+      zeroCopy = true;
+  }
+#endif
+}
+
+
+size_t SocketStream::tryWrite(const void *ptr, size_t size)
+{
+  iovec piece = { const_cast<void *>(ptr), size };
+  return zeroCopy ? tryWritev(&piece, 1) : FileDescriptorBasedStream::tryWrite(ptr, size);
+}
+
+
+size_t SocketStream::tryWritev(const iovec *pieces, unsigned count)
+{
+#if defined SO_ZEROCOPY && defined MSG_ZEROCOPY
+  if (zeroCopy) {
+    msghdr message;
+    memset(&message, 0, sizeof message);
+    message.msg_iov    = const_cast<iovec *>(pieces);
+    message.msg_iovlen = count;
+
+    ssize_t bytes;
+
+    // ENOBUFS: too many pending completions
+    while ((bytes = sendmsg(fd, &message, MSG_ZEROCOPY)) < 0 && errno == ENOBUFS)
+      waitForCompletion();
+
+    if (bytes < 0)
+      throw SystemCallException("sendmsg", errno);
+
+    ++ nrZeroCopySends;
+    return bytes;
+  }
+#endif
+
+  return FileDescriptorBasedStream::tryWritev(pieces, count);
+}
+
+
+void SocketStream::waitForCompletion()
+{
+#if defined SO_ZEROCOPY && defined MSG_ZEROCOPY
+  // the kernel reports ranges of completed sends on the error queue
+  while (nrZeroCopyCompletions != nrZeroCopySends) {
+    char   control[128];
+    msghdr message;
+    memset(&message, 0, sizeof message);
+    message.msg_control    = control;
+    message.msg_controllen = sizeof control;
+
+    if (recvmsg(fd, &message, MSG_ERRQUEUE) < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	throw SystemCallException("recvmsg", errno);
+
+      pollfd pfd = { fd, 0, 0 }; // POLLERR is always reported
+
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	throw SystemCallException("poll", errno);
+
+      continue;
+    }
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+      if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+	const sock_extended_err *error = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+
+	if (error->ee_errno == 0 && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+	  nrZeroCopyCompletions += error->ee_data - error->ee_info + 1;
+      }
+  }
+#endif
+}
+
+
 void SocketStream::syncNFS()
 {
   // sync NFS
@@ -37,6 +37,14 @@ class SocketStream : public FileDescriptorBasedStream
     void  setWriteBufferSize(size_t size);
     void  setTimeout(double seconds);
 
+    // sends with MSG_ZEROCOPY (TCP only); the memory of a write can be reused
+    // after waitForCompletion()
+    void  enableZeroCopy();
+
+    virtual size_t tryWrite(const void *ptr, size_t size);
+    virtual size_t tryWritev(const iovec *, unsigned count);
+    virtual void   waitForCompletion();
+
     const Protocol protocol;
     const Mode mode;
 
@@ -45,6 +53,8 @@ class SocketStream : public FileDescriptorBasedStream
     uint16_t port;
     const std::string nfskey;
     int listen_sk;
+    bool zeroCopy;
+    uint32_t nrZeroCopySends, nrZeroCopyCompletions; // wrap around, like the kernel's counter
 
     void accept(time_t timeout);
 
@@ -2,6 +2,10 @@
 
 #include "Common/Stream/Stream.h"
 
+#include <algorithm>
+
+#include <limits.h>
+
 
 Stream::EndOfStreamException::EndOfStreamException(const std::string &msg)
 :
@@ -42,6 +46,40 @@ void Stream::write(const void *ptr, size_t size)
 }
 
 
+size_t Stream::tryWritev(const iovec *pieces, unsigned count)
+{
+  for (unsigned i = 0; i < count; i ++)
+    if (pieces[i].iov_len > 0)
+      return tryWrite(pieces[i].iov_base, pieces[i].iov_len);
+
+  return 0;
+}
+
+
+void Stream::writev(const std::vector<iovec> &pieces)
+{
+  for (size_t first = 0; first < pieces.size();) {
+    size_t bytes = tryWritev(&pieces[first], std::min((size_t) IOV_MAX, pieces.size() - first));
+
+    for (; first < pieces.size() && bytes >= pieces[first].iov_len; first ++)
+      bytes -= pieces[first].iov_len;
+
+    if (first < pieces.size() && bytes > 0) {
+      // after a short write, only the partially written piece is copied
+      iovec rest { static_cast<char *>(pieces[first].iov_base) + bytes, pieces[first].iov_len - bytes };
+
+      while (rest.iov_len > 0) {
+	bytes = tryWritev(&rest, 1);
+	rest.iov_base = static_cast<char *>(rest.iov_base) + bytes;
+	rest.iov_len -= bytes;
+      }
+
+      first ++;
+    }
+  }
+}
+
+
 std::string Stream::readLine()
 {
   // TODO: do not do a system call per character
@@ -63,3 +101,14 @@ std::string Stream::readLine()
 void Stream::sync()
 {
 }
+
+
+void Stream::waitForCompletion()
+{
+}
+
+
+size_t Stream::writeAlignment() const
+{
+  return 1;
+}
@@ -2,6 +2,9 @@
 #define STREAM_STREAM_H
 
 #include <string>
+#include <vector>
+
+#include <sys/uio.h>
 
 #include "Common/Exceptions/Exception.h"
 
@@ -24,6 +27,19 @@ class Stream
     virtual size_t tryWrite(const void *ptr, size_t size) = 0;
     void	   write(const void *ptr, size_t size); // does not return until all bytes are written
 
+    virtual size_t tryWritev(const iovec *, unsigned count); // by default, writes (part of) the first non-empty piece
+    void	   writev(const std::vector<iovec> &); // does not return until all bytes are written
+
+    // A zero-copy stream may still read the memory of a write after the
+    // write returned; returns when the memory of all earlier writes can be
+    // reused.
+    virtual void   waitForCompletion();
+
+    // A zero-copy stream may only write data directly from memory that
+    // start at a multiple of writeAlignment() bytes into the stream; a
+    // writer can pad its data accordingly.
+    virtual size_t writeAlignment() const;
+
     std::string    readLine(); // excludes '\n'
 
     virtual void   sync();
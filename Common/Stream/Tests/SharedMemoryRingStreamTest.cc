@@ -0,0 +1,224 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/SharedMemoryRingStream.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// Blocks written to a shared-memory ring are read by two consumers, in place
+// and as a stream, and a consumer that does not keep up loses the oldest
+// blocks.  A stream consumer whose block is reclaimed while it is read gets
+// an OverrunException, and continues at the beginning of a later block.  The
+// slot of a consumer that died is taken over even if its pid is in use.
+
+struct BlockHeader {
+  uint32_t sequence, nrValues;
+};
+
+
+static uint32_t value(unsigned block, unsigned index)
+{
+  return block * 1000003 + index;
+}
+
+
+static void writeBlock(Stream &writer, unsigned block, unsigned nrValues)
+{
+  BlockHeader header { block, nrValues };
+  std::vector<uint32_t> values(nrValues);
+
+  for (unsigned i = 0; i < nrValues; i ++)
+    values[i] = value(block, i);
+
+  writer.writev({ iovec { &header, sizeof header }, iovec { values.data(), values.size() * sizeof(uint32_t) } });
+}
+
+
+static bool testConsumers()
+{
+  const unsigned nrBlocks = 12, nrValues = 1000;
+  std::string descriptor = "shm:SharedMemoryRingStreamTest-" + std::to_string(getpid()) + ":1";
+  std::unique_ptr<SharedMemoryRingStream> inPlace;
+  std::unique_ptr<Stream> copying;
+
+  {
+    std::unique_ptr<Stream> writer(createStream(descriptor, false));
+
+    inPlace.reset(dynamic_cast<SharedMemoryRingStream *>(createStream(descriptor, true)));
+    copying.reset(createStream(descriptor, true));
+
+    for (unsigned block = 0; block < nrBlocks; block ++)
+      writeBlock(*writer, block, nrValues);
+  } // ends the stream
+
+  bool ok = true;
+  const void *data;
+  size_t size;
+
+  for (unsigned block = 0; (data = inPlace->acquire(size)) != nullptr; block ++) {
+    const BlockHeader *header = static_cast<const BlockHeader *>(data);
+    const uint32_t *values = reinterpret_cast<const uint32_t *>(header + 1);
+
+    ok &= block < nrBlocks && size == sizeof *header + nrValues * sizeof(uint32_t) && header->sequence == block;
+
+    for (unsigned i = 0; ok && i < nrValues; i ++)
+      ok &= values[i] == value(block, i);
+
+    ok &= inPlace->release();
+  }
+
+  for (unsigned block = 0; block < nrBlocks; block ++) {
+    BlockHeader header;
+    std::vector<uint32_t> values(nrValues);
+
+    copying->read(&header, sizeof header);
+    copying->read(values.data(), values.size() * sizeof(uint32_t));
+    ok &= header.sequence == block && values[nrValues - 1] == value(block, nrValues - 1);
+  }
+
+  return ok && inPlace->nrDroppedBlocks() == 0;
+}
+
+
+static bool testSlowConsumer()
+{
+  // the consumer does not read while 1000 blocks go through a ring that holds
+  // 256 of them
+  std::string name = "SharedMemoryRingStreamTest-" + std::to_string(getpid());
+  std::unique_ptr<SharedMemoryRingStream> reader;
+
+  {
+    std::vector<char> block(4096);
+    SharedMemoryRingStream writer(name, false, 1 << 20);
+    reader.reset(new SharedMemoryRingStream(name, true));
+
+    for (unsigned sequence = 0; sequence < 1000; sequence ++) {
+      memcpy(block.data(), &sequence, sizeof sequence);
+      writer.write(block.data(), block.size());
+    }
+  }
+
+  bool ok = true;
+  unsigned nrReceived = 0, first = 0;
+  const void *data;
+  size_t size;
+
+  for (; (data = reader->acquire(size)) != nullptr; nrReceived ++) {
+    unsigned sequence;
+    memcpy(&sequence, data, sizeof sequence);
+
+    if (nrReceived == 0)
+      first = sequence;
+
+    ok &= size == 4096 && sequence == first + nrReceived && reader->release();
+  }
+
+  return ok && nrReceived > 0 && nrReceived <= 256 && reader->nrDroppedBlocks() + nrReceived == 1000 && first + nrReceived == 1000;
+}
+
+
+static bool testOverrun()
+{
+  const unsigned nrValues = 1000;
+  std::string name = "SharedMemoryRingStreamTest-" + std::to_string(getpid());
+  SharedMemoryRingStream writer(name, false, 1 << 20);
+  SharedMemoryRingStream reader(name, true);
+  BlockHeader header;
+  std::vector<uint32_t> values(nrValues);
+  bool ok = true;
+
+  // the writer reclaims the block in the middle of the read
+  writeBlock(writer, 0, nrValues);
+  reader.read(&header, sizeof header);
+  ok &= header.sequence == 0;
+
+  for (unsigned block = 1; block < 1000; block ++)
+    writeBlock(writer, block, nrValues);
+
+  try {
+    reader.read(values.data(), values.size() * sizeof(uint32_t));
+    ok = false;
+  } catch (SharedMemoryRingStream::OverrunException &) {
+  }
+
+  // the reader continues at a block boundary
+  for (unsigned i = 0; i < 2; i ++) {
+    reader.read(&header, sizeof header);
+    reader.read(values.data(), values.size() * sizeof(uint32_t));
+    ok &= header.sequence > 0 && header.nrValues == nrValues && values[0] == value(header.sequence, 0) && values[nrValues - 1] == value(header.sequence, nrValues - 1);
+  }
+
+  return ok && reader.nrDroppedBlocks() > 0;
+}
+
+
+static bool testDeadConsumer()
+{
+  std::string name = "SharedMemoryRingStreamTest-" + std::to_string(getpid());
+  SharedMemoryRingStream writer(name, false, 1 << 20);
+  std::vector<std::unique_ptr<SharedMemoryRingStream>> readers;
+  bool ok = true;
+
+  for (unsigned consumer = 0; consumer < SharedMemoryRingStream::maxConsumers; consumer ++)
+    readers.emplace_back(new SharedMemoryRingStream(name, true));
+
+  try {
+    SharedMemoryRingStream reader(name, true);
+    ok = false;
+  } catch (std::runtime_error &) {
+  }
+
+  // make the first consumer look like an earlier process with the same pid
+  int fd = shm_open(('/' + name).c_str(), O_RDWR, 0);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot open shared memory ring");
+
+  void *segment = mmap(nullptr, sizeof(SharedMemoryRingStream::RingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (segment == MAP_FAILED)
+    throw std::runtime_error("cannot map shared memory ring");
+
+  SharedMemoryRingStream::Consumer &slot = static_cast<SharedMemoryRingStream::RingHeader *>(segment)->consumers[0];
+  slot.owner.store(slot.owner.load() + (1ULL << 32));
+  munmap(segment, sizeof(SharedMemoryRingStream::RingHeader));
+
+  SharedMemoryRingStream reader(name, true);
+  writeBlock(writer, 0, 1);
+
+  size_t size;
+  const void *data = reader.acquire(size);
+  return ok && data != nullptr && static_cast<const BlockHeader *>(data)->sequence == 0 && reader.release();
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running SharedMemoryRingStreamTest" << std::endl;
+
+    bool ok = testConsumers() && testSlowConsumer() && testOverrun() && testDeadConsumer();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
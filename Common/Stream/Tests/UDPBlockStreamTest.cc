@@ -0,0 +1,144 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/UDPBlockStream.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Blocks of different sizes, sent as (paced) UDP datagrams, are reassembled
+// by a UDPBlockReceiver.  A block of which the sender sent only the first
+// datagram is given up at the end of the stream, and its missing datagrams
+// are counted as lost.  Datagrams with headers that would make the receiver
+// allocate too much memory, or write outside a block, are dropped.
+
+static char value(unsigned block, size_t index)
+{
+  return (char) (block * 31 + index * 7);
+}
+
+
+static bool testBlocks()
+{
+  const unsigned nrBlocks = 12;
+  uint16_t port = 20000 + getpid() % 10000;
+  UDPBlockReceiver receiver("127.0.0.1", port, 5);
+  std::vector<std::vector<char>> blocks;
+  std::thread thread([&] () {
+    std::vector<char> block;
+
+    while (receiver.receive(block))
+      blocks.push_back(block);
+  });
+
+  {
+    std::unique_ptr<Stream> sender(createStream("udpblock:127.0.0.1:" + std::to_string(port) + ":1472:1e9", false));
+
+    for (unsigned block = 0; block < nrBlocks; block ++) {
+      std::vector<char> data(block * 10000 + 1000);
+
+      for (size_t i = 0; i < data.size(); i ++)
+	data[i] = value(block, i);
+
+      // two pieces, the first of which ends in the middle of a datagram
+      sender->writev({ iovec { data.data(), 100 }, iovec { data.data() + 100, data.size() - 100 } });
+    }
+  } // sends the end-of-stream marker
+
+  thread.join();
+
+  UDPBlockReceiver::Statistics statistics = receiver.statistics();
+  bool ok = blocks.size() == nrBlocks && statistics.nrBlocks == nrBlocks && statistics.nrLostBlocks == 0 && statistics.nrIncompleteBlocks == 0 && statistics.nrLostDatagrams == 0;
+
+  for (unsigned block = 0; ok && block < nrBlocks; block ++) {
+    ok &= blocks[block].size() == block * 10000 + 1000;
+
+    for (size_t i = 0; ok && i < blocks[block].size(); i ++)
+      ok &= blocks[block][i] == value(block, i);
+  }
+
+  return ok;
+}
+
+
+static bool testPartialBlock()
+{
+  uint16_t port = 20000 + (getpid() + 1) % 10000;
+  UDPBlockReceiver receiver("127.0.0.1", port, 5);
+  SocketStream sender("127.0.0.1", port, SocketStream::UDP, SocketStream::Client);
+  std::vector<char> datagram(1000);
+  UDPBlockStream::DatagramHeader header { UDPBlockStream::magic, 0, 3, 0, 0, 3 * (datagram.size() - sizeof header), 0 };
+  UDPBlockStream::DatagramHeader marker { UDPBlockStream::magic, 0, 0, 0, 1, 0, 0 };
+
+  memcpy(datagram.data(), &header, sizeof header);
+  sender.write(datagram.data(), datagram.size());
+  sender.write(&marker, sizeof marker);
+
+  std::vector<char> block;
+  bool ok = !receiver.receive(block);
+  UDPBlockReceiver::Statistics statistics = receiver.statistics();
+
+  return ok && statistics.nrBlocks == 0 && statistics.nrIncompleteBlocks == 1 && statistics.nrDatagrams == 1 && statistics.nrLostDatagrams == 2;
+}
+
+
+static bool testInvalidDatagrams()
+{
+  uint16_t port = 20000 + (getpid() + 2) % 10000;
+  UDPBlockReceiver receiver("127.0.0.1", port, 5, 4, 1 << 20);
+  SocketStream sender("127.0.0.1", port, SocketStream::UDP, SocketStream::Client);
+  std::vector<char> datagram(1000);
+  uint64_t payloadSize = datagram.size() - sizeof(UDPBlockStream::DatagramHeader);
+
+  const UDPBlockStream::DatagramHeader headers[] = {
+    { UDPBlockStream::magic, 0, 1 << 20, 0, 0, (uint64_t) 1 << 40, 0 },		// larger than maxBlockSize
+    { UDPBlockStream::magic, 0, 0xFFFFFFFF, 0, 1, 10 * payloadSize, 0 },	// more datagrams than bytes
+    { UDPBlockStream::magic, 0, 1, 0, 2, 100 * payloadSize, 0 },		// too few datagrams for the block
+    { UDPBlockStream::magic, 1, 2, 0, 3, 2 * payloadSize, ~(uint64_t) 0 - 10 }, // offset + size overflows
+    { UDPBlockStream::magic, 0, 2, 0, 4, 2 * payloadSize, payloadSize },	// payload not at its offset
+    { UDPBlockStream::magic, 0, 1, 0, 5, payloadSize, 0 },			// valid
+  };
+
+  UDPBlockStream::DatagramHeader marker { UDPBlockStream::magic, 0, 0, 0, 6, 0, 0 };
+
+  for (const UDPBlockStream::DatagramHeader &header : headers) {
+    memcpy(datagram.data(), &header, sizeof header);
+    sender.write(datagram.data(), datagram.size());
+  }
+
+  sender.write(&marker, sizeof marker);
+
+  std::vector<char> block;
+  uint64_t blockSequence;
+  bool ok = receiver.receive(block, &blockSequence) && blockSequence == 5 && block.size() == payloadSize && !receiver.receive(block);
+  UDPBlockReceiver::Statistics statistics = receiver.statistics();
+
+  return ok && statistics.nrBlocks == 1 && statistics.nrDatagrams == 1 && statistics.nrInvalidDatagrams == 5 && statistics.nrIncompleteBlocks == 0;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running UDPBlockStreamTest" << std::endl;
+
+    bool ok = testBlocks() && testPartialBlock() && testInvalidDatagrams();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,361 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/UDPBlockStream.h"
+#include "Common/Logger.h"
+#include "Common/SystemCallException.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#if !defined UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+
+UDPBlockStream::UDPBlockStream(const std::string &hostname, uint16_t port, unsigned datagramSize, double rate, time_t deadline)
+:
+  SocketStream(hostname, port, UDP, Client, deadline),
+  datagramSize(datagramSize),
+  rate(rate),
+  useGSO(true),
+  nextBlockSequence(0),
+  nextSendTime(std::chrono::steady_clock::now())
+{
+  if (datagramSize <= sizeof(DatagramHeader) || datagramSize > 65507)
+    throw std::runtime_error("UDP datagram size must be between " + std::to_string(sizeof(DatagramHeader) + 1) + " and 65507 bytes");
+
+  // probes for GSO support; the segment size is set per message
+  int segmentSize = datagramSize;
+
+  if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segmentSize, sizeof segmentSize) < 0)
+    useGSO = false;
+
+  segmentSize = 0;
+  setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segmentSize, sizeof segmentSize);
+
+  if (rate > 0) {
+    uint64_t bytesPerSecond = rate / 8;
+
+    // only effective with the fq qdisc; the sender paces itself as well
+    if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &bytesPerSecond, sizeof bytesPerSecond) < 0) {
+      uint32_t bytesPerSecond32 = std::min(bytesPerSecond, (uint64_t) UINT32_MAX);
+      setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &bytesPerSecond32, sizeof bytesPerSecond32);
+    }
+  }
+
+  setWriteBufferSize(16 * 1024 * 1024);
+}
+
+
+UDPBlockStream::~UDPBlockStream() noexcept(false)
+{
+  // the end-of-stream marker is sent a few times, as it may get lost
+  DatagramHeader marker { magic, 0, 0, 0, nextBlockSequence, 0, 0 };
+
+  for (unsigned i = 0; i < 3; i ++)
+    if (::send(fd, &marker, sizeof marker, 0) < 0)
+      break;
+}
+
+
+void UDPBlockStream::pace(size_t nrBytes)
+{
+  if (rate <= 0)
+    return;
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  // do not catch up after an idle period
+  if (nextSendTime < now)
+    nextSendTime = now;
+  else
+    std::this_thread::sleep_until(nextSendTime);
+
+  nextSendTime += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(nrBytes * 8 / rate));
+}
+
+
+void UDPBlockStream::send(mmsghdr *messages, unsigned count)
+{
+  for (unsigned first = 0; first < count;) {
+    int nrSent = sendmmsg(fd, messages + first, count - first, 0);
+
+    if (nrSent >= 0) {
+      first += nrSent;
+    } else if (errno == EAGAIN || errno == ENOBUFS) {
+      // wait until the socket buffer drains; the device queue (ENOBUFS) does
+      // not wake up poll(), hence the time out
+      pollfd pfd { fd, POLLOUT, 0 };
+
+      if (poll(&pfd, 1, 1) < 0 && errno != EINTR)
+	throw SystemCallException("poll", errno);
+    } else if (errno != EINTR && errno != ECONNREFUSED) { // ECONNREFUSED: an earlier datagram had no receiver
+      throw SystemCallException("sendmmsg", errno);
+    }
+  }
+}
+
+
+size_t UDPBlockStream::tryWritev(const iovec *pieces, unsigned count)
+{
+  size_t size = 0;
+
+  for (unsigned i = 0; i < count; i ++)
+    size += pieces[i].iov_len;
+
+  size_t   payloadSize = datagramSize - sizeof(DatagramHeader);
+  uint32_t nrDatagrams = std::max((size_t) 1, (size + payloadSize - 1) / payloadSize);
+  uint64_t blockSequence = nextBlockSequence ++;
+
+  // the headers and iovecs of all datagrams; starts[d] is the first iovec of
+  // datagram d.  The vectors keep their capacity from block to block.
+  unsigned piece = 0;
+  size_t   pieceOffset = 0;
+
+  headers.resize(nrDatagrams);
+  iovecs.clear();
+  starts.clear();
+
+  for (uint32_t datagram = 0; datagram < nrDatagrams; datagram ++) {
+    uint64_t offset = datagram * payloadSize;
+    headers[datagram] = DatagramHeader { magic, datagram, nrDatagrams, 0, blockSequence, size, offset };
+    starts.push_back(iovecs.size());
+    iovecs.push_back(iovec { &headers[datagram], sizeof(DatagramHeader) });
+
+    for (size_t bytes = std::min(payloadSize, size - offset); bytes > 0;) {
+      if (pieceOffset == pieces[piece].iov_len) {
+	piece ++, pieceOffset = 0;
+	continue;
+      }
+
+      size_t part = std::min(bytes, pieces[piece].iov_len - pieceOffset);
+      iovecs.push_back(iovec { static_cast<char *>(pieces[piece].iov_base) + pieceOffset, part });
+      pieceOffset += part, bytes -= part;
+    }
+  }
+
+  starts.push_back(iovecs.size());
+
+  for (;;) {
+    // with GSO, one message holds up to 64 datagrams, which together fit in
+    // one (64 KiB) UDP packet; the kernel splits it at datagramSize bytes
+    unsigned datagramsPerMessage = useGSO ? std::max(1U, std::min(maxSegmentsPerMessage, 65000 / datagramSize)) : 1;
+    unsigned nrMessages = (nrDatagrams + datagramsPerMessage - 1) / datagramsPerMessage;
+
+    messages.assign(nrMessages, mmsghdr());
+    controls.assign(nrMessages * CMSG_SPACE(sizeof(uint16_t)), 0);
+
+    for (unsigned message = 0; message < nrMessages; message ++) {
+      unsigned first = message * datagramsPerMessage, last = std::min(first + datagramsPerMessage, nrDatagrams);
+      msghdr   &header = messages[message].msg_hdr;
+
+      header.msg_iov    = &iovecs[starts[first]];
+      header.msg_iovlen = starts[last] - starts[first];
+
+      if (last - first > 1) {
+	header.msg_control    = &controls[message * CMSG_SPACE(sizeof(uint16_t))];
+	header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+	cmsghdr *control = CMSG_FIRSTHDR(&header);
+	control->cmsg_level = SOL_UDP;
+	control->cmsg_type  = UDP_SEGMENT;
+	control->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+	*reinterpret_cast<uint16_t *>(CMSG_DATA(control)) = datagramSize;
+      }
+    }
+
+    try {
+      for (unsigned first = 0; first < nrMessages; first += maxMessagesPerCall) {
+	size_t nrBytes = 0;
+
+	for (unsigned datagram = first * datagramsPerMessage; datagram < std::min((first + maxMessagesPerCall) * datagramsPerMessage, nrDatagrams); datagram ++)
+	  nrBytes += sizeof(DatagramHeader) + std::min(payloadSize, size - headers[datagram].offset);
+
+	pace(nrBytes);
+	send(&messages[first], std::min(maxMessagesPerCall, nrMessages - first));
+      }
+
+      return size;
+    } catch (SystemCallException &ex) {
+      // the device cannot segment (EIO); the datagrams that were already
+      // sent are ignored by the receiver
+      if (!useGSO || ex.error != EIO)
+	throw;
+
+      LOG(Logger::Warning, "UDP GSO failed, sending datagrams one by one");
+      useGSO = false;
+    }
+  }
+}
+
+
+size_t UDPBlockStream::tryWrite(const void *ptr, size_t size)
+{
+  iovec piece { const_cast<void *>(ptr), size };
+  return tryWritev(&piece, 1);
+}
+
+
+UDPBlockReceiver::UDPBlockReceiver(const std::string &hostname, uint16_t port, double timeout, unsigned maxBlocksInFlight, size_t maxBlockSize)
+:
+  socket(hostname, port, SocketStream::UDP, SocketStream::Server),
+  maxBlocksInFlight(maxBlocksInFlight),
+  maxBlockSize(maxBlockSize),
+  firstSequence(0),
+  nextSequence(0),
+  expiredSequence(0),
+  counts(),
+  buffers(batchSize, std::vector<char>(maxDatagramSize)),
+  iovecs(batchSize),
+  messages(batchSize),
+  nrBuffered(0),
+  nextBuffered(0)
+{
+  socket.setReadBufferSize(64 * 1024 * 1024);
+
+  if (timeout > 0)
+    socket.setTimeout(timeout);
+
+  for (unsigned i = 0; i < batchSize; i ++) {
+    iovecs[i] = iovec { buffers[i].data(), maxDatagramSize };
+    messages[i].msg_hdr.msg_iov	   = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+
+bool UDPBlockReceiver::isValid(const UDPBlockStream::DatagramHeader &header, size_t payloadSize) const
+{
+  // every datagram but the last carries a full payload, of at most
+  // maxDatagramSize bytes, and every datagram carries at least one byte
+  // (an empty block is sent as one empty datagram)
+  const uint64_t maxPayloadSize = maxDatagramSize - sizeof(UDPBlockStream::DatagramHeader);
+
+  return header.blockSize <= maxBlockSize &&
+	 header.nrDatagrams <= std::max(header.blockSize, (uint64_t) 1) &&
+	 header.blockSize <= header.nrDatagrams * maxPayloadSize &&
+	 header.datagramIndex < header.nrDatagrams &&
+	 header.offset <= header.blockSize && payloadSize <= header.blockSize - header.offset && // without overflow
+	 (header.datagramIndex == header.nrDatagrams - 1 ? header.offset + payloadSize == header.blockSize : payloadSize > 0 && header.offset == header.datagramIndex * payloadSize);
+}
+
+
+void UDPBlockReceiver::giveUpOldestBlock()
+{
+  std::map<uint64_t, Assembly>::iterator oldest = assemblies.begin();
+
+  counts.nrIncompleteBlocks ++;
+  counts.nrLostDatagrams += oldest->second.nrDatagrams - oldest->second.nrReceived;
+  expiredSequence = std::max(expiredSequence, oldest->first + 1);
+  assemblies.erase(oldest);
+}
+
+
+bool UDPBlockReceiver::receive(std::vector<char> &block, uint64_t *blockSequence)
+{
+  for (;;) {
+    if (nextBuffered == nrBuffered) {
+      int nrReceived = recvmmsg(socket.fd, messages.data(), batchSize, MSG_WAITFORONE, nullptr);
+
+      if (nrReceived < 0) {
+	if (errno == EINTR)
+	  continue;
+	else if (errno == EAGAIN || errno == EWOULDBLOCK)
+	  return false; // timeout
+	else
+	  throw SystemCallException("recvmmsg", errno);
+      }
+
+      nrBuffered = nrReceived, nextBuffered = 0;
+    }
+
+    const char *datagram = buffers[nextBuffered].data();
+    size_t     size	 = messages[nextBuffered ++].msg_len;
+    UDPBlockStream::DatagramHeader header;
+
+    if (size < sizeof header)
+      continue;
+
+    memcpy(&header, datagram, sizeof header);
+    size -= sizeof header;
+
+    if (header.magic != UDPBlockStream::magic)
+      continue;
+
+    if (header.nrDatagrams == 0) { // end of stream
+      while (!assemblies.empty())
+	giveUpOldestBlock();
+
+      return false;
+    }
+
+    if (!isValid(header, size)) {
+      counts.nrInvalidDatagrams ++;
+      continue;
+    }
+
+    counts.nrDatagrams ++;
+
+    if (nextSequence == 0)
+      firstSequence = header.blockSequence;
+
+    nextSequence = std::max(nextSequence, header.blockSequence + 1);
+
+    // a late datagram of a block that was completed or given up
+    if (header.blockSequence < expiredSequence || completed.count(header.blockSequence) > 0)
+      continue;
+
+    std::map<uint64_t, Assembly>::iterator assembly = assemblies.find(header.blockSequence);
+
+    if (assembly == assemblies.end()) {
+      assembly = assemblies.emplace(header.blockSequence, Assembly { std::vector<char>(header.blockSize), std::vector<bool>(header.nrDatagrams), header.nrDatagrams, 0 }).first;
+
+      while (assemblies.size() > maxBlocksInFlight)
+	giveUpOldestBlock();
+
+      if ((assembly = assemblies.find(header.blockSequence)) == assemblies.end())
+	continue;
+    }
+
+    Assembly &current = assembly->second;
+
+    if (header.nrDatagrams != current.nrDatagrams || header.blockSize != current.data.size() || current.received[header.datagramIndex])
+      continue;
+
+    memcpy(&current.data[header.offset], datagram + sizeof header, size);
+    current.received[header.datagramIndex] = true;
+
+    if (++ current.nrReceived == current.nrDatagrams) {
+      block.swap(current.data);
+
+      if (blockSequence != nullptr)
+	*blockSequence = assembly->first;
+
+      completed.insert(assembly->first);
+
+      while (completed.size() > 64)
+	completed.erase(completed.begin());
+
+      assemblies.erase(assembly);
+      counts.nrBlocks ++;
+      return true;
+    }
+  }
+}
+
+
+UDPBlockReceiver::Statistics UDPBlockReceiver::statistics() const
+{
+  Statistics statistics = counts;
+  uint64_t   nrAccounted = counts.nrBlocks + counts.nrIncompleteBlocks + assemblies.size();
+
+  statistics.nrLostBlocks = nextSequence - firstSequence > nrAccounted ? nextSequence - firstSequence - nrAccounted : 0;
+  return statistics;
+}
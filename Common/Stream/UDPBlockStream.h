@@ -0,0 +1,131 @@
+#ifndef STREAM_UDP_BLOCK_STREAM_H
+#define STREAM_UDP_BLOCK_STREAM_H
+
+#include "Common/Stream/SocketStream.h"
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Sends blocks over UDP.  Every tryWritev() (so every writev() of at most
+// IOV_MAX pieces) is one block, which is split into datagrams of at most
+// datagramSize bytes (1472 for a 1500-byte MTU, up to 8972 for jumbo
+// frames).  Every datagram starts with a DatagramHeader, so that the
+// receiver can put its payload in place, whatever the order of arrival.
+//
+// Up to 64 datagrams are handed to the kernel as one message with UDP GSO
+// (UDP_SEGMENT), which segments them, and up to maxMessagesPerCall such
+// messages are passed per sendmmsg().  If the kernel does not support GSO,
+// every datagram is a message of its own.  With a rate (in bits/s), the
+// datagrams are paced: SO_MAX_PACING_RATE asks the fq qdisc to spread them,
+// and the sender sleeps between calls to keep the average rate.  If the
+// socket buffer is full, the sender waits in poll().
+//
+// The payload is sent from the caller's memory; only the headers are built.
+// A datagram with nrDatagrams == 0 marks the end of the stream.
+
+class UDPBlockStream : public SocketStream
+{
+  public:
+    struct DatagramHeader {
+      uint32_t magic;		// 0x3B98F0D0
+      uint32_t datagramIndex, nrDatagrams;
+      uint32_t pad;
+      uint64_t blockSequence, blockSize, offset; // of the payload in the block
+    };
+
+    static const uint32_t magic = 0x3B98F0D0;
+
+		   UDPBlockStream(const std::string &hostname, uint16_t port, unsigned datagramSize = 1472, double rate = 0, time_t deadline = 0);
+    virtual	   ~UDPBlockStream() noexcept(false);
+
+    virtual size_t tryWrite(const void *ptr, size_t size);
+    virtual size_t tryWritev(const iovec *, unsigned count);
+
+  private:
+    void	   send(mmsghdr *messages, unsigned count);
+    void	   pace(size_t nrBytes);
+
+    const unsigned datagramSize;
+    const double   rate;	// bits/s; 0: not paced
+    bool	   useGSO;
+    uint64_t	   nextBlockSequence;
+
+    std::vector<DatagramHeader> headers;   // [datagram]
+    std::vector<iovec>	   iovecs;
+    std::vector<size_t>	   starts;	   // [datagram + 1], the first iovec of a datagram
+    std::vector<mmsghdr>   messages;
+    std::vector<char>	   controls;	   // [message], UDP_SEGMENT control messages
+    std::chrono::steady_clock::time_point nextSendTime;
+
+    static const unsigned  maxSegmentsPerMessage = 64, maxMessagesPerCall = 32;
+};
+
+
+// Receives the blocks of a UDPBlockStream, and reassembles them.  Up to
+// maxBlocksInFlight blocks are assembled at the same time, so that reordered
+// datagrams of consecutive blocks are not lost; when a datagram of a newer
+// block arrives, the oldest incomplete block is given up, and counted as
+// lost.  At the end of the stream, the blocks that are still incomplete
+// (e.g., because the sender stopped in the middle of a block) are given up
+// as well.
+//
+// The headers come from the network, so they are checked before a block is
+// allocated: datagrams of blocks larger than maxBlockSize, with a datagram
+// count that does not match the block size, or with a payload outside the
+// block are dropped, and counted as invalid.
+
+class UDPBlockReceiver
+{
+  public:
+    struct Statistics {
+      uint64_t nrBlocks;	   // complete blocks
+      uint64_t nrIncompleteBlocks; // given up
+      uint64_t nrLostBlocks;	   // no datagram received
+      uint64_t nrDatagrams, nrLostDatagrams; // lost: of the incomplete blocks
+      uint64_t nrInvalidDatagrams; // dropped
+    };
+
+    // timeout in seconds; 0: wait forever
+    UDPBlockReceiver(const std::string &hostname, uint16_t port, double timeout = 0, unsigned maxBlocksInFlight = 4, size_t maxBlockSize = 1 << 30);
+
+    // returns false at the end of the stream, or if no datagram arrived
+    // within the timeout
+    bool	   receive(std::vector<char> &block, uint64_t *blockSequence = nullptr);
+
+    Statistics	   statistics() const;
+
+  private:
+    struct Assembly {
+      std::vector<char> data;
+      std::vector<bool> received; // [datagram]
+      uint32_t		nrDatagrams, nrReceived;
+    };
+
+    bool	   isValid(const UDPBlockStream::DatagramHeader &, size_t payloadSize) const;
+    void	   giveUpOldestBlock();
+
+    SocketStream   socket;
+    const unsigned maxBlocksInFlight;
+    const size_t   maxBlockSize;
+    std::map<uint64_t, Assembly> assemblies; // by block sequence
+    uint64_t	   firstSequence, nextSequence; // of the blocks seen; nextSequence == 0: none yet
+    uint64_t	   expiredSequence;		// datagrams of older blocks are ignored
+    std::set<uint64_t> completed;		// the last completed blocks
+    Statistics	   counts;
+
+    std::vector<std::vector<char>> buffers;   // [datagram]
+    std::vector<iovec>	   iovecs;
+    std::vector<mmsghdr>   messages;
+    unsigned	   nrBuffered, nextBuffered;
+
+    static const unsigned  batchSize = 64, maxDatagramSize = 65536;
+};
+
+#endif
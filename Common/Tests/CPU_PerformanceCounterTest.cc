@@ -0,0 +1,117 @@
+#include "Common/Config.h"
+
+#include "Common/CPU_PerformanceCounter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+// Feeds known times, from nanoseconds to seconds, through add(), and checks
+// that the percentiles of the log-linear histogram are within 1/32 of the
+// exact ones, and that the maximum is exact.  Then more threads than there
+// are shards add times concurrently, so that threads share shards; no time
+// may be lost.
+
+// the value below which the given fraction of the times is, with the rank
+// that CPU_PerformanceCounter uses
+static uint64_t exactPercentile(std::vector<uint64_t> times, double fraction)
+{
+  std::sort(times.begin(), times.end());
+  return times[std::max((uint64_t) 1, (uint64_t) std::ceil(fraction * times.size())) - 1];
+}
+
+
+static bool close(double measured, uint64_t exact)
+{
+  return std::abs(measured * 1e9 - exact) <= exact / 32.0 + .5;
+}
+
+
+static bool testPercentiles()
+{
+  CPU_PerformanceCounter counter("percentiles", true);
+  std::vector<uint64_t> times; // nanoseconds
+  std::mt19937_64 generator(17);
+  std::uniform_real_distribution<double> exponent(0, 30); // up to a second
+  uint64_t total = 0;
+
+  for (unsigned i = 0; i < 100000; i ++) {
+    uint64_t time = (uint64_t) std::exp2(exponent(generator));
+    times.push_back(time);
+    total += time;
+    counter.add(time * 1e-9);
+  }
+
+  CPU_PerformanceCounter::Summary summary = counter.summary();
+  bool ok = summary.nrTimes == times.size() && std::llround(summary.totalTime * 1e9) == (long long) total;
+
+  ok &= close(summary.p50, exactPercentile(times, .5));
+  ok &= close(summary.p99, exactPercentile(times, .99));
+  ok &= std::llround(summary.maxTime * 1e9) == (long long) *std::max_element(times.begin(), times.end());
+
+  // times below 32 ns have buckets of their own
+  CPU_PerformanceCounter small("small", true);
+
+  for (uint64_t time = 1; time <= 20; time ++)
+    small.add(time * 1e-9);
+
+  CPU_PerformanceCounter::Summary smallSummary = small.summary();
+  ok &= std::llround(smallSummary.p50 * 1e9) == 10 && std::llround(smallSummary.p99 * 1e9) == 20 && std::llround(smallSummary.maxTime * 1e9) == 20;
+
+  std::cout << "p50 " << summary.p50 * 1e9 << " ns (exact " << exactPercentile(times, .5) << "), p99 " << summary.p99 * 1e9 << " ns (exact " << exactPercentile(times, .99) << "), max " << summary.maxTime * 1e9 << " ns" << std::endl;
+  return ok;
+}
+
+
+static bool testSharedShards()
+{
+  const unsigned nrThreads = 100, nrTimesPerThread = 10000; // more threads than shards
+  CPU_PerformanceCounter counter("shared shards", true);
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> times;
+
+  for (unsigned thread = 0; thread < nrThreads; thread ++)
+    threads.emplace_back([&counter, thread] () {
+      for (unsigned i = 0; i < nrTimesPerThread; i ++)
+	counter.add((thread + 1) * 1000 * 1e-9);
+    });
+
+  for (std::thread &thread : threads)
+    thread.join();
+
+  for (unsigned thread = 0; thread < nrThreads; thread ++)
+    times.insert(times.end(), nrTimesPerThread, (thread + 1) * 1000);
+
+  CPU_PerformanceCounter::Summary summary = counter.summary();
+
+  return summary.nrTimes == (uint64_t) nrThreads * nrTimesPerThread &&
+	 std::llround(summary.totalTime * 1e9) == (long long) nrTimesPerThread * 1000 * nrThreads * (nrThreads + 1) / 2 &&
+	 close(summary.p50, exactPercentile(times, .5)) &&
+	 close(summary.p99, exactPercentile(times, .99)) &&
+	 std::llround(summary.maxTime * 1e9) == nrThreads * 1000;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running CPU_PerformanceCounterTest" << std::endl;
+
+    bool ok = testPercentiles() && testSharedShards();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,174 @@
+#include "Common/Config.h"
+
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/HardwareCounters.h"
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Enables the hardware counters and times some work with Measurements.  If
+// the events are available, the summary and the report of the counter must
+// include them.  Then the same is done in a thread for which a seccomp
+// filter makes perf_event_open(2) fail with EACCES, as it does if
+// /proc/sys/kernel/perf_event_paranoid forbids it: read() must return false,
+// and the report must be the one of a counter without hardware counters.
+
+struct Run {
+  CPU_PerformanceCounter::Summary summary;
+  std::string report; // printed at destruction of the counter
+};
+
+
+static Run measure(const char *name)
+{
+  const unsigned nrMeasurements = 100;
+  std::unique_ptr<CPU_PerformanceCounter> counter(new CPU_PerformanceCounter(name, true));
+  std::vector<double> data(1 << 16, 1);
+  volatile double sink;
+
+  for (unsigned i = 0; i < nrMeasurements; i ++) {
+    CPU_PerformanceCounter::Measurement measurement(*counter);
+    sink = std::accumulate(data.begin(), data.end(), 0.0);
+  }
+
+  (void) sink;
+
+  Run run;
+  std::ostringstream report;
+  std::streambuf *coutBuffer = std::cout.rdbuf(report.rdbuf());
+
+  run.summary = counter->summary();
+  counter.reset();
+  std::cout.rdbuf(coutBuffer);
+  run.report = report.str();
+  return run;
+}
+
+
+// the part of the report after the maximum time, where the events are
+static std::string eventsPart(const std::string &report)
+{
+  size_t max = report.find(", max ");
+
+  if (max == std::string::npos)
+    return report;
+
+  size_t unit = report.find(' ', max + 6);
+  return unit == std::string::npos ? "" : report.substr(report.find_first_of(",\n", unit));
+}
+
+
+static bool has(unsigned available, HardwareCounters::Event event)
+{
+  return (available & (1U << event)) != 0;
+}
+
+
+static bool testAvailable()
+{
+  HardwareCounters::enable();
+  HardwareCounters::Values values;
+
+  if (!HardwareCounters::read(values)) {
+    std::cout << "hardware counters not available; only testing refusal" << std::endl;
+    return true;
+  }
+
+  Run run = measure("available");
+  bool ok = run.summary.availableEvents == values.available;
+
+  if (has(values.available, HardwareCounters::Cycles))
+    ok &= run.summary.events[HardwareCounters::Cycles] > 0;
+
+  if (has(values.available, HardwareCounters::Instructions))
+    ok &= run.summary.events[HardwareCounters::Instructions] > 0;
+
+  if (has(values.available, HardwareCounters::Cycles) && has(values.available, HardwareCounters::Instructions))
+    ok &= run.report.find(", IPC ") != std::string::npos;
+
+  std::cout << "available: " << run.report << std::flush;
+  return ok;
+}
+
+
+static void refusePerfEvents()
+{
+  sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_perf_event_open, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EACCES),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+
+  sock_fprog program = { sizeof filter / sizeof *filter, filter };
+
+  // applies to the calling thread only
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0 || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) != 0)
+    throw std::runtime_error("cannot install seccomp filter");
+}
+
+
+static bool testRefused()
+{
+  bool ok = false;
+
+  // a new thread, as the events of a thread are opened at its first read
+  std::thread thread([&ok] () {
+    refusePerfEvents();
+
+    HardwareCounters::enable();
+    HardwareCounters::Values values;
+    ok = !HardwareCounters::read(values) && values.available == 0;
+
+    Run refused = measure("refused");
+
+    HardwareCounters::enable(false);
+    Run plain = measure("plain");
+
+    ok &= refused.summary.nrTimes == plain.summary.nrTimes && refused.summary.availableEvents == 0 && plain.summary.availableEvents == 0;
+
+    for (unsigned event = 0; event < HardwareCounters::nrEvents; event ++)
+      ok &= refused.summary.events[event] == 0;
+
+    ok &= eventsPart(refused.report) == eventsPart(plain.report) && eventsPart(plain.report) == "\n";
+
+    std::cout << "refused: " << refused.report << "plain:   " << plain.report << std::flush;
+  });
+
+  thread.join();
+  return ok;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running HardwareCountersTest" << std::endl;
+
+    bool ok = testAvailable() && testRefused();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,119 @@
+#include "Common/Config.h"
+
+#include "Common/Logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Messages that several threads log concurrently all appear, in the order of
+// each thread, with the values at the time of the call, also if their
+// arguments are too large to be deferred.  Messages below the minimum
+// severity are discarded, and a rate-limited statement writes one message
+// in a burst.
+
+struct Large { // does not fit in a record
+  Large(char c) { memset(text, c, sizeof text - 1); text[sizeof text - 1] = '\0'; }
+
+  char text[256];
+};
+
+
+static std::ostream &operator << (std::ostream &os, const Large &large)
+{
+  return os << large.text;
+}
+
+
+static bool testLogger()
+{
+  const unsigned nrThreads = 4, nrMessages = 100;
+  std::ostringstream log;
+  std::streambuf *clogBuffer;
+
+  Logger::flush();
+
+#pragma omp critical (clog)
+  clogBuffer = std::clog.rdbuf(log.rdbuf());
+
+  {
+    std::vector<std::thread> threads;
+
+    for (unsigned thread = 0; thread < nrThreads; thread ++)
+      threads.emplace_back([thread] {
+	std::string text = "message";
+
+	for (unsigned message = 0; message < nrMessages; message ++) {
+	  LOG(Logger::Info, "thread ", thread, ' ', text, ' ', message);
+	  text = "overwritten"; // the message has a copy
+	  text = "message";
+	}
+      });
+
+    for (std::thread &thread : threads)
+      thread.join();
+
+    LOG(Logger::Debug, "debug message");
+
+    for (unsigned message = 0; message < 10; message ++)
+      LOG_RATE_LIMITED(Logger::Warning, .001, "rate limited ", message);
+
+    Large large('x');
+    LOG(Logger::Info, "large ", 64, ' ', large, ' ', std::string(300, 'y'));
+    memset(large.text, 'z', 10);
+  }
+
+  Logger::flush();
+
+#pragma omp critical (clog)
+  std::clog.rdbuf(clogBuffer);
+
+  std::vector<unsigned> nextMessage(nrThreads, 0);
+  unsigned nrRateLimited = 0;
+  bool	   ok = true;
+
+  std::istringstream lines(log.str());
+
+  for (std::string line; std::getline(lines, line);) {
+    unsigned thread, message;
+    char     text[16];
+
+    if (sscanf(line.c_str(), "thread %u %15s %u", &thread, text, &message) == 3)
+      ok &= thread < nrThreads && strcmp(text, "message") == 0 && message == nextMessage[thread] ++;
+    else if (line.compare(0, 22, "Warning: rate limited ") == 0)
+      nrRateLimited ++;
+  }
+
+  for (unsigned thread = 0; thread < nrThreads; thread ++)
+    ok &= nextMessage[thread] == nrMessages;
+
+  return ok &&
+	 nrRateLimited == 1 &&
+	 log.str().find("large 64 " + std::string(255, 'x') + ' ' + std::string(300, 'y') + '\n') != std::string::npos &&
+	 log.str().find("debug message") == std::string::npos;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running LoggerTest" << std::endl;
+
+    bool ok = testLogger();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,137 @@
+#include "Common/Config.h"
+
+#include "Common/Metrics.h"
+#include "Common/Stream/SocketStream.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Several threads update a counter and a gauge concurrently.  The metrics
+// are read back through the HTTP endpoint of a Metrics::Exporter, and from
+// its JSON snapshot, which is written once more at destruction, with the
+// final values.  A client that does not read its response must not stall
+// the Exporter.
+
+static std::string get(uint16_t port, const std::string &path)
+{
+  SocketStream client("127.0.0.1", port, SocketStream::TCP, SocketStream::Client, time(0) + 5);
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n", response;
+  client.write(request.data(), request.size());
+
+  try {
+    for (char buffer[4096];;)
+      response.append(buffer, client.tryRead(buffer, sizeof buffer));
+  } catch (Stream::EndOfStreamException &) {
+  }
+
+  return response;
+}
+
+
+static bool testExporter()
+{
+  const unsigned nrThreads = 4, nrUpdates = 100000;
+  uint16_t port = 30000 + getpid() % 10000;
+  std::string snapshotFile = "/tmp/MetricsTest-" + std::to_string(getpid()) + ".json";
+
+  Metrics::Counter &counter = Metrics::counter("test_updates_total", {{ "kind", "counter" }}, "updates of the test");
+  Metrics::Gauge   &gauge   = Metrics::gauge("test_level", {}, "level of the test");
+  std::string response, notFound;
+
+  {
+    Metrics::Exporter exporter(port, snapshotFile, 10);
+    std::vector<std::thread> threads;
+
+    for (unsigned thread = 0; thread < nrThreads; thread ++)
+      threads.emplace_back([&] {
+	for (unsigned update = 0; update < nrUpdates; update ++)
+	  counter.add();
+      });
+
+    for (std::thread &thread : threads)
+      thread.join();
+
+    gauge.set(2.5);
+    response = get(port, "/metrics");
+    notFound = get(port, "/other");
+    counter.add(1); // after the first snapshot; appears in the last one
+  } // writes the last snapshot
+
+  std::ifstream file(snapshotFile);
+  std::string snapshot((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  unlink(snapshotFile.c_str());
+
+  return counter.value() == nrThreads * nrUpdates + 1 &&
+	 response.compare(0, 15, "HTTP/1.1 200 OK") == 0 &&
+	 response.find("# HELP test_updates_total updates of the test\n# TYPE test_updates_total counter\n") != std::string::npos &&
+	 response.find("test_updates_total{kind=\"counter\"} " + std::to_string(nrThreads * nrUpdates) + "\n") != std::string::npos &&
+	 response.find("# TYPE test_level gauge\ntest_level 2.5\n") != std::string::npos &&
+	 notFound.compare(0, 22, "HTTP/1.1 404 Not Found") == 0 &&
+	 snapshot.find("\"test_updates_total\": [\n      { \"labels\": { \"kind\": \"counter\" }, \"value\": " + std::to_string(nrThreads * nrUpdates + 1) + " }") != std::string::npos &&
+	 snapshot.find("\"test_level\": [\n      { \"labels\": {  }, \"value\": 2.5 }") != std::string::npos;
+}
+
+
+// a client that sends a request, but does not read the (large) response,
+// must not keep the destructor of the Exporter from returning
+
+static bool testStalledClient()
+{
+  uint16_t port = 30000 + (getpid() + 1) % 10000;
+
+  // enough metrics for a response that does not fit in the socket buffers
+  for (unsigned i = 0; i < 200000; i ++)
+    Metrics::counter("test_padding_total", {{ "index", std::to_string(i) }}, "metrics that make the response large");
+
+  std::chrono::steady_clock::time_point start;
+  double seconds;
+
+  {
+    std::unique_ptr<SocketStream> client;
+
+    {
+      Metrics::Exporter exporter(port, "", 10);
+      client.reset(new SocketStream("127.0.0.1", port, SocketStream::TCP, SocketStream::Client, time(0) + 5));
+      client->setReadBufferSize(4096);
+
+      std::string request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+      client->write(request.data(), request.size());
+      usleep(100000); // until the exporter is blocked in send()
+
+      start = std::chrono::steady_clock::now();
+    } // the client is still connected
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return seconds < 5;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running MetricsTest" << std::endl;
+
+    bool ok = testExporter() && testStalledClient();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,161 @@
+#include "Common/Config.h"
+
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/Tracer.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Events of one thread, of which the oldest ones are overwritten in its
+// ring, and events on a track of their own appear in the trace file.
+// Producer threads that keep adding events while the Session writes the
+// trace do not disturb it: the events of each thread are consecutive.
+
+static std::string readTrace(const std::string &traceFile)
+{
+  std::ifstream file(traceFile);
+  std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  unlink(traceFile.c_str());
+  return trace;
+}
+
+
+static bool wellFormed(const std::string &trace)
+{
+  return trace.compare(0, 43, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n") == 0 &&
+	 trace.size() >= 47 && trace.compare(trace.size() - 4, 4, "\n]}\n") == 0;
+}
+
+
+// the "seq" arguments of the events with the given name, by tid
+static std::map<int, std::vector<int64_t>> sequences(const std::string &trace, const std::string &name)
+{
+  std::map<int, std::vector<int64_t>> sequences;
+  std::string prefix = "{\"ph\": \"X\", \"name\": \"" + name + "\"";
+
+  for (size_t position = 0; (position = trace.find(prefix, position)) != std::string::npos; position ++) {
+    size_t tid = trace.find("\"tid\": ", position) + 7, seq = trace.find("{\"seq\": ", position) + 8;
+    sequences[atoi(trace.c_str() + tid)].push_back(atoll(trace.c_str() + seq));
+  }
+
+  return sequences;
+}
+
+
+static bool consecutive(const std::vector<int64_t> &sequence)
+{
+  for (size_t i = 1; i < sequence.size(); i ++)
+    if (sequence[i] != sequence[i - 1] + 1)
+      return false;
+
+  return true;
+}
+
+
+static bool testRing()
+{
+  const unsigned nrEvents = 2500, nrEventsPerThread = 1000;
+  std::string traceFile = "/tmp/TracerTest-" + std::to_string(getpid()) + ".json";
+
+  {
+    Tracer::Session session(traceFile, nrEventsPerThread);
+    Tracer::setThreadName("main");
+    int track = Tracer::newTrack("device");
+    uint64_t now = CPU_PerformanceCounter::now();
+
+    // is recorded in the ring of this thread, and overwritten
+    Tracer::complete("kernel", now, now + 1000, "seq", 0, track);
+
+    for (unsigned event = 0; event < nrEvents; event ++)
+      Tracer::Scope scope("step", "seq", event);
+
+    Tracer::complete("kernel", now, now + 1000, "seq", 1, track);
+  }
+
+  std::string trace = readTrace(traceFile);
+  std::map<int, std::vector<int64_t>> steps = sequences(trace, "step"), kernels = sequences(trace, "kernel");
+
+  return wellFormed(trace) &&
+	 trace.find("\"args\": {\"name\": \"main\"}") != std::string::npos &&
+	 trace.find("\"args\": {\"name\": \"device\"}") != std::string::npos &&
+	 steps.size() == 1 && steps.begin()->second.size() == nrEventsPerThread - 1 &&
+	 steps.begin()->second.front() == nrEvents - nrEventsPerThread + 1 && consecutive(steps.begin()->second) &&
+	 kernels.size() == 1 && kernels.begin()->first != steps.begin()->first &&
+	 kernels.begin()->second == std::vector<int64_t> { 1 };
+}
+
+
+static bool testConcurrentProducers()
+{
+  const unsigned nrThreads = 4, nrEventsPerThread = 256;
+  std::string traceFile = "/tmp/TracerTest-" + std::to_string(getpid()) + ".json";
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned> nrStarted(0);
+  std::vector<std::thread> threads;
+
+  {
+    Tracer::Session session(traceFile, nrEventsPerThread);
+
+    for (unsigned thread = 0; thread < nrThreads; thread ++)
+      threads.emplace_back([&, thread] {
+	Tracer::setThreadName("producer " + std::to_string(thread));
+
+	for (int64_t event = 0; !stop.load(std::memory_order_relaxed); event ++) {
+	  Tracer::Scope scope("step", "seq", event);
+
+	  if (event == 10 * nrEventsPerThread)
+	    nrStarted ++; // the rings have wrapped
+	}
+      });
+
+    while (nrStarted < nrThreads)
+      std::this_thread::yield();
+  } // writes the trace while the producers continue
+
+  stop = true;
+
+  for (std::thread &thread : threads)
+    thread.join();
+
+  std::string trace = readTrace(traceFile);
+  std::map<int, std::vector<int64_t>> steps = sequences(trace, "step");
+  bool ok = wellFormed(trace) && steps.size() == nrThreads;
+
+  for (const std::pair<const int, std::vector<int64_t>> &thread : steps)
+    ok &= thread.second.size() == nrEventsPerThread && consecutive(thread.second);
+
+  for (unsigned thread = 0; thread < nrThreads; thread ++)
+    ok &= trace.find("\"args\": {\"name\": \"producer " + std::to_string(thread) + "\"}") != std::string::npos;
+
+  return ok;
+}
+
+
+int main()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running TracerTest" << std::endl;
+
+    bool ok = testRing() && testConcurrentProducers();
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
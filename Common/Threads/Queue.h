@@ -23,13 +23,21 @@ template <typename T> class Queue
     mutable std::mutex	    mutex;
     std::condition_variable newElementAppended;
     std::list<T>	    queue;
+    std::list<T>	    freeNodes; // list nodes are recycled to avoid a heap allocation per append()
 };
 
 
 template <typename T> inline void Queue<T>::append(T &element)
 {
   std::lock_guard<std::mutex> lock(mutex);
-  queue.push_back(std::move(element));
+
+  if (freeNodes.empty()) {
+    queue.push_back(std::move(element));
+  } else {
+    freeNodes.front() = std::move(element);
+    queue.splice(queue.end(), freeNodes, freeNodes.begin());
+  }
+
   newElementAppended.notify_one();
 }
 
@@ -42,7 +50,7 @@ template <typename T> inline T Queue<T>::remove()
     newElementAppended.wait(lock);
 
   T element(std::move(queue.front()));
-  queue.pop_front();
+  freeNodes.splice(freeNodes.begin(), queue, queue.begin());
 
   return element;
 }
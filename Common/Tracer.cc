@@ -0,0 +1,227 @@
+#include "Common/Config.h"
+
+#include "Common/Tracer.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+
+std::atomic<bool> Tracer::isEnabled(false);
+
+
+struct Tracer::Buffer {
+  Buffer(size_t nrEvents) : events(nrEvents), nrEvents(0), busy(false), tid(syscall(SYS_gettid)) {}
+
+  std::vector<Event>	events; // a ring
+  std::atomic<uint64_t> nrEvents;
+  std::atomic<bool>	busy;	// while the thread writes an event
+  const int		tid;
+  std::string		threadName;
+};
+
+
+struct Tracer::State {
+  State() : generation(0), nrEventsPerThread(0), nextTrack(1 << 30) {}
+
+  std::mutex		   mutex;
+  std::atomic<unsigned>	   generation;	// of the buffers; incremented by every Session
+  size_t		   nrEventsPerThread;
+  std::vector<std::unique_ptr<Buffer>> buffers, retiredBuffers;
+  std::map<int, std::string> trackNames;
+  int			   nextTrack;	// beyond the thread IDs
+};
+
+
+Tracer::State &Tracer::state()
+{
+  static State state;
+  return state;
+}
+
+
+Tracer::Buffer *Tracer::myBuffer()
+{
+  thread_local Buffer	*buffer	    = nullptr;
+  thread_local unsigned generation = 0;
+
+  if (buffer == nullptr || generation != state().generation.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+
+    state().buffers.emplace_back(buffer = new Buffer(state().nrEventsPerThread));
+    generation = state().generation.load(std::memory_order_relaxed);
+  }
+
+  return buffer;
+}
+
+
+void Tracer::complete(const char *name, uint64_t startTicks, uint64_t stopTicks, const char *argName, int64_t arg, int track)
+{
+  if (enabled()) {
+    Buffer *buffer = myBuffer();
+
+    // the write is announced before the Session is checked again (both
+    // sequentially consistent), so that a Session that stops either waits
+    // for the write, or is seen to have stopped
+    buffer->busy.store(true);
+
+    if (isEnabled.load()) {
+      uint64_t index = buffer->nrEvents.load(std::memory_order_relaxed);
+
+      buffer->events[index % buffer->events.size()] = Event { name, argName, arg, startTicks, stopTicks, track };
+      buffer->nrEvents.store(index + 1, std::memory_order_release);
+    }
+
+    buffer->busy.store(false, std::memory_order_release);
+  }
+}
+
+
+void Tracer::setThreadName(const std::string &name)
+{
+  if (enabled()) {
+    Buffer *buffer = myBuffer();
+    std::lock_guard<std::mutex> lock(state().mutex);
+
+    buffer->threadName = name;
+  }
+}
+
+
+int Tracer::newTrack(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(state().mutex);
+
+  state().trackNames[state().nextTrack] = name;
+  return state().nextTrack ++;
+}
+
+
+Tracer::Session::Session(const std::string &fileName, size_t nrEventsPerThread)
+:
+  fileName(fileName)
+{
+  if (fileName != "") {
+    if (enabled())
+      throw std::runtime_error("only one trace session can be active");
+
+    {
+      // buffers of an earlier session may still be referenced by their
+      // threads, so they are not freed
+      std::lock_guard<std::mutex> lock(state().mutex);
+
+      for (std::unique_ptr<Buffer> &buffer : state().buffers)
+	state().retiredBuffers.push_back(std::move(buffer));
+
+      state().buffers.clear();
+      state().nrEventsPerThread = nrEventsPerThread;
+      state().generation ++;
+    }
+
+    startTicks = CPU_PerformanceCounter::now();
+    isEnabled.store(true, std::memory_order_release);
+  }
+}
+
+
+Tracer::Session::~Session()
+{
+  if (fileName != "") {
+    isEnabled.store(false);
+
+    try {
+      write();
+    } catch (std::exception &ex) {
+#pragma omp critical (cerr)
+      std::cerr << "could not write trace " << fileName << ": " << ex.what() << std::endl;
+    }
+  }
+}
+
+
+static void writeString(std::ostream &os, const char *string)
+{
+  os << '"';
+
+  for (; *string != '\0'; string ++)
+    if (*string == '"' || *string == '\\')
+      os << '\\' << *string;
+    else if ((unsigned char) *string >= ' ')
+      os << *string;
+
+  os << '"';
+}
+
+
+void Tracer::Session::write() const
+{
+  std::ofstream file(fileName);
+
+  if (!file)
+    throw std::runtime_error("cannot open file");
+
+  std::lock_guard<std::mutex> lock(state().mutex);
+  const int  pid       = getpid();
+  const char *separator = "\n";
+
+  // threads that still write an event (e.g., CUDA callback threads) finish
+  // it; after that, no thread writes to the buffers
+  for (const std::unique_ptr<Buffer> &buffer : state().buffers)
+    while (buffer->busy.load())
+      std::this_thread::yield();
+
+  file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+  auto writeName = [&] (int tid, const std::string &name) {
+    file << separator << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pid << ", \"tid\": " << tid << ", \"args\": {\"name\": ";
+    writeString(file, name.c_str());
+    file << "}}";
+    separator = ",\n";
+  };
+
+  for (const std::pair<const int, std::string> &track : state().trackNames)
+    writeName(track.first, track.second);
+
+  for (const std::unique_ptr<Buffer> &buffer : state().buffers) {
+    if (buffer->threadName != "")
+      writeName(buffer->tid, buffer->threadName);
+
+    uint64_t nrEvents = buffer->nrEvents.load(std::memory_order_acquire);
+
+    for (uint64_t index = nrEvents > buffer->events.size() ? nrEvents - buffer->events.size() : 0; index < nrEvents; index ++) {
+      const Event &event = buffer->events[index % buffer->events.size()];
+
+      if (event.startTicks < startTicks || event.stopTicks < event.startTicks)
+	continue;
+
+      file << separator << "{\"ph\": \"X\", \"name\": ";
+      writeString(file, event.name);
+      file << ", \"pid\": " << pid << ", \"tid\": " << (event.track >= 0 ? event.track : buffer->tid)
+	   << ", \"ts\": " << CPU_PerformanceCounter::ticksToSeconds(event.startTicks - startTicks) * 1e6
+	   << ", \"dur\": " << CPU_PerformanceCounter::ticksToSeconds(event.stopTicks - event.startTicks) * 1e6;
+
+      if (event.argName != nullptr) {
+	file << ", \"args\": {";
+	writeString(file, event.argName);
+	file << ": " << event.arg << '}';
+      }
+
+      file << '}';
+      separator = ",\n";
+    }
+  }
+
+  file << "\n]}\n";
+
+  if (!file)
+    throw std::runtime_error("write error");
+}
@@ -0,0 +1,91 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "Common/CPU_PerformanceCounter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Records a timeline of the pipeline stages, and writes it as Chrome
+// trace-event JSON (chrome://tracing, https://ui.perfetto.dev).  While a
+// Session exists, a Scope records a complete event (begin and end time)
+// into a buffer of the calling thread, which is written only by that
+// thread, without locks.  A buffer keeps the last nrEventsPerThread events;
+// at destruction, the Session stops recording, waits for the events that
+// are still being written, and writes all buffers.  Without a Session, a
+// Scope costs one relaxed load.
+//
+// Event and argument names are not copied; they must outlive the Session
+// (string literals, or names of objects that live longer).  Events that are
+// not measured on a host thread (e.g., GPU work) can be put on a track of
+// their own.
+
+class Tracer
+{
+  public:
+    class Scope {
+      public:
+	Scope(const char *name, const char *argName = nullptr, int64_t arg = 0)
+	:
+	  name(name), argName(argName), arg(arg), start(enabled() ? CPU_PerformanceCounter::now() : 0)
+	{
+	}
+
+	~Scope()
+	{
+	  if (start != 0)
+	    complete(name, start, CPU_PerformanceCounter::now(), argName, arg);
+	}
+
+      private:
+	const char     *name, *argName;
+	const int64_t  arg;
+	const uint64_t start;
+    };
+
+    class Session {
+      public:
+	// does nothing if fileName is empty
+	Session(const std::string &fileName, size_t nrEventsPerThread = 65536);
+	~Session();
+
+      private:
+	void		  write() const;
+
+	const std::string fileName;
+	uint64_t	  startTicks;
+    };
+
+    static bool enabled() { return isEnabled.load(std::memory_order_relaxed); }
+
+    // times are in CPU_PerformanceCounter::now() ticks; track >= 0 puts the
+    // event on that track instead of on the track of the calling thread
+    static void complete(const char *name, uint64_t startTicks, uint64_t stopTicks, const char *argName = nullptr, int64_t arg = 0, int track = -1);
+
+    // names the track of the calling thread
+    static void setThreadName(const std::string &);
+
+    // returns a new track with the given name
+    static int	newTrack(const std::string &name);
+
+  private:
+    struct Event {
+      const char *name, *argName;
+      int64_t	 arg;
+      uint64_t	 startTicks, stopTicks;
+      int	 track;
+    };
+
+    struct Buffer;
+    struct State;
+
+    static Buffer	       *myBuffer();
+    static State	       &state();
+
+    static std::atomic<bool>   isEnabled;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include "Common/Config.h"
+
+#include "Common/UncachedMemory.h"
+
+#if defined __AVX__
+#include <immintrin.h>
+#endif
+
+#include <cstddef>
+#include <cstring>
+
+
+void uncached_memcpy(void *__restrict dst, const void *__restrict src, size_t size)
+{
+#if defined __AVX__
+  size_t done = 0;
+
+#if 0
+  // size should be multiple of 2
+
+  while (done < size && ((ptrdiff_t) ((char *) dst + done) & 0x1F) != 0) {
+    * (short *) ((char *) dst + done) = * (short *) ((const char *) src + done);
+    done += sizeof(short);
+  }
+#endif
+
+  while (done + sizeof(__m256i) <= size) {
+    _mm256_stream_si256((__m256i *) ((char *) dst + done), _mm256_loadu_si256((const __m256i *) ((const char *) src + done)));
+    done += sizeof(__m256i);
+  }
+
+#if 0
+  while (done < size) {
+    * (short *) ((char *) dst + done) = * (short *) ((const char *) src + done);
+    done += sizeof(short);
+  }
+#endif
+#else
+  memcpy(dst, src, size);
+#endif
+}
+
+
+void uncached_memclear(void *dst, size_t size)
+{
+#if defined __AVX__
+  size_t done = 0;
+
+#if 0
+  // size should be multiple of sizeof(int)
+
+  while (done < size && ((ptrdiff_t) ((char *) dst + done) & 0x1F) != 0) {
+    * (int *) ((char *) dst + done) = 0;
+    done += sizeof(int);
+  }
+#endif
+
+  while (done + sizeof(__m256i) <= size) {
+    _mm256_stream_si256((__m256i *) ((char *) dst + done), _mm256_setzero_si256());
+    done += sizeof(__m256i);
+  }
+
+#if 0
+  while (done < size) {
+    * (int *) ((char *) dst + done) = 0;
+    done += sizeof(int);
+  }
+#endif
+#else
+  memset(dst, 0, size);
+#endif
+}
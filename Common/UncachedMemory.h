@@ -0,0 +1,15 @@
+#ifndef COMMON_UNCACHED_MEMORY_H
+#define COMMON_UNCACHED_MEMORY_H
+
+#include <cstddef>
+
+
+// Copy and clear with non-temporal (streaming) stores, so that data that is
+// not read again soon, like the input ring buffer, does not evict the
+// caches.  With AVX, only whole 32-byte words are written, and dst must be
+// 32-byte aligned; otherwise, these are memcpy() and memset().
+
+void uncached_memcpy(void *__restrict dst, const void *__restrict src, size_t size);
+void uncached_memclear(void *dst, size_t size);
+
+#endif
@@ -0,0 +1,431 @@
+#include "Common/Config.h"
+
+#include "Correlator/CPU_Correlator.h"
+
+#include <omp.h>
+
+#if defined __AVX2__ || defined __AVX512F__ || defined __F16C__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+
+
+namespace {
+
+// Minimal SIMD abstractions, so that the tile kernels are written only once.
+
+#if defined __AVX512F__
+struct FloatVector
+{
+  typedef __m512 type;
+  static const unsigned width = 16;
+
+  static type  zero() { return _mm512_setzero_ps(); }
+  static type  load(const float *ptr) { return _mm512_load_ps(ptr); }
+  static type  fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+  static type  fnmadd(type a, type b, type c) { return _mm512_fnmadd_ps(a, b, c); }
+  static float sum(type a) { return _mm512_reduce_add_ps(a); }
+};
+#elif defined __AVX2__ && defined __FMA__
+struct FloatVector
+{
+  typedef __m256 type;
+  static const unsigned width = 8;
+
+  static type  zero() { return _mm256_setzero_ps(); }
+  static type  load(const float *ptr) { return _mm256_load_ps(ptr); }
+  static type  fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+  static type  fnmadd(type a, type b, type c) { return _mm256_fnmadd_ps(a, b, c); }
+
+  static float sum(type a)
+  {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+  }
+};
+#else
+struct FloatVector
+{
+  typedef float type;
+  static const unsigned width = 1;
+
+  static type  zero() { return 0; }
+  static type  load(const float *ptr) { return *ptr; }
+  static type  fmadd(type a, type b, type c) { return a * b + c; }
+  static type  fnmadd(type a, type b, type c) { return c - a * b; }
+  static float sum(type a) { return a; }
+};
+#endif
+
+
+// A 32-bit lane holds an (int16, int16) pair; dot() adds the products of
+// the low and the high halves to the accumulator.
+
+#if defined __AVX512BW__
+struct IntVector
+{
+  typedef __m512i type;
+  static const unsigned width = 16;
+
+  static type    zero() { return _mm512_setzero_si512(); }
+  static type    load(const int32_t *ptr) { return _mm512_load_si512(ptr); }
+#if defined __AVX512VNNI__
+  static type    dot(type acc, type a, type b) { return _mm512_dpwssd_epi32(acc, a, b); }
+#else
+  static type    dot(type acc, type a, type b) { return _mm512_add_epi32(acc, _mm512_madd_epi16(a, b)); }
+#endif
+  static int32_t sum(type a) { return _mm512_reduce_add_epi32(a); }
+};
+#elif defined __AVX2__
+struct IntVector
+{
+  typedef __m256i type;
+  static const unsigned width = 8;
+
+  static type    zero() { return _mm256_setzero_si256(); }
+  static type    load(const int32_t *ptr) { return _mm256_load_si256(reinterpret_cast<const __m256i *>(ptr)); }
+#if defined __AVXVNNI__
+  static type    dot(type acc, type a, type b) { return _mm256_dpwssd_avx_epi32(acc, a, b); }
+#else
+  static type    dot(type acc, type a, type b) { return _mm256_add_epi32(acc, _mm256_madd_epi16(a, b)); }
+#endif
+
+  static int32_t sum(type a)
+  {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtsi128_si32(_mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1))));
+  }
+};
+#else
+struct IntVector
+{
+  typedef int32_t type;
+  static const unsigned width = 1;
+
+  static type    zero() { return 0; }
+  static type    load(const int32_t *ptr) { return *ptr; }
+  static type    dot(type acc, type a, type b) { return acc + (int16_t) a * (int16_t) b + (a >> 16) * (b >> 16); }
+  static int32_t sum(type a) { return a; }
+};
+#endif
+
+
+const unsigned paddingAlignment = 16; // times; also keeps vector loads 64-byte aligned
+
+
+inline int32_t pack(int re, int im)
+{
+  return (int32_t) ((uint32_t) (uint16_t) re | (uint32_t) (uint16_t) im << 16);
+}
+
+
+inline float halfToFloat(uint16_t half)
+{
+#if defined __F16C__
+  return _cvtsh_ss(half);
+#else
+  int   exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+  float value = exponent == 0 ? std::ldexp((float) mantissa, -24) : exponent == 31 ? (mantissa == 0 ? INFINITY : NAN) : std::ldexp((float) (mantissa | 0x400), exponent - 25);
+
+  return half & 0x8000 ? -value : value;
+#endif
+}
+
+
+template <unsigned nrPolarizations, unsigned nrReceiversA, typename T> inline void storeVisibilities(std::complex<float> *visibilities, unsigned stationA, unsigned stationB, const T sums[nrReceiversA][nrPolarizations][COMPLEX])
+{
+  for (unsigned a = 0; a < nrReceiversA; a ++) {
+    unsigned station0 = stationA + a / nrPolarizations, pol0 = a % nrPolarizations;
+    unsigned baseline = station0 * (station0 + 1) / 2 + stationB;
+
+    for (unsigned pol1 = 0; pol1 < nrPolarizations; pol1 ++)
+      visibilities[(baseline * nrPolarizations + pol0) * nrPolarizations + pol1] += std::complex<float>(sums[a][pol1][REAL], sums[a][pol1][IMAG]);
+  }
+}
+
+
+// scratch layout: [receiver][REAL/IMAG][nrPaddedTimes]
+
+template <unsigned nrPolarizations> struct FloatTileKernel
+{
+  template <unsigned nrStationsA> void tile(unsigned stationA, unsigned stationB) const
+  {
+    const unsigned nrReceiversA = nrStationsA * nrPolarizations, nrReceiversB = nrPolarizations;
+    const float	   *a = scratch + (size_t) stationA * nrPolarizations * COMPLEX * nrPaddedTimes;
+    const float	   *b = scratch + (size_t) stationB * nrPolarizations * COMPLEX * nrPaddedTimes;
+
+    typename FloatVector::type real[nrReceiversA][nrReceiversB], imag[nrReceiversA][nrReceiversB];
+
+    for (unsigned i = 0; i < nrReceiversA; i ++)
+      for (unsigned j = 0; j < nrReceiversB; j ++)
+	real[i][j] = imag[i][j] = FloatVector::zero();
+
+    for (unsigned time = firstTime; time < lastTime; time += FloatVector::width) {
+      typename FloatVector::type bReal[nrReceiversB], bImag[nrReceiversB];
+
+      for (unsigned j = 0; j < nrReceiversB; j ++) {
+	bReal[j] = FloatVector::load(b + (j * COMPLEX + REAL) * nrPaddedTimes + time);
+	bImag[j] = FloatVector::load(b + (j * COMPLEX + IMAG) * nrPaddedTimes + time);
+      }
+
+      for (unsigned i = 0; i < nrReceiversA; i ++) {
+	typename FloatVector::type aReal = FloatVector::load(a + (i * COMPLEX + REAL) * nrPaddedTimes + time);
+	typename FloatVector::type aImag = FloatVector::load(a + (i * COMPLEX + IMAG) * nrPaddedTimes + time);
+
+	for (unsigned j = 0; j < nrReceiversB; j ++) {
+	  real[i][j] = FloatVector::fmadd(aReal, bReal[j], real[i][j]);
+	  real[i][j] = FloatVector::fmadd(aImag, bImag[j], real[i][j]);
+	  imag[i][j] = FloatVector::fmadd(aImag, bReal[j], imag[i][j]);
+	  imag[i][j] = FloatVector::fnmadd(aReal, bImag[j], imag[i][j]);
+	}
+      }
+    }
+
+    float sums[nrReceiversA][nrReceiversB][COMPLEX];
+
+    for (unsigned i = 0; i < nrReceiversA; i ++)
+      for (unsigned j = 0; j < nrReceiversB; j ++) {
+	sums[i][j][REAL] = FloatVector::sum(real[i][j]);
+	sums[i][j][IMAG] = FloatVector::sum(imag[i][j]);
+      }
+
+    storeVisibilities<nrPolarizations, nrReceiversA>(visibilities, stationA, stationB, sums);
+  }
+
+  const float	      *scratch;
+  unsigned	      nrPaddedTimes, firstTime, lastTime;
+  std::complex<float> *visibilities;
+};
+
+
+// scratch layout: [receiver][2][nrPaddedTimes], with (re, im) pairs first
+// and (-im, re) pairs second, so that
+// dot(a(re, im), b(re, im)) = Re(a * conj(b)) and
+// dot(a(re, im), b(-im, re)) = Im(a * conj(b))
+
+template <unsigned nrPolarizations> struct IntTileKernel
+{
+  template <unsigned nrStationsA> void tile(unsigned stationA, unsigned stationB) const
+  {
+    const unsigned nrReceiversA = nrStationsA * nrPolarizations, nrReceiversB = nrPolarizations;
+    const int32_t  *a = scratch + (size_t) stationA * nrPolarizations * 2 * nrPaddedTimes;
+    const int32_t  *b = scratch + (size_t) stationB * nrPolarizations * 2 * nrPaddedTimes;
+
+    typename IntVector::type real[nrReceiversA][nrReceiversB], imag[nrReceiversA][nrReceiversB];
+
+    for (unsigned i = 0; i < nrReceiversA; i ++)
+      for (unsigned j = 0; j < nrReceiversB; j ++)
+	real[i][j] = imag[i][j] = IntVector::zero();
+
+    for (unsigned time = firstTime; time < lastTime; time += IntVector::width) {
+      typename IntVector::type bPairs[nrReceiversB], bRotated[nrReceiversB];
+
+      for (unsigned j = 0; j < nrReceiversB; j ++) {
+	bPairs[j]   = IntVector::load(b + (j * 2 + 0) * nrPaddedTimes + time);
+	bRotated[j] = IntVector::load(b + (j * 2 + 1) * nrPaddedTimes + time);
+      }
+
+      for (unsigned i = 0; i < nrReceiversA; i ++) {
+	typename IntVector::type aPairs = IntVector::load(a + i * 2 * nrPaddedTimes + time);
+
+	for (unsigned j = 0; j < nrReceiversB; j ++) {
+	  real[i][j] = IntVector::dot(real[i][j], aPairs, bPairs[j]);
+	  imag[i][j] = IntVector::dot(imag[i][j], aPairs, bRotated[j]);
+	}
+      }
+    }
+
+    int32_t sums[nrReceiversA][nrReceiversB][COMPLEX];
+
+    for (unsigned i = 0; i < nrReceiversA; i ++)
+      for (unsigned j = 0; j < nrReceiversB; j ++) {
+	sums[i][j][REAL] = IntVector::sum(real[i][j]);
+	sums[i][j][IMAG] = IntVector::sum(imag[i][j]);
+      }
+
+    storeVisibilities<nrPolarizations, nrReceiversA>(visibilities, stationA, stationB, sums);
+  }
+
+  const int32_t	      *scratch;
+  unsigned	      nrPaddedTimes, firstTime, lastTime;
+  std::complex<float> *visibilities;
+};
+
+
+// Visits all baselines, mostly with tiles of two stations (A) by one
+// station (B), where both stations of A are not smaller than B.  The time
+// axis is processed in blocks, so that the samples of A stay in the L1
+// cache while B runs over the other stations.
+
+const unsigned nrTimesPerTimeBlock = 512;
+
+
+template <typename Kernel> void correlateTriangle(const Kernel &kernel, unsigned nrStations)
+{
+  unsigned stationA = 0;
+
+  for (; stationA + 2 <= nrStations; stationA += 2) {
+    for (unsigned stationB = 0; stationB <= stationA; stationB ++)
+      kernel.template tile<2>(stationA, stationB);
+
+    kernel.template tile<1>(stationA + 1, stationA + 1);
+  }
+
+  if (stationA < nrStations)
+    for (unsigned stationB = 0; stationB <= stationA; stationB ++)
+      kernel.template tile<1>(stationA, stationB);
+}
+
+}
+
+
+CPU_Correlator::CPU_Correlator(const CorrelatorParset &ps, InputFormat inputFormat)
+:
+  nrStations(ps.nrStations()),
+  nrPolarizations(ps.nrPolarizations()),
+  nrReceivers(ps.nrStations() * ps.nrPolarizations()),
+  nrOutputChannels(ps.nrOutputChannelsPerSubband()),
+  channelIntegrationFactor(ps.channelIntegrationFactor()),
+  nrSamplesPerChannel(ps.nrSamplesPerChannel()),
+  nrTimes(ps.nrSamplesPerChannel() * ps.channelIntegrationFactor()),
+  nrPaddedTimes((nrTimes + paddingAlignment - 1) / paddingAlignment * paddingAlignment),
+  inputFormat(inputFormat)
+{
+  if (ps.correlationMode() != 15)
+    throw Parset::Error("the CPU correlator currently only supports correlator mode 15");
+
+  if (nrPolarizations != 1 && nrPolarizations != 2)
+    throw Parset::Error("the CPU correlator supports 1 or 2 polarizations");
+
+  if (nrSamplesPerChannel % nrTimesPerBlock() != 0)
+    throw Parset::Error("nrSamplesPerChannel must be a multiple of " + std::to_string(nrTimesPerBlock()));
+
+  size_t scratchSize = (size_t) nrReceivers * 2 * nrPaddedTimes * sizeof(float);
+
+  for (int thread = 0, nrThreads = omp_get_max_threads(); thread < nrThreads; thread ++) {
+    void *ptr = aligned_alloc(64, scratchSize);
+
+    if (ptr == nullptr)
+      throw std::bad_alloc();
+
+    memset(ptr, 0, scratchSize); // the padding stays zero
+    scratch.emplace_back(ptr, free);
+  }
+}
+
+
+size_t CPU_Correlator::nrOperations() const
+{
+  return (size_t) 8 * nrStations * (nrStations + 1) / 2 * nrPolarizations * nrPolarizations * nrTimes * nrOutputChannels;
+}
+
+
+template <typename SampleType> void CPU_Correlator::transposeFloat(float *scratch, const SampleType *samples, unsigned outputChannel) const
+{
+  const unsigned T = nrTimesPerBlock();
+
+  for (unsigned subChannel = 0; subChannel < channelIntegrationFactor; subChannel ++) {
+    const SampleType *channel = samples + (size_t) (outputChannel * channelIntegrationFactor + subChannel) * nrSamplesPerChannel * nrReceivers * COMPLEX;
+
+    for (unsigned major = 0; major < nrSamplesPerChannel / T; major ++)
+      for (unsigned receiver = 0; receiver < nrReceivers; receiver ++) {
+	const SampleType *in  = channel + ((size_t) major * nrReceivers + receiver) * T * COMPLEX;
+	float		 *out = scratch + (size_t) receiver * COMPLEX * nrPaddedTimes + subChannel * nrSamplesPerChannel + major * T;
+
+	for (unsigned minor = 0; minor < T; minor ++) {
+	  if constexpr (std::is_same<SampleType, uint16_t>::value) {
+	    out[REAL * nrPaddedTimes + minor] = halfToFloat(in[minor * COMPLEX + REAL]);
+	    out[IMAG * nrPaddedTimes + minor] = halfToFloat(in[minor * COMPLEX + IMAG]);
+	  } else {
+	    out[REAL * nrPaddedTimes + minor] = in[minor * COMPLEX + REAL];
+	    out[IMAG * nrPaddedTimes + minor] = in[minor * COMPLEX + IMAG];
+	  }
+	}
+      }
+  }
+}
+
+
+void CPU_Correlator::transposeInt(int32_t *scratch, const int8_t *samples, unsigned outputChannel) const
+{
+  const unsigned T = nrTimesPerBlock();
+
+  for (unsigned subChannel = 0; subChannel < channelIntegrationFactor; subChannel ++) {
+    const int8_t *channel = samples + (size_t) (outputChannel * channelIntegrationFactor + subChannel) * nrSamplesPerChannel * nrReceivers * COMPLEX;
+
+    for (unsigned major = 0; major < nrSamplesPerChannel / T; major ++)
+      for (unsigned receiver = 0; receiver < nrReceivers; receiver ++) {
+	const int8_t *in  = channel + ((size_t) major * nrReceivers + receiver) * T * COMPLEX;
+	int32_t	     *out = scratch + (size_t) receiver * 2 * nrPaddedTimes + subChannel * nrSamplesPerChannel + major * T;
+
+	for (unsigned minor = 0; minor < T; minor ++) {
+	  int re = in[minor * COMPLEX + REAL], im = in[minor * COMPLEX + IMAG];
+
+	  out[minor] = pack(re, im);
+	  out[nrPaddedTimes + minor] = pack(-im, re);
+	}
+      }
+  }
+}
+
+
+void CPU_Correlator::correlateFloat(std::complex<float> *visibilities, const float *scratch, unsigned outputChannel) const
+{
+  size_t	      nrVisibilities = (size_t) nrStations * (nrStations + 1) / 2 * nrPolarizations * nrPolarizations;
+  std::complex<float> *channelVisibilities = visibilities + outputChannel * nrVisibilities;
+
+  std::fill_n(channelVisibilities, nrVisibilities, 0);
+
+  for (unsigned firstTime = 0; firstTime < nrPaddedTimes; firstTime += nrTimesPerTimeBlock)
+    if (nrPolarizations == 2)
+      correlateTriangle(FloatTileKernel<2> { scratch, nrPaddedTimes, firstTime, std::min(firstTime + nrTimesPerTimeBlock, nrPaddedTimes), channelVisibilities }, nrStations);
+    else
+      correlateTriangle(FloatTileKernel<1> { scratch, nrPaddedTimes, firstTime, std::min(firstTime + nrTimesPerTimeBlock, nrPaddedTimes), channelVisibilities }, nrStations);
+}
+
+
+void CPU_Correlator::correlateInt(std::complex<float> *visibilities, const int32_t *scratch, unsigned outputChannel) const
+{
+  size_t	      nrVisibilities = (size_t) nrStations * (nrStations + 1) / 2 * nrPolarizations * nrPolarizations;
+  std::complex<float> *channelVisibilities = visibilities + outputChannel * nrVisibilities;
+
+  std::fill_n(channelVisibilities, nrVisibilities, 0);
+
+  for (unsigned firstTime = 0; firstTime < nrPaddedTimes; firstTime += nrTimesPerTimeBlock)
+    if (nrPolarizations == 2)
+      correlateTriangle(IntTileKernel<2> { scratch, nrPaddedTimes, firstTime, std::min(firstTime + nrTimesPerTimeBlock, nrPaddedTimes), channelVisibilities }, nrStations);
+    else
+      correlateTriangle(IntTileKernel<1> { scratch, nrPaddedTimes, firstTime, std::min(firstTime + nrTimesPerTimeBlock, nrPaddedTimes), channelVisibilities }, nrStations);
+}
+
+
+void CPU_Correlator::launch(std::complex<float> *visibilities, const void *samples)
+{
+#pragma omp parallel for schedule(dynamic) num_threads(scratch.size())
+  for (unsigned outputChannel = 0; outputChannel < nrOutputChannels; outputChannel ++) {
+    void *threadScratch = scratch[omp_get_thread_num()].get();
+
+    switch (inputFormat) {
+      case fp32 : transposeFloat(static_cast<float *>(threadScratch), static_cast<const float *>(samples), outputChannel);
+		  correlateFloat(visibilities, static_cast<float *>(threadScratch), outputChannel);
+		  break;
+
+      case fp16 : transposeFloat(static_cast<float *>(threadScratch), static_cast<const uint16_t *>(samples), outputChannel);
+		  correlateFloat(visibilities, static_cast<float *>(threadScratch), outputChannel);
+		  break;
+
+      case i8	: transposeInt(static_cast<int32_t *>(threadScratch), static_cast<const int8_t *>(samples), outputChannel);
+		  correlateInt(visibilities, static_cast<int32_t *>(threadScratch), outputChannel);
+		  break;
+    }
+  }
+}
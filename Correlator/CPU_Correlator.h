@@ -0,0 +1,58 @@
+#if !defined CPU_CORRELATOR_H
+#define CPU_CORRELATOR_H
+
+#include "Correlator/Parset.h"
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+
+// CPU version of the Tensor-Core Correlator.  It reads the same input
+// ([channel][time / T][station][polarization][T] complex samples, starting
+// at channel 1) and produces the same output
+// ([outputChannel][baseline][polarization][polarization] complex<float>).
+// For baseline (station0, station1) with station0 >= station1,
+// baseline = station0 * (station0 + 1) / 2 + station1, and the visibility
+// is the sum of sample[station0][pol0] * conj(sample[station1][pol1]).
+// Consecutive input channels are integrated into one output channel if
+// nrOutputChannelsPerSubband < nrChannelsPerSubband - 1.
+//
+// The samples of one output channel are transposed to structure-of-arrays
+// form, after which tiles of two by one stations are correlated in
+// registers.  Complex int8 input is widened to int16 pairs, so that a
+// complex multiply-add takes two (AVX-VNNI or AVX512-VNNI) dpwssd
+// instructions.  Output channels are divided over an OpenMP thread team;
+// like CPU_Filter, a CPU_Correlator must not be used by multiple threads at
+// the same time.
+
+class CPU_Correlator
+{
+  public:
+    enum InputFormat { fp32, fp16, i8 };
+
+    CPU_Correlator(const CorrelatorParset &, InputFormat = fp32);
+
+    void launch(std::complex<float> *visibilities, const void *samples);
+
+    size_t nrOperations() const;
+    unsigned nrTimesPerBlock() const { return inputFormat == fp32 ? 4 : inputFormat == fp16 ? 8 : 16; }
+
+  private:
+    template <typename SampleType> void transposeFloat(float *scratch, const SampleType *samples, unsigned outputChannel) const;
+    void transposeInt(int32_t *scratch, const int8_t *samples, unsigned outputChannel) const;
+
+    void correlateFloat(std::complex<float> *visibilities, const float *scratch, unsigned outputChannel) const;
+    void correlateInt(std::complex<float> *visibilities, const int32_t *scratch, unsigned outputChannel) const;
+
+    const unsigned	nrStations, nrPolarizations, nrReceivers;
+    const unsigned	nrOutputChannels, channelIntegrationFactor, nrSamplesPerChannel;
+    const unsigned	nrTimes, nrPaddedTimes;
+    const InputFormat	inputFormat;
+    std::vector<std::unique_ptr<void, decltype(&free)>> scratch;
+};
+
+#endif
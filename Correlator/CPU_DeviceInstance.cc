@@ -0,0 +1,42 @@
+#include "Common/Config.h"
+#include "Correlator/CorrelatorPipeline.h"
+#include "Correlator/CPU_DeviceInstance.h"
+
+#include <omp.h>
+
+
+CPU_DeviceInstance::CPU_DeviceInstance(CorrelatorPipeline &pipeline, unsigned deviceNr)
+:
+  DeviceInstance(pipeline),
+  filters {
+    std::make_unique<CPU_Filter>(ps, false, CPU_Filter::fp32),
+    std::make_unique<CPU_Filter>(ps, true, CPU_Filter::fp32),
+  },
+  correlator(ps, CPU_Correlator::fp32),
+  inputBuffer((size_t) ps.nrStations() * ps.nrPolarizations() * (ps.nrSamplesPerChannel() + NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter() * ps.nrBytesPerRealSample()),
+  correctedData(filters[0]->outputBufferSize()),
+  inputBufferView(reinterpret_cast<CUdeviceptr>((void *) inputBuffer))
+{
+  // the work queues are OpenMP threads themselves
+  omp_set_max_active_levels(2);
+}
+
+
+void CPU_DeviceInstance::doSubband(const TimeStamp &time,
+				   unsigned subband,
+				   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
+				   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
+				   const MultiArrayHostBuffer<float, 2> &hostDelays,
+				   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
+				   unsigned startIndex)
+{
+  // the filters and correlator use all cores and own their scratch buffers
+  std::lock_guard<std::mutex> lock(enqueueMutex);
+
+  enqueueHostToDeviceTransfer(nullptr, inputBufferView, pipeline.samplesCounter);
+  filters[filterIndexForSubband(subband)]->launch(correctedData, static_cast<const int8_t *>((void *) inputBuffer), hostDelays.origin(), ps.subbandFrequencies()[subband]);
+
+  // like the GPU correlator, skip channel 0
+  const float *channel0skipped = static_cast<const float *>((void *) correctedData) + (size_t) ps.nrSamplesPerChannel() * ps.nrStations() * ps.nrPolarizations() * COMPLEX;
+  correlator.launch(hostVisibilities.origin(), channel0skipped);
+}
@@ -0,0 +1,42 @@
+#if !defined CPU_DEVICE_INSTANCE_H
+#define CPU_DEVICE_INSTANCE_H
+
+#include "Common/CUDA_Support.h"
+#include "Correlator/CPU_Correlator.h"
+#include "Correlator/CPU_Filter.h"
+#include "Correlator/DeviceInstance.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+
+
+// Runs the filter bank and the correlator on the CPU, for small arrays
+// where a GPU is not needed.  One subband is processed at a time, using
+// all cores through nested OpenMP parallelism.
+
+class CPU_DeviceInstance : public DeviceInstance
+{
+  public:
+    CPU_DeviceInstance(CorrelatorPipeline &, unsigned deviceNr);
+
+    virtual void doSubband(const TimeStamp &,
+		   unsigned subband,
+		   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
+		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
+		   const MultiArrayHostBuffer<float, 2> &hostDelays,
+		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
+		   unsigned startIndex = 0
+		  );
+
+    using DeviceInstance::doSubband;
+
+  private:
+    std::array<std::unique_ptr<CPU_Filter>, 2> filters;
+    CPU_Correlator		correlator;
+    HostBuffer			inputBuffer, correctedData;
+    cu::DeviceMemory		inputBufferView;
+    std::mutex			enqueueMutex;
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "Common/Config.h"
+
+#include "Common/HalfPrecision.h"
+#include "Correlator/CPU_Filter.h"
+
+#include <omp.h>
+
+#if defined __AVX2__ || defined __AVX512F__ || defined __F16C__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+
+
+struct CPU_Filter::Scratch
+{
+  Scratch(unsigned nrTimesPerChunk, unsigned nrChannels, bool delayCompensation)
+  :
+    samples(static_cast<float *>(fftwf_malloc((nrTimesPerChunk + NR_TAPS - 1) * 2 * nrChannels * sizeof(float))), fftwf_free),
+    firOutput(static_cast<float *>(fftwf_malloc(nrTimesPerChunk * 2 * nrChannels * sizeof(float))), fftwf_free),
+    spectra(static_cast<fftwf_complex *>(fftwf_malloc(nrTimesPerChunk * (nrChannels + 1) * sizeof(fftwf_complex))), fftwf_free),
+    phasors(delayCompensation ? static_cast<float *>(fftwf_malloc(nrTimesPerChunk * nrChannels * COMPLEX * sizeof(float))) : nullptr, fftwf_free)
+  {
+    if (samples == nullptr || firOutput == nullptr || spectra == nullptr || (delayCompensation && phasors == nullptr))
+      throw std::bad_alloc();
+  }
+
+  std::unique_ptr<float [], decltype(&fftwf_free)>	    samples;   // [time + tap][branch]
+  std::unique_ptr<float [], decltype(&fftwf_free)>	    firOutput; // [time][branch]
+  std::unique_ptr<fftwf_complex [], decltype(&fftwf_free)> spectra;   // [time][channel + 1]
+  std::unique_ptr<float [], decltype(&fftwf_free)>	    phasors;   // [time][channel][COMPLEX]
+};
+
+
+static unsigned chooseNrTimesPerChunk(unsigned nrSamplesPerChannel, unsigned nrTimesPerBlock)
+{
+  if (nrSamplesPerChannel % nrTimesPerBlock != 0)
+    throw Parset::Error("nrSamplesPerChannel must be a multiple of " + std::to_string(nrTimesPerBlock));
+
+  // large enough to amortize the FFTW call, small enough to stay in L2
+  unsigned nrTimesPerChunk = nrTimesPerBlock;
+
+  for (unsigned size = nrTimesPerBlock; size <= 64; size += nrTimesPerBlock)
+    if (nrSamplesPerChannel % size == 0)
+      nrTimesPerChunk = size;
+
+  return nrTimesPerChunk;
+}
+
+
+CPU_Filter::CPU_Filter(const CorrelatorParset &ps, bool mirror, OutputFormat outputFormat)
+:
+  nrStations(ps.nrStations()),
+  nrPolarizations(ps.nrPolarizations()),
+  nrChannels(ps.nrChannelsPerSubband()),
+  nrSamplesPerChannel(ps.nrSamplesPerChannel()),
+  nrTimesPerChunk(chooseNrTimesPerChunk(ps.nrSamplesPerChannel(), outputFormat == fp16 ? 8 : 4)),
+  outputFormat(outputFormat),
+  delayCompensation(ps.delayCompensation()),
+  delayPolynomialOrder(ps.delayPolynomialOrder()),
+  subbandBandwidth(ps.subbandBandwidth()),
+  weights(filterWeights(NR_TAPS, ps.nrChannelsPerSubbandBeforeFilter()))
+{
+  unsigned nrBranches = 2 * nrChannels;
+
+  if (mirror)
+    for (unsigned tap = 0; tap < NR_TAPS; tap ++)
+      for (unsigned branch = 1; branch < nrBranches; branch += 2)
+	weights[tap * nrBranches + branch] = - weights[tap * nrBranches + branch];
+
+  for (int thread = 0, nrThreads = omp_get_max_threads(); thread < nrThreads; thread ++)
+    scratch.emplace_back(new Scratch(nrTimesPerChunk, nrChannels, delayCompensation));
+
+  int n = nrBranches;
+
+  // FFTW's planner is not thread safe, and device instances are created in
+  // parallel
+#pragma omp critical (FFTW)
+  plan = fftwf_plan_many_dft_r2c(1, &n, nrTimesPerChunk,
+				 scratch[0]->firOutput.get(), nullptr, 1, nrBranches,
+				 scratch[0]->spectra.get(), nullptr, 1, nrChannels + 1,
+				 FFTW_MEASURE);
+
+  if (plan == nullptr)
+    throw std::runtime_error("could not create FFTW plan");
+}
+
+
+CPU_Filter::~CPU_Filter()
+{
+#pragma omp critical (FFTW)
+  fftwf_destroy_plan(plan);
+}
+
+
+std::vector<float> CPU_Filter::filterWeights(unsigned nrTaps, unsigned nrBranches)
+{
+  const double beta = 9.0695; // ~90 dB side-lobe suppression
+  unsigned     size = nrTaps * nrBranches;
+  std::vector<double> window(size);
+  double	      sum = 0;
+
+  for (unsigned i = 0; i < size; i ++) {
+    double x = (i - (size - 1) / 2.0) / nrBranches;
+    double r = 2.0 * i / (size - 1) - 1;
+    double sinc = x == 0 ? 1 : std::sin(M_PI * x) / (M_PI * x);
+
+    sum += window[i] = sinc * std::cyl_bessel_i(0.0, beta * std::sqrt(1 - r * r)) / std::cyl_bessel_i(0.0, beta);
+  }
+
+  // unit gain per branch, so that the FFT output does not depend on nrTaps
+  std::vector<float> weights(size);
+
+  for (unsigned i = 0; i < size; i ++)
+    weights[i] = window[i] * nrBranches / sum;
+
+  return weights;
+}
+
+
+size_t CPU_Filter::nrOperations() const
+{
+  size_t nrBranches = 2 * nrChannels;
+  size_t nrSpectra  = (size_t) nrStations * nrPolarizations * nrSamplesPerChannel;
+
+  return nrSpectra * (2 * NR_TAPS * nrBranches + (size_t) (2.5 * nrBranches * std::log2(nrBranches)) + (delayCompensation ? 6 : 2) * nrChannels);
+}
+
+
+size_t CPU_Filter::outputBufferSize() const
+{
+  return (size_t) nrChannels * nrSamplesPerChannel * nrStations * nrPolarizations * 2 * (outputFormat == fp16 ? sizeof(uint16_t) : sizeof(float));
+}
+
+
+// computes four consecutive FIR outputs for all branches; reusing each
+// weight for four time steps keeps the loop from being load bound
+
+static inline void firBranches(float *output, const float *samples, const float *weights, unsigned nrBranches)
+{
+  unsigned branch = 0;
+
+#if defined __AVX512F__
+  for (; branch + 16 <= nrBranches; branch += 16) {
+    __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps(), sum2 = _mm512_setzero_ps(), sum3 = _mm512_setzero_ps();
+
+    for (unsigned tap = 0; tap < NR_TAPS; tap ++) {
+      __m512	  weight = _mm512_loadu_ps(weights + tap * nrBranches + branch);
+      const float *in	 = samples + tap * nrBranches + branch;
+
+      sum0 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(in + 0 * nrBranches), sum0);
+      sum1 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(in + 1 * nrBranches), sum1);
+      sum2 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(in + 2 * nrBranches), sum2);
+      sum3 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(in + 3 * nrBranches), sum3);
+    }
+
+    _mm512_storeu_ps(output + 0 * nrBranches + branch, sum0);
+    _mm512_storeu_ps(output + 1 * nrBranches + branch, sum1);
+    _mm512_storeu_ps(output + 2 * nrBranches + branch, sum2);
+    _mm512_storeu_ps(output + 3 * nrBranches + branch, sum3);
+  }
+#endif
+
+#if defined __AVX2__ && defined __FMA__
+  for (; branch + 8 <= nrBranches; branch += 8) {
+    __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps(), sum2 = _mm256_setzero_ps(), sum3 = _mm256_setzero_ps();
+
+    for (unsigned tap = 0; tap < NR_TAPS; tap ++) {
+      __m256	  weight = _mm256_loadu_ps(weights + tap * nrBranches + branch);
+      const float *in	 = samples + tap * nrBranches + branch;
+
+      sum0 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(in + 0 * nrBranches), sum0);
+      sum1 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(in + 1 * nrBranches), sum1);
+      sum2 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(in + 2 * nrBranches), sum2);
+      sum3 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(in + 3 * nrBranches), sum3);
+    }
+
+    _mm256_storeu_ps(output + 0 * nrBranches + branch, sum0);
+    _mm256_storeu_ps(output + 1 * nrBranches + branch, sum1);
+    _mm256_storeu_ps(output + 2 * nrBranches + branch, sum2);
+    _mm256_storeu_ps(output + 3 * nrBranches + branch, sum3);
+  }
+#endif
+
+  for (; branch < nrBranches; branch ++)
+    for (unsigned time = 0; time < 4; time ++) {
+      float sum = 0;
+
+      for (unsigned tap = 0; tap < NR_TAPS; tap ++)
+	sum += weights[tap * nrBranches + branch] * samples[(time + tap) * nrBranches + branch];
+
+      output[time * nrBranches + branch] = sum;
+    }
+}
+
+
+void CPU_Filter::filter(Scratch &scratch, const int8_t *input, unsigned station, unsigned polarization, unsigned firstTime)
+{
+  unsigned     nrBranches = 2 * nrChannels;
+  const int8_t *in	  = input + (((size_t) station * nrPolarizations + polarization) * (nrSamplesPerChannel + NR_TAPS - 1) + firstTime) * nrBranches;
+  float	       *samples	  = scratch.samples.get();
+
+  // convert once, rather than once per tap
+  for (unsigned i = 0, size = (nrTimesPerChunk + NR_TAPS - 1) * nrBranches; i < size; i ++)
+    samples[i] = in[i];
+
+  for (unsigned time = 0; time < nrTimesPerChunk; time += 4)
+    firBranches(scratch.firOutput.get() + time * nrBranches, samples + time * nrBranches, weights.data(), nrBranches);
+
+  fftwf_execute_dft_r2c(plan, scratch.firOutput.get(), scratch.spectra.get());
+}
+
+
+static inline void storeBlock(uint16_t *output, const float *block /* [8][COMPLEX] */)
+{
+#if defined __AVX512F__
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(output), _mm512_cvtps_ph(_mm512_loadu_ps(block), _MM_FROUND_TO_NEAREST_INT));
+#elif defined __F16C__
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(output), _mm256_cvtps_ph(_mm256_loadu_ps(block), _MM_FROUND_TO_NEAREST_INT));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 8), _mm256_cvtps_ph(_mm256_loadu_ps(block + 8), _MM_FROUND_TO_NEAREST_INT));
+#else
+  for (unsigned i = 0; i < 8 * COMPLEX; i ++)
+    output[i] = floatToHalf(block[i]);
+#endif
+}
+
+
+static inline void storeBlock(float *output, const float *block /* [4][COMPLEX] */)
+{
+  memcpy(output, block, 4 * COMPLEX * sizeof(float));
+}
+
+
+// The phase of channel c at time t is -2 pi (f_0 + c * df) d(t), which is
+// linear in c.  For each time, an exact phasor is computed every
+// resyncInterval channels, and the channels in between are reached with a
+// double-precision recurrence in steps of eight channels.  The eight
+// channels of a step are expanded from a table of powers of the per-channel
+// rotation, so that the innermost loop has no loop-carried dependency.
+
+void CPU_Filter::computePhasors(Scratch &scratch, const float *stationDelays, double subbandFrequency, unsigned firstTime) const
+{
+  const unsigned resyncInterval = 64, groupSize = 8;
+  const double	 channelBandwidth = subbandBandwidth / nrChannels;
+  const double	 lowestFrequency = subbandFrequency - .5 * subbandBandwidth;
+  float		 *phasors = scratch.phasors.get();
+
+  for (unsigned time = 0; time < nrTimesPerChunk; time ++) {
+    double t = firstTime + time, delay = 0;
+
+    for (int k = delayPolynomialOrder; k >= 0; k --)
+      delay = delay * t + stationDelays[k];
+
+    std::complex<double> step = std::polar(1.0, -2 * M_PI * channelBandwidth * delay);
+    std::complex<double> groupStep = std::polar(1.0, -2 * M_PI * groupSize * channelBandwidth * delay);
+    std::complex<double> power = 1, base;
+    float		 powers[groupSize][COMPLEX];
+
+    for (unsigned i = 0; i < groupSize; i ++, power *= step) {
+      powers[i][REAL] = power.real();
+      powers[i][IMAG] = power.imag();
+    }
+
+    for (unsigned channel = 0; channel < nrChannels; channel += groupSize, base *= groupStep) {
+      if (channel % resyncInterval == 0)
+	base = std::polar(1.0, -2 * M_PI * (lowestFrequency + channel * channelBandwidth) * delay);
+
+      float	   baseReal = base.real(), baseImag = base.imag();
+      unsigned	   nrChannelsInGroup = std::min(groupSize, nrChannels - channel);
+      float	   *out = phasors + ((size_t) time * nrChannels + channel) * COMPLEX;
+
+      for (unsigned i = 0; i < nrChannelsInGroup; i ++) {
+	out[i * COMPLEX + REAL] = baseReal * powers[i][REAL] - baseImag * powers[i][IMAG];
+	out[i * COMPLEX + IMAG] = baseReal * powers[i][IMAG] + baseImag * powers[i][REAL];
+      }
+    }
+  }
+}
+
+
+template <typename T> void CPU_Filter::writeOutput(T *output, const Scratch &scratch, unsigned station, unsigned polarization, unsigned firstTime)
+{
+  const unsigned nrTimesPerBlock = sizeof(T) == sizeof(uint16_t) ? 8 : 4;
+  const fftwf_complex *spectra = scratch.spectra.get();
+  const float	 *phasors = scratch.phasors.get();
+  float		 block[8 * COMPLEX];
+
+  // the Nyquist bin (channel nrChannels) is dropped
+  for (unsigned channel = 0; channel < nrChannels; channel ++)
+    for (unsigned time = 0; time < nrTimesPerChunk; time += nrTimesPerBlock) {
+      if (delayCompensation) {
+	for (unsigned minorTime = 0; minorTime < nrTimesPerBlock; minorTime ++) {
+	  const float *sample = spectra[(time + minorTime) * (nrChannels + 1) + channel];
+	  const float *phasor = phasors + ((time + minorTime) * nrChannels + channel) * COMPLEX;
+
+	  block[minorTime * COMPLEX + REAL] = sample[REAL] * phasor[REAL] - sample[IMAG] * phasor[IMAG];
+	  block[minorTime * COMPLEX + IMAG] = sample[REAL] * phasor[IMAG] + sample[IMAG] * phasor[REAL];
+	}
+      } else {
+	for (unsigned minorTime = 0; minorTime < nrTimesPerBlock; minorTime ++) {
+	  block[minorTime * COMPLEX + REAL] = spectra[(time + minorTime) * (nrChannels + 1) + channel][REAL];
+	  block[minorTime * COMPLEX + IMAG] = spectra[(time + minorTime) * (nrChannels + 1) + channel][IMAG];
+	}
+      }
+
+      size_t majorTime = (firstTime + time) / nrTimesPerBlock;
+      storeBlock(output + ((((size_t) channel * (nrSamplesPerChannel / nrTimesPerBlock) + majorTime) * nrStations + station) * nrPolarizations + polarization) * nrTimesPerBlock * COMPLEX, block);
+    }
+}
+
+
+void CPU_Filter::launch(void *output, const int8_t *input, const float *delays, double subbandFrequency)
+{
+  if (delayCompensation && delays == nullptr)
+    throw std::runtime_error("CPU_Filter::launch: delay compensation requires delays");
+
+  unsigned nrChunks = nrSamplesPerChannel / nrTimesPerChunk;
+
+  // the polarizations of a station share their phasors
+#pragma omp parallel for collapse(2) schedule(dynamic) num_threads(scratch.size())
+  for (unsigned station = 0; station < nrStations; station ++)
+    for (unsigned chunk = 0; chunk < nrChunks; chunk ++) {
+      Scratch &threadScratch = *scratch[omp_get_thread_num()];
+
+      if (delayCompensation)
+	computePhasors(threadScratch, delays + station * (delayPolynomialOrder + 1), subbandFrequency, chunk * nrTimesPerChunk);
+
+      for (unsigned polarization = 0; polarization < nrPolarizations; polarization ++) {
+	filter(threadScratch, input, station, polarization, chunk * nrTimesPerChunk);
+
+	if (outputFormat == fp16)
+	  writeOutput(static_cast<uint16_t *>(output), threadScratch, station, polarization, chunk * nrTimesPerChunk);
+	else
+	  writeOutput(static_cast<float *>(output), threadScratch, station, polarization, chunk * nrTimesPerChunk);
+      }
+    }
+}
@@ -0,0 +1,79 @@
+#if !defined CPU_FILTER_H
+#define CPU_FILTER_H
+
+#include "Correlator/Parset.h"
+
+#include <fftw3.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+// CPU version of the polyphase filter bank that tcc::Filter runs on the GPU.
+// The input is the same buffer that is copied to devInputBuffer:
+// [station][polarization][(nrSamplesPerChannel + NR_TAPS - 1) * 2C] int8
+// real samples, with C = nrChannelsPerSubband.  The output is in the input
+// format of the Tensor-Core Correlator:
+// [channel][time / T][station][polarization][T] complex, with T = 8 for
+// fp16 and T = 4 for fp32 samples.  The FFT is not normalized.
+//
+// For mirrored (lower-sideband) subbands, every odd FIR branch is negated,
+// which is the same as multiplying the real input by (-1)^n; this reverses
+// the spectrum.
+//
+// If the parset enables delay compensation, launch() also applies the
+// fractional delay and fringe rotation of each station: channel c at
+// channel sample t is multiplied by exp(-2 pi i f_c d(t)), with
+// f_c = subbandFrequency - subbandBandwidth / 2 + c * subbandBandwidth / C
+// and d(t) the (negated) delay polynomial from hostDelays.  This is done
+// while the spectra are transposed to the output format, so that it does not
+// cost an extra pass over the data.  Like the CUDA filter (Filter.cc), it
+// does not correct the band pass, whatever correctBandPass says, so that
+// both device types produce the same visibilities.
+//
+// launch() uses an OpenMP thread team and per-thread scratch buffers that
+// belong to the filter, so a CPU_Filter must not be used by multiple
+// threads at the same time.
+
+class CPU_Filter
+{
+  public:
+    enum OutputFormat { fp16, fp32 };
+
+    CPU_Filter(const CorrelatorParset &, bool mirror, OutputFormat = fp16);
+    ~CPU_Filter();
+
+    // delays: [station][delayPolynomialOrder + 1], only used (and required)
+    // with delay compensation
+    void launch(void *output, const int8_t *input, const float *delays = nullptr, double subbandFrequency = 0);
+
+    size_t nrOperations() const;
+    size_t outputBufferSize() const;
+    unsigned nrTimesPerBlock() const { return outputFormat == fp16 ? 8 : 4; }
+
+    // Kaiser-windowed sinc, [tap][branch], without the mirror signs
+    static std::vector<float> filterWeights(unsigned nrTaps, unsigned nrChannelsBeforeFilter);
+
+  private:
+    struct Scratch;
+
+    void filter(Scratch &, const int8_t *input, unsigned station, unsigned polarization, unsigned firstTime);
+
+    void computePhasors(Scratch &, const float *stationDelays, double subbandFrequency, unsigned firstTime) const;
+
+    template <typename T> void writeOutput(T *output, const Scratch &, unsigned station, unsigned polarization, unsigned firstTime);
+
+    const unsigned	 nrStations, nrPolarizations, nrChannels, nrSamplesPerChannel;
+    const unsigned	 nrTimesPerChunk;
+    const OutputFormat	 outputFormat;
+    const bool		 delayCompensation;
+    const unsigned	 delayPolynomialOrder;
+    const double	 subbandBandwidth;
+    std::vector<float>	 weights;
+    fftwf_plan		 plan;
+    std::vector<std::unique_ptr<Scratch>> scratch;
+};
+
+#endif
@@ -9,15 +9,23 @@
 #include <omp.h>
 
 #include <iostream>
+#include <memory>
 
 int main(int argc, char **argv)
 {
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   try {
 #endif
-    cu::init();
-    cu::Device device(0);
-    cu::Context context(CU_CTX_SCHED_BLOCKING_SYNC, device);
+    CorrelatorParset ps(argc, argv);
+    std::unique_ptr<cu::Context> context;
+
+    if (ps.deviceType() != CorrelatorParset::CUDA_Device) {
+      HostBuffer::usePageLockedMemory = false;
+    } else {
+      cu::init();
+      cu::Device device(0);
+      context = std::make_unique<cu::Context>(CU_CTX_SCHED_BLOCKING_SYNC, device);
+    }
 
 #if defined __linux__
     setScheduler(SCHED_BATCH, 0);
@@ -27,12 +35,11 @@ int main(int argc, char **argv)
     powerSensor.dump("/tmp/sensor_values");
 #endif
 
-    CorrelatorParset ps(argc, argv);
     //CorrelatorPipeline pipeline(ps).doWork();
     CorrelatorPipeline pipeline(ps);
 
     MultiArrayHostBuffer<char, 4> hostInputBuffer(boost::extents[ps.nrStations()][ps.nrPolarizations()][(ps.nrSamplesPerChannel() + NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter()][ps.nrBytesPerRealSample()]);
-    MultiArrayHostBuffer<float, 2> hostDelays(boost::extents[ps.nrStations()][2]);
+    MultiArrayHostBuffer<float, 2> hostDelays(boost::extents[ps.nrStations()][ps.delayPolynomialOrder() + 1]);
     //MultiArrayHostBuffer<float, 2> hostPhaseOffsets(boost::extents[ps.nrBeams()][ps.nrPolarizations()]);
     MultiArrayHostBuffer<std::complex<float>, 4> hostVisibilities(boost::extents[ps.nrOutputChannelsPerSubband()][ps.nrBaselines()][ps.nrPolarizations()][ps.nrPolarizations()]);
 
@@ -1,7 +1,9 @@
 #include "Common/Config.h"
 #include "Common/CUDA_Support.h"
 #include "Correlator/CorrelatorPipeline.h"
+#include "Correlator/CPU_DeviceInstance.h"
 #include "Correlator/DeviceInstance.h"
+#include "Correlator/NullDeviceInstance.h"
 
 #include <omp.h>
 
@@ -34,12 +36,16 @@ void CorrelatorPipeline::createDeviceInstances()
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
     try {
 #endif
-      if (ps.GPUs()[deviceIndex] >= cu::Device::getCount()) {
+      if (ps.deviceType() == CorrelatorParset::NullDevice) {
+	deviceInstances[deviceIndex] = std::unique_ptr<DeviceInstance>(new NullDeviceInstance(*this, deviceIndex));
+      } else if (ps.deviceType() == CorrelatorParset::CPU_Device) {
+	deviceInstances[deviceIndex] = std::unique_ptr<DeviceInstance>(new CPU_DeviceInstance(*this, deviceIndex));
+      } else if (ps.GPUs()[deviceIndex] >= cu::Device::getCount()) {
 	std::stringstream str;
 	str << "GPU " << (signed) ps.GPUs()[deviceIndex] << " does not exit";
 	throw Parset::Error(str.str());
       } else {
-        deviceInstances[deviceIndex] = std::unique_ptr<DeviceInstance>(cu::Device(deviceIndex).getAttribute(CU_DEVICE_ATTRIBUTE_INTEGRATED) ? new DeviceInstance(*this, deviceIndex) : new DeviceInstanceWithoutUnifiedMemory(*this, deviceIndex));
+        deviceInstances[deviceIndex] = std::unique_ptr<DeviceInstance>(cu::Device(deviceIndex).getAttribute(CU_DEVICE_ATTRIBUTE_INTEGRATED) ? new CUDA_DeviceInstance(*this, deviceIndex) : new DeviceInstanceWithoutUnifiedMemory(*this, deviceIndex));
       }
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
     } catch (...) {
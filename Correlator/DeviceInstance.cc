@@ -8,6 +8,8 @@
 #include <cuda_fp16.h>
 #include <omp.h>
 
+#include <cstring>
+
 #if 0 && defined CL_DEVICE_TOPOLOGY_AMD
 inline static cpu_set_t cpu_and(const cpu_set_t &a, const cpu_set_t &b)
 {
@@ -17,20 +19,24 @@ inline static cpu_set_t cpu_and(const cpu_set_t &a, const cpu_set_t &b)
 }
 #endif
 
-namespace {
-inline unsigned filterIndexForSubband(unsigned subband)
+extern const char _binary_Correlator_Kernels_Transpose_cu_start, _binary_Correlator_Kernels_Transpose_cu_end;
+
+DeviceInstance::DeviceInstance(CorrelatorPipeline &pipeline)
+:
+  pipeline(pipeline),
+  ps(pipeline.ps)
 {
-  return (subband & 1) == 0 ? 1U : 0U;
-}
 }
 
 
-extern const char _binary_Correlator_Kernels_Transpose_cu_start, _binary_Correlator_Kernels_Transpose_cu_end;
+DeviceInstance::~DeviceInstance()
+{
+}
 
-DeviceInstance::DeviceInstance(CorrelatorPipeline &pipeline, unsigned deviceNr)
+
+CUDA_DeviceInstance::CUDA_DeviceInstance(CorrelatorPipeline &pipeline, unsigned deviceNr)
 :
-  pipeline(pipeline),
-  ps(pipeline.ps),
+  DeviceInstance(pipeline),
 
 #if 0 && defined CL_DEVICE_TOPOLOGY_AMD
   supportNumaAMD(device.getInfo<CL_DEVICE_VENDOR_ID>() == 0x1002),
@@ -123,8 +129,8 @@ DeviceInstance::DeviceInstance(CorrelatorPipeline &pipeline, unsigned deviceNr)
 
 DeviceInstanceWithoutUnifiedMemory::DeviceInstanceWithoutUnifiedMemory(CorrelatorPipeline &pipeline, unsigned deviceNr)
 :
-  DeviceInstance(pipeline, deviceNr),
-  devDelays(ps.nrStations() * 2 * sizeof(float)),
+  CUDA_DeviceInstance(pipeline, deviceNr),
+  devDelays(ps.nrStations() * (ps.delayPolynomialOrder() + 1) * sizeof(float)),
   currentVisibilityBuffer(0)
 {
   for (unsigned buffer = 0; buffer < NR_DEV_VISIBILITIES_BUFFERS; buffer ++)
@@ -135,7 +141,13 @@ DeviceInstanceWithoutUnifiedMemory::DeviceInstanceWithoutUnifiedMemory(Correlato
 }
 
 
-DeviceInstance::~DeviceInstance()
+CUDA_DeviceInstance::~CUDA_DeviceInstance()
+{
+  context.setCurrent();
+}
+
+
+void CUDA_DeviceInstance::setCurrentContext()
 {
   context.setCurrent();
 }
@@ -160,9 +172,9 @@ static void unlockPCIeBus(cl_event event, cl_int status, void *arg)
 #endif
 
 
-void DeviceInstance::doSubband(const TimeStamp &time,
+void CUDA_DeviceInstance::doSubband(const TimeStamp &time,
 			       unsigned subband,
-			       std::function<void (cu::Stream &, cu::DeviceMemory &devInputBuffer, PerformanceCounter &)> &enqueueHostToDeviceTransfer,
+			       HostToDeviceTransfer &enqueueHostToDeviceTransfer,
 			       const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
 			       const MultiArrayHostBuffer<float, 2> &hostDelays,
 			       MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
@@ -178,7 +190,7 @@ void DeviceInstance::doSubband(const TimeStamp &time,
     //     	         devCorrectedData,
     //     		 cu::DeviceMemory(hostInputBuffer));
 
-    cu::DeviceMemory devVisibilities(hostVisibilities);
+    cu::DeviceMemory devVisibilities(hostVisibilities.pageLocked());
     cu::DeviceMemory devCorrectedDataChannel0skipped(static_cast<CUdeviceptr>(devCorrectedData) + ps.nrSamplesPerChannel() * ps.nrStations() * ps.nrPolarizations() * sizeof(__half2));
     tcc.launchAsync(executeStream, devVisibilities, devCorrectedDataChannel0skipped, pipeline.correlateCounter);
   }
@@ -189,7 +201,7 @@ void DeviceInstance::doSubband(const TimeStamp &time,
 
 void DeviceInstanceWithoutUnifiedMemory::doSubband(const TimeStamp &time,
                                                    unsigned subband,
-				                   std::function<void (cu::Stream &, cu::DeviceMemory &devInputBuffer, PerformanceCounter &)> &enqueueHostToDeviceTransfer,
+				                   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
 				                   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
 				                   const MultiArrayHostBuffer<float, 2> &hostDelays,
 				                   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
@@ -209,7 +221,7 @@ void DeviceInstanceWithoutUnifiedMemory::doSubband(const TimeStamp &time,
       hostToDeviceStream.memcpyHtoDAsync(devDelays, hostDelays.origin(), hostDelays.bytesize());
     }
 
-    enqueueHostToDeviceTransfer(hostToDeviceStream, devInputBuffer, pipeline.samplesCounter);
+    enqueueHostToDeviceTransfer(&hostToDeviceStream, devInputBuffer, pipeline.samplesCounter);
     hostToDeviceStream.record(inputTransferReady);
 
 #if 0 && defined CL_DEVICE_TOPOLOGY_AMD
@@ -273,9 +285,13 @@ void DeviceInstance::doSubband(const TimeStamp &time,
 			       MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities
 			      )
 {
-  std::function<void (cu::Stream &, cu::DeviceMemory &, PerformanceCounter &)> enqueueHostToDeviceTransfer = [&] (cu::Stream &stream, cu::DeviceMemory &devInputBuffer, PerformanceCounter &counter) {
-    PerformanceCounter::Measurement measurement(counter, stream, 0, 0, hostInputBuffer.bytesize());
-    stream.memcpyHtoDAsync(devInputBuffer, hostInputBuffer, hostInputBuffer.bytesize());
+  HostToDeviceTransfer enqueueHostToDeviceTransfer = [&] (cu::Stream *stream, cu::DeviceMemory &devInputBuffer, PerformanceCounter &counter) {
+    if (stream != nullptr) {
+      PerformanceCounter::Measurement measurement(counter, *stream, 0, 0, hostInputBuffer.bytesize());
+      stream->memcpyHtoDAsync(devInputBuffer, hostInputBuffer, hostInputBuffer.bytesize());
+    } else {
+      memcpy(reinterpret_cast<void *>(static_cast<CUdeviceptr>(devInputBuffer)), hostInputBuffer, hostInputBuffer.bytesize());
+    }
   };
 
   doSubband(time, subband, enqueueHostToDeviceTransfer, hostInputBuffer, hostDelays, hostVisibilities);
@@ -16,20 +16,27 @@
 
 class CorrelatorPipeline;
 
+// A device correlates one subband at a time.  The input samples are copied
+// by the enqueueHostToDeviceTransfer callback, which is handed a stream and
+// the device input buffer; a nullptr stream means that the "device" buffer
+// is host memory that must be filled synchronously (see NullDeviceInstance).
+
 class DeviceInstance
 {
   public:
-    DeviceInstance(CorrelatorPipeline &, unsigned deviceNr);
-    ~DeviceInstance();
+    typedef std::function<void (cu::Stream *, cu::DeviceMemory &devInputBuffer, PerformanceCounter &)> HostToDeviceTransfer;
+
+    DeviceInstance(CorrelatorPipeline &);
+    virtual ~DeviceInstance();
 
     virtual void doSubband(const TimeStamp &,
 		   unsigned subband,
-		   std::function<void (cu::Stream &, cu::DeviceMemory &devInputBuffer, PerformanceCounter &)> &enqueueHostToDeviceTransfer,
+		   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
 		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
 		   const MultiArrayHostBuffer<float, 2> &hostDelays,
 		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
 		   unsigned startIndex = 0
-		  );
+		  ) = 0;
 
     void doSubband(const TimeStamp &,
 		   unsigned subband,
@@ -38,6 +45,12 @@ class DeviceInstance
 		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities
 		  );
 
+    // make the device usable from the calling thread
+    virtual void setCurrentContext() {}
+
+    // even subbands are lower sideband, and need the mirrored filter
+    static unsigned filterIndexForSubband(unsigned subband) { return (subband & 1) == 0 ? 1U : 0U; }
+
     CorrelatorPipeline		&pipeline;
     const CorrelatorParset	&ps;
 
@@ -46,6 +59,27 @@ class DeviceInstance
     unsigned			numaNode;
     std::unique_ptr<BoundThread> boundThread;
 #endif
+};
+
+
+class CUDA_DeviceInstance : public DeviceInstance
+{
+  public:
+    CUDA_DeviceInstance(CorrelatorPipeline &, unsigned deviceNr);
+    ~CUDA_DeviceInstance();
+
+    virtual void doSubband(const TimeStamp &,
+		   unsigned subband,
+		   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
+		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
+		   const MultiArrayHostBuffer<float, 2> &hostDelays,
+		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
+		   unsigned startIndex = 0
+		  );
+
+    using DeviceInstance::doSubband;
+
+    virtual void setCurrentContext();
 
   public:
     cu::Device			device;
@@ -70,20 +104,22 @@ class DeviceInstance
 };
 
 
-class DeviceInstanceWithoutUnifiedMemory : public DeviceInstance
+class DeviceInstanceWithoutUnifiedMemory : public CUDA_DeviceInstance
 {
   public:
     DeviceInstanceWithoutUnifiedMemory(CorrelatorPipeline &, unsigned deviceNr);
 
     virtual void doSubband(const TimeStamp &,
 		   unsigned subband,
-		   std::function<void (cu::Stream &, cu::DeviceMemory &devInputBuffer, PerformanceCounter &)> &enqueueHostToDeviceTransfer,
+		   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
 		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
 		   const MultiArrayHostBuffer<float, 2> &hostDelays,
 		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
 		   unsigned startIndex = 0
 		  );
 
+    using DeviceInstance::doSubband;
+
     cu::Stream			  hostToDeviceStream, deviceToHostStream;
     cu::DeviceMemory		  devDelays;
     std::vector<cu::DeviceMemory> devVisibilities;//[NR_DEV_VISIBILITIES_BUFFERS];
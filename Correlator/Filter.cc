@@ -22,7 +22,7 @@ Filter::Filter(const cu::Device &device, const CorrelatorParset &ps, bool mirror
       },
       .delays                       = ps.delayCompensation() ? std::optional<tcc::FilterArgs::Delays>(tcc::FilterArgs::Delays {
           .subbandBandwidth         = ps.subbandBandwidth(),
-          .polynomialOrder          = 1,
+          .polynomialOrder          = ps.delayPolynomialOrder(),
           .separatePerPolarization  = false,
       }) : std::nullopt,
       .bandPassCorrection           = std::nullopt,
@@ -0,0 +1,43 @@
+#include "Common/Config.h"
+#include "Correlator/CorrelatorPipeline.h"
+#include "Correlator/NullDeviceInstance.h"
+
+#include <chrono>
+#include <thread>
+
+
+NullDeviceInstance::NullDeviceInstance(CorrelatorPipeline &pipeline, unsigned deviceNr)
+:
+  DeviceInstance(pipeline),
+  inputBuffer((size_t) ps.nrStations() * ps.nrPolarizations() * (ps.nrSamplesPerChannel() + NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter() * ps.nrBytesPerRealSample()),
+  inputBufferView(reinterpret_cast<CUdeviceptr>((void *) inputBuffer))
+{
+}
+
+
+void NullDeviceInstance::doSubband(const TimeStamp &time,
+				   unsigned subband,
+				   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
+				   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
+				   const MultiArrayHostBuffer<float, 2> &hostDelays,
+				   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
+				   unsigned startIndex)
+{
+  {
+    // like a GPU, process one block at a time
+    std::lock_guard<std::mutex> lock(enqueueMutex);
+
+    enqueueHostToDeviceTransfer(nullptr, inputBufferView, pipeline.samplesCounter);
+
+    if (ps.nullDeviceKernelTime() > 0)
+      std::this_thread::sleep_for(std::chrono::duration<double>(ps.nullDeviceKernelTime()));
+  }
+
+  // visibility i of block b is (i, b), so that consumers can verify both
+  // the ordering of the blocks and the layout within a block
+  float block = (float) ((int64_t) (time - ps.startTime()) / ps.nrSamplesPerSubbandBeforeFilter());
+  std::complex<float> *visibilities = hostVisibilities.origin();
+
+  for (size_t i = 0, count = hostVisibilities.num_elements(); i < count; i ++)
+    visibilities[i] = std::complex<float>((float) i, block);
+}
@@ -0,0 +1,37 @@
+#if !defined NULL_DEVICE_INSTANCE_H
+#define NULL_DEVICE_INSTANCE_H
+
+#include "Common/CUDA_Support.h"
+#include "Correlator/DeviceInstance.h"
+
+#include <mutex>
+
+
+// A device that does not need a GPU: it copies the input samples into host
+// memory through the same callback that feeds a real device, optionally
+// sleeps to emulate kernel time, and produces deterministic visibilities.
+// It is meant to run and profile the host pipeline in isolation.
+
+class NullDeviceInstance : public DeviceInstance
+{
+  public:
+    NullDeviceInstance(CorrelatorPipeline &, unsigned deviceNr);
+
+    virtual void doSubband(const TimeStamp &,
+		   unsigned subband,
+		   HostToDeviceTransfer &enqueueHostToDeviceTransfer,
+		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
+		   const MultiArrayHostBuffer<float, 2> &hostDelays,
+		   MultiArrayHostBuffer<std::complex<float>, 4> &hostVisibilities,
+		   unsigned startIndex = 0
+		  );
+
+    using DeviceInstance::doSubband;
+
+  private:
+    HostBuffer			inputBuffer;
+    cu::DeviceMemory		inputBufferView;
+    std::mutex			enqueueMutex;
+};
+
+#endif
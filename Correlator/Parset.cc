@@ -15,6 +15,17 @@ CorrelatorParset::CorrelatorParset(int argc, char **argv, bool throwExceptionOnU
   allowed_options.add_options()
     ("nrOutputChannelsPerSubband,C", value<unsigned>(&_nrOutputChannelsPerSubband)->default_value(0))
     ("correlationMode,m", value<unsigned>(&_correlationMode)->default_value(0xF))
+    ("deviceType", value<std::string>()->default_value("cuda")->notifier([this] (const std::string &arg) {
+      if (arg == "cuda")
+	_deviceType = CUDA_Device;
+      else if (arg == "cpu")
+	_deviceType = CPU_Device;
+      else if (arg == "null")
+	_deviceType = NullDevice;
+      else
+	throw Error("device type must be \"cuda\", \"cpu\", or \"null\"");
+    }))
+    ("nullDeviceKernelTime", value<double>(&_nullDeviceKernelTime)->default_value(0))
   ;
 
   variables_map vm;
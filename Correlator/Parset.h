@@ -9,12 +9,16 @@ class CorrelatorParset : public Parset
   public:
     CorrelatorParset(int argc, char **argv, bool throwExceptionOnUnmatchedParameter = true);
 
+    enum DeviceType { CUDA_Device, CPU_Device, NullDevice };
+
     unsigned nrVisibilityPolarizations() const { return _nrVisibilityPolarizations; }
     unsigned correlationMode() const { return _correlationMode; }
     unsigned nrBaselines() const { return nrStations() * (nrStations() + 1) / 2; }
     unsigned nrOutputChannelsPerSubband() const { return _nrOutputChannelsPerSubband; }
     unsigned channelIntegrationFactor() const { return nrChannelsPerSubband() == 1 ? 1 : (nrChannelsPerSubband() - 1) / nrOutputChannelsPerSubband(); }
     unsigned outputChannelBandwidth() const { return channelBandwidth() * channelIntegrationFactor(); }
+    DeviceType deviceType() const { return _deviceType; }
+    double   nullDeviceKernelTime() const { return _nullDeviceKernelTime; }
 
     virtual std::vector<std::string> compileOptions() const;
 
@@ -22,6 +26,8 @@ class CorrelatorParset : public Parset
     unsigned _correlationMode;
     unsigned _nrVisibilityPolarizations;
     unsigned _nrOutputChannelsPerSubband;
+    DeviceType _deviceType;
+    double   _nullDeviceKernelTime;
 
 };
 
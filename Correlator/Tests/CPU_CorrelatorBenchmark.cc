@@ -0,0 +1,78 @@
+#include "Common/Config.h"
+
+#include "Common/HalfPrecision.h"
+#include "Correlator/CPU_Correlator.h"
+#include "Correlator/Parset.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+// Measures the CPU correlator throughput for all input formats.  Without
+// arguments, a small ISBI-like configuration is used; otherwise the
+// arguments are parsed as correlator parset, e.g.
+//   Correlator/Tests/CPU_CorrelatorBenchmark -n 32 -c 256 -t 768
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    const char *defaultArgs[] = { argv[0], "-n", "16", "-c", "64", "-t", "3072" };
+    CorrelatorParset ps(argc > 1 ? argc : sizeof defaultArgs / sizeof *defaultArgs, argc > 1 ? argv : const_cast<char **>(defaultArgs));
+
+    size_t nrSamples = (size_t) (ps.nrChannelsPerSubband() - 1) * ps.nrSamplesPerChannel() * ps.nrStations() * ps.nrPolarizations() * COMPLEX;
+    std::vector<float> samples(nrSamples);
+    std::vector<std::complex<float>> visibilities((size_t) ps.nrOutputChannelsPerSubband() * ps.nrBaselines() * ps.nrPolarizations() * ps.nrPolarizations());
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<int> distribution(-127, 127);
+
+    // all formats get the same values; small integers are exact in every
+    // format
+    for (float &sample : samples)
+      sample = distribution(generator);
+
+    std::vector<uint16_t> halfSamples(nrSamples);
+    std::vector<int8_t>   byteSamples(samples.begin(), samples.end());
+
+    std::transform(samples.begin(), samples.end(), halfSamples.begin(), floatToHalf);
+
+    std::cout << ps.nrStations() << " stations, " << ps.nrBaselines() << " baselines, " << ps.nrOutputChannelsPerSubband() << " channels, " << ps.nrSamplesPerChannel() * ps.channelIntegrationFactor() << " samples per channel, " << omp_get_max_threads() << " threads" << std::endl;
+
+    for (CPU_Correlator::InputFormat format : { CPU_Correlator::fp32, CPU_Correlator::fp16, CPU_Correlator::i8 }) {
+      CPU_Correlator correlator(ps, format);
+      const void     *input = format == CPU_Correlator::fp32 ? (const void *) samples.data() : format == CPU_Correlator::fp16 ? (const void *) halfSamples.data() : (const void *) byteSamples.data();
+
+      correlator.launch(visibilities.data(), input); // warm up
+
+      unsigned nrIterations = 0;
+      double   startTime = omp_get_wtime(), runTime;
+
+      do {
+	correlator.launch(visibilities.data(), input);
+	nrIterations ++;
+      } while ((runTime = omp_get_wtime() - startTime) < 2);
+
+      double time = runTime / nrIterations;
+      double rate = (double) ps.nrBaselines() * ps.nrOutputChannelsPerSubband() * ps.nrSamplesPerChannel() * ps.channelIntegrationFactor() / time;
+
+      std::cout << (format == CPU_Correlator::fp32 ? "fp32" : format == CPU_Correlator::fp16 ? "fp16" : "i8  ")
+		<< std::setprecision(3) << ": " << time * 1e3 << " ms, "
+		<< rate * 1e-9 << " G baselines*channels*samples/s, "
+		<< correlator.nrOperations() / time * 1e-9 << " GOPS" << std::endl;
+    }
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include "Common/Config.h"
+
+#include "Correlator/CPU_Correlator.h"
+#include "Correlator/Parset.h"
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Compares the CPU correlator against a straightforward implementation, for
+// all input formats, with an odd number of stations (so that the remainder
+// tiles are used), with channel integration, and with one polarization.
+
+static uint16_t smallIntToHalf(int value)
+{
+  // exact for |value| < 2048
+  if (value == 0)
+    return 0;
+
+  unsigned magnitude = std::abs(value), exponent = 0;
+
+  while ((magnitude >> exponent) > 1)
+    exponent ++;
+
+  return (value < 0 ? 0x8000 : 0) | (exponent + 15) << 10 | ((magnitude << 10 >> exponent) & 0x3FF);
+}
+
+
+static bool test(const std::vector<std::string> &arguments, CPU_Correlator::InputFormat format)
+{
+  std::vector<const char *> args { "CPU_CorrelatorTest" };
+
+  for (const std::string &argument : arguments)
+    args.push_back(argument.c_str());
+
+  CorrelatorParset ps(args.size(), const_cast<char **>(args.data()));
+  CPU_Correlator   correlator(ps, format);
+
+  unsigned nrStations = ps.nrStations(), nrPolarizations = ps.nrPolarizations(), nrReceivers = nrStations * nrPolarizations;
+  unsigned nrChannels = ps.nrChannelsPerSubband() - 1; // channel 0 is skipped
+  unsigned T = correlator.nrTimesPerBlock();
+
+  // [channel][time][receiver] small integers, representable in all formats
+  std::vector<std::complex<int>> samples((size_t) nrChannels * ps.nrSamplesPerChannel() * nrReceivers);
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> distribution(-127, 127);
+
+  for (std::complex<int> &sample : samples)
+    sample = std::complex<int>(distribution(generator), distribution(generator));
+
+  std::vector<char> input(samples.size() * COMPLEX * (format == CPU_Correlator::fp32 ? 4 : format == CPU_Correlator::fp16 ? 2 : 1));
+
+  for (unsigned channel = 0; channel < nrChannels; channel ++)
+    for (unsigned time = 0; time < ps.nrSamplesPerChannel(); time ++)
+      for (unsigned receiver = 0; receiver < nrReceivers; receiver ++) {
+	std::complex<int> sample = samples[((size_t) channel * ps.nrSamplesPerChannel() + time) * nrReceivers + receiver];
+	size_t index = ((((size_t) channel * (ps.nrSamplesPerChannel() / T) + time / T) * nrReceivers + receiver) * T + time % T) * COMPLEX;
+
+	switch (format) {
+	  case CPU_Correlator::fp32 : reinterpret_cast<float *>(input.data())[index + REAL] = sample.real();
+				      reinterpret_cast<float *>(input.data())[index + IMAG] = sample.imag();
+				      break;
+
+	  case CPU_Correlator::fp16 : reinterpret_cast<uint16_t *>(input.data())[index + REAL] = smallIntToHalf(sample.real());
+				      reinterpret_cast<uint16_t *>(input.data())[index + IMAG] = smallIntToHalf(sample.imag());
+				      break;
+
+	  case CPU_Correlator::i8   : reinterpret_cast<int8_t *>(input.data())[index + REAL] = sample.real();
+				      reinterpret_cast<int8_t *>(input.data())[index + IMAG] = sample.imag();
+				      break;
+	}
+      }
+
+  std::vector<std::complex<float>> visibilities((size_t) ps.nrOutputChannelsPerSubband() * ps.nrBaselines() * nrPolarizations * nrPolarizations);
+  correlator.launch(visibilities.data(), input.data());
+
+  double maxError = 0;
+
+  for (unsigned outputChannel = 0; outputChannel < ps.nrOutputChannelsPerSubband(); outputChannel ++)
+    for (unsigned station0 = 0, baseline = 0; station0 < nrStations; station0 ++)
+      for (unsigned station1 = 0; station1 <= station0; station1 ++, baseline ++)
+	for (unsigned pol0 = 0; pol0 < nrPolarizations; pol0 ++)
+	  for (unsigned pol1 = 0; pol1 < nrPolarizations; pol1 ++) {
+	    std::complex<double> sum = 0;
+
+	    for (unsigned subChannel = 0; subChannel < ps.channelIntegrationFactor(); subChannel ++)
+	      for (unsigned time = 0; time < ps.nrSamplesPerChannel(); time ++) {
+		const std::complex<int> *sample = &samples[((size_t) (outputChannel * ps.channelIntegrationFactor() + subChannel) * ps.nrSamplesPerChannel() + time) * nrReceivers];
+		std::complex<int> a = sample[station0 * nrPolarizations + pol0], b = sample[station1 * nrPolarizations + pol1];
+		sum += std::complex<double>(a.real(), a.imag()) * std::conj(std::complex<double>(b.real(), b.imag()));
+	      }
+
+	    std::complex<double> actual = visibilities[((outputChannel * ps.nrBaselines() + baseline) * nrPolarizations + pol0) * nrPolarizations + pol1];
+	    maxError = std::max(maxError, abs(actual - sum) / (abs(sum) + 1));
+	  }
+
+  bool ok = maxError < 1e-6;
+
+  std::cout << (format == CPU_Correlator::fp32 ? "fp32" : format == CPU_Correlator::fp16 ? "fp16" : "i8  ");
+
+  for (const std::string &argument : arguments)
+    std::cout << ' ' << argument;
+
+  std::cout << ": max relative error " << maxError << (ok ? "" : " (too large)") << std::endl;
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running CPU_CorrelatorTest" << std::endl;
+
+    const std::vector<std::vector<std::string>> configurations {
+      { "-n", "5", "-c", "9", "-t", "48" },
+      { "-n", "6", "-c", "9", "-C", "4", "-t", "32" },
+      { "-n", "3", "-c", "5", "-t", "64", "--nrPolarizations", "1" },
+    };
+
+    bool ok = true;
+
+    for (const std::vector<std::string> &configuration : configurations)
+      for (CPU_Correlator::InputFormat format : { CPU_Correlator::fp32, CPU_Correlator::fp16, CPU_Correlator::i8 })
+	ok &= test(configuration, format);
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
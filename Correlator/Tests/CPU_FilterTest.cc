@@ -0,0 +1,186 @@
+#include "Common/Config.h"
+
+#include "Correlator/CPU_Filter.h"
+#include "Correlator/Parset.h"
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Compares the CPU filter bank against a straightforward FIR filter and DFT
+// in double precision, for fp32 and fp16 output, and checks that the
+// mirrored filter bank produces the reversed spectrum.  With delay
+// compensation, the reference is multiplied by the exact phasor of each
+// sample.  Like the CUDA filter, the CPU filter must not correct the band
+// pass, neither with the default parset nor with correctBandPass set, so
+// that both device types produce the same visibilities.
+
+static std::vector<std::complex<double>> referenceFilter(const CorrelatorParset &ps, const std::vector<int8_t> &input)
+{
+  unsigned nrBranches = ps.nrChannelsPerSubbandBeforeFilter(), nrChannels = ps.nrChannelsPerSubband();
+  unsigned nrTimes = ps.nrSamplesPerChannel() + NR_TAPS - 1;
+  std::vector<float> weights = CPU_Filter::filterWeights(NR_TAPS, nrBranches);
+  std::vector<std::complex<double>> output((size_t) ps.nrStations() * ps.nrPolarizations() * ps.nrSamplesPerChannel() * nrChannels); // [station][pol][time][channel]
+  std::vector<double> fir(nrBranches);
+
+  for (unsigned station = 0; station < ps.nrStations(); station ++)
+    for (unsigned pol = 0; pol < ps.nrPolarizations(); pol ++)
+      for (unsigned time = 0; time < ps.nrSamplesPerChannel(); time ++) {
+	const int8_t *samples = &input[((size_t) station * ps.nrPolarizations() + pol) * nrTimes * nrBranches];
+
+	for (unsigned branch = 0; branch < nrBranches; branch ++) {
+	  fir[branch] = 0;
+
+	  for (unsigned tap = 0; tap < NR_TAPS; tap ++)
+	    fir[branch] += weights[tap * nrBranches + branch] * samples[(time + tap) * nrBranches + branch];
+	}
+
+	for (unsigned channel = 0; channel < nrChannels; channel ++) {
+	  std::complex<double> sum = 0;
+
+	  for (unsigned branch = 0; branch < nrBranches; branch ++)
+	    sum += fir[branch] * std::polar(1.0, -2 * M_PI * (branch * channel % nrBranches) / nrBranches);
+
+	  output[(((size_t) station * ps.nrPolarizations() + pol) * ps.nrSamplesPerChannel() + time) * nrChannels + channel] = sum;
+	}
+      }
+
+  return output;
+}
+
+
+static double halfToFloat(uint16_t half)
+{
+  int exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+  double value = exponent == 0 ? std::ldexp(mantissa, -24) : std::ldexp(mantissa | 0x400, exponent - 25);
+
+  return half & 0x8000 ? -value : value;
+}
+
+
+static std::complex<double> getOutput(const CorrelatorParset &ps, const CPU_Filter &filter, const std::vector<char> &output, bool fp16, unsigned channel, unsigned station, unsigned pol, unsigned time)
+{
+  unsigned T = filter.nrTimesPerBlock();
+  size_t   index = (((((size_t) channel * (ps.nrSamplesPerChannel() / T) + time / T) * ps.nrStations() + station) * ps.nrPolarizations() + pol) * T + time % T) * COMPLEX;
+
+  if (fp16) {
+    const uint16_t *samples = reinterpret_cast<const uint16_t *>(output.data());
+    return std::complex<double>(halfToFloat(samples[index + REAL]), halfToFloat(samples[index + IMAG]));
+  } else {
+    const float *samples = reinterpret_cast<const float *>(output.data());
+    return std::complex<double>(samples[index + REAL], samples[index + IMAG]);
+  }
+}
+
+
+static std::complex<double> correction(const CorrelatorParset &ps, const std::vector<float> &delays, unsigned station, unsigned channel, unsigned time)
+{
+  std::complex<double> factor = 1;
+
+  if (ps.delayCompensation()) {
+    const float *stationDelays = &delays[station * (ps.delayPolynomialOrder() + 1)];
+    double	delay = 0;
+
+    for (int k = ps.delayPolynomialOrder(); k >= 0; k --)
+      delay = delay * time + stationDelays[k];
+
+    double frequency = ps.subbandFrequencies()[0] - .5 * ps.subbandBandwidth() + channel * ps.subbandBandwidth() / ps.nrChannelsPerSubband();
+    factor *= std::polar(1.0, -2 * M_PI * frequency * delay);
+  }
+
+  return factor;
+}
+
+
+static bool compare(const CorrelatorParset &ps, CPU_Filter::OutputFormat format, bool mirror, const std::vector<int8_t> &input, const std::vector<std::complex<double>> &reference, const std::vector<float> &delays = std::vector<float>())
+{
+  CPU_Filter filter(ps, mirror, format);
+  std::vector<char> output(filter.outputBufferSize());
+  filter.launch(output.data(), input.data(), ps.delayCompensation() ? delays.data() : nullptr, ps.subbandFrequencies()[0]);
+
+  unsigned nrChannels = ps.nrChannelsPerSubband();
+  double   maxError = 0, maxValue = 0;
+
+  for (unsigned station = 0; station < ps.nrStations(); station ++)
+    for (unsigned pol = 0; pol < ps.nrPolarizations(); pol ++)
+      for (unsigned time = 0; time < ps.nrSamplesPerChannel(); time ++)
+	for (unsigned channel = mirror ? 1 : 0; channel < nrChannels; channel ++) {
+	  // a mirrored spectrum of a real signal is the conjugated, reversed spectrum
+	  std::complex<double> expected = reference[(((size_t) station * ps.nrPolarizations() + pol) * ps.nrSamplesPerChannel() + time) * nrChannels + (mirror ? nrChannels - channel : channel)];
+	  std::complex<double> actual = getOutput(ps, filter, output, format == CPU_Filter::fp16, channel, station, pol, time);
+
+	  if (mirror)
+	    expected = conj(expected);
+
+	  expected *= correction(ps, delays, station, channel, time);
+	  maxValue = std::max(maxValue, abs(expected));
+	  maxError = std::max(maxError, abs(actual - expected));
+	}
+
+  double tolerance = format == CPU_Filter::fp16 ? 1e-3 : 1e-5;
+  bool   ok = maxError <= tolerance * maxValue;
+
+  std::cout << (format == CPU_Filter::fp16 ? "fp16" : "fp32") << (mirror ? " mirrored" : "") << (ps.delayCompensation() ? " delays" : "") << ": max error " << maxError << " of " << maxValue << (ok ? "" : " (too large)") << std::endl;
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running CPU_FilterTest" << std::endl;
+
+    // the default parset, which sets correctBandPass
+    const char *args[] = { argv[0], "-n", "3", "-c", "16", "-t", "64" };
+    CorrelatorParset ps(sizeof args / sizeof *args, const_cast<char **>(args));
+
+    // 70 ns of delay at 6.6 GHz gives hundreds of turns of phase, which stresses
+    // the phasor recurrence
+    const char *delayArgs[] = { argv[0], "-n", "3", "-c", "16", "-t", "64", "-B", "1", "-d", "1", "--delayPolynomialOrder", "2", "-s", "1", "-F", "6.6e9" };
+    CorrelatorParset delayParset(sizeof delayArgs / sizeof *delayArgs, const_cast<char **>(delayArgs));
+
+    std::vector<int8_t> input((size_t) ps.nrStations() * ps.nrPolarizations() * (ps.nrSamplesPerChannel() + NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter());
+    std::mt19937 generator(42);
+    std::normal_distribution<float> noise(0, 8);
+
+    // noise plus a tone in channel 5, so that the spectrum is not symmetric
+    for (size_t i = 0; i < input.size(); i ++)
+      input[i] = (int8_t) std::max(-127.0f, std::min(127.0f, std::round(noise(generator) + 32 * (float) std::cos(2 * M_PI * 5.3 * i / ps.nrChannelsPerSubbandBeforeFilter()))));
+
+    std::vector<std::complex<double>> reference = referenceFilter(ps, input);
+    bool ok = true;
+
+    ok &= compare(ps, CPU_Filter::fp32, false, input, reference);
+    ok &= compare(ps, CPU_Filter::fp16, false, input, reference);
+    ok &= compare(ps, CPU_Filter::fp32, true, input, reference);
+    ok &= compare(ps, CPU_Filter::fp16, true, input, reference);
+
+    std::vector<float> delays(ps.nrStations() * (delayParset.delayPolynomialOrder() + 1));
+    std::uniform_real_distribution<float> delay(-1, 1);
+
+    for (unsigned station = 0; station < ps.nrStations(); station ++) {
+      delays[station * 3 + 0] = 7e-8f * delay(generator);
+      delays[station * 3 + 1] = 1e-11f * delay(generator);
+      delays[station * 3 + 2] = 1e-14f * delay(generator);
+    }
+
+    ok &= compare(delayParset, CPU_Filter::fp32, false, input, reference, delays);
+    ok &= compare(delayParset, CPU_Filter::fp16, false, input, reference, delays);
+    ok &= compare(delayParset, CPU_Filter::fp32, true, input, reference, delays);
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
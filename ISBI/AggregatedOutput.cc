@@ -0,0 +1,207 @@
+#include "Common/Config.h"
+
+#include "ISBI/AggregatedOutput.h"
+#include "ISBI/Compressor.h"
+#include "ISBI/OutputTransform.h"
+#include "ISBI/Visibilities.h"
+#include "Common/SystemCallException.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+
+static std::string fileNameFromDescriptor(const std::string &descriptor)
+{
+  return descriptor.compare(0, 5, "file:") == 0 ? descriptor.substr(5) : descriptor;
+}
+
+
+static void preallocate(int fd, size_t size)
+{
+  if (size == 0)
+    return;
+
+  // not every file system supports fallocate(); a sparse file will do
+  if (fallocate(fd, 0, 0, size) < 0 && ftruncate(fd, size) < 0)
+    throw SystemCallException("ftruncate", errno);
+}
+
+
+AggregatedOutput::File::File(const std::string &name, size_t size, size_t indexSize, bool create)
+{
+  int flags = create ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY;
+
+  if ((fd = open(name.c_str(), flags, 0666)) < 0)
+    throw SystemCallException(std::string("open ") + name, errno);
+
+  if ((indexFd = open((name + ".index").c_str(), flags, 0666)) < 0) {
+    int error = errno;
+    close(fd);
+    throw SystemCallException(std::string("open ") + name + ".index", error);
+  }
+
+  if (!create)
+    return; // reopened for a late block
+
+  preallocate(fd, size);
+
+  // the index is zero-filled, which marks all slots as not written
+  if (ftruncate(indexFd, indexSize) < 0)
+    throw SystemCallException("ftruncate", errno);
+}
+
+
+AggregatedOutput::File::~File()
+{
+  close(fd);
+  close(indexFd);
+}
+
+
+AggregatedOutput::AggregatedOutput(const ISBI_Parset &ps, unsigned integrationLevel)
+:
+  ps(ps),
+  name(fileNameFromDescriptor(ps.outputDescriptors()[integrationLevel])),
+  nrSamplesPerBlock((int64_t) ps.nrSamplesPerSubbandBeforeFilter() * ps.visibilitiesIntegration()[integrationLevel]),
+  nrBlocks(std::max((int64_t) 1, ((ps.stopTime() - ps.startTime()) + nrSamplesPerBlock - 1) / nrSamplesPerBlock)),
+  _slotSize(computeSlotSize(ps)),
+  _nrBlocksPerFile(ps.outputFileDuration() > 0 ? std::max((uint64_t) 1, (uint64_t) std::llround(ps.outputFileDuration() * ps.clockSpeed() / nrSamplesPerBlock)) : nrBlocks),
+  newestFile(0)
+{
+}
+
+
+AggregatedOutput::~AggregatedOutput()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  files.clear();
+}
+
+
+// the largest block that OutputBuffer can write, rounded up to the file
+// system block size
+
+size_t AggregatedOutput::computeSlotSize(const ISBI_Parset &ps)
+{
+  size_t size = sizeof(Visibilities::Header);
+
+  if (ps.transformOutput()) {
+    OutputTransform transform(ps);
+    size += transform.baselines().size() * sizeof(Visibilities::BaselineDescriptor) + transform.scaleFactors().size() * sizeof(float) + transform.outputSize();
+  } else {
+    size += (size_t) ps.nrOutputChannelsPerSubband() * ps.nrBaselines() * ps.nrPolarizations() * ps.nrPolarizations() * sizeof(std::complex<float>);
+  }
+
+  if (ps.outputCompression() != ISBI_Parset::NoCompression) {
+    size_t nrChunks = (size + ps.compressionChunkSize() - 1) / ps.compressionChunkSize();
+    size += sizeof(Compressor::FrameHeader) + nrChunks * sizeof(Compressor::ChunkHeader);
+  }
+
+  return (size + 4095) & ~(size_t) 4095;
+}
+
+
+std::string AggregatedOutput::fileName(unsigned fileNumber) const
+{
+  if (ps.outputFileDuration() <= 0)
+    return name;
+
+  char suffix[16];
+  snprintf(suffix, sizeof suffix, ".%04u", fileNumber);
+  return name + suffix;
+}
+
+
+// returns the file, and closes the files that are two or more files older
+// than the newest block
+
+std::shared_ptr<AggregatedOutput::File> AggregatedOutput::getFile(unsigned fileNumber)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  newestFile = std::max(newestFile, fileNumber);
+
+  for (auto file = files.begin(); file != files.end() && file->first + 1 < newestFile;)
+    file = files.erase(file); // writers that still use the file keep it open
+
+  std::shared_ptr<File> &file = files[fileNumber];
+
+  if (file == nullptr) {
+    uint64_t nrBlocksInFile = std::min(_nrBlocksPerFile, nrBlocks > (uint64_t) fileNumber * _nrBlocksPerFile ? nrBlocks - (uint64_t) fileNumber * _nrBlocksPerFile : 0);
+    uint64_t nrSlots = nrBlocksInFile * ps.nrSubbands();
+    bool     create = fileNumber >= createdFiles.size() || !createdFiles[fileNumber];
+
+    if (create) {
+      createdFiles.resize(std::max(createdFiles.size(), (size_t) fileNumber + 1));
+      createdFiles[fileNumber] = true;
+    }
+
+    file = std::make_shared<File>(fileName(fileNumber), nrSlots * _slotSize, nrSlots * sizeof(IndexEntry), create);
+  }
+
+  return file;
+}
+
+
+void AggregatedOutput::write(unsigned subband, const TimeStamp &startTime, const TimeStamp &endTime, const std::vector<iovec> &pieces)
+{
+  size_t size = 0;
+
+  for (const iovec &piece : pieces)
+    size += piece.iov_len;
+
+  if (size > _slotSize)
+    throw std::runtime_error("block does not fit in its aggregated output slot");
+
+  if (startTime < ps.startTime())
+    throw std::runtime_error("block starts before the observation");
+
+  uint64_t block = (startTime - ps.startTime()) / nrSamplesPerBlock;
+  unsigned fileNumber = block / _nrBlocksPerFile;
+  uint64_t slot = (block % _nrBlocksPerFile) * ps.nrSubbands() + subband;
+  off_t    offset = slot * _slotSize;
+  std::shared_ptr<File> file = getFile(fileNumber);
+
+  std::vector<iovec> remaining(pieces);
+  iovec *vector = remaining.data();
+  int count = remaining.size();
+
+  for (size_t written = 0; written < size;) {
+    ssize_t bytes = pwritev(file->fd, vector, std::min(count, IOV_MAX), offset + written);
+
+    if (bytes < 0) {
+      if (errno == EINTR)
+	continue;
+
+      throw SystemCallException("pwritev", errno);
+    }
+
+    written += bytes;
+
+    for (; count > 0 && (size_t) bytes >= vector->iov_len; count --)
+      bytes -= (vector ++)->iov_len;
+
+    if (bytes > 0) {
+      vector->iov_base = static_cast<char *>(vector->iov_base) + bytes;
+      vector->iov_len -= bytes;
+    }
+  }
+
+  IndexEntry entry { (double) startTime, (double) endTime, subband, 0, (uint64_t) offset, size };
+
+  ssize_t bytes = pwrite(file->indexFd, &entry, sizeof entry, slot * sizeof entry);
+
+  if (bytes < 0)
+    throw SystemCallException("pwrite", errno);
+
+  if (bytes != sizeof entry)
+    throw std::runtime_error("short write of aggregated output index entry");
+}
@@ -0,0 +1,80 @@
+#ifndef ISBI_AGGREGATED_OUTPUT_H
+#define ISBI_AGGREGATED_OUTPUT_H
+
+#include "ISBI/Parset.h"
+#include "Common/TimeStamp.h"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Writes the output of one integration level of all subbands to a single
+// file.  Every (block, subband) pair has a fixed-size slot in the file, so
+// that the output threads of the subbands can write their blocks with
+// pwritev() in parallel, without coordinating.  The slot size is the largest
+// block that the output path can produce (including the compression frame
+// overhead), rounded up to the file system block size.  The files are
+// preallocated with fallocate(), so that they are not fragmented by the
+// interleaved writes.
+//
+// With outputFileDuration() > 0, a new file is started every
+// outputFileDuration() seconds; the files are named <name>.0000,
+// <name>.0001, and so on.  Every data file has an index file
+// (<data file name>.index) with an IndexEntry per slot, in slot order, so
+// that a consumer can find a (time, subband) block without scanning the
+// data file.  The index entries of slots that were not written are zero.
+// A file is closed once any subband writes a block two files later, so that
+// subbands without output do not keep files open; a subband that is later
+// than that reopens the file.
+
+class AggregatedOutput
+{
+  public:
+    struct IndexEntry {
+      double   startTime, endTime; // as in the block header
+      uint32_t subband, pad;
+      uint64_t offset, size;	   // of the block in the data file; size 0: not written
+    };
+
+    AggregatedOutput(const ISBI_Parset &, unsigned integrationLevel);
+    ~AggregatedOutput();
+
+    // writes the block that starts at startTime for the given subband; may
+    // be called concurrently for different subbands
+    void write(unsigned subband, const TimeStamp &startTime, const TimeStamp &endTime, const std::vector<iovec> &pieces);
+
+    size_t slotSize() const { return _slotSize; }
+    uint64_t nrBlocksPerFile() const { return _nrBlocksPerFile; }
+    std::string fileName(unsigned fileNumber) const;
+
+  private:
+    struct File {
+      File(const std::string &name, size_t size, size_t indexSize, bool create);
+      ~File();
+
+      int fd, indexFd;
+    };
+
+    static size_t computeSlotSize(const ISBI_Parset &);
+    std::shared_ptr<File> getFile(unsigned fileNumber);
+
+    const ISBI_Parset		  &ps;
+    const std::string		  name;
+    const int64_t		  nrSamplesPerBlock;
+    const uint64_t		  nrBlocks;
+    const size_t		  _slotSize;
+    const uint64_t		  _nrBlocksPerFile;
+
+    std::mutex			  mutex;
+    std::map<unsigned, std::shared_ptr<File>> files; // open files, by file number
+    std::vector<bool>		  createdFiles;	     // [file number]
+    unsigned			  newestFile;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "Common/Config.h"
+
+#include "ISBI/Compressor.h"
+#include "Common/Logger.h"
+
+#if defined HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#if defined HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+
+Compressor::Compressor(const ISBI_Parset &ps, unsigned subband)
+:
+  ps(ps),
+  subband(subband),
+  codec(ps.outputCompression() == ISBI_Parset::LZ4_Compression ? LZ4 : ZSTD),
+  elementSize(ps.visibilitiesFormat() == ISBI_Parset::FP32_Visibilities ? sizeof(float) : sizeof(uint16_t)),
+  chunkSize(ps.compressionChunkSize()),
+  gathered(ps.nrCompressionThreads()),
+  shuffled(ps.nrCompressionThreads()),
+  contexts(ps.nrCompressionThreads(), nullptr),
+  counter("compress " + std::to_string(subband), ps.profiling()),
+  totalNrBytesIn(0),
+  totalNrBytesOut(0)
+{
+  pieceOffsets.reserve(8); // Visibilities::serialize() produces a few pieces
+
+  for (unsigned thread = 0; thread < ps.nrCompressionThreads(); thread ++) {
+    gathered[thread].resize(chunkSize);
+    shuffled[thread].resize(chunkSize);
+
+#if defined HAVE_ZSTD
+    if (codec == ZSTD)
+      contexts[thread] = ZSTD_createCCtx();
+#endif
+  }
+}
+
+
+Compressor::~Compressor()
+{
+#if defined HAVE_ZSTD
+  for (void *context : contexts)
+    ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(context));
+#endif
+
+  if (totalNrBytesOut > 0)
+    LOG(Logger::Info, "subband ", subband, ": compression ratio ", (double) totalNrBytesIn / totalNrBytesOut);
+}
+
+
+// transposes the bytes of size / elementSize elements: byte b of element i
+// moves to position b * nrElements + i; the remaining bytes are copied
+
+void Compressor::shuffle(char *out, const char *in, size_t size, unsigned elementSize)
+{
+  size_t nrElements = size / elementSize, i = 0;
+
+#if defined __AVX2__
+  if (elementSize == 4) {
+    const __m256i bytes = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m256i words = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (; i + 8 <= nrElements; i += 8) {
+      // 8 elements: after the shuffles, 64-bit word b holds byte b of all 8
+      __m256i v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 4 * i)), bytes), words);
+      __m128i lo = _mm256_castsi256_si128(v), hi = _mm256_extracti128_si256(v, 1);
+
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 0 * nrElements + i), lo);
+      _mm_storeh_pd(reinterpret_cast<double *>(out + 1 * nrElements + i), _mm_castsi128_pd(lo));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 2 * nrElements + i), hi);
+      _mm_storeh_pd(reinterpret_cast<double *>(out + 3 * nrElements + i), _mm_castsi128_pd(hi));
+    }
+  }
+#endif
+
+  for (unsigned byte = 0; byte < elementSize; byte ++)
+    for (size_t element = i; element < nrElements; element ++)
+      out[byte * nrElements + element] = in[element * elementSize + byte];
+
+  memcpy(out + nrElements * elementSize, in + nrElements * elementSize, size % elementSize);
+}
+
+
+void Compressor::unshuffle(char *out, const char *in, size_t size, unsigned elementSize)
+{
+  size_t nrElements = size / elementSize, i = 0;
+
+#if defined __AVX2__
+  if (elementSize == 4) {
+    // the byte shuffle within a lane is its own inverse
+    const __m256i bytes = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m256i words = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    for (; i + 8 <= nrElements; i += 8) {
+      __m128i lo = _mm_castpd_si128(_mm_loadh_pd(_mm_castsi128_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + 0 * nrElements + i))), reinterpret_cast<const double *>(in + 1 * nrElements + i)));
+      __m128i hi = _mm_castpd_si128(_mm_loadh_pd(_mm_castsi128_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + 2 * nrElements + i))), reinterpret_cast<const double *>(in + 3 * nrElements + i)));
+      __m256i v  = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(_mm256_set_m128i(hi, lo), words), bytes);
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 4 * i), v);
+    }
+  }
+#endif
+
+  for (unsigned byte = 0; byte < elementSize; byte ++)
+    for (size_t element = i; element < nrElements; element ++)
+      out[element * elementSize + byte] = in[byte * nrElements + element];
+
+  memcpy(out + nrElements * elementSize, in + nrElements * elementSize, size % elementSize);
+}
+
+
+size_t Compressor::maxCompressedSize(size_t size) const
+{
+  switch (codec) {
+#if defined HAVE_LZ4
+    case LZ4:	return LZ4_compressBound(size);
+#endif
+
+#if defined HAVE_ZSTD
+    case ZSTD:	return ZSTD_compressBound(size);
+#endif
+
+    default:	return size;
+  }
+}
+
+
+// returns 0 if the chunk could not be compressed into outSize bytes
+
+size_t Compressor::compressChunk(unsigned thread, char *out, size_t outSize, const char *in, size_t size)
+{
+  switch (codec) {
+#if defined HAVE_LZ4
+    case LZ4:	return LZ4_compress_default(in, out, size, outSize);
+#endif
+
+#if defined HAVE_ZSTD
+    case ZSTD:	{
+		  size_t compressedSize = ZSTD_compressCCtx(static_cast<ZSTD_CCtx *>(contexts[thread]), out, outSize, in, size, ps.compressionLevel());
+		  return ZSTD_isError(compressedSize) ? 0 : compressedSize;
+		}
+#endif
+
+    default:	return 0;
+  }
+}
+
+
+const std::vector<iovec> &Compressor::compress(const std::vector<iovec> &pieces)
+{
+  CPU_PerformanceCounter::Measurement measurement(counter);
+
+  pieceOffsets.resize(1);
+
+  for (const iovec &piece : pieces)
+    pieceOffsets.push_back(pieceOffsets.back() + piece.iov_len);
+
+  size_t   size = pieceOffsets.back();
+  unsigned nrChunks = (size + chunkSize - 1) / chunkSize;
+
+  compressed.resize(std::max((size_t) nrChunks, compressed.size()));
+  chunkHeaders.resize(nrChunks);
+
+#pragma omp parallel for schedule(dynamic) num_threads(ps.nrCompressionThreads())
+  for (unsigned chunk = 0; chunk < nrChunks; chunk ++) {
+    unsigned thread = omp_get_thread_num();
+    size_t   offset = (size_t) chunk * chunkSize, chunkBytes = std::min((size_t) chunkSize, size - offset);
+    unsigned piece  = std::upper_bound(pieceOffsets.begin(), pieceOffsets.end(), offset) - pieceOffsets.begin() - 1;
+    const char *in;
+
+    if (offset + chunkBytes <= pieceOffsets[piece + 1]) {
+      in = static_cast<const char *>(pieces[piece].iov_base) + (offset - pieceOffsets[piece]);
+    } else { // the chunk spans several pieces
+      for (size_t done = 0; done < chunkBytes; piece ++) {
+	size_t begin = offset + done - pieceOffsets[piece], bytes = std::min(pieces[piece].iov_len - begin, chunkBytes - done);
+	memcpy(&gathered[thread][done], static_cast<const char *>(pieces[piece].iov_base) + begin, bytes);
+	done += bytes;
+      }
+
+      in = gathered[thread].data();
+    }
+
+    if (elementSize > 1) {
+      shuffle(shuffled[thread].data(), in, chunkBytes, elementSize);
+      in = shuffled[thread].data();
+    }
+
+    std::vector<char> &out = compressed[chunk];
+    out.resize(maxCompressedSize(chunkBytes));
+    size_t compressedBytes = compressChunk(thread, out.data(), out.size(), in, chunkBytes);
+
+    if (compressedBytes == 0 || compressedBytes >= chunkBytes) {
+      memcpy(out.data(), in, chunkBytes);
+      compressedBytes = chunkBytes;
+    }
+
+    chunkHeaders[chunk] = ChunkHeader { (uint32_t) chunkBytes, (uint32_t) compressedBytes };
+  }
+
+  frameHeader = FrameHeader { 0x3B98F0C0, (uint8_t) codec, (uint8_t) elementSize, 0, nrChunks, chunkSize, size, 0 };
+
+  for (const ChunkHeader &chunkHeader : chunkHeaders)
+    frameHeader.compressedSize += chunkHeader.compressedSize;
+
+  frame.assign({ iovec { &frameHeader, sizeof frameHeader }, iovec { chunkHeaders.data(), chunkHeaders.size() * sizeof(ChunkHeader) } });
+
+  for (unsigned chunk = 0; chunk < nrChunks; chunk ++)
+    frame.push_back(iovec { compressed[chunk].data(), chunkHeaders[chunk].compressedSize });
+
+  totalNrBytesIn  += size;
+  totalNrBytesOut += sizeof frameHeader + chunkHeaders.size() * sizeof(ChunkHeader) + frameHeader.compressedSize;
+  return frame;
+}
+
+
+void Compressor::write(Stream *stream, const std::vector<iovec> &pieces)
+{
+  stream->writev(compress(pieces));
+}
+
+
+bool Compressor::read(Stream *stream, std::vector<char> &block, unsigned nrThreads)
+{
+  FrameHeader frameHeader;
+
+  try {
+    stream->read(&frameHeader, sizeof frameHeader);
+  } catch (Stream::EndOfStreamException &) {
+    return false;
+  }
+
+  if (frameHeader.magic != 0x3B98F0C0)
+    throw std::runtime_error("not a compressed visibilities frame");
+
+  // the headers are checked before anything is allocated or decompressed,
+  // so that a corrupt or truncated file cannot write outside the buffers
+  if (frameHeader.chunkSize == 0 || frameHeader.elementSize == 0 ||
+      frameHeader.nrChunks != (frameHeader.size + frameHeader.chunkSize - 1) / frameHeader.chunkSize ||
+      frameHeader.compressedSize > frameHeader.size)
+    throw std::runtime_error("corrupt frame");
+
+  std::vector<ChunkHeader> chunkHeaders(frameHeader.nrChunks);
+  std::vector<size_t>	   offsets(1, 0);
+
+  stream->read(chunkHeaders.data(), chunkHeaders.size() * sizeof(ChunkHeader));
+
+  for (unsigned chunk = 0; chunk < frameHeader.nrChunks; chunk ++) {
+    const ChunkHeader &chunkHeader = chunkHeaders[chunk];
+
+    if (chunkHeader.size > frameHeader.chunkSize ||
+	(uint64_t) chunk * frameHeader.chunkSize + chunkHeader.size > frameHeader.size ||
+	chunkHeader.compressedSize > chunkHeader.size)
+      throw std::runtime_error("corrupt frame");
+
+    offsets.push_back(offsets.back() + chunkHeader.compressedSize);
+  }
+
+  if (offsets.back() != frameHeader.compressedSize)
+    throw std::runtime_error("corrupt frame");
+
+  std::vector<char> compressed(frameHeader.compressedSize);
+
+  stream->read(compressed.data(), compressed.size());
+  block.resize(frameHeader.size);
+
+  bool ok = true;
+
+#pragma omp parallel num_threads(nrThreads) if(nrThreads > 1)
+  {
+    std::vector<char> decompressed(frameHeader.chunkSize);
+
+#pragma omp for schedule(dynamic) reduction(&&:ok)
+    for (unsigned chunk = 0; chunk < frameHeader.nrChunks; chunk ++) {
+      const ChunkHeader &chunkHeader = chunkHeaders[chunk];
+      const char *in  = &compressed[offsets[chunk]];
+      char	 *out = &block[(size_t) chunk * frameHeader.chunkSize];
+      char	 *dst = frameHeader.elementSize > 1 ? decompressed.data() : out;
+
+      if (chunkHeader.compressedSize == chunkHeader.size) {
+	memcpy(dst, in, chunkHeader.size);
+      } else {
+	switch (frameHeader.codec) {
+#if defined HAVE_LZ4
+	  case LZ4:	if (LZ4_decompress_safe(in, dst, chunkHeader.compressedSize, chunkHeader.size) != (int) chunkHeader.size)
+			  ok = false;
+
+			break;
+#endif
+
+#if defined HAVE_ZSTD
+	  case ZSTD:	if (ZSTD_decompress(dst, chunkHeader.size, in, chunkHeader.compressedSize) != chunkHeader.size)
+			  ok = false;
+
+			break;
+#endif
+
+	  default:	ok = false;
+	}
+      }
+
+      if (frameHeader.elementSize > 1)
+	unshuffle(out, dst, chunkHeader.size, frameHeader.elementSize);
+    }
+  }
+
+  if (!ok)
+    throw std::runtime_error("cannot decompress visibilities frame");
+
+  return true;
+}
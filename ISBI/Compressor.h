@@ -0,0 +1,81 @@
+#ifndef ISBI_COMPRESSOR_H
+#define ISBI_COMPRESSOR_H
+
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/Stream/Stream.h"
+#include "ISBI/Parset.h"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+
+// Compresses blocks of visibilities (as produced by Visibilities::serialize())
+// losslessly.  A block is split into chunks of compressionChunkSize() bytes.
+// Every chunk is byte shuffled, so that the bytes with the same significance
+// of all samples end up next to each other (which makes the mostly similar
+// exponents compressible), and is then compressed with LZ4 or zstd.  The
+// chunks are independent, and are compressed by nrCompressionThreads()
+// threads.
+//
+// A compressed block is written as a frame: a FrameHeader, a ChunkHeader per
+// chunk, and the compressed chunks.  The frame header holds the size of the
+// frame, so that a reader can skip frames, and the chunk headers hold the
+// compressed chunk sizes, so that a reader can decompress the chunks of a
+// frame in parallel.  A chunk that does not compress is stored (shuffled)
+// as is.
+
+class Compressor
+{
+  public:
+    enum Codec { Stored, LZ4, ZSTD };
+
+    struct FrameHeader {
+      uint32_t magic;		// 0x3B98F0C0
+      uint8_t  codec;
+      uint8_t  elementSize;	// of the byte shuffle; 1 means not shuffled
+      uint16_t pad;
+      uint32_t nrChunks, chunkSize; // uncompressed bytes per chunk, except for the last one
+      uint64_t size, compressedSize; // of the block and of the compressed chunks
+    };
+
+    struct ChunkHeader {
+      uint32_t size, compressedSize; // compressedSize == size: stored
+    };
+
+    Compressor(const ISBI_Parset &, unsigned subband);
+    ~Compressor();
+
+    // returns the pieces of the frame; the frame is kept until the next
+    // compress() or write(), for zero-copy streams
+    const std::vector<iovec> &compress(const std::vector<iovec> &pieces);
+    void write(Stream *, const std::vector<iovec> &pieces);
+
+    // reads and decompresses the next frame; returns false at the end of the
+    // stream
+    static bool read(Stream *, std::vector<char> &block, unsigned nrThreads = 1);
+
+    static void shuffle(char *out, const char *in, size_t size, unsigned elementSize);
+    static void unshuffle(char *out, const char *in, size_t size, unsigned elementSize);
+
+  private:
+    size_t maxCompressedSize(size_t size) const;
+    size_t compressChunk(unsigned thread, char *out, size_t outSize, const char *in, size_t size);
+
+    const ISBI_Parset			&ps;
+    const unsigned			subband;
+    const Codec				codec;
+    const unsigned			elementSize, chunkSize;
+    std::vector<std::vector<char>>	gathered, shuffled; // [thread]
+    std::vector<std::vector<char>>	compressed;	    // [chunk]
+    FrameHeader				frameHeader;
+    std::vector<ChunkHeader>		chunkHeaders;
+    std::vector<size_t>			pieceOffsets;	    // [piece + 1]
+    std::vector<iovec>			frame;
+    std::vector<void *>			contexts;	    // [thread], for zstd
+    CPU_PerformanceCounter		counter;
+    uint64_t				totalNrBytesIn, totalNrBytesOut; // for the compression ratio
+};
+
+#endif
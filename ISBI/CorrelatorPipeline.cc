@@ -4,6 +4,7 @@
 #include "ISBI/CorrelatorWorkQueue.h"
 #include "Common/Exceptions/Exception.h"
 #include "Common/CUDA_Support.h"
+#include "Common/Logger.h"
 
 #include <algorithm>
 #include <iostream>
@@ -18,10 +19,36 @@ ISBI_CorrelatorPipeline::ISBI_CorrelatorPipeline(const ISBI_Parset &ps)
   CorrelatorPipeline(ps),
   ps(ps),
   nrWorkQueues(ps.nrQueuesPerGPU() * ps.nrGPUs()),
+  traceSession(ps.traceFile()),
+  metricsExporter(ps.metricsPort(), ps.metricsFile(), ps.metricsInterval()),
   delayCorrection(ps),
   inputSection(ps),
   outputSection(ps),
+  computeWeightsCounter("weights", ps.profiling()),
+  subbandMetrics([&] () {
+    std::vector<SubbandMetrics> metrics;
+
+    for (unsigned subband = 0; subband < ps.nrSubbands(); subband ++)
+      metrics.emplace_back(subband);
+
+    return metrics;
+  } ()),
+  delayResidual(Metrics::gauge("isbi_delay_residual_seconds", {}, "largest error of the delay polynomials over the last block, over all stations")),
+  performanceReport(ps.profiling() ? ps.performanceReportInterval() : 0),
+  currentTimeGauge(Metrics::gauge("isbi_current_time_seconds", {}, "start time of the block that is being correlated")),
   nextTime(ps.startTime())
+{
+  // at most one time per work queue is in flight; avoid reallocations
+  currentTimes.reserve((nrWorkQueues + 1) * ps.nrSubbands());
+}
+
+
+ISBI_CorrelatorPipeline::SubbandMetrics::SubbandMetrics(unsigned subband)
+:
+  nrBlocks(Metrics::counter("isbi_blocks_correlated_total", {{ "subband", std::to_string(subband) }}, "blocks that were correlated")),
+  nrBlocksWithoutInput(Metrics::counter("isbi_blocks_without_input_total", {{ "subband", std::to_string(subband) }}, "blocks that were skipped for lack of valid samples")),
+  nrLateBlocks(Metrics::counter("isbi_blocks_late_total", {{ "subband", std::to_string(subband) }}, "blocks that were skipped because the input was overwritten")),
+  lateness(Metrics::gauge("isbi_block_lateness_seconds", {{ "subband", std::to_string(subband) }}, "time between the end of the last block and its completion"))
 {
 }
 
@@ -29,6 +56,11 @@ ISBI_CorrelatorPipeline::ISBI_CorrelatorPipeline(const ISBI_Parset &ps)
 void ISBI_CorrelatorPipeline::doWork()
 {
   double startTime = omp_get_wtime();
+  RAPL::Sampler *energySensor = CPU_PerformanceCounter::getEnergySensor();
+  double	startJoules[RAPL::nrDomains];
+
+  if (energySensor != nullptr)
+    energySensor->joules(startJoules);
 
 #pragma omp parallel num_threads(ps.nrQueuesPerGPU() * ps.nrGPUs())
   {
@@ -36,7 +68,8 @@ void ISBI_CorrelatorPipeline::doWork()
     try {
 #endif
       unsigned deviceNr = omp_get_thread_num() / ps.nrQueuesPerGPU();
-      deviceInstances[deviceNr]->context.setCurrent();
+      Tracer::setThreadName("work queue " + std::to_string(omp_get_thread_num()));
+      deviceInstances[deviceNr]->setCurrentContext();
       CorrelatorWorkQueue(*this, *deviceInstances[deviceNr]).doWork();
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
     } catch (cu::Error &error) {
@@ -54,7 +87,20 @@ void ISBI_CorrelatorPipeline::doWork()
   double runTime = omp_get_wtime() - startTime;
 
 #pragma omp critical (cout)
-  std::cout << "total: " << runTime << " s" << std::endl;
+  {
+    std::cout << "total: " << runTime << " s";
+
+    if (energySensor != nullptr) {
+      double joules[RAPL::nrDomains];
+      energySensor->joules(joules);
+
+      for (unsigned domain = 0; domain < RAPL::nrDomains; domain ++)
+	if (energySensor->sensor.hasDomain((RAPL::Domain) domain))
+	  std::cout << ", " << RAPL::name((RAPL::Domain) domain) << ' ' << joules[domain] - startJoules[domain] << " J (" << (joules[domain] - startJoules[domain]) / runTime << " W)";
+    }
+
+    std::cout << std::endl;
+  }
 }
 
 
@@ -76,8 +122,7 @@ bool ISBI_CorrelatorPipeline::getWork(unsigned preferredNode, TimeStamp &time, u
     if (!subbandsDone[subband])
       break;
 
-#pragma omp critical (clog)
-  std::clog << nextTime << ": subband " << subband << " processed on unpreferred NUMA domain " << preferredNode << std::endl;
+  LOG_RATE_LIMITED(Logger::Info, 1, nextTime, ": subband ", subband, " processed on unpreferred NUMA domain ", preferredNode);
 
 found:
   time = nextTime;
@@ -96,15 +141,12 @@ void ISBI_CorrelatorPipeline::logProgress(const TimeStamp &time) const
 {
   static double lastTime = omp_get_wtime();
 
-#pragma omp critical (clog)
-  {
-    std::clog << "time: " << time << ", ";
-
-    if (ps.realTime())
-      std::clog << "late: " << (double) TimeStamp::now(ps.clockSpeed()) - (double) time - ps.nrSamplesPerSubbandBeforeFilter() / ps.subbandBandwidth() << "s, ";
+  currentTimeGauge.set(time);
 
-    std::clog << "exec: " << omp_get_wtime() - lastTime << std::endl;
-  }
+  if (ps.realTime())
+    LOG(Logger::Info, "time: ", time, ", late: ", (double) TimeStamp::now(ps.clockSpeed()) - (double) time - ps.nrSamplesPerSubbandBeforeFilter() / ps.subbandBandwidth(), "s, exec: ", omp_get_wtime() - lastTime);
+  else
+    LOG(Logger::Info, "time: ", time, ", exec: ", omp_get_wtime() - lastTime);
 
   lastTime = omp_get_wtime();
 }
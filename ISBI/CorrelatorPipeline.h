@@ -6,8 +6,11 @@
 #include "ISBI/DelayCorrection.h"
 
 #include <libfilter/FilterBank.h>
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/Metrics.h"
 #include "Common/PerformanceCounter.h"
 #include "Common/SlidingPointer.h"
+#include "Common/Tracer.h"
 #include "Correlator/CorrelatorPipeline.h"
 
 #include <bitset>
@@ -32,9 +35,22 @@ class ISBI_CorrelatorPipeline : public CorrelatorPipeline
 
     const ISBI_Parset  &ps;
     const unsigned	   nrWorkQueues;
+    Tracer::Session	   traceSession; // before the sections, whose threads are traced
+    Metrics::Exporter	   metricsExporter; // before the sections, so that the final snapshot follows their last blocks
     DelayCorrection delayCorrection;
     InputSection	   inputSection;
     OutputSection	   outputSection;
+    CPU_PerformanceCounter computeWeightsCounter;
+
+    struct SubbandMetrics {
+      SubbandMetrics(unsigned subband);
+
+      Metrics::Counter	   &nrBlocks, &nrBlocksWithoutInput, &nrLateBlocks;
+      Metrics::Gauge	   &lateness;
+    };
+
+    std::vector<SubbandMetrics> subbandMetrics;
+    Metrics::Gauge	   &delayResidual;
 
     std::vector<TimeStamp> currentTimes;
     std::mutex		   currentTimesMutex;
@@ -43,6 +59,9 @@ class ISBI_CorrelatorPipeline : public CorrelatorPipeline
   private:
     void		   logProgress(const TimeStamp &time) const;
 
+    CPU_PerformanceCounter::PeriodicReport performanceReport;
+    Metrics::Gauge	   &currentTimeGauge;
+
     std::mutex		   getWorkLock;
     std::bitset<64>	   subbandsDone;
     TimeStamp		   nextTime;
@@ -2,6 +2,8 @@
 
 #include "Common/BandPass.h"
 #include "ISBI/CorrelatorWorkQueue.h"
+#include "Common/Logger.h"
+#include "Common/Tracer.h"
 
 #include <iostream>
 
@@ -12,9 +14,16 @@ CorrelatorWorkQueue::CorrelatorWorkQueue(ISBI_CorrelatorPipeline &pipeline, Devi
   pipeline(pipeline),
   deviceInstance(deviceInstance),
 
-  hostDelays(boost::extents[ps.nrStations()][2]),
+  hostDelays(boost::extents[ps.nrStations()][ps.delayPolynomialOrder() + 1]),
 
-  validData(ps.inputDescriptors().size()) // FIXME???
+  validData(ps.inputDescriptors().size()), // FIXME???
+  stationDelays(ps.nrStations()),
+  integerStationDelays(ps.nrStations(), 0),
+
+  enqueueCopyInputBuffer([this] (cu::Stream *stream, cu::DeviceMemory &devInputBuffer, PerformanceCounter &counter)
+  {
+    this->pipeline.inputSection.enqueueHostToDeviceCopy(stream, devInputBuffer, counter, currentTime, currentSubband, integerStationDelays.data());
+  })
 
 #if defined USE_SEPARATE_THREAD
 , stop(false),
@@ -61,57 +70,103 @@ bool CorrelatorWorkQueue::inTime(const TimeStamp &time)
 
 void CorrelatorWorkQueue::computeWeights(const std::vector<SparseSet<TimeStamp> > &validData, Visibilities *visibilities)
 {
-  for (unsigned stat2 = 0, pair = 0; stat2 < validData.size(); stat2 ++)
-    for (unsigned stat1 = 0; stat1 <= stat2 && pair < sizeof(visibilities->header.weights) / sizeof(visibilities->header.weights[0]); stat1 ++, pair ++)
-      visibilities->header.weights[pair] = ((uint32_t) (int64_t) (validData[stat1] & validData[stat2]).count() / ps.nrChannelsPerSubbandBeforeFilter() - (NR_TAPS - 1)) * ps.channelIntegrationFactor();
+  CPU_PerformanceCounter::Measurement measurement(pipeline.computeWeightsCounter);
+  visibilities->computeWeights(validData);
 }
 
 
 void CorrelatorWorkQueue::doSubband(const TimeStamp &time, unsigned subband)
 {
-  pipeline.startReadTransaction(time);
-  pipeline.inputSection.fillInMissingSamples(time, subband, validData);
+  Tracer::Scope scope("doSubband", "subband", subband);
+
+  {
+    Tracer::Scope scope("startReadTransaction");
+    pipeline.startReadTransaction(time);
+  }
+
+  {
+    Tracer::Scope scope("fillInMissingSamples");
+    pipeline.inputSection.fillInMissingSamples(time, subband, validData);
+  }
 
   if (hasValidData(validData) && inTime(time)) {
-    std::unique_ptr<Visibilities> visibilities = pipeline.outputSection.getVisibilitiesBuffer(subband);
-    std::vector<int64_t> integerStationDelays(ps.nrStations(), 0);
+    std::unique_ptr<Visibilities> visibilities;
+
+    {
+      Tracer::Scope scope("getVisibilitiesBuffer");
+      visibilities = pipeline.outputSection.getVisibilitiesBuffer(subband);
+    }
 
     // TODO:
     // if (pipeline.delayCorrection) {
-    std::vector<DelayCorrection::StationDelay> stationDelays = pipeline.delayCorrection.stationDelays(time);
-
-    if (stationDelays.size() != ps.nrStations()) {
-      throw std::runtime_error("unexpected amount of delays");
+    {
+      Tracer::Scope scope("stationDelays");
+      pipeline.delayCorrection.stationDelays(time, stationDelays);
     }
 
+    double   maxResidual = 0.0;
+    unsigned worstStation = 0;
+
     for (unsigned station = 0; station < ps.nrStations(); ++station) {
       integerStationDelays[station] = stationDelays[station].integerSamples;
-      hostDelays[station][0] = stationDelays[station].d0;
-      hostDelays[station][1] = stationDelays[station].d1;
+
+      for (unsigned k = 0; k <= ps.delayPolynomialOrder(); ++k)
+        hostDelays[station][k] = stationDelays[station].d[k];
+
+      if (stationDelays[station].maxResidual > maxResidual) {
+        maxResidual = stationDelays[station].maxResidual;
+        worstStation = station;
+      }
+    }
+
+    if (subband == 0 && ps.delayCompensation()) {
+      pipeline.delayResidual.set(maxResidual);
+      LOG_RATE_LIMITED(Logger::Info, .1, "delay polynomial residual at ", time, ": ", maxResidual * 1e12, " ps (station ", worstStation, ')');
     }
 
     // } else set delays to 0
-    
-    std::function<void (cu::Stream &, cu::DeviceMemory &, PerformanceCounter &)> enqueueCopyInputBuffer = [=] (cu::Stream &stream, cu::DeviceMemory &devInputBuffer, PerformanceCounter &counter)
-    {
-      pipeline.inputSection.enqueueHostToDeviceCopy(stream, devInputBuffer, counter, time, subband, integerStationDelays);
-    };
+
+    currentTime = time;
+    currentSubband = subband;
 
     unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
     unsigned startIndex = (time - nrHistorySamples) % ps.nrRingBufferSamplesPerSubband();
-    deviceInstance.doSubband(time, subband, enqueueCopyInputBuffer, pipeline.inputSection.hostRingBuffers[subband], hostDelays, visibilities->hostVisibilities, startIndex);
+
+    {
+      Tracer::Scope scope("device");
+      deviceInstance.doSubband(time, subband, enqueueCopyInputBuffer, pipeline.inputSection.hostRingBuffers[subband], hostDelays, visibilities->hostVisibilities, startIndex);
+    }
 
     visibilities->startTime = time;
     visibilities->endTime = time + ps.nrSamplesPerSubbandBeforeFilter();
-    computeWeights(validData, visibilities.get());
-    pipeline.outputSection.putVisibilitiesBuffer(std::move(visibilities), time, subband);
+
+    {
+      Tracer::Scope scope("computeWeights");
+      computeWeights(validData, visibilities.get());
+    }
+
+    {
+      Tracer::Scope scope("putVisibilitiesBuffer");
+      pipeline.outputSection.putVisibilitiesBuffer(std::move(visibilities), time, subband);
+    }
+
+    pipeline.subbandMetrics[subband].nrBlocks.add();
+
+    if (ps.realTime())
+      pipeline.subbandMetrics[subband].lateness.set((double) TimeStamp::now(ps.clockSpeed()) - (double) (time + ps.nrSamplesPerSubbandBeforeFilter()));
   } else {
+    if (!hasValidData(validData))
+      pipeline.subbandMetrics[subband].nrBlocksWithoutInput.add();
+    else
+      pipeline.subbandMetrics[subband].nrLateBlocks.add();
+
     if (subband == 0)
-#pragma omp critical (clog)
-      std::clog << "Warning: no valid samples for block starting at " << time << std::endl;
+      LOG(Logger::Warning, "no valid samples for block starting at ", time);
 
+    Tracer::Scope scope("putVisibilitiesBuffer");
     pipeline.outputSection.putVisibilitiesBuffer(nullptr, time, subband);
   }
 
+  Tracer::Scope endScope("endReadTransaction");
   pipeline.endReadTransaction(time);
 }
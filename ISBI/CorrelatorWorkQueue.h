@@ -9,6 +9,7 @@
 #include "Common/TimeStamp.h"
 #include "Correlator/DeviceInstance.h"
 
+#include <functional>
 #include <vector>
 
 
@@ -32,6 +33,14 @@ class CorrelatorWorkQueue
     void computeWeights(const std::vector<SparseSet<TimeStamp> > &validData, Visibilities *);
 
     std::vector<SparseSet<TimeStamp>> validData;
+
+    // per-block scratch state, allocated once so that doSubband() does not
+    // allocate memory
+    std::vector<DelayCorrection::StationDelay> stationDelays;
+    std::vector<int64_t> integerStationDelays;
+    TimeStamp currentTime;
+    unsigned currentSubband;
+    DeviceInstance::HostToDeviceTransfer enqueueCopyInputBuffer;
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "ISBI/DelayCorrection.h"
 
+#include <cmath>
 #include <fstream>
 #include <map>
 #include <vector>
@@ -39,7 +40,8 @@ std::vector<std::map<int64_t, double>> DelayCorrection::readDelayFile() const {
 DelayCorrection::DelayCorrection(const ISBI_Parset &ps) :
   ps(ps),
   rawDelays(readDelayFile()),
-  referenceStation(0) {}
+  referenceStation(0),
+  counter("delays", ps.profiling()) {}
 
 double DelayCorrection::getDelayAt(const int64_t &timestamp, unsigned station) const {
   if (rawDelays[station].empty()) {
@@ -72,42 +74,101 @@ double DelayCorrection::getDelayAt(const int64_t &timestamp, unsigned station) c
   return v1 + ratio * (v2 - v1);
 }
 
-std::vector<DelayCorrection::StationDelay> DelayCorrection::stationDelays(const TimeStamp &time) const {
-  std::vector<DelayCorrection::StationDelay> result(ps.nrStations());
+void DelayCorrection::stationDelays(const TimeStamp &time, std::vector<StationDelay> &result) const {
+  CPU_PerformanceCounter::Measurement measurement(counter);
+
+  result.resize(ps.nrStations());
+
+  const unsigned order = ps.delayPolynomialOrder();
+  const unsigned nrCheckPoints = 17;
 
-  TimeStamp endTime = time + ps.nrSamplesPerSubbandBeforeFilter();
   double Fs = (double)ps.sampleRate();
   double N = (double)ps.nrSamplesPerChannel();
+  double samplesPerChannelSample = (double)ps.nrChannelsPerSubbandBeforeFilter();
+
+  // fit the polynomial through the Chebyshev-Lobatto points of the block
+  // (for order 1: the begin and end of the block), and verify it at a set of
+  // equidistant points in between
+  std::array<int64_t, maxPolynomialOrder + 1> nodeTimes;
+  std::array<double, maxPolynomialOrder + 1> nodes, nodeRefDelays;
+  std::array<int64_t, nrCheckPoints> checkTimes;
+  std::array<double, nrCheckPoints> checkPoints, checkRefDelays;
+
+  for (unsigned j = 0; j <= order; ++j) {
+    int64_t offset = std::llround((.5 - .5 * std::cos(M_PI * j / order)) * N * samplesPerChannelSample);
+    nodeTimes[j] = time + offset;
+    nodes[j] = offset / samplesPerChannelSample;
+    nodeRefDelays[j] = getDelayAt(nodeTimes[j], referenceStation);
+  }
+
+  for (unsigned j = 0; j < nrCheckPoints; ++j) {
+    int64_t offset = std::llround(j * N * samplesPerChannelSample / (nrCheckPoints - 1));
+    checkTimes[j] = time + offset;
+    checkPoints[j] = offset / samplesPerChannelSample;
+    checkRefDelays[j] = getDelayAt(checkTimes[j], referenceStation);
+  }
 
   for (unsigned station = 0; station < ps.nrStations(); ++station) {
-    double delayAtStart = getDelayAt(time, station);
-    double delayAtEnd = getDelayAt(endTime, station);
-
-    if (station != referenceStation) {
-      double delayAtStartRef = getDelayAt(time, referenceStation);
-      double delayAtEndRef = getDelayAt(endTime, referenceStation);
-
-      delayAtStart -= delayAtStartRef;
-      delayAtEnd -= delayAtEndRef;
-    } else {
-      delayAtStart = 0.0;
-      delayAtEnd = 0.0;
+    if (station == referenceStation) {
+      result[station] = StationDelay();
+      continue;
     }
 
-    double delaySamplesAtStart = delayAtStart * Fs;
-    int64_t integerDelay = static_cast<int64_t>(std::llround(delaySamplesAtStart));
+    std::array<double, maxPolynomialOrder + 1> y;
+
+    for (unsigned j = 0; j <= order; ++j)
+      y[j] = getDelayAt(nodeTimes[j], station) - nodeRefDelays[j];
 
-    double fractionalDelay = delaySamplesAtStart - (double)integerDelay;
+    int64_t integerDelay = static_cast<int64_t>(std::llround(y[0] * Fs));
 
-    double d0 = fractionalDelay / Fs;
-    double d1 = (delayAtEnd - delayAtStart) / N;
+    for (unsigned j = 0; j <= order; ++j)
+      y[j] -= integerDelay / Fs;
+
+    // Newton divided differences ...
+    for (unsigned k = 1; k <= order; ++k)
+      for (unsigned j = order; j >= k; --j)
+        y[j] = (y[j] - y[j - 1]) / (nodes[j] - nodes[j - k]);
+
+    // ... converted to the monomial basis
+    std::array<double, maxPolynomialOrder + 1> c {};
+    c[0] = y[order];
+
+    for (int k = order - 1; k >= 0; --k) {
+      for (unsigned i = order - k; i > 0; --i)
+        c[i] = c[i - 1] - nodes[k] * c[i];
+
+      c[0] = y[k] - nodes[k] * c[0];
+    }
 
     result[station].integerSamples = integerDelay;
-    result[station].d0 = -static_cast<float>(d0);
-    result[station].d1 = -static_cast<float>(d1);
+
+    for (unsigned k = 0; k <= order; ++k)
+      result[station].d[k] = -static_cast<float>(c[k]);
+
+    double maxResidual = 0.0;
+
+    for (unsigned j = 0; j < nrCheckPoints; ++j) {
+      double delay = getDelayAt(checkTimes[j], station) - checkRefDelays[j] - integerDelay / Fs;
+      maxResidual = std::max(maxResidual, std::abs(delay + evaluate(result[station], order, checkPoints[j])));
+    }
+
+    result[station].maxResidual = maxResidual;
   }
+}
+
+
+double DelayCorrection::evaluate(const StationDelay &delay, unsigned polynomialOrder, double t)
+{
+  double value = 0.0;
 
-  return result;
+  for (int k = polynomialOrder; k >= 0; --k)
+    value = value * t + delay.d[k];
+
+  return value;
 }
 
 
+std::complex<double> DelayCorrection::phasor(const StationDelay &delay, unsigned polynomialOrder, double frequency, double t)
+{
+  return std::polar(1.0, -2 * M_PI * frequency * evaluate(delay, polynomialOrder, t));
+}
@@ -2,27 +2,46 @@
 #define ISBI_DELAY_CORRECTION_H
 
 #include "ISBI/Parset.h"
+#include "Common/CPU_PerformanceCounter.h"
 #include "Common/TimeStamp.h"
 
+#include <array>
+#include <complex>
 #include <vector>
 #include <cstdint>
 #include <map>
 
 class DelayCorrection {
   public:
+    static const unsigned maxPolynomialOrder = 3;
+
+    // The residual (non-integer) delay within a block is approximated by
+    // d[0] + d[1] * t + ... + d[order] * t^order seconds, with t the sample
+    // index within a channel (0 <= t <= nrSamplesPerChannel).  Coefficients
+    // are negated, like the filter expects them.  maxResidual is the largest
+    // deviation (in seconds) between the polynomial and the delay model that
+    // was found within the block.
     struct StationDelay {
       int64_t integerSamples = 0;
-      float d0 = 0.0f;
-      float d1 = 0.0f;
+      std::array<float, maxPolynomialOrder + 1> d {};
+      double maxResidual = 0.0;
     };
 
     DelayCorrection(const ISBI_Parset &);
 
-    std::vector<StationDelay> stationDelays(const TimeStamp &) const;
+    // fills in one StationDelay per station; does not allocate memory if the
+    // vector has the right size already
+    void stationDelays(const TimeStamp &, std::vector<StationDelay> &) const;
+
+    // CPU reference of the fringe rotation that the filter applies to
+    // channel sample t of a channel centered at the given frequency
+    static std::complex<double> phasor(const StationDelay &, unsigned polynomialOrder, double frequency, double t);
+    static double evaluate(const StationDelay &, unsigned polynomialOrder, double t);
 
   private:
     const ISBI_Parset &ps;
     unsigned referenceStation;
+    mutable CPU_PerformanceCounter counter;
 
     std::vector<std::map<int64_t, double>> rawDelays;
 
@@ -1,6 +1,9 @@
 #include "Common/Config.h"
 #include "Common/Stream/Descriptor.h"
 #include "Common/Affinity.h"
+#include "Common/Logger.h"
+#include "Common/Tracer.h"
+#include "Common/UncachedMemory.h"
 
 #include "ISBI/InputBuffer.h"
 #include "ISBI/VDIFStream.h"
@@ -9,10 +12,6 @@
 #include <omp.h>
 #include <sys/socket.h>
 
-#if defined __AVX__
-#include <immintrin.h>
-#endif
-
 #include <cassert>
 #include <algorithm>
 #include <chrono>
@@ -25,110 +24,15 @@
 
 volatile std::sig_atomic_t InputBuffer::signalCaught = false;
 
-namespace {
-  const std::array<int8_t, 256 * 4> decodeLUT = [] {
-    std::array<int8_t, 256 * 4> lut{};
-    for (unsigned byte = 0; byte < 256; ++byte) {
-      lut[4 * byte + 0] = DECODER_LEVEL_2BIT[(byte >> 0) & 0x3];
-      lut[4 * byte + 1] = DECODER_LEVEL_2BIT[(byte >> 2) & 0x3];
-      lut[4 * byte + 2] = DECODER_LEVEL_2BIT[(byte >> 4) & 0x3];
-      lut[4 * byte + 3] = DECODER_LEVEL_2BIT[(byte >> 6) & 0x3];
-    }
-    return lut;
-  } ();
-
-  inline void decodeMappedChannelSamples(
-      int8_t *__restrict dst,
-      unsigned nrSamples,
-      const uint8_t *__restrict payload,
-      size_t payloadBytes,
-      unsigned nchan,
-      size_t dataIndex)
-  {
-    for (unsigned sample = 0; sample < nrSamples; ++sample, dataIndex += nchan) {
-      const size_t byteIndex = dataIndex >> 2;
-
-      if (byteIndex >= payloadBytes) {
-        dst[sample] = 0;
-        continue;
-      }
-
-      const size_t lutIndex = (static_cast<size_t>(payload[byteIndex]) << 2) + (dataIndex & 0x3);
-      dst[sample] = decodeLUT[lutIndex];
-    }
-  }
-}
-
-void uncached_memcpy(void *__restrict dst, const void *__restrict src, size_t size)
+std::ostream &operator << (std::ostream &os, const InputBuffer::LogPrefix &prefix)
 {
-#if defined __AVX__
-  size_t done = 0;
-
-#if 0
-  // size should be multiple of 2
-
-  while (done < size && ((ptrdiff_t) ((char *) dst + done) & 0x1F) != 0) {
-    * (short *) ((char *) dst + done) = * (short *) ((const char *) src + done);
-    done += sizeof(short);
-  }
-#endif
-
-  while (done + sizeof(__m256i) <= size) {
-    _mm256_stream_si256((__m256i *) ((char *) dst + done), _mm256_loadu_si256((const __m256i *) ((const char *) src + done)));
-    done += sizeof(__m256i);
-  }
-
-#if 0
-  while (done < size) {
-    * (short *) ((char *) dst + done) = * (short *) ((const char *) src + done);
-    done += sizeof(short);
-  }
-#endif
-#else
-  memcpy(dst, src, size);
-#endif
+  return os << "InputBuffer " << prefix.firstStation << '-' << prefix.lastStation;
 }
 
 
-void uncached_memclear(void *dst, size_t size)
+InputBuffer::LogPrefix InputBuffer::logMessage() const
 {
-#if defined __AVX__
-  size_t done = 0;
-
-#if 0
-  // size should be multiple of sizeof(int)
-
-  while (done < size && ((ptrdiff_t) ((char *) dst + done) & 0x1F) != 0) {
-    * (int *) ((char *) dst + done) = 0;
-    done += sizeof(int);
-  }
-#endif
-
-  while (done + sizeof(__m256i) <= size) {
-    _mm256_stream_si256((__m256i *) ((char *) dst + done), _mm256_setzero_si256());
-    done += sizeof(__m256i);
-  }
-
-#if 0
-  while (done < size) {
-    * (int *) ((char *) dst + done) = 0;
-    done += sizeof(int);
-  }
-#endif
-#else
-  memset(dst, 0, size);
-#endif
-}
-
-
-std::ostream &operator << (std::ostream &os, std::function<std::ostream & (std::ostream &os)> function)
-{
-  return function(os);
-}
-
-
-std::function<std::ostream & (std::ostream &)> InputBuffer::logMessage() const{
-  return [&] (std::ostream &os) -> std::ostream & { return os << "InputBuffer " << myFirstStation << '-' << myFirstStation + myNrStations - 1; };
+  return LogPrefix { myFirstStation, myFirstStation + myNrStations - 1 };
 }
 
 
@@ -143,13 +47,12 @@ InputBuffer::InputBuffer(const ISBI_Parset &ps, MultiArrayHostBuffer<char, 4> ho
   nrRingBufferSamplesPerSubband(ps.nrRingBufferSamplesPerSubband()),
   mappedChannels([&] {
     std::vector<uint32_t> channels(myNrSubbands * ps.nrPolarizations());
-    std::vector<uint32_t> channelMapping = {8, 12,  0,  4,  9, 13,  1,  5, 10, 14,  2,  6, 11, 15,  3,  7};
 
     for (unsigned subband = 0; subband < myNrSubbands; ++subband) {
       const unsigned subbandOffset = (myFirstSubband + subband) * ps.nrPolarizations();
 
       for (unsigned pol = 0; pol < ps.nrPolarizations(); ++pol) {
-        channels[subband * ps.nrPolarizations() + pol] = channelMapping[subbandOffset + pol];
+        channels[subband * ps.nrPolarizations() + pol] = VDIF_CHANNEL_MAPPING[subbandOffset + pol];
       }
     }
 
@@ -173,6 +76,20 @@ InputBuffer::InputBuffer(const ISBI_Parset &ps, MultiArrayHostBuffer<char, 4> ho
   nrHistorySamples((NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter()),
   latestWriteTime(0, ps.clockSpeed()),
   stop(false),
+  handlePacketsCounter("packets " + std::to_string(myFirstStation), ps.profiling()),
+  fillInMissingSamplesCounter("flag " + std::to_string(myFirstStation), ps.profiling()),
+  latestReadTime(ps.startTime() - nrHistorySamples - ps.maxDelay()),
+  nrPacketsReceived(Metrics::counter("isbi_input_packets_received_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames read from the input")),
+  nrPacketsWritten(Metrics::counter("isbi_input_packets_written_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames written into the ring buffer")),
+  nrPacketsInvalid(Metrics::counter("isbi_input_packets_invalid_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames with an invalid header or an impossible timestamp")),
+  nrPacketsOutOfOrder(Metrics::counter("isbi_input_packets_out_of_order_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames dropped because they are older than the newest frame received (other than duplicates)")),
+  nrPacketsDuplicate(Metrics::counter("isbi_input_packets_duplicate_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames dropped because they have the timestamp of the newest frame received")),
+  nrPacketsLate(Metrics::counter("isbi_input_packets_late_dropped_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF frames newer than all frames received before them, dropped because the ring buffer had already been advanced past their time without input")),
+  nrGapSamples(Metrics::counter("isbi_input_gap_samples_total", {{ "station", std::to_string(myFirstStation) }}, "samples skipped between consecutively received VDIF frames")),
+  nrDecodedBytes(Metrics::counter("isbi_input_decoded_bytes_total", {{ "station", std::to_string(myFirstStation) }}, "VDIF payload bytes decoded into the ring buffer")),
+  ringBufferWriteAhead(Metrics::gauge("isbi_ring_buffer_write_ahead_samples", {{ "station", std::to_string(myFirstStation) }}, "distance between the write pointer and the read pointer of the ring buffer")),
+  ringBufferFill(Metrics::gauge("isbi_ring_buffer_fill_ratio", {{ "station", std::to_string(myFirstStation) }}, "fraction of the ring buffer between the read and write pointers")),
+  flaggedFraction(Metrics::gauge("isbi_input_flagged_ratio", {{ "station", std::to_string(myFirstStation) }}, "fraction of the samples of the last block that was flagged")),
   readerAndWriterSynchronization(nrRingBufferSamplesPerSubband, ps.startTime() - nrHistorySamples - ps.maxDelay()),
   inputThread(&InputBuffer::inputThreadBody, this),
   logThread(&InputBuffer::logThreadBody, this),
@@ -185,8 +102,7 @@ InputBuffer::InputBuffer(const ISBI_Parset &ps, MultiArrayHostBuffer<char, 4> ho
   //assert(myNrStations * ps.nrPolarizations() * ps.nrBytesPerComplexSample() % 32 == 0);
 #endif
 
-#pragma omp critical (clog)
-  std::clog << logMessage() << " created by CPU " << currentCPU() << " on node " << currentNode() << ", memory at node " << node(hostRingBuffer) << std::endl;
+  LOG(Logger::Info, logMessage(), " created by CPU ", currentCPU(), " on node ", currentNode(), ", memory at node ", node(hostRingBuffer));
 }
 
 InputBuffer::~InputBuffer()
@@ -203,6 +119,8 @@ InputBuffer::~InputBuffer()
 
 
 void InputBuffer::handleConsecutivePackets(std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer>& packetBuffer, unsigned firstPacket, unsigned lastPacket) {
+  CPU_PerformanceCounter::Measurement measurement(handlePacketsCounter);
+  Tracer::Scope scope("handleConsecutivePackets", "station", myFirstStation);
   const VDIFHeader* header = reinterpret_cast<const VDIFHeader*>(packetBuffer[firstPacket].data());
   TimeStamp beginTime(header->timestamp(ps.sampleRate()), ps.clockSpeed());
 
@@ -264,6 +182,10 @@ void InputBuffer::handleConsecutivePackets(std::array<std::array<char, maxPacket
     }
 
     readerAndWriterSynchronization.finishedWrite(endTime);
+    nrPacketsWritten.add(lastPacket - firstPacket);
+    nrDecodedBytes.add((lastPacket - firstPacket) * header->dataSize());
+  } else {
+    nrPacketsLate.add(lastPacket - firstPacket);
   }
 }
 
@@ -275,20 +197,18 @@ void InputBuffer::inputThreadBody() {
 #if defined FAKE_TIMES
   //expectedTimeStamp = ps.startTime() - nrHistorySamples - 20;
   expectedTimeStamp = TimeStamp::now(ps.clockSpeed()) - nrHistorySamples - 20;
-#pragma omp critical (clog)
-  std::clog<<"expectedTimeStamp " << expectedTimeStamp << std::endl;
+  LOG(Logger::Debug, "expectedTimeStamp ", expectedTimeStamp);
 
 #endif
 
+  Tracer::setThreadName("input " + std::to_string(myFirstStation));
+
   TimeStamp seekTime = ps.startTime() - nrHistorySamples - ps.maxDelay();
 
   VDIFStream vdifStream(ps.inputDescriptors()[myFirstStation], ps.sampleRate(), seekTime);
   assert(&vdifStream != nullptr);
 
-#pragma omp critical (clog)
-  std::clog << "Station " << myFirstStation << " first VDIF timestamp: "
-          << vdifStream.getFirstTimestamp() << " samples"
-          << " vs ps.startTime()=" << ps.startTime() << std::endl;
+  LOG(Logger::Info, "Station ", myFirstStation, " first VDIF timestamp: ", vdifStream.getFirstTimestamp(), " samples vs ps.startTime()=", ps.startTime());
 
   std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer> packetBuffer;
 
@@ -296,6 +216,12 @@ void InputBuffer::inputThreadBody() {
   unsigned nrPackets, firstPacket, nextPacket;
   TimeStamp timeStamp(0, ps.clockSpeed()); 
 
+  // the end of the newest valid frame received, against which every frame is
+  // classified as out of order, duplicate, or new (possibly after a gap)
+  TimeStamp newestEndTime(0, ps.clockSpeed());
+  bool      receivedValidFrame = false;
+  uint64_t  reportedInvalidFrames = 0;
+
 #if defined USE_RECVMMSG
   struct iovec   iovecs[maxNrPacketsInBuffer];
   struct mmsghdr msgvec[maxNrPacketsInBuffer];
@@ -311,16 +237,21 @@ void InputBuffer::inputThreadBody() {
   do {
     //#if defined USE_RECVMMSG  
     try {
+      Tracer::Scope scope("read", "station", myFirstStation);
+
       for (nrPackets = 0; nrPackets < maxNrPacketsInBuffer; nrPackets ++) {
         vdifStream.read(packetBuffer[nrPackets].data());
       }
     }
     catch (Stream::EndOfStreamException) {
-#pragma omp critical (clog)
-      std::clog <<  logMessage()  << " caught EndOfStreamException" << std::endl;
+      LOG(Logger::Info, logMessage(), " caught EndOfStreamException");
       stop = true;
     } 
 
+    nrPacketsReceived.add(nrPackets);
+    nrPacketsInvalid.add(vdifStream.nrInvalidFrames() - reportedInvalidFrames);
+    reportedInvalidFrames = vdifStream.nrInvalidFrames();
+
     /* catch (const SystemCallException &ex) {
        if (ex.error != EAGAIN && ex.error != EINTR) // expect timeout; rethrow others
        throw;
@@ -329,25 +260,49 @@ void InputBuffer::inputThreadBody() {
     for (firstPacket = nextPacket = 0; nextPacket < nrPackets; nextPacket ++) {
       const VDIFHeader* header = reinterpret_cast<const VDIFHeader*>(packetBuffer[nextPacket].data());
       timeStamp = TimeStamp(header->timestamp(ps.sampleRate()), ps.clockSpeed());
+      bool drop = false;
 
       if (timeStamp != expectedTimeStamp) {
-        if (firstPacket < nextPacket) {
-          handleConsecutivePackets(packetBuffer, firstPacket, nextPacket);
-        }
-
         if (ps.realTime() && abs(TimeStamp::now(ps.clockSpeed()) - timeStamp) > 15 * ps.subbandBandwidth()) {
           if (!printedImpossibleTimeStampWarning) {
             printedImpossibleTimeStampWarning = true;
-#pragma omp critical (clog)
-            std::clog << logMessage() << ": impossible timestamp " << timeStamp << std::endl;
+            LOG(Logger::Warning, logMessage(), ": impossible timestamp ", timeStamp);
           }
 
-          firstPacket = nextPacket + 1;
+          nrPacketsInvalid.add();
           timeStamp = 0;
+          drop = true;
         } else {
           printedImpossibleTimeStampWarning = false;
-          firstPacket = nextPacket;
+
+          if (receivedValidFrame && timeStamp >= newestEndTime)
+            nrGapSamples.add(timeStamp - newestEndTime);
+        }
+      }
+
+      // every frame that is not newer than the newest frame received is
+      // dropped here and counted once, also within a run of consecutive
+      // frames, so that handleConsecutivePackets() only sees new frames
+      if (!drop && receivedValidFrame && timeStamp < newestEndTime) {
+        if (timeStamp + nrTimesPerPacket == newestEndTime)
+          nrPacketsDuplicate.add();
+        else
+          nrPacketsOutOfOrder.add();
+
+        drop = true;
+      }
+
+      if (drop || timeStamp != expectedTimeStamp) {
+        if (firstPacket < nextPacket) {
+          handleConsecutivePackets(packetBuffer, firstPacket, nextPacket);
         }
+
+        firstPacket = drop ? nextPacket + 1 : nextPacket;
+      }
+
+      if (!drop) {
+        newestEndTime = timeStamp + nrTimesPerPacket;
+        receivedValidFrame = true;
       }
 
       expectedTimeStamp = timeStamp + nrTimesPerPacket;
@@ -382,12 +337,31 @@ void InputBuffer::logThreadBody()
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   try {
 #endif
+    Health previous = health();
+
     while (!stop && !signalCaught) {
       std::this_thread::sleep_for(std::chrono::seconds(1));
 
+      {
+        // name the station whose input degraded during the last second
+        Health current = health();
+
+        if (current.invalid != previous.invalid || current.outOfOrder != previous.outOfOrder || current.duplicate != previous.duplicate || current.lateDropped != previous.lateDropped || current.gapSamples != previous.gapSamples)
+          LOG(Logger::Warning, logMessage(), ": ", current.received - previous.received, " frames received, ", current.invalid - previous.invalid, " invalid, ", current.outOfOrder - previous.outOfOrder, " out of order, ", current.duplicate - previous.duplicate, " duplicate, ", current.lateDropped - previous.lateDropped, " late, ", current.gapSamples - previous.gapSamples, " samples missing");
+
+        previous = current;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(latestWriteTimeMutex);
+        int64_t writeAhead = (int64_t) latestWriteTime - latestReadTime.load(std::memory_order_relaxed);
+
+        ringBufferWriteAhead.set(writeAhead);
+        ringBufferFill.set(std::max(0.0, std::min(1.0, (double) writeAhead / nrRingBufferSamplesPerSubband)));
+      }
+
       std::lock_guard<std::mutex> lock(validDataMutex);
-#pragma omp critical (clog)
-      std::clog << logMessage() << ", valid: " << validData << std::endl;
+      LOG(Logger::Info, logMessage(), ", valid: ", validData); // a copy
     }
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   } catch (std::exception &ex) {
@@ -409,7 +383,7 @@ void InputBuffer::noInputThreadBody()
     WallClockTime wallClock;
     bool lateLastTime = false;
 
-    for (TimeStamp timeStamp = ps.startTime(); timeStamp < ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter() * ps.visibilitiesIntegration() && !stop && !signalCaught; timeStamp += ps.subbandBandwidth() / 10) {
+    for (TimeStamp timeStamp = ps.startTime(); timeStamp < ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter() * ps.visibilitiesIntegration().back() && !stop && !signalCaught; timeStamp += ps.subbandBandwidth() / 10) {
       wallClock.waitUntil(timeStamp + ps.subbandBandwidth() / 3);
 
       std::lock_guard<std::mutex> lock(latestWriteTimeMutex);
@@ -420,13 +394,11 @@ void InputBuffer::noInputThreadBody()
 	latestWriteTime = timeStamp;
 
 	if (!lateLastTime) {
-#pragma omp critical (clog)
-	  std::clog << logMessage() << ": forcing correlator to continue without data " << timeStamp << std::endl;
+	  LOG(Logger::Warning, logMessage(), ": forcing correlator to continue without data ", timeStamp);
 	  lateLastTime = true;
 	}
       } else if (lateLastTime) {
-#pragma omp critical (clog)
-	std::clog << logMessage() << ": resumed normal operation " << timeStamp << std::endl;
+	LOG(Logger::Info, logMessage(), ": resumed normal operation ", timeStamp);
 	lateLastTime = false;
       }
     }
@@ -444,39 +416,60 @@ void InputBuffer::noInputThreadBody()
 
 
 
-SparseSet<TimeStamp> InputBuffer::getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime)
+void InputBuffer::getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime, SparseSet<TimeStamp> &currentValidData)
 {
   std::lock_guard<std::mutex> lock(validDataMutex);
-  return validData & SparseSet<TimeStamp>(earlyStartTime, endTime);
+  currentValidData.assignSubset(validData, earlyStartTime, endTime);
 }
 
 void InputBuffer::fillInMissingSamples(const TimeStamp &startTime, unsigned subband, SparseSet<TimeStamp> &validData)
 {
+  CPU_PerformanceCounter::Measurement measurement(fillInMissingSamplesCounter);
+
   TimeStamp earlyStartTime   = startTime - nrHistorySamples - ps.maxDelay();
   TimeStamp endTime          = startTime + ps.nrSamplesPerSubbandBeforeFilter() + ps.maxDelay();
 
-  validData = getCurrentValidData(earlyStartTime, endTime);
-  SparseSet<TimeStamp> flaggedData = validData.invert(earlyStartTime, endTime);
-  const SparseSet<TimeStamp>::Ranges &flaggedRanges = flaggedData.getRanges();
-  size_t size = myNrStations * ps.nrBytesPerRealSample(); 
-  
-  for (const SparseSet<TimeStamp>::range &it : flaggedRanges) {
-    for (unsigned timeIndex = it.begin % nrRingBufferSamplesPerSubband, timeEndIndex = it.end % nrRingBufferSamplesPerSubband; timeIndex != timeEndIndex;) {
-      for (unsigned pol = 0; pol < ps.nrPolarizations(); pol++) {
-        uncached_memclear(hostRingBuffer[subband][myFirstStation][pol][timeIndex].origin(), size);
+  getCurrentValidData(earlyStartTime, endTime, validData);
+
+  // walk over the gaps between the valid ranges rather than constructing the
+  // inverted set, to avoid memory allocations for every block
+  size_t   size = myNrStations * ps.nrBytesPerRealSample(); 
+  int64_t  nrFlaggedSamples = 0;
+  unsigned nrFlaggedRanges = 0;
+
+  auto clear = [&] (const TimeStamp &begin, const TimeStamp &end) {
+    if (begin < end) {
+      for (unsigned timeIndex = begin % nrRingBufferSamplesPerSubband, timeEndIndex = end % nrRingBufferSamplesPerSubband; timeIndex != timeEndIndex;) {
+        for (unsigned pol = 0; pol < ps.nrPolarizations(); pol++) {
+          uncached_memclear(hostRingBuffer[subband][myFirstStation][pol][timeIndex].origin(), size);
+        }
+
+        if (++ timeIndex == nrRingBufferSamplesPerSubband)
+          timeIndex = 0;
       }
 
-      if (++ timeIndex == nrRingBufferSamplesPerSubband)
-        timeIndex = 0;
+      nrFlaggedSamples += end - begin;
+      nrFlaggedRanges ++;
     }
+  };
+
+  TimeStamp flaggedBegin = earlyStartTime;
+
+  for (const SparseSet<TimeStamp>::range &it : validData.getRanges()) {
+    clear(flaggedBegin, it.begin);
+    flaggedBegin = it.end;
   }
 
+  clear(flaggedBegin, endTime);
+
   unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
   unsigned nrSamples        = nrHistorySamples + ps.nrSamplesPerSubbandBeforeFilter();
 
-  if (subband == 0)
-#pragma omp critical (clog)
-    std::clog << logMessage() << ' ' << earlyStartTime << " flagged: " << 100.0 * (int64_t) flaggedData.count() / nrSamples << "% (" << flaggedRanges.size() << ')' << std::endl;
+  if (subband == 0) {
+    flaggedFraction.set((double) nrFlaggedSamples / nrSamples);
+
+    LOG(Logger::Info, logMessage(), ' ', earlyStartTime, " flagged: ", 100.0 * nrFlaggedSamples / nrSamples, "% (", nrFlaggedRanges, ')');
+  }
 }
 
 
@@ -486,6 +479,7 @@ void InputBuffer::startReadTransaction(const TimeStamp &startTime)
   TimeStamp endTime          = startTime + ps.nrSamplesPerSubbandBeforeFilter() + ps.maxDelay();
 
   readerAndWriterSynchronization.startRead(earlyStartTime, endTime);
+  latestReadTime.store(earlyStartTime, std::memory_order_relaxed);
 }
 
 
@@ -497,6 +491,20 @@ void InputBuffer::endReadTransaction(const TimeStamp &startTime)
 }
 
 
+InputBuffer::Health InputBuffer::health() const
+{
+  return Health {
+    nrPacketsReceived.value(),
+    nrPacketsInvalid.value(),
+    nrPacketsOutOfOrder.value(),
+    nrPacketsDuplicate.value(),
+    nrPacketsLate.value(),
+    nrGapSamples.value(),
+    nrDecodedBytes.value(),
+  };
+}
+
+
 void InputBuffer::caughtSignal()
 {
   signalCaught = true;
@@ -2,7 +2,9 @@
 #define RADIOBLOCKS_INPUTBUFFER_H
 
 #include "ISBI/Parset.h"
+#include "Common/CPU_PerformanceCounter.h"
 #include "Common/CUDA_Support.h"
+#include "Common/Metrics.h"
 #include "Common/ReaderWriterSynchronization.h"
 #include "Common/SparseSet.h"
 #include "Common/TimeStamp.h"
@@ -13,7 +15,7 @@
 #include <cstdint>
 #include <atomic>
 #include <csignal>
-#include <functional>
+#include <ostream>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -21,6 +23,18 @@
 
 class InputBuffer{
 public:
+    // the input accounting of the station(s) of this InputBuffer, since the
+    // start; also exported as isbi_input_* metrics, labelled by station
+    struct Health {
+      uint64_t received;	// frames read from the input
+      uint64_t invalid;		// frames with an invalid header or an impossible timestamp
+      uint64_t outOfOrder;	// frames dropped as older than the newest frame received, other than duplicates
+      uint64_t duplicate;	// frames dropped as having the timestamp of the newest frame received
+      uint64_t lateDropped;	// new frames dropped as the ring buffer had already been advanced past them
+      uint64_t gapSamples;	// samples skipped between consecutively received frames
+      uint64_t decodedBytes;	// payload bytes decoded into the ring buffer
+    };
+
     InputBuffer(const ISBI_Parset &, MultiArrayHostBuffer<char, 4> hostRingBuffer[], unsigned myFirstSubband, unsigned myNrSubbands, unsigned myFirstStation, unsigned myNrStations, unsigned nrTimesPerPacket);
     ~InputBuffer();
 
@@ -29,6 +43,8 @@ public:
     void startReadTransaction(const TimeStamp &);
     void endReadTransaction(const TimeStamp &);
 
+    Health health() const;
+
     static void caughtSignal();
 
 private:
@@ -36,10 +52,15 @@ private:
     const static unsigned	maxPacketSize	     = 8032; // this must not be a power of 2, or performance will collapse due to limited cache associativity
 
     void inputThreadBody(), noInputThreadBody(), logThreadBody();
-    std::function<std::ostream & (std::ostream &)> logMessage() const;
+
+    // "InputBuffer <first station>-<last station>"; a value, so that a log
+    // message can be formatted after the call
+    struct LogPrefix { unsigned firstStation, lastStation; };
+    LogPrefix logMessage() const;
+    friend std::ostream &operator << (std::ostream &, const LogPrefix &);
 
     void handleConsecutivePackets(std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer>& packetBuffer, unsigned firstPacket, unsigned lastPacket);
-    SparseSet<TimeStamp> getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime);
+    void getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime, SparseSet<TimeStamp> &);
 
     const ISBI_Parset	&ps;
     unsigned			myFirstSubband, myNrSubbands, myFirstStation, myNrStations, nrRingBufferSamplesPerSubband, nrTimesPerPacket, nrHistorySamples;
@@ -52,6 +73,13 @@ private:
     std::mutex			validDataMutex, latestWriteTimeMutex;
     std::atomic<bool>		stop;
 
+    CPU_PerformanceCounter	handlePacketsCounter, fillInMissingSamplesCounter;
+
+    std::atomic<int64_t>	latestReadTime; // the first sample of the last read transaction
+    Metrics::Counter		&nrPacketsReceived, &nrPacketsWritten;
+    Metrics::Counter		&nrPacketsInvalid, &nrPacketsOutOfOrder, &nrPacketsDuplicate, &nrPacketsLate, &nrGapSamples, &nrDecodedBytes;
+    Metrics::Gauge		&ringBufferWriteAhead, &ringBufferFill, &flaggedFraction;
+
     SynchronizedReaderAndWriter readerAndWriterSynchronization;
     std::thread			inputThread, logThread;
     std::unique_ptr<std::thread> noInputThreadPtr;
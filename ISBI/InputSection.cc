@@ -11,6 +11,8 @@
 #include <cstdint>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <optional>
 
 InputSection::InputSection(const ISBI_Parset &ps)
 :
@@ -47,7 +49,17 @@ InputSection::~InputSection()
     inputBuffers[i] = nullptr;
 }
 
-void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory &devBuffer, PerformanceCounter &counter, const TimeStamp &startTime, unsigned subband, std::vector<int64_t> integerStationDelays) {
+void InputSection::enqueueHostToDeviceCopy(cu::Stream *stream, cu::DeviceMemory &devBuffer, PerformanceCounter &counter, const TimeStamp &startTime, unsigned subband, const int64_t integerStationDelays[]) {
+  // without stream, devBuffer is host memory (see DeviceInstance)
+  auto copy = [&] (size_t offset, const void *src, size_t size) {
+    if (stream != nullptr) {
+      cu::DeviceMemory dst(devBuffer + offset);
+      stream->memcpyHtoDAsync(dst, src, size);
+    } else {
+      memcpy(reinterpret_cast<char *>(static_cast<CUdeviceptr>(devBuffer)) + offset, src, size);
+    }
+  };
+
   for (unsigned station = 0; station < ps.nrStations(); station++) {
     unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
 
@@ -60,7 +72,10 @@ void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory
     unsigned nrBytesPerTime = ps.nrBytesPerRealSample();
 
     {
-      PerformanceCounter::Measurement measurement(counter, stream, 0, 0, (endTime - earlyStartTime) * nrBytesPerTime);
+      std::optional<PerformanceCounter::Measurement> measurement;
+
+      if (stream != nullptr)
+        measurement.emplace(counter, *stream, 0, 0, (endTime - earlyStartTime) * nrBytesPerTime);
 
       uint32_t n = endTime - earlyStartTime;
       assert(n <= ps.nrRingBufferSamplesPerSubband());
@@ -79,23 +94,11 @@ void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory
 
         assert(firstPart + secondPart == n);
 
-        if (firstPart > 0) {
-          cu::DeviceMemory dst(devBuffer + offset);
-          stream.memcpyHtoDAsync(
-              dst, 
-              hostRingBuffers[subband][station][pol][startTimeIndex].origin(),
-              firstPart * nrBytesPerTime
-              );
-        }
+        if (firstPart > 0)
+          copy(offset, hostRingBuffers[subband][station][pol][startTimeIndex].origin(), firstPart * nrBytesPerTime);
 
-        if (secondPart > 0) {
-          cu::DeviceMemory dst(devBuffer + offset + firstPart * nrBytesPerTime);
-          stream.memcpyHtoDAsync(
-              dst,
-              hostRingBuffers[subband][station][pol][0].origin(),
-              secondPart * nrBytesPerTime
-              );
-        }
+        if (secondPart > 0)
+          copy(offset + firstPart * nrBytesPerTime, hostRingBuffers[subband][station][pol][0].origin(), secondPart * nrBytesPerTime);
       }
     }
   }
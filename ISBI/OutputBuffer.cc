@@ -2,25 +2,53 @@
 
 #include "ISBI/OutputBuffer.h"
 #include "Common/Affinity.h"
+#include "Common/Logger.h"
 #include "Common/Stream/Descriptor.h"
 #include "Common/Stream/SocketStream.h"
+#include "Common/Tracer.h"
 
 #include <iostream>
 
 
-OutputBuffer::OutputBuffer(const ISBI_Parset &ps, unsigned subband)
+OutputBuffer::IntegrationLevel::IntegrationLevel(const ISBI_Parset &ps, unsigned subband, unsigned level, AggregatedOutput *aggregatedOutput)
 :
-  ps(ps),
-  subband(subband),
-  currentTime(ps.startTime()),
-  stream(createStream(ps.outputDescriptors()[subband], false)),
-  thread(&OutputBuffer::outputThreadBody, this)
+  integrationFactor(ps.visibilitiesIntegration()[level]),
+  nrInputsPerOutput(level == 0 ? integrationFactor : integrationFactor / ps.visibilitiesIntegration()[level - 1]),
+  nrIntegratedInputs(0),
+  stream(aggregatedOutput == nullptr ? createStream(ps.outputDescriptor(level, subband), false, 0, ps.zeroCopyOutput()) : nullptr),
+  aggregatedOutput(aggregatedOutput),
+  accumulator(integrationFactor > 1 ? new Visibilities(ps, subband) : nullptr)
 {
   SocketStream *socketStream = dynamic_cast<SocketStream *>(stream.get());
 
   if (socketStream != nullptr)
     socketStream->setWriteBufferSize(64 * 1024 * 1024);
+}
+
 
+OutputBuffer::OutputBuffer(const ISBI_Parset &ps, unsigned subband, const std::vector<AggregatedOutput *> &aggregatedOutputs)
+:
+  ps(ps),
+  subband(subband),
+  currentTime(ps.startTime()),
+  integrationLevels([&] () {
+    std::vector<IntegrationLevel> levels;
+    levels.reserve(ps.visibilitiesIntegration().size());
+
+    for (unsigned level = 0; level < ps.visibilitiesIntegration().size(); level ++)
+      levels.emplace_back(ps, subband, level, level < aggregatedOutputs.size() ? aggregatedOutputs[level] : nullptr);
+
+    return levels;
+  } ()),
+  outputTransform(ps.transformOutput() ? new OutputTransform(ps) : nullptr),
+  compressor(ps.outputCompression() != ISBI_Parset::NoCompression ? new Compressor(ps, subband) : nullptr),
+  integrateCounter("integrate " + std::to_string(subband), ps.profiling()),
+  writeCounter("write " + std::to_string(subband), ps.profiling()),
+  nrBlocksWritten(Metrics::counter("isbi_output_blocks_total", {{ "subband", std::to_string(subband) }}, "blocks that were handed to the output thread")),
+  nrBlocksDropped(Metrics::counter("isbi_output_blocks_dropped_total", {{ "subband", std::to_string(subband) }}, "blocks that were dropped because the output could not keep up")),
+  pendingQueueDepth(Metrics::gauge("isbi_output_queue_depth", {{ "subband", std::to_string(subband) }}, "blocks that wait for the output thread")),
+  thread(&OutputBuffer::outputThreadBody, this)
+{
   Visibilities *vis;
 
   //for (unsigned i = 0; i < 3; i ++) { Does not fit on A100
@@ -29,8 +57,7 @@ OutputBuffer::OutputBuffer(const ISBI_Parset &ps, unsigned subband)
     freeQueue.append(visibilties);
   }
 
-#pragma omp critical (clog)
-  std::clog << "output buffer " << subband << " created by CPU " << currentCPU() << " on node " << currentNode() << ", memory at node " << node(vis->hostVisibilities.data()) << std::endl;
+  LOG(Logger::Info, "output buffer ", subband, " created by CPU ", currentCPU(), " on node ", currentNode(), ", memory at node ", node(vis->hostVisibilities.data()));
 }
 
 
@@ -43,25 +70,86 @@ OutputBuffer::~OutputBuffer()
 }
 
 
+void OutputBuffer::waitForCompletion()
+{
+  for (IntegrationLevel &level : integrationLevels)
+    if (level.stream != nullptr)
+      level.stream->waitForCompletion();
+}
+
+
 void OutputBuffer::outputThreadBody()
 {
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   try {
 #endif
-    std::unique_ptr<Visibilities> visibilities, integratedVisibilities;
+    std::unique_ptr<Visibilities> visibilities, inFlight;
+    std::vector<iovec>		  pieces;
+
+    Tracer::setThreadName("output " + std::to_string(subband));
+
+    // Blocks are integrated into the accumulators as they arrive, and are
+    // returned to the free queue immediately, so that the device can reuse
+    // them while the integration periods are not complete yet.  Zero-copy
+    // streams may still read a block, an accumulator, or the output of the
+    // transform or compressor after the write returned; the block is
+    // returned to the free queue, and the other buffers are reused, when the
+    // writes have completed.
+    while ((visibilities = pendingQueue.remove()) != nullptr) {
+      Visibilities *input = visibilities.get();
+      Stream	   *previousStream = nullptr;
+
+      pendingQueueDepth.set(pendingQueue.size());
+
+      if (inFlight != nullptr) {
+	waitForCompletion();
+	freeQueue.append(inFlight);
+      }
 
-    while ((integratedVisibilities = pendingQueue.remove()) != nullptr) {
-      for (unsigned i = 1; i < ps.visibilitiesIntegration(); i ++) {
-	if ((visibilities = pendingQueue.remove()) == nullptr)
-	  return;
+      for (IntegrationLevel &level : integrationLevels) {
+	if (level.accumulator != nullptr) {
+	  {
+	    CPU_PerformanceCounter::Measurement measurement(integrateCounter);
+	    Tracer::Scope scope("integrate", "subband", subband);
+	    level.accumulator->accumulate(*input, level.nrIntegratedInputs == 0, ps.nrIntegrationThreads());
+	  }
 
-	*integratedVisibilities += *visibilities;
-	freeQueue.append(visibilities);
+	  if (++ level.nrIntegratedInputs < level.nrInputsPerOutput)
+	    break; // the higher levels have no new input either
+
+	  level.nrIntegratedInputs = 0;
+	  input = level.accumulator.get();
+	}
+
+	// the transform and the compressor reuse their output buffers
+	if (ps.zeroCopyOutput() && previousStream != nullptr && (outputTransform != nullptr || compressor != nullptr))
+	  previousStream->waitForCompletion();
+
+	{
+	  CPU_PerformanceCounter::Measurement measurement(writeCounter);
+	  Tracer::Scope scope("write", "subband", subband);
+
+	  input->serialize(pieces, level.outputHeader, level.integrationFactor, outputTransform.get(), level.stream != nullptr && compressor == nullptr ? level.stream->writeAlignment() : 1);
+	  const std::vector<iovec> &frame = compressor != nullptr ? compressor->compress(pieces) : pieces;
+
+	  if (level.aggregatedOutput != nullptr)
+	    level.aggregatedOutput->write(subband, input->startTime, input->endTime, frame);
+	  else
+	    level.stream->writev(frame);
+	}
+
+	previousStream = level.stream.get();
       }
 
-//#pragma omp critical (writelock)
-      integratedVisibilities->write(stream.get());
-      freeQueue.append(integratedVisibilities);
+      if (ps.zeroCopyOutput())
+	inFlight = std::move(visibilities);
+      else
+	freeQueue.append(visibilities);
+    }
+
+    if (inFlight != nullptr) {
+      waitForCompletion();
+      freeQueue.append(inFlight);
     }
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   } catch (std::exception &ex) {
@@ -77,8 +165,9 @@ std::unique_ptr<Visibilities> OutputBuffer::getVisibilitiesBuffer()
   if (!freeQueue.empty() || !ps.realTime())
     return freeQueue.remove();
 
-#pragma omp critical (clog)
-  std::clog << "Warning: dropping visibilities block for subband " << subband << std::endl;
+  nrBlocksDropped.add();
+
+  LOG(Logger::Warning, "dropping visibilities block for subband ", subband);
   return pendingQueue.remove();
 }
 
@@ -97,8 +186,11 @@ void OutputBuffer::putVisibilitiesBuffer(std::unique_ptr<Visibilities> visibilit
 	    std::cout << "bl = " << baseline << ", ch = " << channel << ", pol = " << polarization << ": " << (visibilities->visibilities)[baseline][channel][polarization] << std::endl;
 #endif
 
-  if (visibilities != nullptr) // visibilities == nullptr ==> skipped block
+  if (visibilities != nullptr) { // visibilities == nullptr ==> skipped block
     pendingQueue.append(visibilities);
+    nrBlocksWritten.add();
+    pendingQueueDepth.set(pendingQueue.size());
+  }
 
   currentTime.advanceTo(time + ps.nrSamplesPerSubbandBeforeFilter());
 }
@@ -1,32 +1,64 @@
 #ifndef ISBI_OUTPUT_BUFFER_H
 #define ISBI_OUTPUT_BUFFER_H
 
+#include "ISBI/AggregatedOutput.h"
+#include "ISBI/Compressor.h"
+#include "ISBI/OutputTransform.h"
 #include "ISBI/Parset.h"
 #include "ISBI/Visibilities.h"
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/Metrics.h"
 #include "Common/SlidingPointer.h"
 #include "Common/Stream/Stream.h"
 #include "Common/Threads/Queue.h"
 #include "Common/TimeStamp.h"
 
 #include <thread>
+#include <vector>
 
 
 class OutputBuffer
 {
   public:
-    OutputBuffer(const ISBI_Parset &, unsigned subband);
+    // with aggregated output, the blocks of each integration level are
+    // written to aggregatedOutputs[level] instead of to a stream per subband
+    OutputBuffer(const ISBI_Parset &, unsigned subband, const std::vector<AggregatedOutput *> &aggregatedOutputs = std::vector<AggregatedOutput *>());
     ~OutputBuffer();
 
     std::unique_ptr<Visibilities> getVisibilitiesBuffer();
     void putVisibilitiesBuffer(std::unique_ptr<Visibilities>, const TimeStamp &);
 
   private:
+    // Each integration level has its own output stream (or shares an
+    // AggregatedOutput with the other subbands).  A level integrates
+    // the blocks of the level below, so the higher levels cost only
+    // additions.  A level that integrates single blocks has no accumulator
+    // and writes the blocks as they are.
+    struct IntegrationLevel {
+      IntegrationLevel(const ISBI_Parset &, unsigned subband, unsigned level, AggregatedOutput *);
+
+      const unsigned		    integrationFactor;	      // in blocks
+      const unsigned		    nrInputsPerOutput;	      // blocks of the level below
+      unsigned			    nrIntegratedInputs;
+      std::unique_ptr<Stream>	    stream;		      // only if aggregatedOutput == nullptr
+      AggregatedOutput		    *aggregatedOutput;
+      std::unique_ptr<Visibilities> accumulator;
+      Visibilities::Header	    outputHeader; // kept until the next write, for zero-copy streams
+    };
+
+    void waitForCompletion();
+
     void outputThreadBody();
 
     const ISBI_Parset	   	   &ps;
     const unsigned		   subband;
     SlidingPointer<TimeStamp>      currentTime;
-    std::unique_ptr<Stream>	   stream;
+    std::vector<IntegrationLevel>  integrationLevels;
+    std::unique_ptr<OutputTransform> outputTransform; // only if ps.transformOutput()
+    std::unique_ptr<Compressor>	   compressor;	     // only if ps.outputCompression() != NoCompression
+    CPU_PerformanceCounter	   integrateCounter, writeCounter;
+    Metrics::Counter		   &nrBlocksWritten, &nrBlocksDropped;
+    Metrics::Gauge		   &pendingQueueDepth;
     Queue<std::unique_ptr<Visibilities>> freeQueue, pendingQueue;
 
     std::thread thread;
@@ -9,9 +9,26 @@
 OutputSection::OutputSection(const ISBI_Parset &ps)
 :
   ps(ps),
+  aggregatedOutputs([&] () {
+    std::vector<std::unique_ptr<AggregatedOutput>> outputs;
+
+    if (ps.aggregatedOutput()) {
+      if (ps.outputDescriptors().size() != ps.visibilitiesIntegration().size())
+	throw Exception("expected one output descriptor per integration level");
+
+      for (unsigned level = 0; level < ps.visibilitiesIntegration().size(); level ++)
+	outputs.emplace_back(new AggregatedOutput(ps, level));
+    } else if (ps.outputDescriptors().size() != ps.nrSubbands() * ps.visibilitiesIntegration().size()) {
+      throw Exception("expected one output descriptor per subband and integration level");
+    }
+
+    return outputs;
+  } ()),
   outputBuffers([&] () {
-    if (ps.outputDescriptors().size() != ps.nrSubbands())
-      throw Exception("expected the same amount of descriptors as the number of subbands");
+    std::vector<AggregatedOutput *> outputs;
+
+    for (const std::unique_ptr<AggregatedOutput> &output : aggregatedOutputs)
+      outputs.push_back(output.get());
 
     // FIXME: is it allowed to allocate a host buffer for devices[0] and use it on other devices?
 
@@ -19,7 +36,7 @@ OutputSection::OutputSection(const ISBI_Parset &ps)
 
     for (unsigned subband = 0; subband < ps.nrSubbands(); subband ++) {
       std::unique_ptr<BoundThread> bt(ps.outputBufferNodes().size() > 0 ? new BoundThread(ps.allowedCPUs(ps.outputBufferNodes()[subband])) : nullptr);
-      outputBuffers[subband] = std::unique_ptr<OutputBuffer>(new OutputBuffer(ps, subband));
+      buffers[subband] = std::unique_ptr<OutputBuffer>(new OutputBuffer(ps, subband, outputs));
     }
 
     return buffers;
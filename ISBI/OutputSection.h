@@ -1,6 +1,7 @@
 #ifndef ISBI_OUTPUT_SECTION_H
 #define ISBI_OUTPUT_SECTION_H
 
+#include "ISBI/AggregatedOutput.h"
 #include "ISBI/Parset.h"
 #include "ISBI/OutputBuffer.h"
 #include "ISBI/Visibilities.h"
@@ -19,6 +20,7 @@ class OutputSection
 
   private:
     const ISBI_Parset &ps;
+    std::vector<std::unique_ptr<AggregatedOutput>> aggregatedOutputs; // [integrationLevel], outlive the output buffers
     std::vector<std::unique_ptr<OutputBuffer>> outputBuffers;
 };
 
@@ -0,0 +1,175 @@
+#include "Common/Config.h"
+
+#include "Common/HalfPrecision.h"
+#include "ISBI/OutputTransform.h"
+
+#if defined __AVX2__ || defined __AVX512F__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+
+OutputTransform::OutputTransform(const ISBI_Parset &ps)
+:
+  nrInputBaselines(ps.nrBaselines()),
+  nrFloatsPerBaseline(ps.nrPolarizations() * ps.nrPolarizations() * COMPLEX),
+  format(ps.visibilitiesFormat())
+{
+  std::vector<std::pair<unsigned, unsigned>> stations = ps.outputBaselines();
+
+  if (stations.empty())
+    for (unsigned station0 = 0; station0 < ps.nrStations(); station0 ++)
+      for (unsigned station1 = 0; station1 <= station0; station1 ++)
+	stations.push_back(std::make_pair(station0, station1));
+
+  size_t offset = 0, scaleOffset = 0;
+
+  for (const std::pair<unsigned, unsigned> &pair : stations) {
+    unsigned factor = channelAveraging(ps, pair.first, pair.second);
+    unsigned nrChannels = ps.nrOutputChannelsPerSubband() / factor;
+
+    descriptors.push_back(Visibilities::BaselineDescriptor { (uint16_t) pair.first, (uint16_t) pair.second, (uint16_t) factor, (uint16_t) nrChannels });
+    baselineIndices.push_back(pair.first * (pair.first + 1) / 2 + pair.second);
+    outputOffsets.push_back(offset);
+    scaleOffsets.push_back(scaleOffset);
+    offset += nrChannels * ps.nrPolarizations() * ps.nrPolarizations();
+    scaleOffset += nrChannels;
+  }
+
+  output.resize(offset);
+
+  if (format != ISBI_Parset::FP32_Visibilities) {
+    scales.resize(scaleOffset);
+    packed.resize(offset * COMPLEX);
+  }
+}
+
+
+unsigned OutputTransform::channelAveraging(const ISBI_Parset &ps, unsigned station0, unsigned station1)
+{
+  unsigned factor = ps.outputChannelAveraging();
+
+  if (ps.bdaReferenceLength() > 0) {
+    const double *position0 = &ps.stationPositions()[3 * station0], *position1 = &ps.stationPositions()[3 * station1];
+    double length = std::sqrt((position0[0] - position1[0]) * (position0[0] - position1[0]) + (position0[1] - position1[1]) * (position0[1] - position1[1]) + (position0[2] - position1[2]) * (position0[2] - position1[2]));
+
+    // the largest divisor of the full factor that is at most half the
+    // current factor, so that the channels still tile the subband
+    for (double limit = ps.bdaReferenceLength(); length > limit && factor > 1; limit *= 2)
+      for (factor /= 2; ps.outputChannelAveraging() % factor != 0; factor --)
+	;
+  }
+
+  return factor;
+}
+
+
+#if defined __AVX2__
+static inline float horizontalMax(__m256 v)
+{
+  __m128 max = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+  return _mm_cvtss_f32(_mm_max_ss(max, _mm_movehdup_ps(max)));
+}
+#endif
+
+
+static inline float scaleFactor(float maxAbs)
+{
+  return maxAbs / 32767;
+}
+
+
+// converts nrGroups groups of groupSize floats (one channel of one
+// baseline) to fp16 or int16, with one scale factor per group
+
+template <ISBI_Parset::VisibilitiesFormat format> static void compress(uint16_t *out, float *scales, const float *in, unsigned nrGroups, unsigned groupSize)
+{
+  unsigned group = 0;
+
+  if (groupSize == 8) { // two polarizations
+#if defined __AVX512F__
+    for (; group + 2 <= nrGroups; group += 2) {
+      __m512 values = _mm512_loadu_ps(in + group * 8), abs = _mm512_abs_ps(values);
+      scales[group]	= scaleFactor(horizontalMax(_mm512_castps512_ps256(abs)));
+      scales[group + 1] = scaleFactor(horizontalMax(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(abs), 1))));
+
+      __m256 inverse0 = _mm256_set1_ps(scales[group] > 0 ? 1 / scales[group] : 0);
+      __m256 inverse1 = _mm256_set1_ps(scales[group + 1] > 0 ? 1 / scales[group + 1] : 0);
+      __m512 scaled = _mm512_mul_ps(values, _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(inverse0)), _mm256_castps_pd(inverse1), 1)));
+
+      if (format == ISBI_Parset::FP16_Visibilities)
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + group * 8), _mm512_cvtps_ph(scaled, _MM_FROUND_TO_NEAREST_INT));
+      else
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + group * 8), _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(scaled)));
+    }
+#endif
+
+#if defined __AVX2__ && defined __F16C__
+    for (; group < nrGroups; group ++) {
+      __m256 values = _mm256_loadu_ps(in + group * 8);
+      scales[group] = scaleFactor(horizontalMax(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), values)));
+      __m256 scaled = _mm256_mul_ps(values, _mm256_set1_ps(scales[group] > 0 ? 1 / scales[group] : 0));
+
+      if (format == ISBI_Parset::FP16_Visibilities) {
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out + group * 8), _mm256_cvtps_ph(scaled, _MM_FROUND_TO_NEAREST_INT));
+      } else {
+	__m256i integers = _mm256_cvtps_epi32(scaled);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out + group * 8), _mm_packs_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1)));
+      }
+    }
+#endif
+  }
+
+  for (; group < nrGroups; group ++) {
+    float maxAbs = 0;
+
+    for (unsigned i = 0; i < groupSize; i ++)
+      maxAbs = std::max(maxAbs, std::abs(in[group * groupSize + i]));
+
+    scales[group] = scaleFactor(maxAbs);
+    float inverse = scales[group] > 0 ? 1 / scales[group] : 0;
+
+    for (unsigned i = 0; i < groupSize; i ++)
+      if (format == ISBI_Parset::FP16_Visibilities)
+	out[group * groupSize + i] = floatToHalf(in[group * groupSize + i] * inverse);
+      else
+	out[group * groupSize + i] = (int16_t) std::max(-32768.0f, std::min(32767.0f, std::nearbyint(in[group * groupSize + i] * inverse)));
+  }
+}
+
+
+const void *OutputTransform::apply(const Visibilities &visibilities, unsigned nrThreads)
+{
+  const float *input = reinterpret_cast<const float *>(visibilities.hostVisibilities.origin());
+  size_t      channelStride = (size_t) nrInputBaselines * nrFloatsPerBaseline;
+
+#pragma omp parallel for schedule(dynamic) num_threads(nrThreads) if(nrThreads > 1)
+  for (unsigned baseline = 0; baseline < descriptors.size(); baseline ++) {
+    const float *in	  = input + (size_t) baselineIndices[baseline] * nrFloatsPerBaseline;
+    float	*out	  = reinterpret_cast<float *>(&output[outputOffsets[baseline]]);
+    unsigned	factor	  = descriptors[baseline].channelAveraging;
+    float	scale	  = 1.0f / factor;
+
+    for (unsigned channel = 0; channel < descriptors[baseline].nrChannels; channel ++) {
+      float sum[2 * 2 * COMPLEX] = { 0 };
+
+      for (unsigned subChannel = 0; subChannel < factor; subChannel ++)
+	for (unsigned i = 0; i < nrFloatsPerBaseline; i ++)
+	  sum[i] += in[(size_t) (channel * factor + subChannel) * channelStride + i];
+
+      for (unsigned i = 0; i < nrFloatsPerBaseline; i ++)
+	out[channel * nrFloatsPerBaseline + i] = sum[i] * scale;
+    }
+
+    if (format == ISBI_Parset::FP16_Visibilities)
+      compress<ISBI_Parset::FP16_Visibilities>(&packed[outputOffsets[baseline] * COMPLEX], &scales[scaleOffsets[baseline]], out, descriptors[baseline].nrChannels, nrFloatsPerBaseline);
+    else if (format == ISBI_Parset::I16_Visibilities)
+      compress<ISBI_Parset::I16_Visibilities>(&packed[outputOffsets[baseline] * COMPLEX], &scales[scaleOffsets[baseline]], out, descriptors[baseline].nrChannels, nrFloatsPerBaseline);
+  }
+
+  return format == ISBI_Parset::FP32_Visibilities ? (const void *) output.data() : (const void *) packed.data();
+}
@@ -0,0 +1,55 @@
+#ifndef ISBI_OUTPUT_TRANSFORM_H
+#define ISBI_OUTPUT_TRANSFORM_H
+
+#include "ISBI/Parset.h"
+#include "ISBI/Visibilities.h"
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+
+// Reduces the visibilities before they are written: selects the baselines
+// from outputBaselines() and averages outputChannelAveraging() adjacent
+// channels.  With baseline-dependent averaging, the averaging factor of a
+// baseline is halved every time its length doubles beyond
+// bdaReferenceLength(), which keeps the decorrelation by frequency smearing
+// about the same for all baselines.  The result is stored per baseline in a
+// buffer that belongs to the transform, so every output thread needs its
+// own OutputTransform.
+//
+// For fp16 and int16 output, every baseline and channel gets a scale factor
+// that maps its largest real or imaginary part to 32767.  The conversion is
+// done per baseline, while the averaged visibilities are still in cache.
+
+class OutputTransform
+{
+  public:
+    OutputTransform(const ISBI_Parset &);
+
+    // returns [baseline][channel][polarization][polarization] complex
+    // values in the output format, in the order of baselines()
+    const void *apply(const Visibilities &, unsigned nrThreads = 1);
+
+    const std::vector<Visibilities::BaselineDescriptor> &baselines() const { return descriptors; }
+    const std::vector<unsigned> &inputBaselines() const { return baselineIndices; }
+    const std::vector<float> &scaleFactors() const { return scales; } // [baseline][channel], empty for fp32
+    size_t nrVisibilities() const { return output.size(); }
+    size_t outputSize() const { return format == ISBI_Parset::FP32_Visibilities ? output.size() * sizeof(std::complex<float>) : packed.size() * sizeof(uint16_t); }
+    ISBI_Parset::VisibilitiesFormat outputFormat() const { return format; }
+
+    static unsigned channelAveraging(const ISBI_Parset &, unsigned station0, unsigned station1);
+
+  private:
+    const unsigned	nrInputBaselines, nrFloatsPerBaseline;
+    const ISBI_Parset::VisibilitiesFormat format;
+    std::vector<Visibilities::BaselineDescriptor> descriptors;
+    std::vector<unsigned> baselineIndices; // [baseline], index in the input
+    std::vector<size_t>	outputOffsets;	   // [baseline], in visibilities
+    std::vector<size_t>	scaleOffsets;	   // [baseline], in channels
+    std::vector<std::complex<float>> output;
+    std::vector<float>	scales;
+    std::vector<uint16_t> packed;	   // fp16 or int16
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <algorithm>
 #include <cmath>
+#include <set>
 
 
 #if 0
@@ -22,11 +23,56 @@ std::vector<std::string> AARTFAAC_Parset::getDescriptors(const std::string &arg)
 #endif
 
 
+// parses a list like "0-1,3-*": station pairs, where '*' stands for all
+// stations
+
+static std::vector<std::pair<unsigned, unsigned>> getBaselines(const std::vector<std::string> &pairs, unsigned nrStations)
+{
+  std::set<std::pair<unsigned, unsigned>> baselines; // sorted by (station0, station1), i.e., in baseline order
+
+  for (const std::string &pair : pairs) {
+    size_t dash = pair.find('-');
+
+    if (dash == std::string::npos)
+      throw Parset::Error("cannot parse baseline \'" + pair + '\'');
+
+    std::string stations[2] = { pair.substr(0, dash), pair.substr(dash + 1) };
+
+    for (unsigned station0 = 0; station0 < nrStations; station0 ++)
+      for (unsigned station1 = 0; station1 < nrStations; station1 ++)
+	if ((stations[0] == "*" || boost::lexical_cast<unsigned>(stations[0]) == station0) && (stations[1] == "*" || boost::lexical_cast<unsigned>(stations[1]) == station1))
+	  baselines.insert(std::make_pair(std::max(station0, station1), std::min(station0, station1)));
+
+    if ((stations[0] != "*" && boost::lexical_cast<unsigned>(stations[0]) >= nrStations) || (stations[1] != "*" && boost::lexical_cast<unsigned>(stations[1]) >= nrStations))
+      throw Parset::Error("station number in baseline \'" + pair + "\' out of range");
+  }
+
+  return std::vector<std::pair<unsigned, unsigned>>(baselines.begin(), baselines.end());
+}
+
+
 ISBI_Parset::ISBI_Parset(int argc, char **argv)
 :
   CorrelatorParset(argc, argv, false),
   _nrRingBufferSamplesPerSubband(128015360),
-  _visibilitiesIntegration(1),
+  _visibilitiesIntegration(1, 1),
+  _nrIntegrationThreads(4),
+  _outputChannelAveraging(1),
+  _bdaReferenceLength(0),
+  _visibilitiesFormat(FP32_Visibilities),
+  _outputCompression(NoCompression),
+  _compressionLevel(1),
+  _compressionChunkSize(1 << 20),
+  _nrCompressionThreads(4),
+  _zeroCopyOutput(false),
+  _aggregatedOutput(false),
+  _outputFileDuration(0),
+  _performanceReportInterval(0),
+  _hardwareCounters(false),
+  _cpuEnergy(false),
+  _metricsPort(0),
+  _metricsInterval(1),
+  _logLevel(Logger::Info),
   _maxDelaySamples(1000)
 {
   using namespace boost::program_options;
@@ -41,8 +87,58 @@ ISBI_Parset::ISBI_Parset(int argc, char **argv)
     ("outputBufferNodes,O", value<std::string>()->notifier([this] (std::string arg) { _outputBufferNodes = getNodeVector(arg.c_str()); }))
 #endif
     ("nrRingBufferSamplesPerSubband,T", value<unsigned>(&_nrRingBufferSamplesPerSubband))
-    ("visibilitiesIntegration,I", value<unsigned>(&_visibilitiesIntegration))
+    ("visibilitiesIntegration,I", value<std::string>()->notifier([this] (std::string arg) { _visibilitiesIntegration = splitArgs<unsigned>(arg); } ))
+    ("nrIntegrationThreads", value<unsigned>(&_nrIntegrationThreads))
     ("delayFile,delayFile", value<std::string>()->notifier([this] (std::string arg) { _delayFile = arg; } ))
+    ("outputBaselines", value<std::string>()->notifier([this] (std::string arg) { _outputBaselines = getBaselines(splitArgs<std::string>(arg), nrStations()); } ))
+    ("outputChannelAveraging", value<unsigned>(&_outputChannelAveraging))
+    ("stationPositions", value<std::string>()->notifier([this] (std::string arg) { _stationPositions = splitArgs<double>(arg); } ))
+    ("bdaReferenceLength", value<double>(&_bdaReferenceLength))
+    ("visibilitiesFormat", value<std::string>()->notifier([this] (const std::string &arg) {
+      if (arg == "fp32")
+	_visibilitiesFormat = FP32_Visibilities;
+      else if (arg == "fp16")
+	_visibilitiesFormat = FP16_Visibilities;
+      else if (arg == "i16")
+	_visibilitiesFormat = I16_Visibilities;
+      else
+	throw Error("visibilities format must be \"fp32\", \"fp16\", or \"i16\"");
+    }))
+    ("outputCompression", value<std::string>()->notifier([this] (const std::string &arg) {
+      if (arg == "none")
+	_outputCompression = NoCompression;
+      else if (arg == "lz4")
+	_outputCompression = LZ4_Compression;
+      else if (arg == "zstd")
+	_outputCompression = ZSTD_Compression;
+      else
+	throw Error("output compression must be \"none\", \"lz4\", or \"zstd\"");
+    }))
+    ("compressionLevel", value<int>(&_compressionLevel))
+    ("compressionChunkSize", value<unsigned>(&_compressionChunkSize))
+    ("nrCompressionThreads", value<unsigned>(&_nrCompressionThreads))
+    ("zeroCopyOutput", value<bool>(&_zeroCopyOutput))
+    ("aggregatedOutput", value<bool>(&_aggregatedOutput))
+    ("outputFileDuration", value<double>(&_outputFileDuration))
+    ("performanceReportInterval", value<double>(&_performanceReportInterval))
+    ("hardwareCounters", value<bool>(&_hardwareCounters))
+    ("cpuEnergy", value<bool>(&_cpuEnergy))
+    ("metricsPort", value<uint16_t>(&_metricsPort))
+    ("metricsFile", value<std::string>(&_metricsFile))
+    ("metricsInterval", value<double>(&_metricsInterval))
+    ("traceFile", value<std::string>(&_traceFile))
+    ("logLevel", value<std::string>()->notifier([this] (const std::string &arg) {
+      if (arg == "debug")
+	_logLevel = Logger::Debug;
+      else if (arg == "info")
+	_logLevel = Logger::Info;
+      else if (arg == "warning")
+	_logLevel = Logger::Warning;
+      else if (arg == "error")
+	_logLevel = Logger::Error;
+      else
+	throw Error("log level must be \"debug\", \"info\", \"warning\", or \"error\"");
+    }))
   ;
 
 
@@ -56,11 +152,55 @@ ISBI_Parset::ISBI_Parset(int argc, char **argv)
     throw Error(std::string("unrecognized argument \'") + toPassFurther[0] + '\'');
 
 
+  if (_visibilitiesIntegration.size() == 0 || _visibilitiesIntegration[0] == 0)
+    throw Error("visibilitiesIntegration must be at least 1");
+
+  // every level integrates whole blocks of the level below
+  for (unsigned level = 1; level < _visibilitiesIntegration.size(); level ++)
+    if (_visibilitiesIntegration[level] <= _visibilitiesIntegration[level - 1] || _visibilitiesIntegration[level] % _visibilitiesIntegration[level - 1] != 0)
+      throw Error("each visibilitiesIntegration factor must be a larger multiple of the previous one");
+
+  if (_nrIntegrationThreads == 0)
+    throw Error("nrIntegrationThreads must be at least 1");
+
+  if (_outputChannelAveraging == 0 || nrOutputChannelsPerSubband() % _outputChannelAveraging != 0)
+    throw Error("outputChannelAveraging must divide the number of output channels");
+
+  if (_bdaReferenceLength > 0 && _stationPositions.size() != 3 * nrStations())
+    throw Error("baseline-dependent averaging requires three stationPositions coordinates per station");
+
+#if !defined HAVE_LZ4
+  if (_outputCompression == LZ4_Compression)
+    throw Error("LZ4 output compression requires a build with HAVE_LZ4");
+#endif
+
+#if !defined HAVE_ZSTD
+  if (_outputCompression == ZSTD_Compression)
+    throw Error("zstd output compression requires a build with HAVE_ZSTD");
+#endif
+
+  // chunks hold whole samples, so that the byte shuffle does not straddle
+  // chunk boundaries
+  if (_compressionChunkSize == 0 || _compressionChunkSize % 16 != 0)
+    throw Error("compressionChunkSize must be a positive multiple of 16");
+
+  if (_nrCompressionThreads == 0)
+    throw Error("nrCompressionThreads must be at least 1");
+
+  if (_outputFileDuration < 0)
+    throw Error("outputFileDuration must not be negative");
+
+  if (_performanceReportInterval < 0)
+    throw Error("performanceReportInterval must not be negative");
+
+  if (_metricsInterval <= 0)
+    throw Error("metricsInterval must be positive");
+
 #if defined __linux__
   if (_inputBufferNodes.size() != 0 && _inputBufferNodes.size() != _inputDescriptors.size())
     throw Error("input buffer node list has unexpected size");
 
-  if (_outputBufferNodes.size() != 0 && _outputBufferNodes.size() != _outputDescriptors.size())
+  if (_outputBufferNodes.size() != 0 && _outputBufferNodes.size() != nrSubbands())
     throw Error("output buffer node list has unexpected size");
 #endif
 
@@ -1,24 +1,89 @@
 #if !defined ISBI_PARSET_H
 #define ISBI_PARSET_H
 
+#include "Common/Logger.h"
 #include "Correlator/Parset.h"
 
+#include <utility>
+
 class ISBI_Parset : public CorrelatorParset
 {
   public:
+    enum VisibilitiesFormat { FP32_Visibilities, FP16_Visibilities, I16_Visibilities };
+    enum OutputCompression { NoCompression, LZ4_Compression, ZSTD_Compression };
+
     ISBI_Parset(int argc, char **argv);
 
     const std::vector<std::string> &inputDescriptors() const { return _inputDescriptors; }
     const std::vector<std::string> &outputDescriptors() const { return _outputDescriptors; }
+    const std::string &outputDescriptor(unsigned integrationLevel, unsigned subband) const { return _outputDescriptors[integrationLevel * nrSubbands() + subband]; }
 
 #if defined __linux__
     std::vector<unsigned>  inputBufferNodes() const { return _inputBufferNodes; }
     std::vector<unsigned>  outputBufferNodes() const { return _outputBufferNodes; }
 #endif
 
-    unsigned visibilitiesIntegration() const { return _visibilitiesIntegration; }
+    // one factor (in blocks) per integration level, ascending
+    const std::vector<unsigned> &visibilitiesIntegration() const { return _visibilitiesIntegration; }
+    unsigned nrIntegrationThreads() const { return _nrIntegrationThreads; }
     unsigned nrRingBufferSamplesPerSubband() const { return _nrRingBufferSamplesPerSubband; }
 
+    // Output transform: the selected (station0, station1) pairs, with
+    // station0 >= station1 and in baseline order (all baselines if empty),
+    // the number of adjacent output channels that are averaged, and for
+    // baseline-dependent averaging, the baseline length (in meters) up to
+    // which the full averaging factor is used
+    const std::vector<std::pair<unsigned, unsigned>> &outputBaselines() const { return _outputBaselines; }
+    unsigned outputChannelAveraging() const { return _outputChannelAveraging; }
+    const std::vector<double> &stationPositions() const { return _stationPositions; } // [station][3], ITRF
+    double   bdaReferenceLength() const { return _bdaReferenceLength; }
+    VisibilitiesFormat visibilitiesFormat() const { return _visibilitiesFormat; }
+    bool     transformOutput() const { return _outputBaselines.size() > 0 || _outputChannelAveraging > 1 || _bdaReferenceLength > 0 || _visibilitiesFormat != FP32_Visibilities; }
+
+    // Output compression: the codec, its level (zstd only), the number of
+    // uncompressed bytes per independently compressed chunk, and the number
+    // of threads that compress the chunks of a block
+    OutputCompression outputCompression() const { return _outputCompression; }
+    int      compressionLevel() const { return _compressionLevel; }
+    unsigned compressionChunkSize() const { return _compressionChunkSize; }
+    unsigned nrCompressionThreads() const { return _nrCompressionThreads; }
+
+    // write the output with O_DIRECT (file:), vmsplice (pipe:), or
+    // MSG_ZEROCOPY (tcp:)
+    bool     zeroCopyOutput() const { return _zeroCopyOutput; }
+
+    // write all subbands of an integration level into one (rotated) file,
+    // with one output descriptor per integration level; see AggregatedOutput
+    bool     aggregatedOutput() const { return _aggregatedOutput; }
+    double   outputFileDuration() const { return _outputFileDuration; } // seconds; 0: one file
+
+    // with profiling, print the host-side performance counters every this
+    // many seconds; 0: only at the end
+    double   performanceReportInterval() const { return _performanceReportInterval; }
+
+    // with profiling, also count CPU events (cycles, instructions, LLC misses,
+    // stall cycles) in the host-side performance counters; see
+    // HardwareCounters
+    bool     hardwareCounters() const { return _hardwareCounters; }
+
+    // with profiling, also measure the energy of the CPU packages and DRAM
+    // (RAPL) per performance report interval and for the whole run
+    bool     cpuEnergy() const { return _cpuEnergy; }
+
+    // health metrics: served in the Prometheus text format on
+    // http://127.0.0.1:metricsPort/metrics (0: not served), and written as
+    // JSON to metricsFile every metricsInterval seconds ("": not written)
+    uint16_t metricsPort() const { return _metricsPort; }
+    const std::string &metricsFile() const { return _metricsFile; }
+    double   metricsInterval() const { return _metricsInterval; }
+
+    // write a timeline of the pipeline stages as Chrome trace-event JSON
+    // ("": no timeline); see Tracer
+    const std::string &traceFile() const { return _traceFile; }
+
+    // log messages below this severity are discarded; see Logger
+    Logger::Severity logLevel() const { return _logLevel; }
+
     const int maxDelay() const { return _maxDelaySamples; }; 
     const std::string delayFile() const { return _delayFile; }
     
@@ -33,7 +98,27 @@ class ISBI_Parset : public CorrelatorParset
 #endif
 
     unsigned _nrRingBufferSamplesPerSubband;
-    unsigned _visibilitiesIntegration;
+    std::vector<unsigned> _visibilitiesIntegration;
+    unsigned _nrIntegrationThreads;
+    std::vector<std::pair<unsigned, unsigned>> _outputBaselines;
+    unsigned _outputChannelAveraging;
+    std::vector<double> _stationPositions;
+    double   _bdaReferenceLength;
+    VisibilitiesFormat _visibilitiesFormat;
+    OutputCompression _outputCompression;
+    int      _compressionLevel;
+    unsigned _compressionChunkSize, _nrCompressionThreads;
+    bool     _zeroCopyOutput;
+    bool     _aggregatedOutput;
+    double   _outputFileDuration;
+    double   _performanceReportInterval;
+    bool     _hardwareCounters;
+    bool     _cpuEnergy;
+    uint16_t _metricsPort;
+    std::string _metricsFile;
+    double   _metricsInterval;
+    std::string _traceFile;
+    Logger::Severity _logLevel;
     int _maxDelaySamples;
 };
 
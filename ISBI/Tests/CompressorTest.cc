@@ -0,0 +1,191 @@
+#include "Common/Config.h"
+
+#include "Common/HostBuffer.h"
+#include "Common/Stream/FileStream.h"
+#include "ISBI/Compressor.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Visibilities.h"
+
+#include <complex>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+// Checks the byte shuffle, and compresses blocks of visibilities and random
+// (incompressible) data with every codec that is compiled in, reads them back
+// in parallel, and compares them with the original blocks.  Frames with
+// corrupt headers must be rejected.
+
+static bool testShuffle()
+{
+  bool ok = true;
+  std::vector<char> in(1003), shuffled(in.size()), out(in.size());
+
+  for (size_t i = 0; i < in.size(); i ++)
+    in[i] = i * 7;
+
+  for (unsigned elementSize : { 2, 4 }) {
+    Compressor::shuffle(shuffled.data(), in.data(), in.size(), elementSize);
+    Compressor::unshuffle(out.data(), shuffled.data(), in.size(), elementSize);
+
+    ok &= out == in;
+    ok &= shuffled[1] == in[elementSize] && shuffled[in.size() / elementSize] == in[1];
+  }
+
+  return ok;
+}
+
+
+// a frame with inconsistent headers must be rejected as corrupt before
+// anything is decompressed; a truncated frame must be rejected at all
+
+static bool readFails(const std::vector<char> &frame, const char *expectedError = "corrupt frame")
+{
+  char name[] = "/tmp/CompressorTest-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create output file");
+
+  close(fd);
+
+  {
+    FileStream stream(name, 0666);
+    stream.write(frame.data(), frame.size());
+  }
+
+  FileStream stream(name);
+  std::vector<char> block;
+  bool failed = false;
+
+  try {
+    Compressor::read(&stream, block, 2);
+  } catch (std::exception &ex) {
+    failed = expectedError == nullptr || strcmp(ex.what(), expectedError) == 0;
+  }
+
+  unlink(name);
+  return failed;
+}
+
+
+static bool testCorruptFrames(const ISBI_Parset &ps, const std::vector<iovec> &pieces)
+{
+  Compressor compressor(ps, 0);
+  std::vector<char> frame;
+
+  for (const iovec &piece : compressor.compress(pieces))
+    frame.insert(frame.end(), static_cast<char *>(piece.iov_base), static_cast<char *>(piece.iov_base) + piece.iov_len);
+
+  Compressor::FrameHeader frameHeader;
+  memcpy(&frameHeader, frame.data(), sizeof frameHeader);
+
+  auto chunkHeader = [&] (std::vector<char> &frame, unsigned chunk) {
+    return reinterpret_cast<Compressor::ChunkHeader *>(frame.data() + sizeof(Compressor::FrameHeader)) + chunk;
+  };
+
+  std::vector<char> tooLargeChunk(frame), pastEndOfBlock(frame), wrongCompressedSize(frame), wrongNrChunks(frame);
+  std::vector<char> truncated(frame.begin(), frame.end() - 1);
+
+  chunkHeader(tooLargeChunk, 0)->size = frameHeader.chunkSize + 1;
+  chunkHeader(pastEndOfBlock, frameHeader.nrChunks - 1)->size = frameHeader.chunkSize; // the last chunk is not full
+  chunkHeader(wrongCompressedSize, 0)->compressedSize --;
+  reinterpret_cast<Compressor::FrameHeader *>(wrongNrChunks.data())->nrChunks ++;
+
+  return frameHeader.size % frameHeader.chunkSize != 0 && readFails(tooLargeChunk) && readFails(pastEndOfBlock) && readFails(wrongCompressedSize) && readFails(wrongNrChunks) && readFails(truncated, nullptr);
+}
+
+
+static bool testCodec(int argc, char **argv, const char *codec)
+{
+  const char *args[] = { argv[0], "-n", "48", "-c", "9", "-t", "32", "-s", "1", "--outputCompression", codec, "--compressionChunkSize", "4096", "--nrCompressionThreads", "2" };
+  ISBI_Parset ps(sizeof args / sizeof *args, const_cast<char **>(args));
+
+  Visibilities visibilities(ps, 0);
+  std::complex<float> *samples = visibilities.hostVisibilities.origin();
+
+  for (size_t i = 0; i < visibilities.hostVisibilities.num_elements(); i ++)
+    samples[i] = std::complex<float>(i % 64, (i % 16) * .25f);
+
+  // the random piece does not compress, and does not end on a chunk boundary
+  std::vector<iovec> pieces;
+  Visibilities::Header outputHeader;
+  visibilities.serialize(pieces, outputHeader, 1);
+
+  std::vector<char> random(10001);
+  std::mt19937 generator;
+
+  for (char &byte : random)
+    byte = generator();
+
+  pieces.push_back(iovec { random.data(), random.size() });
+
+  std::vector<char> expected;
+
+  for (const iovec &piece : pieces)
+    expected.insert(expected.end(), static_cast<char *>(piece.iov_base), static_cast<char *>(piece.iov_base) + piece.iov_len);
+
+  char name[] = "/tmp/CompressorTest-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create output file");
+
+  close(fd);
+
+  {
+    Compressor compressor(ps, 0);
+    FileStream stream(name, 0666);
+    compressor.write(&stream, pieces);
+    compressor.write(&stream, pieces);
+  }
+
+  FileStream stream(name);
+  std::vector<char> block;
+  bool ok = true;
+
+  for (unsigned frame = 0; frame < 2; frame ++)
+    ok &= Compressor::read(&stream, block, 2) && block == expected;
+
+  // two compressed frames take less space than one uncompressed block
+  ok &= !Compressor::read(&stream, block);
+  ok &= (size_t) lseek(fd = open(name, O_RDONLY), 0, SEEK_END) < expected.size();
+  close(fd);
+  unlink(name);
+  return ok && testCorruptFrames(ps, pieces);
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running CompressorTest" << std::endl;
+
+    HostBuffer::usePageLockedMemory = false;
+
+    bool ok = testShuffle();
+
+#if defined HAVE_LZ4
+    ok &= testCodec(argc, argv, "lz4");
+#endif
+
+#if defined HAVE_ZSTD
+    ok &= testCodec(argc, argv, "zstd");
+#endif
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
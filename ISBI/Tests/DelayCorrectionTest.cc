@@ -0,0 +1,203 @@
+#include "Common/Config.h"
+
+#include "Correlator/CPU_Filter.h"
+#include "ISBI/DelayCorrection.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Fits delay polynomials of order 1 to 3 to a quadratic and a cubic delay
+// model, given in a delay file with a point at every clock tick (so that the
+// interpolation in DelayCorrection is exact).  If the order is at least the
+// degree of the model, the coefficients must be the ones of the model;
+// otherwise, the polynomial must still go through the model at the
+// Chebyshev-Lobatto nodes.  In both cases, maxResidual must be the largest
+// deviation at the check points, which is close to the largest deviation
+// anywhere in the block.  Finally, the fringe rotation that CPU_Filter
+// applies for these delays must be DelayCorrection::phasor().
+
+static const char	*startTime = "2024-01-01_00:00:00";
+static const unsigned	clockSpeed = 32000000;
+
+
+// the delay of station 1 (station 0 is the reference, without delay) in
+// seconds, as a polynomial in the channel-sample index t within the block
+struct Model {
+  double c[4];
+
+  double operator () (double t) const { return ((c[3] * t + c[2]) * t + c[1]) * t + c[0]; }
+};
+
+
+static std::unique_ptr<ISBI_Parset> makeParset(char *argv0, unsigned order, const std::string &delayFile)
+{
+  std::string orderString = std::to_string(order);
+  const char *args[] = { argv0, "-n", "2", "-c", "16", "-t", "256", "-s", "1", "-F", "6.6e9", "-D", startTime, "-d", "1", "--delayPolynomialOrder", orderString.c_str(), "--delayFile", delayFile.c_str() };
+
+  return std::unique_ptr<ISBI_Parset>(new ISBI_Parset(sizeof args / sizeof *args, const_cast<char **>(args)));
+}
+
+
+static void writeModel(const std::string &name, const TimeStamp &blockTime, unsigned nrTicksPerChannelSample, unsigned nrTicks, const Model &model)
+{
+  std::ofstream file(name, std::ios::binary);
+
+  for (unsigned station = 0; station < 2; station ++) {
+    uint32_t n = nrTicks + 1;
+    file.write(reinterpret_cast<const char *>(&n), sizeof n);
+
+    for (unsigned tick = 0; tick <= nrTicks; tick ++) {
+      int64_t time = (int64_t) blockTime + tick;
+      double  delay = station == 0 ? 0 : model((double) tick / nrTicksPerChannelSample);
+
+      file.write(reinterpret_cast<const char *>(&time), sizeof time);
+      file.write(reinterpret_cast<const char *>(&delay), sizeof delay);
+    }
+  }
+}
+
+
+static bool testFit(char *argv0, const char *name, const Model &model, unsigned degree)
+{
+  bool ok = true;
+
+  for (unsigned order = 1; order <= DelayCorrection::maxPolynomialOrder; order ++) {
+    TemporaryFile delayFile("/tmp/DelayCorrectionTest");
+    std::unique_ptr<ISBI_Parset> ps = makeParset(argv0, order, delayFile.name);
+
+    unsigned N = ps->nrSamplesPerChannel(), ticksPerSample = ps->nrChannelsPerSubbandBeforeFilter();
+    writeModel(delayFile.name, ps->startTime(), ticksPerSample, N * ticksPerSample, model);
+
+    DelayCorrection delayCorrection(*ps);
+    std::vector<DelayCorrection::StationDelay> delays(ps->nrStations());
+    delayCorrection.stationDelays(ps->startTime(), delays);
+
+    const DelayCorrection::StationDelay &delay = delays[1];
+    int64_t integerSamples = std::llround(model(0) * clockSpeed);
+    double  remainder = (double) integerSamples / clockSpeed;
+    bool    orderOK = delay.integerSamples == integerSamples && delays[0].maxResidual == 0;
+
+    // the polynomial is negated, like the filter expects it
+    auto residual = [&] (double t) { return model(t) - remainder + DelayCorrection::evaluate(delay, order, t); };
+
+    if (order >= degree) {
+      for (unsigned k = 0; k <= order; k ++) {
+	double expected = k == 0 ? model.c[0] - remainder : model.c[k];
+	orderOK &= std::abs(-delay.d[k] - expected) <= 1e-5 * std::abs(expected) + 1e-25;
+      }
+
+      orderOK &= delay.maxResidual <= 1e-14;
+    } else {
+      for (unsigned j = 0; j <= order; j ++) {
+	double node = std::llround((.5 - .5 * std::cos(M_PI * j / order)) * N * ticksPerSample) / (double) ticksPerSample;
+	orderOK &= std::abs(residual(node)) <= 1e-14;
+      }
+
+      double maxDeviation = 0;
+
+      for (unsigned tick = 0; tick <= N * ticksPerSample; tick ++)
+	maxDeviation = std::max(maxDeviation, std::abs(residual((double) tick / ticksPerSample)));
+
+      orderOK &= delay.maxResidual <= maxDeviation * (1 + 1e-6) && delay.maxResidual >= .9 * maxDeviation && maxDeviation > 1e-12;
+    }
+
+    std::cout << name << " model, order " << order << ": residual " << delay.maxResidual * 1e12 << " ps" << (orderOK ? "" : " (wrong)") << std::endl;
+    ok &= orderOK;
+  }
+
+  return ok;
+}
+
+
+// runs the filter with the fitted delays and with zero delays; the ratio of
+// the outputs of each channel and time must be the phasor
+
+static bool testPhasor(char *argv0, const Model &model, unsigned order)
+{
+  TemporaryFile delayFile("/tmp/DelayCorrectionTest");
+  std::unique_ptr<ISBI_Parset> ps = makeParset(argv0, order, delayFile.name);
+
+  unsigned N = ps->nrSamplesPerChannel(), nrChannels = ps->nrChannelsPerSubband(), ticksPerSample = ps->nrChannelsPerSubbandBeforeFilter();
+  writeModel(delayFile.name, ps->startTime(), ticksPerSample, N * ticksPerSample, model);
+
+  DelayCorrection delayCorrection(*ps);
+  std::vector<DelayCorrection::StationDelay> delays(ps->nrStations());
+  delayCorrection.stationDelays(ps->startTime(), delays);
+
+  std::vector<float> hostDelays(ps->nrStations() * (order + 1)), zeroDelays(hostDelays.size(), 0);
+
+  for (unsigned station = 0; station < ps->nrStations(); station ++)
+    for (unsigned k = 0; k <= order; k ++)
+      hostDelays[station * (order + 1) + k] = delays[station].d[k];
+
+  std::vector<int8_t> input((size_t) ps->nrStations() * ps->nrPolarizations() * (N + NR_TAPS - 1) * ticksPerSample);
+  std::mt19937 generator(7);
+  std::normal_distribution<float> noise(0, 16);
+
+  for (int8_t &sample : input)
+    sample = (int8_t) std::max(-127.0f, std::min(127.0f, std::round(noise(generator))));
+
+  CPU_Filter filter(*ps, false, CPU_Filter::fp32);
+  std::vector<float> delayed(filter.outputBufferSize() / sizeof(float)), reference(delayed.size());
+  double subbandFrequency = ps->subbandFrequencies()[0];
+
+  filter.launch(delayed.data(), input.data(), hostDelays.data(), subbandFrequency);
+  filter.launch(reference.data(), input.data(), zeroDelays.data(), subbandFrequency);
+
+  double maxError = 0, maxValue = 0;
+  unsigned T = filter.nrTimesPerBlock();
+
+  for (unsigned channel = 0; channel < nrChannels; channel ++)
+    for (unsigned time = 0; time < N; time ++)
+      for (unsigned station = 0; station < ps->nrStations(); station ++)
+	for (unsigned pol = 0; pol < ps->nrPolarizations(); pol ++) {
+	  size_t index = (((((size_t) channel * (N / T) + time / T) * ps->nrStations() + station) * ps->nrPolarizations() + pol) * T + time % T) * COMPLEX;
+	  double frequency = subbandFrequency - .5 * ps->subbandBandwidth() + channel * ps->subbandBandwidth() / nrChannels;
+	  std::complex<double> expected = std::complex<double>(reference[index + REAL], reference[index + IMAG]) * DelayCorrection::phasor(delays[station], order, frequency, time);
+
+	  maxValue = std::max(maxValue, std::abs(expected));
+	  maxError = std::max(maxError, std::abs(std::complex<double>(delayed[index + REAL], delayed[index + IMAG]) - expected));
+	}
+
+  bool ok = maxError <= 1e-5 * maxValue;
+
+  std::cout << "phasor, order " << order << ": max error " << maxError << " of " << maxValue << (ok ? "" : " (too large)") << std::endl;
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running DelayCorrectionTest" << std::endl;
+
+    // about 39.4 samples of delay, and a few ns of change within the block
+    const Model quadratic { { 1.23e-6, 2e-12, 3e-14, 0 } };
+    const Model cubic	  { { 1.23e-6, 2e-12, -1e-14, 1e-16 } };
+
+    bool ok = testFit(argv[0], "quadratic", quadratic, 2) && testFit(argv[0], "cubic", cubic, 3);
+
+    for (unsigned order = 1; order <= DelayCorrection::maxPolynomialOrder; order ++)
+      ok &= testPhasor(argv[0], cubic, order);
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
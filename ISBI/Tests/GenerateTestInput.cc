@@ -0,0 +1,162 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/Descriptor.h"
+#include "Common/TimeStamp.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#include <boost/program_options.hpp>
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Generates VDIF test input with a known correlated signal (see Generator
+// in SyntheticInput.h): every station observes the same noise, delayed by
+// the delay of the station in --delayFile (the format that DelayCorrection
+// reads), plus, with --correlation below 1, noise of its own.  The samples
+// are quantized to --bits (1 or 2) bits.  With --loss or --corruption, that
+// fraction of the frames is left out or gets an invalid header.
+//
+// There is one output descriptor per station (see createStream(); a single
+// descriptor with "%u" in it is expanded for --stations stations), e.g.
+//   ISBI/Tests/GenerateTestInput --stations 8 --duration 10 -D 2024-01-01_00:00:00 --delayFile delays.bin /dev/shm/station-%u.vdif
+//   ISBI/Tests/GenerateTestInput --realTime 10.0.0.1:4000 10.0.0.1:4001
+// A host:port descriptor sends one frame per UDP datagram, as a station
+// does; with --realTime, a frame is sent when its last sample would have
+// been observed.  Otherwise, the data are generated as fast as possible,
+// one thread per station.
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    using namespace boost::program_options;
+
+    std::vector<std::string> outputs;
+    std::string startTimeString, delayFile;
+    unsigned	nrStations, nrChannels, nrBitsPerSample, payloadSize, sampleRate;
+    double	duration, correlation, loss, corruption;
+    uint32_t	seed;
+    bool	realTime;
+
+    options_description allowed_options;
+
+    allowed_options.add_options()
+      ("stations", value<unsigned>(&nrStations)->default_value(0), "the number of outputs if 0")
+      ("nchan", value<unsigned>(&nrChannels)->default_value(16))
+      ("bits", value<unsigned>(&nrBitsPerSample)->default_value(2))
+      ("payloadSize", value<unsigned>(&payloadSize)->default_value(8000))
+      ("sampleRate", value<unsigned>(&sampleRate)->default_value(32000000))
+      ("startTime,D", value<std::string>(&startTimeString), "YYYY-MM-DD_hh:mm:ss, as for the correlator; the next second if omitted")
+      ("duration", value<double>(&duration)->default_value(1), "seconds")
+      ("delayFile", value<std::string>(&delayFile))
+      ("correlation", value<double>(&correlation)->default_value(1), "the fraction of the power that all stations have in common")
+      ("seed", value<uint32_t>(&seed)->default_value(0))
+      ("loss", value<double>(&loss)->default_value(0), "the fraction of the frames that is left out")
+      ("corruption", value<double>(&corruption)->default_value(0), "the fraction of the frames with an invalid header")
+      ("realTime", bool_switch(&realTime))
+      ("output", value<std::vector<std::string>>(&outputs)->composing())
+    ;
+
+    positional_options_description positional;
+    positional.add("output", -1);
+
+    variables_map vm;
+    store(command_line_parser(argc, argv).options(allowed_options).positional(positional).run(), vm);
+    notify(vm);
+
+    if (outputs.size() == 1 && outputs[0].find("%u") != std::string::npos && nrStations > 0) {
+      std::string pattern = outputs[0];
+      outputs.clear();
+
+      for (unsigned station = 0; station < nrStations; station ++)
+	outputs.push_back(std::string(pattern).replace(pattern.find("%u"), 2, std::to_string(station)));
+    }
+
+    if (outputs.empty() || (nrStations > 0 && nrStations != outputs.size()))
+      throw std::runtime_error("need one output per station");
+
+    nrStations = outputs.size();
+
+    if (nrBitsPerSample != 1 && nrBitsPerSample != 2)
+      throw std::runtime_error("only 1 and 2 bits per sample are supported");
+
+    if (nrChannels == 0 || (nrChannels & (nrChannels - 1)) != 0)
+      throw std::runtime_error("the number of channels must be a power of two");
+
+    if (payloadSize == 0 || payloadSize % 8 != 0 || payloadSize * 8 % (nrBitsPerSample * nrChannels) != 0)
+      throw std::runtime_error("the payload size must be a multiple of 8 bytes and hold a whole number of samples of all channels");
+
+    if (correlation < 0 || correlation > 1)
+      throw std::runtime_error("the correlation must be between 0 and 1");
+
+    if (loss < 0 || loss > 1 || corruption < 0 || corruption > 1)
+      throw std::runtime_error("the loss and corruption must be between 0 and 1");
+
+    Delays    delays(delayFile, nrStations);
+    Generator generator(nrChannels, nrBitsPerSample, payloadSize, sampleRate, correlation, seed, delays);
+
+    if (sampleRate % generator.nrTimesPerFrame() != 0 || sampleRate / generator.nrTimesPerFrame() >= 1 << 24)
+      throw std::runtime_error("the sample rate must be a multiple of the " + std::to_string(generator.nrTimesPerFrame()) + " samples per frame, with fewer than 2^24 frames per second");
+
+    int64_t startTime;
+
+    if (vm.count("startTime")) {
+      std::replace(startTimeString.begin(), startTimeString.end(), '_', ' ');
+      startTime = TimeStamp::fromDate(startTimeString.c_str(), sampleRate);
+    } else {
+      startTime = ((int64_t) TimeStamp::now(sampleRate) / sampleRate + 1) * sampleRate;
+    }
+
+    uint64_t nrFrames = (uint64_t) std::ceil(duration * sampleRate / generator.nrTimesPerFrame());
+
+    std::vector<std::unique_ptr<Stream>> streams;
+
+    for (const std::string &output : outputs)
+      streams.emplace_back(createStream(output, false));
+
+    std::vector<std::thread>	    threads;
+    std::vector<std::exception_ptr> exceptions(nrStations);
+    double			    runTime = omp_get_wtime();
+
+    for (unsigned station = 0; station < nrStations; station ++)
+      threads.emplace_back([&, station] {
+	try {
+	  generator.run(station, *streams[station], startTime, nrFrames, realTime, loss, corruption);
+	} catch (...) {
+	  exceptions[station] = std::current_exception();
+	}
+      });
+
+    for (std::thread &thread : threads)
+      thread.join();
+
+    runTime = omp_get_wtime() - runTime;
+
+    for (std::exception_ptr &exception : exceptions)
+      if (exception)
+	std::rethrow_exception(exception);
+
+    streams.clear();
+
+    double seconds = (double) nrFrames * generator.nrTimesPerFrame() / sampleRate;
+
+    std::cout << nrStations << " stations, " << seconds << " s of data (" << nrStations * nrFrames * generator.frameSize() * 1e-9 << " GB) in " << runTime << " s: " << seconds / runTime << "x real time" << std::endl;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,237 @@
+#include "Common/Config.h"
+
+#include "Common/HostBuffer.h"
+#include "Common/SlidingPointer.h"
+#include "Common/SparseSet.h"
+#include "Common/Threads/Queue.h"
+#include "Common/TimeStamp.h"
+#include "Common/UncachedMemory.h"
+#include "ISBI/DelayCorrection.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Visibilities.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Measures the CPU-side work that the ISBI pipeline does for every packet
+// or block, one thread at a time, and prints the results as JSON.  Without
+// arguments, a small configuration is used; otherwise the arguments are
+// parsed as ISBI parset, e.g.
+//   ISBI/Tests/MicroBenchmark -n 64 -c 64 -s 16
+// The start time and the delay file are provided by the benchmark.  No GPU
+// is used.
+
+static const double minRunTime = .5; // seconds per benchmark
+
+
+class Benchmarks
+{
+  public:
+    Benchmarks(const ISBI_Parset &);
+    ~Benchmarks();
+
+    // runs iteration() until minRunTime has passed; an iteration processes
+    // itemsPerIteration units
+    template <typename Function> void run(const char *name, Function iteration, double itemsPerIteration, const char *unit);
+
+  private:
+    bool isFirst;
+};
+
+
+Benchmarks::Benchmarks(const ISBI_Parset &ps)
+:
+  isFirst(true)
+{
+  std::cout << "{\n"
+	       "  \"nrStations\": " << ps.nrStations() << ",\n"
+	       "  \"nrSubbands\": " << ps.nrSubbands() << ",\n"
+	       "  \"nrPolarizations\": " << ps.nrPolarizations() << ",\n"
+	       "  \"nrChannelsPerSubband\": " << ps.nrChannelsPerSubband() << ",\n"
+	       "  \"nrSamplesPerSubband\": " << ps.nrSamplesPerSubbandBeforeFilter() << ",\n"
+	       "  \"benchmarks\": [";
+}
+
+
+Benchmarks::~Benchmarks()
+{
+  std::cout << "\n  ]\n}" << std::endl;
+}
+
+
+template <typename Function> void Benchmarks::run(const char *name, Function iteration, double itemsPerIteration, const char *unit)
+{
+  iteration(); // warm up
+
+  unsigned nrIterations = 0;
+  double   startTime = omp_get_wtime(), runTime;
+
+  do {
+    iteration();
+    nrIterations ++;
+  } while ((runTime = omp_get_wtime() - startTime) < minRunTime);
+
+  double time = runTime / nrIterations;
+
+  std::cout << (isFirst ? "\n" : ",\n")
+	    << "    { \"name\": \"" << name << "\", \"iterations\": " << nrIterations
+	    << ", \"seconds\": " << time << ", \"rate\": " << itemsPerIteration / time
+	    << ", \"unit\": \"" << unit << "\" }" << std::flush;
+
+  isFirst = false;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    const char *startTime = "2024-01-01_00:00:00";
+    const char *defaultArgs[] = { argv[0], "-n", "32", "-c", "64", "-s", "16", "-t", "3072" };
+    std::vector<const char *> args(argc > 1 ? argv : defaultArgs, argc > 1 ? argv + argc : defaultArgs + sizeof defaultArgs / sizeof *defaultArgs);
+
+    // a first parse, only to know the number of stations for the delay file
+    std::vector<const char *> stationArgs(args);
+    stationArgs.insert(stationArgs.end(), { "-D", startTime, "--delayFile", "/dev/null" });
+    unsigned nrStations = ISBI_Parset(stationArgs.size(), const_cast<char **>(stationArgs.data())).nrStations();
+
+    unsigned	clockSpeed = 32000000;
+    TimeStamp	start = TimeStamp::fromDate("2024-01-01 00:00:00", clockSpeed);
+    TemporaryFile delayFile("/tmp/MicroBenchmark-delays");
+
+    writeDelayFile(delayFile.name, nrStations, start, clockSpeed);
+    args.insert(args.end(), { "-D", startTime, "-d", "1", "--delayFile", delayFile.name.c_str() });
+    ISBI_Parset ps(args.size(), const_cast<char **>(args.data()));
+
+    HostBuffer::usePageLockedMemory = false;
+
+    std::mt19937 generator(0);
+    Benchmarks	 benchmarks(ps);
+
+    {
+      // one VDIF frame with all subbands and polarizations interleaved, as
+      // InputBuffer::handleConsecutivePackets() decodes it
+      const size_t   payloadBytes = 8000;
+      const unsigned nchan = ps.nrSubbands() * ps.nrPolarizations(), nrTimes = payloadBytes * 4 / nchan;
+      std::vector<uint8_t> payload(payloadBytes);
+      std::vector<int8_t>  ringBuffer((size_t) nchan * nrTimes);
+
+      for (uint8_t &byte : payload)
+	byte = generator();
+
+      benchmarks.run("decodeMappedChannelSamples", [&] {
+	for (unsigned channel = 0; channel < nchan; channel ++)
+	  decodeMappedChannelSamples(&ringBuffer[(size_t) channel * nrTimes], nrTimes, payload.data(), payloadBytes, nchan, channel);
+      }, payloadBytes, "bytes/s");
+    }
+
+    {
+      // the input of one subband of one block, as copied to the GPU
+      size_t size = (size_t) ps.nrStations() * ps.nrPolarizations() * ps.nrSamplesPerSubbandBeforeFilter() * ps.nrBytesPerRealSample();
+      HostBuffer source(size), destination(size);
+
+      memset(source, 1, size);
+
+      benchmarks.run("uncached_memcpy", [&] { uncached_memcpy(destination, source, size); }, size, "bytes/s");
+      benchmarks.run("uncached_memclear", [&] { uncached_memclear(destination, size); }, size, "bytes/s");
+    }
+
+    std::vector<SparseSet<TimeStamp>> validData(ps.nrStations()), currentValidData(ps.nrStations());
+    TimeStamp time = start;
+
+    {
+      // a block of valid data per station, with a few station-dependent holes
+      benchmarks.run("SparseSet include/exclude", [&] {
+	TimeStamp endTime = time + ps.nrSamplesPerSubbandBeforeFilter();
+
+	for (unsigned station = 0; station < ps.nrStations(); station ++) {
+	  validData[station].include(time + 100 * station, endTime - 7);
+	  validData[station].exclude(time + 1000, time + 1000 + station);
+	  currentValidData[station].assignSubset(validData[station], time, endTime);
+	  validData[station].exclude(TimeStamp(0, clockSpeed), time);
+	}
+
+	time = endTime;
+      }, ps.nrStations(), "stations/s");
+
+      volatile int64_t totalCount; // not optimized away
+
+      benchmarks.run("SparseSet intersectionCount", [&] {
+	int64_t count = 0;
+
+	for (unsigned stat2 = 0; stat2 < ps.nrStations(); stat2 ++)
+	  for (unsigned stat1 = 0; stat1 <= stat2; stat1 ++)
+	    count += (int64_t) currentValidData[stat1].intersectionCount(currentValidData[stat2]);
+
+	totalCount = count;
+      }, ps.nrBaselines(), "baselines/s");
+    }
+
+    {
+      Visibilities sum(ps, 0), block(ps, 0);
+
+      std::fill_n(sum.hostVisibilities.origin(), sum.hostVisibilities.num_elements(), std::complex<float>(0));
+      std::fill_n(block.hostVisibilities.origin(), block.hostVisibilities.num_elements(), std::complex<float>(0));
+
+      benchmarks.run("Visibilities::operator +=", [&] { sum += block; }, block.hostVisibilities.bytesize(), "bytes/s");
+      benchmarks.run("computeWeights", [&] { sum.computeWeights(currentValidData); }, std::min<size_t>(ps.nrBaselines(), sizeof sum.header.weights / sizeof *sum.header.weights), "baselines/s");
+    }
+
+    {
+      DelayCorrection delayCorrection(ps);
+      std::vector<DelayCorrection::StationDelay> stationDelays(ps.nrStations());
+
+      benchmarks.run("DelayCorrection::stationDelays", [&] { delayCorrection.stationDelays(start, stationDelays); }, ps.nrStations(), "stations/s");
+    }
+
+    {
+      // a buffer is passed from one thread to another and back, as between
+      // the correlator work queues and the output section
+      const unsigned nrHandoffs = 1000;
+
+      benchmarks.run("Queue/SlidingPointer handoff", [&] {
+	Queue<std::unique_ptr<int>> freeQueue, pendingQueue;
+	SlidingPointer<unsigned>    sequenceNumber(0);
+	std::unique_ptr<int>	    initialBuffer(new int(0));
+
+	freeQueue.append(initialBuffer);
+
+	std::thread consumer([&] {
+	  for (unsigned handoff = 1; handoff <= nrHandoffs; handoff ++) {
+	    sequenceNumber.waitFor(handoff);
+	    std::unique_ptr<int> buffer = pendingQueue.remove();
+	    freeQueue.append(buffer);
+	  }
+	});
+
+	for (unsigned handoff = 1; handoff <= nrHandoffs; handoff ++) {
+	  std::unique_ptr<int> buffer = freeQueue.remove();
+	  pendingQueue.append(buffer);
+	  sequenceNumber.advanceTo(handoff);
+	}
+
+	consumer.join();
+      }, nrHandoffs, "handoffs/s");
+    }
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+
+  return 0;
+}
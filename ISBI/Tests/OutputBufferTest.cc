@@ -0,0 +1,393 @@
+#include "Common/Config.h"
+
+#include "Common/CUDA_Support.h"
+#include "Common/Metrics.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/DirectFileStream.h"
+#include "Common/Stream/FileStream.h"
+#include "ISBI/AggregatedOutput.h"
+#include "ISBI/OutputBuffer.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Visibilities.h"
+#include "ISBI/VisibilitiesReader.h"
+
+#include <complex>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+// Feeds blocks with known visibilities through an OutputBuffer with three
+// integration levels, and checks the (integrated) blocks in the output file
+// of each level, written normally and with O_DIRECT (zero-copy output).
+// Blocks written with O_DIRECT are padded so that their visibilities are not
+// staged, and read back through a VisibilitiesReader.  With aggregated
+// output, two subbands are written into rotated files, and the blocks are
+// looked up through the index files; the files are closed even if a subband
+// writes nothing.  The blocks are counted in the output metrics.
+
+static std::complex<float> value(unsigned block, size_t index)
+{
+  return std::complex<float>(block + 1, (float) index - block);
+}
+
+
+// passes a block with known visibilities and weights through the output
+// buffer; returns the number of visibilities per block
+
+static size_t putBlock(OutputBuffer &outputBuffer, const ISBI_Parset &ps, unsigned block, float scale = 1)
+{
+  TimeStamp time = ps.startTime() + block * ps.nrSamplesPerSubbandBeforeFilter();
+  std::unique_ptr<Visibilities> visibilities = outputBuffer.getVisibilitiesBuffer();
+  std::complex<float> *samples = visibilities->hostVisibilities.origin();
+  size_t nrVisibilities = visibilities->hostVisibilities.num_elements();
+
+  for (size_t i = 0; i < nrVisibilities; i ++)
+    samples[i] = value(block, i) * scale;
+
+  for (unsigned baseline = 0; baseline < ps.nrBaselines(); baseline ++)
+    visibilities->header.weights[baseline] = block + 1;
+
+  visibilities->startTime = time;
+  visibilities->endTime   = time + ps.nrSamplesPerSubbandBeforeFilter();
+  outputBuffer.putVisibilitiesBuffer(std::move(visibilities), time);
+  return nrVisibilities;
+}
+
+
+static bool test(char *argv0, bool zeroCopy)
+{
+  const unsigned nrBlocks = 12;
+  const std::vector<unsigned> integrationFactors { 1, 2, 6 };
+  std::vector<std::string> names;
+  std::string descriptors;
+
+  for (unsigned level = 0; level < integrationFactors.size(); level ++) {
+    char name[] = "/tmp/OutputBufferTest-XXXXXX";
+    int fd = mkstemp(name);
+
+    if (fd < 0)
+      throw std::runtime_error("cannot create output file");
+
+    close(fd);
+    names.push_back(name);
+    descriptors += std::string(level > 0 ? "," : "") + "file:" + name;
+  }
+
+  const char *args[] = { argv0, "-n", "3", "-c", "9", "-t", "32", "-s", "1", "-R", "0", "-o", descriptors.c_str(), "-I", "1,2,6", "--nrIntegrationThreads", "2", "--zeroCopyOutput", zeroCopy ? "1" : "0" };
+  ISBI_Parset ps(sizeof args / sizeof *args, const_cast<char **>(args));
+
+  Metrics::Counter &nrBlocksWritten = Metrics::counter("isbi_output_blocks_total", {{ "subband", "0" }}, "");
+  uint64_t nrBlocksBefore = nrBlocksWritten.value();
+  size_t nrVisibilities;
+
+  {
+    OutputBuffer outputBuffer(ps, 0);
+
+    for (unsigned block = 0; block < nrBlocks; block ++)
+      nrVisibilities = putBlock(outputBuffer, ps, block);
+  } // flushes the output
+
+  bool ok = nrBlocksWritten.value() == nrBlocksBefore + nrBlocks;
+
+  for (unsigned level = 0; level < integrationFactors.size(); level ++) {
+    unsigned integration = integrationFactors[level];
+    std::ifstream file(names[level], std::ios::binary);
+
+    for (unsigned output = 0; output < nrBlocks / integration; output ++) {
+      Visibilities::Header header;
+      std::vector<std::complex<float>> samples(nrVisibilities);
+
+      file.read(reinterpret_cast<char *>(&header), sizeof header);
+      size_t alignmentMask = ((size_t) 1 << header.log2Alignment) - 1; // zero-copy output pads the block
+      file.ignore(-sizeof header & alignmentMask);
+      file.read(reinterpret_cast<char *>(samples.data()), samples.size() * sizeof(std::complex<float>));
+      file.ignore(-(samples.size() * sizeof(std::complex<float>)) & alignmentMask);
+
+      if (!file.good())
+	throw std::runtime_error("output file too short");
+
+      unsigned firstBlock = output * integration, expectedWeight = 0;
+
+      for (unsigned block = firstBlock; block < firstBlock + integration; block ++)
+	expectedWeight += block + 1;
+
+      ok &= header.nrSamplesPerIntegration == ps.nrSamplesPerChannel() * ps.channelIntegrationFactor() * integration;
+      ok &= header.weights[0] == expectedWeight;
+      ok &= header.startTime == (double) (ps.startTime() + firstBlock * ps.nrSamplesPerSubbandBeforeFilter());
+      ok &= header.endTime == (double) (ps.startTime() + (firstBlock + integration) * ps.nrSamplesPerSubbandBeforeFilter());
+
+      for (size_t i = 0; i < nrVisibilities; i ++) {
+	std::complex<float> expected = 0;
+
+	for (unsigned block = firstBlock; block < firstBlock + integration; block ++)
+	  expected += value(block, i);
+
+	ok &= samples[i] == expected;
+      }
+    }
+
+    file.peek();
+    ok &= file.eof();
+    unlink(names[level].c_str());
+  }
+
+  return ok;
+}
+
+
+static bool testDirectFile(char *argv0)
+{
+  // blocks with the real header and visibilities layout, written with
+  // O_DIRECT; only the header, the padding, and the unaligned end of the
+  // visibilities may be staged
+  const unsigned nrBlocks = 5;
+  char name[] = "/tmp/OutputBufferTest-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create output file");
+
+  close(fd);
+
+  const char *args[] = { argv0, "-n", "16", "-c", "65", "-t", "32", "-s", "1", "-R", "0", "-o", "null:" };
+  ISBI_Parset ps(sizeof args / sizeof *args, const_cast<char **>(args));
+  Visibilities visibilities(ps, 0);
+  std::complex<float> *samples = visibilities.hostVisibilities.origin();
+  size_t nrVisibilities = visibilities.hostVisibilities.num_elements();
+  bool ok = true;
+
+  {
+    DirectFileStream stream(name, 0666);
+    size_t alignment = stream.writeAlignment(), cubeSize = visibilities.hostVisibilities.bytesize();
+
+    for (unsigned block = 0; block < nrBlocks; block ++) {
+      for (size_t i = 0; i < nrVisibilities; i ++)
+	samples[i] = value(block, i);
+
+      visibilities.header.weights[0] = block + 1;
+      visibilities.write(&stream, 1);
+    }
+
+    size_t blockSize = (sizeof(Visibilities::Header) + alignment - 1) / alignment * alignment + (cubeSize + alignment - 1) / alignment * alignment;
+    ok &= stream.nrCopiedBytes() <= nrBlocks * (blockSize - cubeSize / alignment * alignment);
+  }
+
+  FileStream file(name);
+  VisibilitiesReader reader(&file);
+  unsigned nrBaselines = ps.nrBaselines(), nrChannels = ps.nrOutputChannelsPerSubband(), nrPolarizations = ps.nrVisibilityPolarizations();
+
+  for (unsigned block = 0; block < nrBlocks; block ++) {
+    ok &= reader.read() && reader.header().weights[0] == block + 1;
+
+    for (unsigned channel = 0; channel < nrChannels; channel ++)
+      for (unsigned baseline = 0; baseline < nrBaselines; baseline ++)
+	for (unsigned polarization = 0; polarization < nrPolarizations; polarization ++)
+	  ok &= reader.visibilities()[((size_t) baseline * nrChannels + channel) * nrPolarizations + polarization] == value(block, ((size_t) channel * nrBaselines + baseline) * nrPolarizations + polarization);
+  }
+
+  ok &= !reader.read();
+  unlink(name);
+  return ok;
+}
+
+
+static bool testAggregated(char *argv0)
+{
+  const unsigned nrBlocks = 12, nrSubbands = 2;
+  const std::vector<unsigned> integrationFactors { 1, 2 };
+  std::vector<std::string> names;
+  std::string descriptors;
+
+  for (unsigned level = 0; level < integrationFactors.size(); level ++) {
+    char name[] = "/tmp/OutputBufferTest-XXXXXX";
+    int fd = mkstemp(name);
+
+    if (fd < 0)
+      throw std::runtime_error("cannot create output file");
+
+    close(fd);
+    unlink(name);
+    names.push_back(name);
+    descriptors += std::string(level > 0 ? "," : "") + "file:" + name;
+  }
+
+  // rotate the files every four blocks
+  const char *args[] = { argv0, "-n", "3", "-c", "9", "-t", "32", "-s", "2", "-r", "1", "-R", "0", "-o", descriptors.c_str(), "-I", "1,2", "--aggregatedOutput", "1" };
+  ISBI_Parset blockParset(sizeof args / sizeof *args, const_cast<char **>(args));
+  std::string duration = std::to_string(4.0 * blockParset.nrSamplesPerSubbandBeforeFilter() / blockParset.clockSpeed());
+  std::vector<const char *> rotatingArgs(args, args + sizeof args / sizeof *args);
+  rotatingArgs.push_back("--outputFileDuration");
+  rotatingArgs.push_back(duration.c_str());
+  ISBI_Parset ps(rotatingArgs.size(), const_cast<char **>(rotatingArgs.data()));
+
+  size_t nrVisibilities, slotSize[2];
+  uint64_t nrBlocksPerFile[2];
+
+  {
+    AggregatedOutput level0(ps, 0), level1(ps, 1);
+    std::vector<std::unique_ptr<OutputBuffer>> outputBuffers;
+
+    for (unsigned subband = 0; subband < nrSubbands; subband ++)
+      outputBuffers.emplace_back(new OutputBuffer(ps, subband, { &level0, &level1 }));
+
+    for (unsigned block = 0; block < nrBlocks; block ++)
+      for (unsigned subband = 0; subband < nrSubbands; subband ++)
+	nrVisibilities = putBlock(*outputBuffers[subband], ps, block, subband + 1);
+
+    slotSize[0] = level0.slotSize(), nrBlocksPerFile[0] = level0.nrBlocksPerFile();
+    slotSize[1] = level1.slotSize(), nrBlocksPerFile[1] = level1.nrBlocksPerFile();
+    outputBuffers.clear(); // flushes the output
+  }
+
+  bool ok = nrBlocksPerFile[0] == 4 && nrBlocksPerFile[1] == 2 && slotSize[0] % 4096 == 0;
+
+  for (unsigned level = 0; level < integrationFactors.size(); level ++) {
+    unsigned integration = integrationFactors[level], nrOutputs = nrBlocks / integration;
+
+    for (unsigned fileNumber = 0; fileNumber < nrOutputs / nrBlocksPerFile[level]; fileNumber ++) {
+      char suffix[16];
+      snprintf(suffix, sizeof suffix, ".%04u", fileNumber);
+      std::string name = names[level] + suffix;
+      std::ifstream file(name, std::ios::binary), index(name + ".index", std::ios::binary);
+
+      // the data file is preallocated
+      file.seekg(0, std::ios::end);
+      ok &= (size_t) file.tellg() == nrBlocksPerFile[level] * nrSubbands * slotSize[level];
+
+      for (unsigned slot = 0; slot < nrBlocksPerFile[level] * nrSubbands; slot ++) {
+	unsigned output = fileNumber * nrBlocksPerFile[level] + slot / nrSubbands, subband = slot % nrSubbands;
+	unsigned firstBlock = output * integration;
+	AggregatedOutput::IndexEntry entry;
+	Visibilities::Header header;
+	std::vector<std::complex<float>> samples(nrVisibilities);
+
+	index.read(reinterpret_cast<char *>(&entry), sizeof entry);
+	file.seekg(entry.offset);
+	file.read(reinterpret_cast<char *>(&header), sizeof header);
+	file.read(reinterpret_cast<char *>(samples.data()), samples.size() * sizeof(std::complex<float>));
+
+	if (!file.good() || !index.good())
+	  throw std::runtime_error("output file too short");
+
+	ok &= entry.subband == subband && entry.offset == slot * slotSize[level] && entry.size == sizeof header + samples.size() * sizeof(std::complex<float>);
+	ok &= entry.startTime == (double) (ps.startTime() + firstBlock * ps.nrSamplesPerSubbandBeforeFilter());
+	ok &= header.startTime == entry.startTime && header.endTime == entry.endTime;
+
+	for (size_t i = 0; i < nrVisibilities; i ++) {
+	  std::complex<float> expected = 0;
+
+	  for (unsigned block = firstBlock; block < firstBlock + integration; block ++)
+	    expected += value(block, i) * (float) (subband + 1);
+
+	  ok &= samples[i] == expected;
+	}
+      }
+
+      index.peek();
+      ok &= index.eof();
+      unlink(name.c_str());
+      unlink((name + ".index").c_str());
+    }
+  }
+
+  return ok;
+}
+
+
+static unsigned nrOpenFiles()
+{
+  unsigned count = 0;
+
+  for (const auto &entry : std::filesystem::directory_iterator("/proc/self/fd"))
+    count ++, (void) entry;
+
+  return count;
+}
+
+
+static bool testAggregatedIdleSubband(char *argv0)
+{
+  // subband 1 writes nothing until subband 0 is far ahead; the old files
+  // are closed anyway, and reopened (not truncated) for a late block
+  const unsigned nrFiles = 8;
+  char name[] = "/tmp/OutputBufferTest-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create output file");
+
+  close(fd);
+  unlink(name);
+
+  std::string descriptor = std::string("file:") + name;
+  const char *args[] = { argv0, "-n", "3", "-c", "9", "-t", "32", "-s", "2", "-r", "1", "-R", "0", "-o", descriptor.c_str(), "--aggregatedOutput", "1" };
+  ISBI_Parset blockParset(sizeof args / sizeof *args, const_cast<char **>(args));
+  int64_t nrSamplesPerBlock = blockParset.nrSamplesPerSubbandBeforeFilter();
+  std::string duration = std::to_string((double) nrSamplesPerBlock / blockParset.clockSpeed());
+  std::vector<const char *> rotatingArgs(args, args + sizeof args / sizeof *args);
+  rotatingArgs.push_back("--outputFileDuration");
+  rotatingArgs.push_back(duration.c_str());
+  ISBI_Parset ps(rotatingArgs.size(), const_cast<char **>(rotatingArgs.data()));
+
+  std::vector<char> block(100, 1);
+  std::vector<iovec> pieces { iovec { block.data(), block.size() } };
+  bool ok = true;
+
+  {
+    AggregatedOutput output(ps, 0);
+    unsigned nrFilesBefore = nrOpenFiles();
+
+    for (unsigned file = 0; file < nrFiles; file ++) {
+      TimeStamp time = ps.startTime() + file * nrSamplesPerBlock;
+      output.write(0, time, time + nrSamplesPerBlock, pieces);
+    }
+
+    ok &= output.nrBlocksPerFile() == 1 && nrOpenFiles() <= nrFilesBefore + 2 * 2;
+
+    output.write(1, ps.startTime(), ps.startTime() + nrSamplesPerBlock, pieces);
+  }
+
+  for (unsigned file = 0; file < nrFiles; file ++) {
+    char suffix[16];
+    snprintf(suffix, sizeof suffix, ".%04u", file);
+    std::string fileName = name + std::string(suffix);
+    std::ifstream index(fileName + ".index", std::ios::binary);
+    AggregatedOutput::IndexEntry entries[2];
+
+    index.read(reinterpret_cast<char *>(entries), sizeof entries);
+    ok &= index.good() && entries[0].size == block.size() && entries[1].size == (file == 0 ? block.size() : 0);
+    unlink(fileName.c_str());
+    unlink((fileName + ".index").c_str());
+  }
+
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running OutputBufferTest" << std::endl;
+
+    HostBuffer::usePageLockedMemory = false;
+
+    bool ok = test(argv[0], false) && test(argv[0], true) && testDirectFile(argv[0]) && testAggregated(argv[0]) && testAggregatedIdleSubband(argv[0]);
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
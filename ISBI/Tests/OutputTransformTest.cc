@@ -0,0 +1,181 @@
+#include "Common/Config.h"
+
+#include "Common/HostBuffer.h"
+#include "Common/Stream/FileStream.h"
+#include "ISBI/OutputTransform.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Visibilities.h"
+#include "ISBI/VisibilitiesReader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+// Checks the baseline selection, the (baseline-dependent) channel averaging,
+// and the header and baseline table that are written with them.  The fp32,
+// fp16, and int16 output is read back with a VisibilitiesReader.
+
+static std::string temporaryFile()
+{
+  char name[] = "/tmp/OutputTransformTest-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create output file");
+
+  close(fd);
+  return name;
+}
+
+
+// writes the visibilities in the given format, reads them back, and checks
+// that the error is within the precision of the format
+
+static bool roundTrip(int argc, const char *args[], const char *format, float tolerance)
+{
+  std::vector<const char *> formatArgs(args, args + argc);
+  formatArgs.push_back("--visibilitiesFormat");
+  formatArgs.push_back(format);
+  ISBI_Parset ps(formatArgs.size(), const_cast<char **>(formatArgs.data()));
+
+  Visibilities visibilities(ps, 0);
+  std::complex<float> *samples = visibilities.hostVisibilities.origin();
+
+  for (size_t i = 0; i < visibilities.hostVisibilities.num_elements(); i ++)
+    samples[i] = std::complex<float>(1000 * std::sin(i), (i % 5) * 1e-3f);
+
+  ISBI_Parset fp32Parset(argc, const_cast<char **>(args));
+  OutputTransform transform(ps), reference(fp32Parset);
+  const std::complex<float> *expected = static_cast<const std::complex<float> *>(reference.apply(visibilities));
+  std::string name = temporaryFile();
+
+  {
+    FileStream stream(name, 0666);
+    visibilities.write(&stream, 1, &transform);
+    visibilities.write(&stream, 1, &transform);
+  }
+
+  FileStream stream(name);
+  VisibilitiesReader reader(&stream);
+  bool ok = true;
+
+  for (unsigned block = 0; block < 2; block ++) {
+    ok &= reader.read();
+    ok &= reader.header().magic == (std::string(format) == "fp32" ? 0x3B98F004 : 0x3B98F005);
+    ok &= reader.visibilities().size() == reference.nrVisibilities() && reader.baselines().size() == reference.baselines().size();
+
+    // the error is relative to the largest value of the channel
+    for (size_t channel = 0; ok && channel < reference.nrVisibilities() / 4; channel ++) {
+      float maxAbs = 0;
+
+      for (unsigned i = 0; i < 4; i ++)
+	maxAbs = std::max({ maxAbs, std::abs(expected[4 * channel + i].real()), std::abs(expected[4 * channel + i].imag()) });
+
+      for (unsigned i = 0; i < 4; i ++)
+	ok &= std::abs(reader.visibilities()[4 * channel + i] - expected[4 * channel + i]) <= tolerance * maxAbs;
+    }
+  }
+
+  ok &= !reader.read();
+  unlink(name.c_str());
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running OutputTransformTest" << std::endl;
+
+    HostBuffer::usePageLockedMemory = false;
+
+    // stations at 0, 100, 300, and 1000 m; baselines up to 150 m are averaged
+    // over four channels, up to 300 m over two channels
+    const char *args[] = { argv[0], "-n", "4", "-c", "9", "-t", "32", "-s", "1",
+			   "--outputBaselines", "2-*,0-0", "--outputChannelAveraging", "4",
+			   "--stationPositions", "0,0,0,100,0,0,300,0,0,1000,0,0", "--bdaReferenceLength", "150" };
+    ISBI_Parset ps(sizeof args / sizeof *args, const_cast<char **>(args));
+
+    Visibilities visibilities(ps, 0);
+    std::complex<float> *samples = visibilities.hostVisibilities.origin();
+    unsigned nrPolarizations = ps.nrPolarizations();
+
+    for (size_t i = 0; i < visibilities.hostVisibilities.num_elements(); i ++)
+      samples[i] = std::complex<float>(i, - (float) (i % 7));
+
+    for (unsigned baseline = 0; baseline < ps.nrBaselines(); baseline ++)
+      visibilities.header.weights[baseline] = 100 + baseline;
+
+    OutputTransform transform(ps);
+    const std::complex<float> *output = static_cast<const std::complex<float> *>(transform.apply(visibilities, 2));
+
+    const unsigned expectedStations[][2] = { { 0, 0 }, { 2, 0 }, { 2, 1 }, { 2, 2 }, { 3, 2 } };
+    const unsigned expectedAveraging[]	 = { 4, 2, 2, 4, 1 };
+    bool ok = transform.baselines().size() == 5;
+
+    for (unsigned baseline = 0; ok && baseline < transform.baselines().size(); baseline ++) {
+      const Visibilities::BaselineDescriptor &descriptor = transform.baselines()[baseline];
+      unsigned input = descriptor.station0 * (descriptor.station0 + 1) / 2 + descriptor.station1;
+
+      ok &= descriptor.station0 == expectedStations[baseline][0] && descriptor.station1 == expectedStations[baseline][1];
+      ok &= descriptor.channelAveraging == expectedAveraging[baseline];
+      ok &= descriptor.nrChannels * descriptor.channelAveraging == ps.nrOutputChannelsPerSubband();
+
+      for (unsigned channel = 0; channel < descriptor.nrChannels; channel ++)
+	for (unsigned pol0 = 0; pol0 < nrPolarizations; pol0 ++)
+	  for (unsigned pol1 = 0; pol1 < nrPolarizations; pol1 ++) {
+	    std::complex<float> sum = 0;
+
+	    for (unsigned subChannel = 0; subChannel < descriptor.channelAveraging; subChannel ++)
+	      sum += visibilities.hostVisibilities[channel * descriptor.channelAveraging + subChannel][input][pol0][pol1];
+
+	    ok &= std::abs(*output ++ - sum / (float) descriptor.channelAveraging) <= 1e-6f * std::abs(sum);
+	  }
+    }
+
+    ok &= output == static_cast<const std::complex<float> *>(transform.apply(visibilities)) + transform.nrVisibilities();
+
+    // the written header describes the transformed visibilities
+    std::string name = temporaryFile();
+
+    {
+      FileStream stream(name, 0666);
+      visibilities.write(&stream, 1, &transform);
+    }
+
+    Visibilities::Header header;
+    std::vector<Visibilities::BaselineDescriptor> table(transform.baselines().size());
+    std::ifstream file(name, std::ios::binary);
+
+    file.read(reinterpret_cast<char *>(&header), sizeof header);
+    file.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(Visibilities::BaselineDescriptor));
+    file.seekg(0, std::ios::end);
+    unlink(name.c_str());
+
+    ok &= header.magic == 0x3B98F004 && header.nrBaselines == table.size();
+    ok &= header.weights[1] == 100 + 3 /* baseline 2-0 */ && header.weights[4] == 100 + 8 /* baseline 3-2 */ && header.weights[5] == 0;
+    ok &= memcmp(table.data(), transform.baselines().data(), table.size() * sizeof(Visibilities::BaselineDescriptor)) == 0;
+    ok &= (size_t) file.tellg() == sizeof header + table.size() * sizeof(Visibilities::BaselineDescriptor) + transform.nrVisibilities() * sizeof(std::complex<float>);
+
+    ok &= roundTrip(sizeof args / sizeof *args, args, "fp32", 0);
+    ok &= roundTrip(sizeof args / sizeof *args, args, "fp16", 1e-3f);
+    ok &= roundTrip(sizeof args / sizeof *args, args, "i16", 1e-4f);
+
+    std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+    return ok ? 0 : 1;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+}
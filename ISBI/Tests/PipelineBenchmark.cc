@@ -0,0 +1,323 @@
+#include "Common/Config.h"
+
+#include "Common/CUDA_Support.h"
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+#include "Common/Stream/FileStream.h"
+#include "Common/TimeStamp.h"
+#include "ISBI/CorrelatorPipeline.h"
+#include "ISBI/Parset.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#include <boost/program_options.hpp>
+#include <omp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Runs the host side of the ISBI pipeline (InputSection, work queues,
+// OutputSection) on synthetic VDIF input, with a null device and null
+// outputs, for a number of station counts, to find out how many stations an
+// ingest node can correlate in real time.  The input is a few synthetic
+// streams (correlated 2-bit noise from the Generator in SyntheticInput.h,
+// 16 channels, 2000 samples per frame) with randomly lost frames and frames
+// with a corrupted header, written to tmpfs; stations share the streams
+// round robin.  The pipeline reads them as fast as it can (not in real
+// time), and is measured against a virtual real-time clock at --sampleRate
+// samples per second per station, e.g.
+//   ISBI/Tests/PipelineBenchmark --stations 8,16,32,64 --loss 1e-3 -- -s 8 -c 64 -t 3072 -r 2 -f 8000000 -T 3145728
+// Arguments that are not benchmark options are parsed as ISBI parset;
+// the station count, inputs, outputs, delay file, device type, and real-time
+// mode are provided by the benchmark.  A lower clock speed (-f) than the
+// nominal sample rate keeps the synthetic files small; the rates below are
+// in samples per second and do not depend on it.
+//
+// For each station count, it reports the throughput of the input (frames
+// and decoded bytes), the correlator (blocks), and the output (blocks), the
+// real-time factor (processed samples per station per second over
+// --sampleRate), and the distribution of the lateness of the blocks: the
+// time at which all subbands of a block were done, relative to the time at
+// which its last sample would have arrived in real time.
+
+static const char *defaultParsetArgs[] = { "-s", "8", "-c", "64", "-t", "3072", "-r", "2", "-f", "8000000", "-T", "3145728", "-p", "1", "--logLevel", "warning", "-D", "2024-01-01_00:00:00" };
+
+
+static uint64_t sumOfCounters(const char *name, const char *label, unsigned nrLabelValues)
+{
+  uint64_t sum = 0;
+
+  for (unsigned value = 0; value < nrLabelValues; value ++)
+    sum += Metrics::counter(name, {{ label, std::to_string(value) }}, "").value();
+
+  return sum;
+}
+
+
+struct Totals {
+  Totals(unsigned nrStations, unsigned nrSubbands)
+  :
+    framesReceived(sumOfCounters("isbi_input_packets_received_total", "station", nrStations)),
+    framesInvalid(sumOfCounters("isbi_input_packets_invalid_total", "station", nrStations)),
+    framesLate(sumOfCounters("isbi_input_packets_late_dropped_total", "station", nrStations)),
+    gapSamples(sumOfCounters("isbi_input_gap_samples_total", "station", nrStations)),
+    decodedBytes(sumOfCounters("isbi_input_decoded_bytes_total", "station", nrStations)),
+    blocksCorrelated(sumOfCounters("isbi_blocks_correlated_total", "subband", nrSubbands)),
+    blocksSkipped(sumOfCounters("isbi_blocks_without_input_total", "subband", nrSubbands) + sumOfCounters("isbi_blocks_late_total", "subband", nrSubbands)),
+    blocksWritten(sumOfCounters("isbi_output_blocks_total", "subband", nrSubbands))
+  {
+  }
+
+  uint64_t framesReceived, framesInvalid, framesLate, gapSamples, decodedBytes;
+  uint64_t blocksCorrelated, blocksSkipped, blocksWritten;
+};
+
+
+// records the time at which each block was done for all subbands, relative
+// to the time at which it would have been complete in real time
+class LatenessMonitor
+{
+  public:
+    LatenessMonitor(const ISBI_Parset &, double blockDuration);
+    ~LatenessMonitor();
+
+    std::vector<double> lateness; // seconds, per block
+
+  private:
+    uint64_t		nrSubbandBlocksDone() const;
+    void		threadBody();
+
+    const ISBI_Parset	&ps;
+    const double	blockDuration, startTime;
+    std::vector<const Metrics::Counter *> counters; // looked up once
+    const uint64_t	nrSubbandBlocksAtStart;
+    std::atomic<bool>	stop;
+    std::thread		thread;
+};
+
+
+LatenessMonitor::LatenessMonitor(const ISBI_Parset &ps, double blockDuration)
+:
+  ps(ps),
+  blockDuration(blockDuration),
+  startTime(omp_get_wtime()),
+  counters([&] () {
+    std::vector<const Metrics::Counter *> counters;
+
+    for (unsigned subband = 0; subband < ps.nrSubbands(); subband ++)
+      for (const char *name : { "isbi_blocks_correlated_total", "isbi_blocks_without_input_total", "isbi_blocks_late_total" })
+	counters.push_back(&Metrics::counter(name, {{ "subband", std::to_string(subband) }}, ""));
+
+    return counters;
+  } ()),
+  nrSubbandBlocksAtStart(nrSubbandBlocksDone()),
+  stop(false),
+  thread(&LatenessMonitor::threadBody, this)
+{
+}
+
+
+LatenessMonitor::~LatenessMonitor()
+{
+  stop = true;
+  thread.join();
+}
+
+
+uint64_t LatenessMonitor::nrSubbandBlocksDone() const
+{
+  uint64_t sum = 0;
+
+  for (const Metrics::Counter *counter : counters)
+    sum += counter->value();
+
+  return sum;
+}
+
+
+void LatenessMonitor::threadBody()
+{
+  do {
+    uint64_t nrBlocksDone = (nrSubbandBlocksDone() - nrSubbandBlocksAtStart) / ps.nrSubbands();
+    double   time = omp_get_wtime() - startTime;
+
+    while (lateness.size() < nrBlocksDone)
+      lateness.push_back(time - (lateness.size() + 1) * blockDuration);
+
+    usleep(100);
+  } while (!stop);
+}
+
+
+static double percentile(std::vector<double> values, double fraction)
+{
+  if (values.empty())
+    return 0;
+
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t) (fraction * values.size()))];
+}
+
+
+static std::vector<unsigned> splitStationCounts(const std::string &list)
+{
+  std::vector<unsigned> counts;
+  std::istringstream	stream(list);
+  std::string		count;
+
+  while (std::getline(stream, count, ','))
+    counts.push_back(std::stoul(count));
+
+  return counts;
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    using namespace boost::program_options;
+
+    std::string stationList, directory;
+    double	nominalSampleRate, loss, corruption;
+    unsigned	nrStreams;
+
+    options_description allowed_options;
+
+    allowed_options.add_options()
+      ("stations", value<std::string>(&stationList)->default_value("4,8,16"))
+      ("sampleRate", value<double>(&nominalSampleRate)->default_value(32e6))
+      ("loss", value<double>(&loss)->default_value(1e-3))
+      ("corruption", value<double>(&corruption)->default_value(1e-4))
+      ("streams", value<unsigned>(&nrStreams)->default_value(4))
+      ("directory", value<std::string>(&directory)->default_value("/dev/shm"))
+    ;
+
+    variables_map vm;
+    parsed_options parsed = command_line_parser(argc, argv).options(allowed_options).allow_unregistered().run();
+    std::vector<std::string> parsetArgs = collect_unrecognized(parsed.options, include_positional);
+    store(parsed, vm);
+    notify(vm);
+
+    if (parsetArgs.empty())
+      parsetArgs.assign(defaultParsetArgs, defaultParsetArgs + sizeof defaultParsetArgs / sizeof *defaultParsetArgs);
+
+    std::vector<unsigned> stationCounts = splitStationCounts(stationList);
+    unsigned maxNrStations = *std::max_element(stationCounts.begin(), stationCounts.end());
+
+    nrStreams = std::max(1U, std::min(nrStreams, maxNrStations));
+    HostBuffer::usePageLockedMemory = false;
+
+    auto makeParset = [&] (unsigned nrStations, const std::vector<std::string> &extraArgs) {
+      std::vector<std::string> args(1, argv[0]);
+      args.insert(args.end(), parsetArgs.begin(), parsetArgs.end());
+      args.insert(args.end(), { "-n", std::to_string(nrStations), "-R", "0", "--deviceType", "null" });
+      args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+
+      std::vector<char *> argPointers;
+
+      for (std::string &arg : args)
+	argPointers.push_back(&arg[0]);
+
+      return std::make_unique<ISBI_Parset>(argPointers.size(), argPointers.data());
+    };
+
+    // the streams and the delay file are written once, for all runs
+    std::unique_ptr<ISBI_Parset> ps = makeParset(maxNrStations, { "--delayFile", "/dev/null" });
+    Logger::setMinimumSeverity(ps->logLevel());
+
+    if (ps->nrSubbands() * ps->nrPolarizations() != 16)
+      throw std::runtime_error("the synthetic input has 16 channels: 8 subbands with 2 polarizations");
+
+    TemporaryFile delayFile(directory + "/PipelineBenchmark-delays");
+    std::vector<std::unique_ptr<TemporaryFile>> streamFiles;
+
+    writeDelayFile(delayFile.name, maxNrStations, ps->startTime(), ps->clockSpeed());
+
+    // from a tenth of a second before the start time to a tenth of a second
+    // after the stop time
+    Delays    delays(delayFile.name, nrStreams);
+    Generator generator(16, 2, 8000, ps->sampleRate(), 1, 0, delays);
+    int64_t   begin = ((int64_t) ps->startTime() - ps->clockSpeed() / 10) / generator.nrTimesPerFrame() * generator.nrTimesPerFrame();
+    uint64_t  nrFrames = ((int64_t) ps->stopTime() + ps->clockSpeed() / 10 - begin + generator.nrTimesPerFrame() - 1) / generator.nrTimesPerFrame();
+
+    for (unsigned stream = 0; stream < nrStreams; stream ++) {
+      streamFiles.emplace_back(new TemporaryFile(directory + "/PipelineBenchmark-" + std::to_string(stream), ".vdif"));
+
+      FileStream file(streamFiles.back()->name, 0644);
+      generator.run(stream, file, begin, nrFrames, false, loss, corruption);
+    }
+
+    double blockDuration = ps->nrSamplesPerSubbandBeforeFilter() / nominalSampleRate;
+    unsigned maxSustainedNrStations = 0;
+
+    std::cout << std::setprecision(3) << nrStreams << " synthetic streams of " << (double) nrFrames * generator.nrTimesPerFrame() / ps->clockSpeed() << " s, loss " << loss << ", corruption " << corruption << ", real time is " << nominalSampleRate * 1e-6 << " Msamples/s per station" << std::endl;
+
+    for (unsigned nrStations : stationCounts) {
+      std::string inputs, outputs;
+
+      for (unsigned station = 0; station < nrStations; station ++)
+	inputs += (station > 0 ? "," : "") + streamFiles[station % nrStreams]->name;
+
+      for (unsigned output = 0; output < ps->nrSubbands() * ps->visibilitiesIntegration().size(); output ++)
+	outputs += output > 0 ? ",null:" : "null:";
+
+      std::unique_ptr<ISBI_Parset> runPs = makeParset(nrStations, { "-i", inputs, "-o", outputs, "--delayFile", delayFile.name });
+      Totals before(nrStations, runPs->nrSubbands());
+      std::vector<double> lateness;
+      double runTime;
+
+      {
+	ISBI_CorrelatorPipeline pipeline(*runPs);
+	double startTime = omp_get_wtime();
+
+	{
+	  LatenessMonitor monitor(*runPs, blockDuration);
+	  pipeline.doWork();
+	  lateness = monitor.lateness;
+	}
+
+	runTime = omp_get_wtime() - startTime;
+      }
+
+      Totals after(nrStations, runPs->nrSubbands());
+
+      uint64_t blocks = after.blocksCorrelated - before.blocksCorrelated;
+      double   samplesPerStation = (double) (blocks + after.blocksSkipped - before.blocksSkipped) / runPs->nrSubbands() * runPs->nrSamplesPerSubbandBeforeFilter();
+      double   realTimeFactor = samplesPerStation / runTime / nominalSampleRate;
+
+      if (realTimeFactor >= 1)
+	maxSustainedNrStations = std::max(maxSustainedNrStations, nrStations);
+
+      std::cout << nrStations << " stations: " << runTime << " s, " << realTimeFactor << "x real time"
+		<< ", input " << (after.framesReceived - before.framesReceived) / runTime * 1e-3 << " kframes/s, " << (after.decodedBytes - before.decodedBytes) / runTime * 1e-9 << " GB/s decoded"
+		<< ", correlator " << blocks / runTime << " blocks/s"
+		<< ", output " << (after.blocksWritten - before.blocksWritten) / runTime << " blocks/s"
+		<< ", skipped " << after.blocksSkipped - before.blocksSkipped << " blocks"
+		<< ", invalid " << after.framesInvalid - before.framesInvalid << " frames"
+		<< ", late " << after.framesLate - before.framesLate << " frames"
+		<< ", gaps " << after.gapSamples - before.gapSamples << " samples"
+		<< ", lateness p50 " << percentile(lateness, .5) * 1e3 << " ms, p99 " << percentile(lateness, .99) * 1e3 << " ms, max " << percentile(lateness, 1) * 1e3 << " ms"
+		<< std::endl;
+    }
+
+    std::cout << "max sustained: " << maxSustainedNrStations << " stations" << std::endl;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+
+  return 0;
+}
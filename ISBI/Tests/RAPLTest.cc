@@ -0,0 +1,114 @@
+#include "Common/Config.h"
+
+#include "Common/RAPL.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+
+// Reads the energy counters of a fake powercap tree with two packages, one
+// DRAM zone, and a core zone (which overlaps the package, and is ignored).
+// The counter of the second package wraps around between the reads.  A
+// Sampler accumulates the energy over a period in which that counter wraps
+// twice.
+
+static void writeFile(const std::string &name, const std::string &contents)
+{
+  std::ofstream(name) << contents << '\n';
+}
+
+
+static void makeZone(const std::string &powercap, const std::string &zone, const std::string &name, uint64_t energy, uint64_t range)
+{
+  std::string directory = powercap + '/' + zone;
+
+  mkdir(directory.c_str(), 0755);
+  writeFile(directory + "/name", name);
+  writeFile(directory + "/energy_uj", std::to_string(energy));
+  writeFile(directory + "/max_energy_range_uj", std::to_string(range));
+}
+
+
+static void setEnergy(const std::string &powercap, const std::string &zone, uint64_t energy)
+{
+  writeFile(powercap + '/' + zone + "/energy_uj", std::to_string(energy));
+}
+
+
+static bool near(double a, double b)
+{
+  return std::abs(a - b) < 1e-9;
+}
+
+
+int main()
+{
+  std::cout << ">>> Running RAPLTest" << std::endl;
+
+  char root[] = "/tmp/RAPLTest-XXXXXX";
+
+  if (mkdtemp(root) == nullptr) {
+    std::cerr << "cannot create " << root << std::endl;
+    return 1;
+  }
+
+  std::string powercap = std::string(root) + "/class/powercap";
+
+  mkdir((std::string(root) + "/class").c_str(), 0755);
+  mkdir(powercap.c_str(), 0755);
+
+  makeZone(powercap, "intel-rapl:0", "package-0", 1000000, 262143328850);
+  makeZone(powercap, "intel-rapl:0:0", "dram", 500, 65712999613);
+  makeZone(powercap, "intel-rapl:0:1", "core", 7000, 262143328850);
+  makeZone(powercap, "intel-rapl:1", "package-1", 999000, 1000000);
+
+  bool ok;
+
+  {
+    RAPL   rapl(root);
+    double joules[RAPL::nrDomains], sampledJoules[RAPL::nrDomains];
+
+    RAPL::State start = rapl.read();
+    setEnergy(powercap, "intel-rapl:0", 3500000);   // +2.5 J
+    setEnergy(powercap, "intel-rapl:0:0", 1500500); // +1.5 J
+    setEnergy(powercap, "intel-rapl:0:1", 9007000); // not counted
+    setEnergy(powercap, "intel-rapl:1", 1000);	    // +0.002001 J, wrapped (at 1000000)
+    rapl.joules(start, rapl.read(), joules);
+
+    {
+      RAPL::Sampler sampler(rapl, 3600); // samples only when asked
+
+      setEnergy(powercap, "intel-rapl:0", 4500000);   // +1 J
+      setEnergy(powercap, "intel-rapl:0:0", 1750500); // +0.25 J
+
+      for (uint64_t energy : { 999000, 500, 998000, 700 }) { // +1.999702 J, wraps twice
+	setEnergy(powercap, "intel-rapl:1", energy);
+	sampler.joules(sampledJoules);
+      }
+    }
+
+    ok = rapl.available() && rapl.hasDomain(RAPL::Package) && rapl.hasDomain(RAPL::DRAM) &&
+	 near(joules[RAPL::Package], 2.502001) && near(joules[RAPL::DRAM], 1.5) &&
+	 near(sampledJoules[RAPL::Package], 2.999702) && near(sampledJoules[RAPL::DRAM], .25);
+  }
+
+  for (const char *zone : { "intel-rapl:0", "intel-rapl:0:0", "intel-rapl:0:1", "intel-rapl:1" }) {
+    for (const char *file : { "name", "energy_uj", "max_energy_range_uj" })
+      unlink((powercap + '/' + zone + '/' + file).c_str());
+
+    rmdir((powercap + '/' + zone).c_str());
+  }
+
+  rmdir(powercap.c_str());
+  rmdir((std::string(root) + "/class").c_str());
+  rmdir(root);
+
+  std::cout << (ok ? "Test OK" : "Test FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
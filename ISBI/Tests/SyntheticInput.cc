@@ -0,0 +1,330 @@
+#include "Common/Config.h"
+
+#include "Common/Stream/SocketStream.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#if defined __AVX__
+#include <immintrin.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+
+static std::string createUniqueFile(const std::string &prefix, const std::string &suffix)
+{
+  std::string name = prefix + "-XXXXXX" + suffix;
+  int fd = mkstemps(&name[0], suffix.size());
+
+  if (fd < 0)
+    throw std::runtime_error("cannot create " + name);
+
+  close(fd);
+  return name;
+}
+
+
+TemporaryFile::TemporaryFile(const std::string &prefix, const std::string &suffix)
+:
+  name(createUniqueFile(prefix, suffix))
+{
+}
+
+
+TemporaryFile::~TemporaryFile()
+{
+  unlink(name.c_str());
+}
+
+
+void writeDelayFile(const std::string &name, unsigned nrStations, const TimeStamp &startTime, unsigned clockSpeed)
+{
+  std::ofstream file(name, std::ios::binary);
+
+  for (unsigned station = 0; station < nrStations; station ++) {
+    uint32_t n = 64;
+    file.write(reinterpret_cast<const char *>(&n), sizeof n);
+
+    for (unsigned i = 0; i < n; i ++) {
+      int64_t time = (int64_t) startTime + ((int64_t) i - 2) * clockSpeed;
+      double  delay = 1e-6 * station + 1e-9 * station * i * i;
+
+      file.write(reinterpret_cast<const char *>(&time), sizeof time);
+      file.write(reinterpret_cast<const char *>(&delay), sizeof delay);
+    }
+  }
+
+  if (!file)
+    throw std::runtime_error("cannot write " + name);
+}
+
+
+static const double   noiseSigma    = 147.80; // of the sum of four uniform bytes
+static const double   threshold2bit = .98;    // sigma
+static const unsigned weightScale   = 1024;   // of the integer weights of the common and station noise
+static const uint32_t commonStream  = ~0U;    // the noise that all stations observe
+static const uint32_t fillPattern   = 0x11223344; // of a VDIF frame that has no valid data
+
+
+static inline uint32_t hash(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7FEB352D;
+  x ^= x >> 15;
+  x *= 0x846CA68B;
+  x ^= x >> 16;
+  return x;
+}
+
+
+// quantizes nrSamples (a multiple of 32) samples to 2 bits, four per byte,
+// the first sample in the least significant bits: -3 for (-inf, -threshold],
+// -1 for (-threshold, 0), 1 for [0, threshold), and 3 for [threshold, inf)
+static void quantize2bit(const float *samples, uint8_t *payload, size_t nrSamples, float threshold)
+{
+#if defined __AVX2__
+  const __m256  lower = _mm256_set1_ps(-threshold), zero = _mm256_setzero_ps(), upper = _mm256_set1_ps(threshold);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  const __m256i firstBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+  for (size_t i = 0; i < nrSamples; i += 32) {
+    __m256i codes[4];
+
+    // a comparison is -1 where it holds
+    for (unsigned j = 0; j < 4; j ++) {
+      __m256 v = _mm256_loadu_ps(samples + i + 8 * j);
+
+      codes[j] = _mm256_sub_epi32(_mm256_sub_epi32(_mm256_sub_epi32(_mm256_setzero_si256(),
+		   _mm256_castps_si256(_mm256_cmp_ps(v, lower, _CMP_GT_OQ))),
+		   _mm256_castps_si256(_mm256_cmp_ps(v, zero, _CMP_GE_OQ))),
+		   _mm256_castps_si256(_mm256_cmp_ps(v, upper, _CMP_GE_OQ)));
+    }
+
+    // one code per byte, in order (the packs work per 128-bit lane)
+    __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(_mm256_packs_epi32(codes[0], codes[1]), _mm256_packs_epi32(codes[2], codes[3])), order);
+
+    // four codes in the low byte of every 32-bit word: c0 + 4 * c1 + 16 * c2 + 64 * c3
+    __m256i words = _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, _mm256_set1_epi16(0x0401)), _mm256_set1_epi32(0x00100001));
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(words, firstBytes), order);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(payload + i / 4), _mm256_castsi256_si128(packed));
+  }
+#else
+  for (size_t i = 0; i < nrSamples; i += 4) {
+    unsigned byte = 0;
+
+    for (unsigned j = 0; j < 4; j ++) {
+      float v = samples[i + j];
+      byte |= ((v > -threshold) + (v >= 0) + (v >= threshold)) << (2 * j);
+    }
+
+    payload[i / 4] = byte;
+  }
+#endif
+}
+
+
+// quantizes nrSamples (a multiple of 32) samples to 1 bit, eight per byte,
+// the first sample in the least significant bit: 0 for (-inf, 0), 1 for
+// [0, inf)
+static void quantize1bit(const float *samples, uint8_t *payload, size_t nrSamples)
+{
+#if defined __AVX__
+  for (size_t i = 0; i < nrSamples; i += 32) {
+    uint32_t bits = 0;
+
+    for (unsigned j = 0; j < 4; j ++)
+      bits |= (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(samples + i + 8 * j), _mm256_setzero_ps(), _CMP_GE_OQ)) << (8 * j);
+
+    memcpy(payload + i / 8, &bits, sizeof bits);
+  }
+#else
+  for (size_t i = 0; i < nrSamples; i += 8) {
+    unsigned byte = 0;
+
+    for (unsigned j = 0; j < 8; j ++)
+      byte |= (samples[i + j] >= 0) << j;
+
+    payload[i / 8] = byte;
+  }
+#endif
+}
+
+
+Delays::Delays(const std::string &fileName, unsigned nrStations)
+:
+  delays(nrStations)
+{
+  if (fileName == "")
+    return;
+
+  std::ifstream file(fileName, std::ios::binary);
+
+  if (!file)
+    throw std::runtime_error("cannot open delay file " + fileName);
+
+  for (unsigned station = 0; station < nrStations; station ++) {
+    uint32_t n = 0;
+    file.read(reinterpret_cast<char *>(&n), sizeof n);
+
+    for (unsigned i = 0; i < n; i ++) {
+      int64_t time;
+      double  delay;
+
+      file.read(reinterpret_cast<char *>(&time), sizeof time);
+      file.read(reinterpret_cast<char *>(&delay), sizeof delay);
+      delays[station][time] = delay;
+    }
+
+    if (!file)
+      throw std::runtime_error("delay file " + fileName + " has no delays for station " + std::to_string(station));
+  }
+}
+
+
+double Delays::delay(unsigned station, int64_t time) const
+{
+  const std::map<int64_t, double> &points = delays[station];
+
+  if (points.empty())
+    return 0;
+
+  auto upper = points.lower_bound(time);
+
+  if (upper == points.begin())
+    return upper->second;
+
+  if (upper == points.end())
+    return std::prev(upper)->second;
+
+  auto lower = std::prev(upper);
+  return lower->second + (double) (time - lower->first) / (upper->first - lower->first) * (upper->second - lower->second);
+}
+
+
+Generator::Generator(unsigned nrChannels, unsigned nrBitsPerSample, unsigned payloadSize, unsigned sampleRate, double correlation, uint32_t seed, const Delays &delays)
+:
+  nrChannels(nrChannels),
+  nrBitsPerSample(nrBitsPerSample),
+  payloadSize(payloadSize),
+  sampleRate(sampleRate),
+  commonWeight(std::lround(std::sqrt(correlation) * weightScale)),
+  stationWeight(std::lround(std::sqrt(1 - correlation) * weightScale)),
+  threshold(threshold2bit * noiseSigma * std::hypot(commonWeight, stationWeight)),
+  seed(seed),
+  delays(delays),
+  subbandPolarizations(nrChannels)
+{
+  for (unsigned subbandPolarization = 0; subbandPolarization < nrChannels; subbandPolarization ++)
+    subbandPolarizations[nrChannels == 16 ? VDIF_CHANNEL_MAPPING[subbandPolarization] : subbandPolarization] = subbandPolarization;
+}
+
+
+// sets (or adds) weight * the noise of the given stream at time + t to
+// samples[t][channel], for all times of a frame
+template <bool add> void Generator::noise(Scratch &scratch, uint32_t stream, int64_t time, int weight) const
+{
+  const unsigned nrTimes = nrTimesPerFrame();
+
+  // the hash of the low 32 bits of the time is keyed by the high 32 bits
+  for (unsigned first = 0; first < nrTimes;) {
+    int64_t  firstTime = time + first;
+    uint32_t epoch     = (uint32_t) (firstTime >> 32);
+    unsigned n	       = (unsigned) std::min<int64_t>(nrTimes - first, (((int64_t) epoch + 1) << 32) - firstTime);
+
+    for (unsigned channel = 0; channel < nrChannels; channel ++)
+      scratch.keys[channel] = hash(seed ^ hash(stream ^ hash(subbandPolarizations[channel] ^ hash(epoch))));
+
+    const uint32_t *keys = scratch.keys.data();
+
+    for (unsigned t = first; t < first + n; t ++) {
+      uint32_t low     = (uint32_t) (time + t);
+      float    *sample = &scratch.samples[(size_t) t * nrChannels];
+
+      for (unsigned channel = 0; channel < nrChannels; channel ++) {
+	uint32_t h     = hash(low + keys[channel]);
+	float	 value = (float) (((int) ((h & 0xFF) + (h >> 8 & 0xFF) + (h >> 16 & 0xFF) + (h >> 24)) - 510) * weight);
+
+	sample[channel] = add ? sample[channel] + value : value;
+      }
+    }
+
+    first += n;
+  }
+}
+
+
+void Generator::generateFrame(Scratch &scratch, VDIFHeader &header, unsigned station, int64_t time, char *frame) const
+{
+  int64_t delay = std::llround(delays.delay(station, time) * sampleRate);
+
+  noise<false>(scratch, commonStream, time - delay, commonWeight);
+
+  if (stationWeight > 0)
+    noise<true>(scratch, station, time, stationWeight);
+
+  header.setTimestamp(time, sampleRate);
+  memcpy(frame, &header, sizeof header);
+
+  uint8_t *payload = reinterpret_cast<uint8_t *>(frame + sizeof header);
+
+  if (nrBitsPerSample == 2)
+    quantize2bit(scratch.samples.data(), payload, scratch.samples.size(), threshold);
+  else
+    quantize1bit(scratch.samples.data(), payload, scratch.samples.size());
+}
+
+
+void Generator::run(unsigned station, Stream &stream, int64_t startTime, uint64_t nrFrames, bool realTime, double loss, double corruption) const
+{
+  // a socket gets one frame per write (per datagram), a file many
+  const unsigned framesPerWrite = dynamic_cast<SocketStream *>(&stream) != nullptr ? 1 : 64;
+
+  Scratch scratch;
+  scratch.samples.resize((size_t) nrTimesPerFrame() * nrChannels);
+  scratch.keys.resize(nrChannels);
+
+  std::vector<char> frames((size_t) framesPerWrite * frameSize());
+
+  VDIFHeader header;
+  memset(&header, 0, sizeof header);
+  header.dataframe_length = frameSize() / 8;
+  header.log2_nchan	  = __builtin_ctz(nrChannels);
+  header.bits_per_sample  = nrBitsPerSample - 1;
+  header.station_id	  = station;
+
+  std::mt19937			     random(hash(seed ^ hash(station)));
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  for (uint64_t frame = 0; frame < nrFrames;) {
+    unsigned n = (unsigned) std::min<uint64_t>(framesPerWrite, nrFrames - frame), nrKept = 0;
+
+    for (unsigned i = 0; i < n; i ++) {
+      if (loss > 0 && uniform(random) < loss)
+	continue;
+
+      char *data = &frames[(size_t) nrKept ++ * frameSize()];
+      generateFrame(scratch, header, station, startTime + (int64_t) (frame + i) * nrTimesPerFrame(), data);
+
+      if (corruption > 0 && uniform(random) < corruption)
+	for (unsigned word = 0; word < sizeof(VDIFHeader) / sizeof(uint32_t); word ++)
+	  memcpy(data + word * sizeof(uint32_t), &fillPattern, sizeof fillPattern);
+    }
+
+    frame += n;
+
+    if (realTime) // until the last sample was observed
+      std::this_thread::sleep_until(std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>((double) (startTime + (int64_t) frame * nrTimesPerFrame()) / sampleRate))));
+
+    stream.write(frames.data(), (size_t) nrKept * frameSize());
+  }
+}
@@ -0,0 +1,100 @@
+#if !defined ISBI_TESTS_SYNTHETIC_INPUT_H
+#define ISBI_TESTS_SYNTHETIC_INPUT_H
+
+#include "Common/Stream/Stream.h"
+#include "Common/TimeStamp.h"
+#include "ISBI/VDIFStream.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Input files for the tests and benchmarks that run (parts of) the ISBI
+// pipeline without real stations.
+
+
+// A file with a unique name (prefix, six random characters, suffix) that is
+// removed when it goes out of scope, also when a test or benchmark throws.
+
+class TemporaryFile
+{
+  public:
+    TemporaryFile(const std::string &prefix, const std::string &suffix = "");
+    ~TemporaryFile();
+
+    TemporaryFile(const TemporaryFile &) = delete;
+    TemporaryFile &operator = (const TemporaryFile &) = delete;
+
+    const std::string name;
+};
+
+
+// Writes a delay file in the format that DelayCorrection reads: for every
+// station, 64 delays at one-second intervals from two seconds before
+// startTime, that grow with the station number and quadratically with time.
+
+void writeDelayFile(const std::string &name, unsigned nrStations, const TimeStamp &startTime, unsigned clockSpeed);
+
+
+// the delays per station in seconds, linearly interpolated between the
+// points in the file, and constant outside them
+class Delays
+{
+  public:
+    Delays(const std::string &fileName, unsigned nrStations); // no file name: no delays
+
+    double delay(unsigned station, int64_t time) const;
+
+  private:
+    std::vector<std::map<int64_t, double>> delays;
+};
+
+
+// Generates VDIF frames with a known correlated signal: every station
+// observes the same noise, delayed by the delay of the station, plus, with
+// a correlation below 1, noise of its own.  The noise is approximately
+// Gaussian (the sum of the four bytes of a counter-based hash of the channel
+// and the sample time), so that any stretch of any station is computed
+// independently and reproducibly for a given seed.  Delays are rounded to
+// whole samples and taken at the start of each frame.  The samples are
+// quantized to 1 or 2 bits; the 2-bit levels are the ones the decoder in
+// VDIFStream.h assumes, with thresholds at +/- 0.98 sigma.
+//
+// With 16 channels, subband s, polarization p is put in VDIF channel
+// VDIF_CHANNEL_MAPPING[2 * s + p], as the ISBI input expects it; the noise
+// depends on the subband and polarization, not on the position in the
+// frame.
+
+class Generator
+{
+  public:
+    Generator(unsigned nrChannels, unsigned nrBitsPerSample, unsigned payloadSize, unsigned sampleRate, double correlation, uint32_t seed, const Delays &);
+
+    // writes nrFrames frames of a station, from startTime on; a frame is
+    // left out with probability loss, or gets an invalid header (the VDIF
+    // fill pattern) with probability corruption
+    void run(unsigned station, Stream &, int64_t startTime, uint64_t nrFrames, bool realTime, double loss = 0, double corruption = 0) const;
+
+    unsigned frameSize() const { return sizeof(VDIFHeader) + payloadSize; }
+    unsigned nrTimesPerFrame() const { return payloadSize * 8 / nrBitsPerSample / nrChannels; }
+
+  private:
+    struct Scratch {
+      std::vector<float>    samples; // [time][channel]
+      std::vector<uint32_t> keys;    // [channel]
+    };
+
+    template <bool add> void noise(Scratch &, uint32_t stream, int64_t time, int weight) const;
+    void generateFrame(Scratch &, VDIFHeader &, unsigned station, int64_t time, char *frame) const;
+
+    const unsigned nrChannels, nrBitsPerSample, payloadSize, sampleRate;
+    const int	   commonWeight, stationWeight; // integers: the samples are exact, whatever the instruction set
+    const float	   threshold;
+    const uint32_t seed;
+    const Delays   &delays;
+    std::vector<uint32_t> subbandPolarizations; // [channel]
+};
+
+#endif
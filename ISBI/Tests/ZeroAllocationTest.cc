@@ -0,0 +1,153 @@
+#include "Common/Config.h"
+
+#include "Common/CUDA_Support.h"
+#include "Common/Logger.h"
+#include "Common/Metrics.h"
+#include "Common/Stream/FileStream.h"
+#include "Common/TimeStamp.h"
+#include "ISBI/CorrelatorPipeline.h"
+#include "ISBI/CorrelatorWorkQueue.h"
+#include "ISBI/Parset.h"
+#include "ISBI/Tests/SyntheticInput.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+
+// Verifies that CorrelatorWorkQueue::doSubband() does not allocate memory
+// once the pipeline runs in a steady state.  Synthetic VDIF streams (from
+// the Generator in SyntheticInput.h) are read by the real InputSection, and
+// every block of every subband is run through a real work queue on the null
+// device, with null outputs.  Only the allocations by the thread that calls
+// doSubband(), while it does so, are counted: the input and output threads
+// run concurrently, and are not on the per-block path of the work queue.
+// Everything on that path (the read transactions, fillInMissingSamples,
+// the delay polynomials, the host-to-device copy callback, computeWeights,
+// and the hand-over of the visibilities) runs on the calling thread.
+
+static std::atomic<size_t>  nrAllocations(0);
+static thread_local bool    countAllocations = false;
+
+
+void *operator new (std::size_t size)
+{
+  if (countAllocations)
+    ++ nrAllocations;
+
+  if (void *ptr = std::malloc(size != 0 ? size : 1))
+    return ptr;
+
+  throw std::bad_alloc();
+}
+
+
+void operator delete (void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+
+void operator delete (void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+
+int main(int argc, char **argv)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    std::cout << ">>> Running ZeroAllocationTest" << std::endl;
+
+    const unsigned nrStations = 4, nrWarmUpBlocks = 4; // the first blocks may grow vectors to their working size
+    const std::string nrStationsArg = std::to_string(nrStations);
+
+    HostBuffer::usePageLockedMemory = false;
+
+    auto makeParset = [&] (const std::vector<std::string> &extraArgs) {
+      std::vector<std::string> args { argv[0], "-n", nrStationsArg, "-s", "8", "-c", "16", "-t", "1024", "-r", "1", "-f", "8000000", "-T", "262144", "-R", "0", "-q", "1", "--deviceType", "null", "-d", "1", "--delayPolynomialOrder", "2", "--logLevel", "warning", "-D", "2024-01-01_00:00:00" };
+      args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+
+      std::vector<char *> argPointers;
+
+      for (std::string &arg : args)
+	argPointers.push_back(&arg[0]);
+
+      return std::make_unique<ISBI_Parset>(argPointers.size(), argPointers.data());
+    };
+
+    std::unique_ptr<ISBI_Parset> ps = makeParset({ "--delayFile", "/dev/null" });
+    Logger::setMinimumSeverity(ps->logLevel());
+
+    TemporaryFile delayFile("/tmp/ZeroAllocationTest-delays");
+    std::vector<std::unique_ptr<TemporaryFile>> streamFiles;
+    std::string inputs, outputs;
+
+    writeDelayFile(delayFile.name, nrStations, ps->startTime(), ps->clockSpeed());
+
+    // 16 channels: 8 subbands with 2 polarizations, from a tenth of a second
+    // before the start time to a tenth of a second after the stop time
+    Delays    delays(delayFile.name, nrStations);
+    Generator generator(16, 2, 8000, ps->sampleRate(), .5, 0, delays);
+    int64_t   begin = ((int64_t) ps->startTime() - ps->clockSpeed() / 10) / generator.nrTimesPerFrame() * generator.nrTimesPerFrame();
+    uint64_t  nrFrames = ((int64_t) ps->stopTime() + ps->clockSpeed() / 10 - begin + generator.nrTimesPerFrame() - 1) / generator.nrTimesPerFrame();
+
+    for (unsigned station = 0; station < nrStations; station ++) {
+      streamFiles.emplace_back(new TemporaryFile("/tmp/ZeroAllocationTest-" + std::to_string(station), ".vdif"));
+
+      FileStream file(streamFiles.back()->name, 0644);
+      generator.run(station, file, begin, nrFrames, false, 1e-3);
+      inputs += (station > 0 ? "," : "") + streamFiles.back()->name;
+    }
+
+    for (unsigned output = 0; output < ps->nrSubbands() * ps->visibilitiesIntegration().size(); output ++)
+      outputs += output > 0 ? ",null:" : "null:";
+
+    ps = makeParset({ "-i", inputs, "-o", outputs, "--delayFile", delayFile.name });
+
+    size_t   nrSteadyStateBlocks = 0;
+    uint64_t nrBlocksCorrelated = 0;
+
+    {
+      ISBI_CorrelatorPipeline pipeline(*ps);
+      DeviceInstance &deviceInstance = *pipeline.deviceInstances[0];
+
+      deviceInstance.setCurrentContext();
+      CorrelatorWorkQueue workQueue(pipeline, deviceInstance);
+      unsigned block = 0;
+
+      for (TimeStamp time = ps->startTime(); time < ps->stopTime(); time += ps->nrSamplesPerSubbandBeforeFilter(), block ++)
+	for (unsigned subband = 0; subband < ps->nrSubbands(); subband ++) {
+	  countAllocations = block >= nrWarmUpBlocks;
+	  workQueue.doSubband(time, subband);
+	  countAllocations = false;
+	}
+
+      nrSteadyStateBlocks = block > nrWarmUpBlocks ? block - nrWarmUpBlocks : 0;
+
+      for (unsigned subband = 0; subband < ps->nrSubbands(); subband ++)
+	nrBlocksCorrelated += Metrics::counter("isbi_blocks_correlated_total", {{ "subband", std::to_string(subband) }}, "").value();
+    }
+
+    // the blocks must have been correlated, not skipped for lack of input
+    if (nrAllocations != 0 || nrSteadyStateBlocks == 0 || nrBlocksCorrelated < nrSteadyStateBlocks * ps->nrSubbands()) {
+      std::cout << "Test FAILED: " << nrAllocations << " allocations in " << nrSteadyStateBlocks << " blocks, " << nrBlocksCorrelated << " subband blocks correlated" << std::endl;
+      return 1;
+    }
+
+    std::cout << "Test OK" << std::endl;
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+    std::cerr << "caught std::exception: " << ex.what() << std::endl;
+    return 1;
+  }
+#endif
+
+  return 0;
+}
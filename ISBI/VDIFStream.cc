@@ -1,4 +1,5 @@
 #include "VDIFStream.h"
+#include "Common/Logger.h"
 
 #include <iostream>
 #include <algorithm>
@@ -14,6 +15,17 @@ constexpr uint32_t HEADER_SIZE = 32; // bytes
 constexpr uint32_t DATA_SIZE = 8000; // bytes
 constexpr std::size_t READ_BUFFER_SIZE = 1u << 20;
 
+const std::array<int8_t, 256 * 4> decodeLUT = [] {
+  std::array<int8_t, 256 * 4> lut{};
+  for (unsigned byte = 0; byte < 256; ++byte) {
+    lut[4 * byte + 0] = DECODER_LEVEL_2BIT[(byte >> 0) & 0x3];
+    lut[4 * byte + 1] = DECODER_LEVEL_2BIT[(byte >> 2) & 0x3];
+    lut[4 * byte + 2] = DECODER_LEVEL_2BIT[(byte >> 4) & 0x3];
+    lut[4 * byte + 3] = DECODER_LEVEL_2BIT[(byte >> 6) & 0x3];
+  }
+  return lut;
+} ();
+
 VDIFStream::VDIFStream(std::string inputFile, double sampleRate, TimeStamp startTime) 
   : ioBuffer(READ_BUFFER_SIZE), 
     firstHeaderFound(false), 
@@ -141,7 +153,8 @@ void VDIFStream::read(char* frame) {
   std::memcpy(&currentHeader, frame, headerSize);
   if (checkHeader() != HeaderStatus::VALID) {
     const off_t expectedOffset = static_cast<off_t>(numberOfFrames) * (headerSize + dataSize);
-    std::cout << "Invalid header found at offset " << expectedOffset << std::endl;
+    LOG_RATE_LIMITED(Logger::Warning, 1, "Invalid header found at offset ", expectedOffset);
+    ++invalidFrames;
     findNextValidHeader();
 
     file.read(frame, frameBytes);
@@ -183,7 +196,7 @@ void VDIFStream::findNextValidHeader() {
 
 
 VDIFStream::~VDIFStream() {
-  std::cout << "Total frames read: " <<  numberOfFrames << std::endl;
+  LOG(Logger::Info, "Total frames read: ", numberOfFrames, ", invalid: ", invalidFrames);
   file.close();
 }
 
@@ -205,19 +218,27 @@ int64_t VDIFHeader::timestamp(double sample_rate) const {
     return out;
 }
 
+void VDIFHeader::setTimestamp(int64_t timestamp, double sample_rate) {
+    const int64_t samplesPerSecond = static_cast<int64_t>(sample_rate);
+    const std::time_t seconds = timestamp / samplesPerSecond;
+
+    std::tm date{};
+    gmtime_r(&seconds, &date);
+
+    // reference epochs start on January 1st and July 1st
+    ref_epoch = 2 * (date.tm_year + 1900 - 2000) + (date.tm_mon >= 6 ? 1 : 0);
+
+    std::tm epoch{};
+    epoch.tm_year = 2000 + ref_epoch / 2 - 1900;
+    epoch.tm_mon = (ref_epoch & 1) ? 6 : 0;
+    epoch.tm_mday = 1;
+
+    sec_from_epoch = seconds - timegm(&epoch);
+    dataframe_in_second = (timestamp % samplesPerSecond) / samplesPerFrame();
+}
+
 void VDIFHeader::decode2bit(const std::array<char, maxPacketSize>& frame,
                             std::vector<int8_t>& out) const {
-  static const std::array<int8_t, 256 * 4> decodeLUT = []() {
-    std::array<int8_t, 256 * 4> lut{};
-    for (unsigned byte = 0; byte < 256; ++byte) {
-      lut[byte * 4 + 0] = DECODER_LEVEL_2BIT[(byte >> 0) & 0x3];
-      lut[byte * 4 + 1] = DECODER_LEVEL_2BIT[(byte >> 2) & 0x3];
-      lut[byte * 4 + 2] = DECODER_LEVEL_2BIT[(byte >> 4) & 0x3];
-      lut[byte * 4 + 3] = DECODER_LEVEL_2BIT[(byte >> 6) & 0x3];
-    }
-    return lut;
-  }();
-
   const std::size_t payloadBytes = static_cast<std::size_t>(dataSize());
   const uint8_t* data =
       reinterpret_cast<const uint8_t*>(frame.data() + headerSize());
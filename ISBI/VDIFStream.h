@@ -13,6 +13,37 @@
 static constexpr int8_t DECODER_LEVEL_2BIT[] = { -3, -1, 1, 3 };
 static constexpr uint32_t maxPacketSize = 8032;
 
+// the VDIF channel that holds [subband * 2 + polarization] in the 16-channel
+// ISBI streams
+static constexpr uint32_t VDIF_CHANNEL_MAPPING[16] = { 8, 12, 0, 4, 9, 13, 1, 5, 10, 14, 2, 6, 11, 15, 3, 7 };
+
+// the levels of the four 2-bit samples in a byte, at [4 * byte + sample]
+extern const std::array<int8_t, 256 * 4> decodeLUT;
+
+// Decodes nrSamples consecutive samples of one channel from a 2-bit payload
+// with nchan interleaved channels; dataIndex is the index of the first
+// sample in the payload.  Samples beyond the payload are 0.
+inline void decodeMappedChannelSamples(
+    int8_t *__restrict dst,
+    unsigned nrSamples,
+    const uint8_t *__restrict payload,
+    size_t payloadBytes,
+    unsigned nchan,
+    size_t dataIndex)
+{
+  for (unsigned sample = 0; sample < nrSamples; ++sample, dataIndex += nchan) {
+    const size_t byteIndex = dataIndex >> 2;
+
+    if (byteIndex >= payloadBytes) {
+      dst[sample] = 0;
+      continue;
+    }
+
+    const size_t lutIndex = (static_cast<size_t>(payload[byteIndex]) << 2) + (dataIndex & 0x3);
+    dst[sample] = decodeLUT[lutIndex];
+  }
+}
+
 enum HeaderStatus {
   INVALID = 0,
   VALID_NOT_START_BLOCK,
@@ -40,6 +71,9 @@ struct VDIFHeader {
 
   
   int64_t timestamp(double sample_rate) const;
+  // the inverse of timestamp(); dataframe_length, log2_nchan, and
+  // bits_per_sample must be set
+  void setTimestamp(int64_t timestamp, double sample_rate);
   uint32_t dataSize() const;
   uint32_t headerSize() const;
   uint32_t samplesPerFrame() const;
@@ -79,7 +113,7 @@ class VDIFStream : public Stream {
 
     bool firstHeaderFound;
 
-    uint32_t invalidFrames;
+    uint64_t invalidFrames;
     uint32_t numberOfFrames;
 
     double sampleRate;
@@ -102,6 +136,10 @@ class VDIFStream : public Stream {
     size_t tryRead(void *ptr, size_t size) { return 0; }
 
     int64_t getFirstTimestamp() const;
+
+    // frames with an invalid header, skipped by read()
+    uint64_t nrInvalidFrames() const { return invalidFrames; }
+
     ~VDIFStream();
 };
 
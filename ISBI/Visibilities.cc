@@ -1,10 +1,13 @@
 #include "Common/Config.h"
 
 #include "ISBI/Visibilities.h"
+#include "ISBI/OutputTransform.h"
 
+#include <algorithm>
 #include <cstring>
+#include <stdexcept>
 
-#if defined __AVX__
+#if defined __AVX__ || defined __AVX512F__
 #include <immintrin.h>
 #endif
 
@@ -19,32 +22,68 @@ Visibilities::Visibilities(const ISBI_Parset &ps, unsigned subband)
 }
 
 
-Visibilities &Visibilities::operator += (const Visibilities &other)
+static void addSamples(float *dst, const float *src, size_t count)
 {
-#if defined __AVX__
-  __m256 *dst = reinterpret_cast<__m256 *>(hostVisibilities.origin());
-  const __m256 *src = reinterpret_cast<const __m256 *>(other.hostVisibilities.origin());
+  size_t i = 0;
+
+#if defined __AVX512F__
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+#elif defined __AVX__
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+#endif
 
-  for (ssize_t count = hostVisibilities.num_elements() * 2 / 8, i = 0; i < count; i ++)
+  for (; i < count; i ++)
     dst[i] += src[i];
-#else
-  for (unsigned channel = 0; channel < ps.nrOutputChannelsPerSubband(); channel ++)
-    for (unsigned baseline = 0; baseline < ps.nrBaselines(); baseline ++)
-      for (unsigned pol0 = 0; pol0 < ps.nrPolarizations(); pol0++)
-        for (unsigned pol1 = 0; pol1 < ps.nrPolarizations(); pol1++)
-          hostVisibilities[channel][baseline][pol0][pol1] += other.hostVisibilities[channel][baseline][pol0][pol1];
-#endif
+}
 
-  for (unsigned i = 0; i < sizeof(header.weights) / sizeof(header.weights[0]); i ++)
-    header.weights[i] += other.header.weights[i];
 
-  startTime = std::min(startTime, other.startTime);
-  endTime   = std::max(endTime,   other.endTime);
+void Visibilities::accumulate(const Visibilities &other, bool overwrite, unsigned nrThreads)
+{
+  unsigned nrChannels	     = hostVisibilities.shape()[0];
+  size_t   nrFloatsPerChannel = hostVisibilities.num_elements() / nrChannels * COMPLEX;
+  float	   *dst		     = reinterpret_cast<float *>(hostVisibilities.origin());
+  const float *src	     = reinterpret_cast<const float *>(other.hostVisibilities.origin());
+
+  // static scheduling gives each thread a contiguous range of channels
+#pragma omp parallel for schedule(static) num_threads(nrThreads) if(nrThreads > 1)
+  for (unsigned channel = 0; channel < nrChannels; channel ++)
+    if (overwrite)
+      memcpy(dst + channel * nrFloatsPerChannel, src + channel * nrFloatsPerChannel, nrFloatsPerChannel * sizeof(float));
+    else
+      addSamples(dst + channel * nrFloatsPerChannel, src + channel * nrFloatsPerChannel, nrFloatsPerChannel);
+
+  if (overwrite) {
+    memcpy(header.weights, other.header.weights, sizeof header.weights);
+    startTime = other.startTime;
+    endTime   = other.endTime;
+  } else {
+    for (unsigned i = 0; i < sizeof(header.weights) / sizeof(header.weights[0]); i ++)
+      header.weights[i] += other.header.weights[i];
+
+    startTime = std::min(startTime, other.startTime);
+    endTime   = std::max(endTime,   other.endTime);
+  }
+}
+
+
+Visibilities &Visibilities::operator += (const Visibilities &other)
+{
+  accumulate(other, false);
   return *this;
 }
 
 
-void Visibilities::write(Stream *stream)
+void Visibilities::computeWeights(const std::vector<SparseSet<TimeStamp>> &validData)
+{
+  for (unsigned stat2 = 0, pair = 0; stat2 < validData.size(); stat2 ++)
+    for (unsigned stat1 = 0; stat1 <= stat2 && pair < sizeof(header.weights) / sizeof(header.weights[0]); stat1 ++, pair ++)
+      header.weights[pair] = ((uint32_t) (int64_t) validData[stat1].intersectionCount(validData[stat2]) / ps.nrChannelsPerSubbandBeforeFilter() - (NR_TAPS - 1)) * ps.channelIntegrationFactor();
+}
+
+
+void Visibilities::serialize(std::vector<iovec> &pieces, Header &outputHeader, unsigned integrationFactor, OutputTransform *transform, size_t alignment)
 {
 #if defined USE_LEGACY_VISIBILITIES_FORMAT
   header.magic			 = 0x3B98F002;
@@ -56,7 +95,7 @@ void Visibilities::write(Stream *stream)
   header.correlationMode	 = ps.correlationMode();
   header.startTime		 = startTime;
   header.endTime		 = endTime;
-  header.nrSamplesPerIntegration = ps.nrSamplesPerChannel() * ps.channelIntegrationFactor() * ps.visibilitiesIntegration();
+  header.nrSamplesPerIntegration = ps.nrSamplesPerChannel() * ps.channelIntegrationFactor() * integrationFactor;
   header.nrChannels		 = ps.nrOutputChannelsPerSubband();
   header.firstChannelFrequency	 = ps.subbandFrequencies().size() > subband ? ps.subbandFrequencies()[subband] - .5 * ps.subbandBandwidth() + .5 * ps.channelBandwidth() /* channel 0 is skipped */ + .5 * ps.outputChannelBandwidth() : 0;
   header.channelBandwidth	 = ps.outputChannelBandwidth();
@@ -100,6 +139,72 @@ void Visibilities::write(Stream *stream)
 #pragma omp critical (clog)
 	  std::clog << "vis: " << subband << ' ' << channel << ' ' << baseline << ' ' << pol << " = " << hostVisibilities[baseline][channel][pol] << std::endl;
 #endif
-  stream->write(&header, sizeof(header));
-  stream->write(hostVisibilities.origin(), hostVisibilities.bytesize());
+  pieces.clear();
+  outputHeader = header;
+
+  if (transform == nullptr) {
+    pieces.push_back(iovec { &outputHeader, sizeof outputHeader });
+    pieces.push_back(iovec { hostVisibilities.origin(), hostVisibilities.bytesize() });
+  } else {
+#if defined USE_LEGACY_VISIBILITIES_FORMAT
+    throw std::runtime_error("the legacy visibilities format does not support output transforms");
+#else
+    // the header of an accumulator must not change, as it is integrated
+    // further after it is written
+    Header &transformedHeader = outputHeader;
+    const std::vector<BaselineDescriptor> &baselines = transform->baselines();
+
+    transformedHeader.magic	   = transform->outputFormat() == ISBI_Parset::FP32_Visibilities ? 0x3B98F004 : 0x3B98F005;
+    transformedHeader.nrBaselines  = baselines.size();
+    transformedHeader.sampleFormat = transform->outputFormat() == ISBI_Parset::FP16_Visibilities ? 1 : transform->outputFormat() == ISBI_Parset::I16_Visibilities ? 2 : 0;
+    memset(transformedHeader.weights, 0, sizeof transformedHeader.weights);
+
+    for (unsigned i = 0; i < std::min(baselines.size(), sizeof(header.weights) / sizeof(header.weights[0])); i ++)
+      transformedHeader.weights[i] = header.weights[transform->inputBaselines()[i]];
+
+    const void *transformed = transform->apply(*this, ps.nrIntegrationThreads());
+
+    pieces.push_back(iovec { &transformedHeader, sizeof transformedHeader });
+    pieces.push_back(iovec { const_cast<BaselineDescriptor *>(baselines.data()), baselines.size() * sizeof(BaselineDescriptor) });
+
+    if (transform->scaleFactors().size() > 0)
+      pieces.push_back(iovec { const_cast<float *>(transform->scaleFactors().data()), transform->scaleFactors().size() * sizeof(float) });
+
+    pieces.push_back(iovec { const_cast<void *>(transformed), transform->outputSize() });
+#endif
+  }
+
+#if !defined USE_LEGACY_VISIBILITIES_FORMAT
+  outputHeader.log2Alignment = 0;
+
+  if (alignment > 1) {
+    size_t offset = 0; // of the visibilities in the block
+
+    for (unsigned piece = 0; piece < pieces.size() - 1; piece ++)
+      offset += pieces[piece].iov_len;
+
+    size_t gap = -offset & (alignment - 1), tail = -pieces.back().iov_len & (alignment - 1);
+
+    if (padding.size() < alignment)
+      padding.resize(alignment);
+
+    outputHeader.log2Alignment = __builtin_ctzl(alignment);
+
+    if (tail > 0)
+      pieces.push_back(iovec { padding.data(), tail });
+
+    if (gap > 0)
+      pieces.insert(pieces.end() - (tail > 0 ? 2 : 1), iovec { padding.data(), gap });
+  }
+#endif
+}
+
+
+void Visibilities::write(Stream *stream, unsigned integrationFactor, OutputTransform *transform)
+{
+  std::vector<iovec> pieces;
+  Header	     outputHeader;
+
+  serialize(pieces, outputHeader, integrationFactor, transform, stream->writeAlignment());
+  stream->writev(pieces);
 }
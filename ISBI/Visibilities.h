@@ -3,10 +3,18 @@
 
 #include "ISBI/Parset.h"
 //#include "Common/AlignedStdAllocator.h"
-#include "Common/CUDA_Support.h"
+#include "Common/HostBuffer.h"
+#include "Common/SparseSet.h"
 #include "Common/Stream/Stream.h"
+#include "Common/TimeStamp.h"
 
 #include <boost/multi_array.hpp>
+#include <sys/uio.h>
+
+#include <vector>
+
+
+class OutputTransform;
 
 #undef USE_LEGACY_VISIBILITIES_FORMAT
 
@@ -33,21 +41,66 @@ class Visibilities
 #if defined USE_LEGACY_VISIBILITIES_FORMAT
       char     pad1[152];
 #else
-      char     pad1[288];
+      // Magic 0x3B98F004: nrBaselines BaselineDescriptors follow the header,
+      // and the visibilities are stored per baseline, as
+      // [baseline][channel][polarization][polarization].  Averaged channel k
+      // of a baseline with channel averaging factor f covers channels
+      // k * f ... k * f + f - 1 of the nrChannels channels above.  weights[i]
+      // belongs to the i-th baseline in the table.
+      //
+      // Magic 0x3B98F005: like 0x3B98F004, but the real and imaginary parts
+      // are stored as fp16 (sampleFormat 1) or int16 (sampleFormat 2), and
+      // have to be multiplied by a scale factor per baseline and channel.
+      // The [baseline][channel] float scale factors are stored between the
+      // baseline table and the visibilities.
+      //
+      // If log2Alignment is nonzero, the visibilities (the last piece of the
+      // block) start, and the block ends, at a multiple of 1 << log2Alignment
+      // bytes from the start of the block; the gaps are filled with zeros.
+      uint16_t nrBaselines;
+      uint8_t  sampleFormat;
+      uint8_t  log2Alignment;
+      char     pad1[284];
 #endif
     };
 
+    struct BaselineDescriptor {
+      uint16_t station0, station1; // station0 >= station1
+      uint16_t channelAveraging, nrChannels;
+    };
+
     Visibilities(const ISBI_Parset &, unsigned subband);
 
-    void write(Stream *);
+    // integrationFactor: the number of blocks that were integrated; if an
+    // output transform is given, the transformed visibilities are written
+    void write(Stream *, unsigned integrationFactor, OutputTransform * = nullptr);
+
+    // the pieces of the block that write() writes, in order; outputHeader is
+    // the storage for the header that is written.  The pieces are valid until
+    // the visibilities or the transform are used again.  With an alignment
+    // (a power of two, see Stream::writeAlignment()), the block is padded so
+    // that the visibilities can be written directly from memory.
+    void serialize(std::vector<iovec> &pieces, Header &outputHeader, unsigned integrationFactor, OutputTransform * = nullptr, size_t alignment = 1);
 
     Visibilities &operator += (const Visibilities &);
 
+    // sets the weight of each baseline to the number of samples per channel
+    // for which both stations had valid input; validData holds the valid
+    // input samples of each station, including the filter history
+    void computeWeights(const std::vector<SparseSet<TimeStamp>> &validData);
+
+    // adds the other visibilities, or copies them if overwrite is set; the
+    // channels are divided over nrThreads OpenMP threads
+    void accumulate(const Visibilities &, bool overwrite, unsigned nrThreads = 1);
+
     const ISBI_Parset			 	 &ps;
     MultiArrayHostBuffer<std::complex<float>, 4> hostVisibilities;
     TimeStamp					 startTime, endTime;
     unsigned					 subband;
     Header					 header;
+
+  private:
+    std::vector<char>				 padding; // zeros
 };
 
 #endif
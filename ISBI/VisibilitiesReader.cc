@@ -0,0 +1,139 @@
+#include "Common/Config.h"
+
+#include "Common/HalfPrecision.h"
+#include "ISBI/VisibilitiesReader.h"
+
+#if defined __AVX2__ && defined __F16C__
+#include <immintrin.h>
+#endif
+
+#include <stdexcept>
+
+
+VisibilitiesReader::VisibilitiesReader(Stream *stream)
+:
+  stream(stream),
+  position(0)
+{
+}
+
+
+bool VisibilitiesReader::read()
+{
+  try {
+    stream->read(&_header, sizeof _header);
+  } catch (Stream::EndOfStreamException &) {
+    return false;
+  }
+
+  position = sizeof _header;
+
+#if defined USE_LEGACY_VISIBILITIES_FORMAT
+  throw std::runtime_error("cannot read visibilities in the legacy format");
+#else
+  if (_header.magic == 0x3B98F003) {
+    readFullResolution();
+  } else if (_header.magic == 0x3B98F004 || _header.magic == 0x3B98F005) {
+    _baselines.resize(_header.nrBaselines);
+    readPiece(_baselines.data(), _baselines.size() * sizeof(Visibilities::BaselineDescriptor));
+
+    size_t nrVisibilities = 0;
+
+    for (const Visibilities::BaselineDescriptor &baseline : _baselines)
+      nrVisibilities += (size_t) baseline.nrChannels * _header.nrPolarizations;
+
+    _visibilities.resize(nrVisibilities);
+
+    if (_header.magic == 0x3B98F004) {
+      skipPadding();
+      readPiece(_visibilities.data(), _visibilities.size() * sizeof(std::complex<float>));
+    } else {
+      readReducedPrecision();
+    }
+  } else {
+    throw std::runtime_error("unknown visibilities format");
+  }
+
+  skipPadding();
+#endif
+
+  return true;
+}
+
+
+void VisibilitiesReader::readPiece(void *ptr, size_t size)
+{
+  stream->read(ptr, size);
+  position += size;
+}
+
+
+void VisibilitiesReader::skipPadding()
+{
+#if !defined USE_LEGACY_VISIBILITIES_FORMAT
+  if (_header.log2Alignment > 0) {
+    padding.resize(-position & ((size_t(1) << _header.log2Alignment) - 1));
+    readPiece(padding.data(), padding.size());
+  }
+#endif
+}
+
+
+void VisibilitiesReader::readFullResolution()
+{
+  unsigned nrBaselines = _header.nrReceivers * (_header.nrReceivers + 1) / 2;
+  unsigned nrPolarizations = _header.nrPolarizations;
+
+  _baselines.clear();
+
+  for (unsigned station0 = 0; station0 < _header.nrReceivers; station0 ++)
+    for (unsigned station1 = 0; station1 <= station0; station1 ++)
+      _baselines.push_back(Visibilities::BaselineDescriptor { (uint16_t) station0, (uint16_t) station1, 1, _header.nrChannels });
+
+  // transpose [channel][baseline][polarization] into the per-baseline order
+  std::vector<std::complex<float>> input((size_t) _header.nrChannels * nrBaselines * nrPolarizations);
+  skipPadding();
+  readPiece(input.data(), input.size() * sizeof(std::complex<float>));
+  _visibilities.resize(input.size());
+
+  for (unsigned channel = 0; channel < _header.nrChannels; channel ++)
+    for (unsigned baseline = 0; baseline < nrBaselines; baseline ++)
+      for (unsigned polarization = 0; polarization < nrPolarizations; polarization ++)
+	_visibilities[((size_t) baseline * _header.nrChannels + channel) * nrPolarizations + polarization] = input[((size_t) channel * nrBaselines + baseline) * nrPolarizations + polarization];
+}
+
+
+void VisibilitiesReader::readReducedPrecision()
+{
+#if !defined USE_LEGACY_VISIBILITIES_FORMAT
+  if (_header.sampleFormat != 1 && _header.sampleFormat != 2)
+    throw std::runtime_error("unknown visibilities sample format");
+
+  unsigned nrFloatsPerChannel = _header.nrPolarizations * COMPLEX;
+
+  scales.resize(_visibilities.size() / _header.nrPolarizations);
+  packed.resize(_visibilities.size() * COMPLEX);
+  readPiece(scales.data(), scales.size() * sizeof(float));
+  skipPadding();
+  readPiece(packed.data(), packed.size() * sizeof(uint16_t));
+
+  float *out = reinterpret_cast<float *>(_visibilities.data());
+
+  for (size_t group = 0; group < scales.size(); group ++) {
+    const uint16_t *in = &packed[group * nrFloatsPerChannel];
+    float	   *dst = out + group * nrFloatsPerChannel, scale = scales[group];
+    unsigned	   i = 0;
+
+#if defined __AVX2__ && defined __F16C__
+    for (; i + 8 <= nrFloatsPerChannel; i += 8) {
+      __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      __m256  floats = _header.sampleFormat == 1 ? _mm256_cvtph_ps(values) : _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(values));
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(floats, _mm256_set1_ps(scale)));
+    }
+#endif
+
+    for (; i < nrFloatsPerChannel; i ++)
+      dst[i] = (_header.sampleFormat == 1 ? halfToFloat(in[i]) : (float) (int16_t) in[i]) * scale;
+  }
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef ISBI_VISIBILITIES_READER_H
+#define ISBI_VISIBILITIES_READER_H
+
+#include "Common/Stream/Stream.h"
+#include "ISBI/Visibilities.h"
+
+#include <complex>
+#include <vector>
+
+
+// Reads blocks of visibilities as written by Visibilities::write(), for
+// consumers that need fp32.  The full-resolution (0x3B98F003), transformed
+// (0x3B98F004), and reduced-precision (0x3B98F005) formats are all
+// converted to fp32 visibilities that are stored per baseline, as
+// [baseline][channel][polarization], where the number of polarizations is
+// header().nrPolarizations.  For the full-resolution format, a baseline
+// table that describes all baselines is synthesized.  The padding of blocks
+// that were aligned for zero-copy output is skipped.
+
+class VisibilitiesReader
+{
+  public:
+    VisibilitiesReader(Stream *);
+
+    // returns false at the end of the stream
+    bool read();
+
+    const Visibilities::Header &header() const { return _header; }
+    const std::vector<Visibilities::BaselineDescriptor> &baselines() const { return _baselines; }
+    const std::vector<std::complex<float>> &visibilities() const { return _visibilities; }
+
+  private:
+    void readFullResolution();
+    void readReducedPrecision();
+    void readPiece(void *, size_t);
+    void skipPadding(); // up to the alignment of the block, if any
+
+    Stream					  *stream;
+    Visibilities::Header			  _header;
+    std::vector<Visibilities::BaselineDescriptor> _baselines;
+    std::vector<std::complex<float>>		  _visibilities;
+    std::vector<float>				  scales;
+    std::vector<uint16_t>			  packed;
+    std::vector<char>				  padding;
+    size_t					  position; // in the current block
+};
+
+#endif
@@ -6,10 +6,14 @@
 //#include "ISBI/SignalHandler.h"
 #include "Common/Affinity.h"
 #include "Common/CUDA_Support.h"
+#include "Common/CPU_PerformanceCounter.h"
+#include "Common/HardwareCounters.h"
+#include "Common/RAPL.h"
 
 
 #include <list>
 #include <iostream>
+#include <memory>
 
 void printArgv(int argc, char **argv)
 {
@@ -43,18 +47,40 @@ int main(int argc, char **argv){
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION
   try {
 #endif
-    cu::init();
-    cu::Device device(0);
-    cu::Context context(CU_CTX_SCHED_BLOCKING_SYNC, device);
+    printArgv(argc, argv);
+    ISBI_Parset ps(argc, argv);
+    Logger::setMinimumSeverity(ps.logLevel());
+    HardwareCounters::enable(ps.profiling() && ps.hardwareCounters());
+
+    std::unique_ptr<RAPL>	   energySensor;
+    std::unique_ptr<RAPL::Sampler> energySampler;
+
+    if (ps.profiling() && ps.cpuEnergy()) {
+      energySensor = std::make_unique<RAPL>();
+
+      if (energySensor->available()) {
+	energySampler = std::make_unique<RAPL::Sampler>(*energySensor);
+	CPU_PerformanceCounter::setEnergySensor(energySampler.get());
+      } else {
+	LOG(Logger::Warning, "CPU energy (RAPL) not available");
+      }
+    }
+    printSettings(ps);
+
+    std::unique_ptr<cu::Context> context;
+
+    if (ps.deviceType() != CorrelatorParset::CUDA_Device) {
+      HostBuffer::usePageLockedMemory = false;
+    } else {
+      cu::init();
+      cu::Device device(0);
+      context = std::make_unique<cu::Context>(CU_CTX_SCHED_BLOCKING_SYNC, device);
+    }
 
 #if defined __linux__
     setScheduler(SCHED_BATCH, 0);
 #endif
 
-    printArgv(argc, argv);
-    ISBI_Parset ps(argc, argv);
-    printSettings(ps);
-
     ISBI_CorrelatorPipeline(ps).doWork();
 
 #if !defined CREATE_BACKTRACE_ON_EXCEPTION